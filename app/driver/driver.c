@@ -1,10 +1,13 @@
 #include <netstack/network.h>
 #include <device/device.h>
+#include <device/capture.h>
+#include <netutil/dump.h>
 
 #include <event/threadpool.h>
 #include <event/event.h>
 #include <event/timer.h>
 #include <event/memorypool.h>
+#include <event/slab.h>
 #include <event/states.h>
 #include <event/signal.h>
 
@@ -13,6 +16,27 @@
                            
 static void driver_exit(int signum) __attribute__((noreturn));
 
+/// @brief  SIGUSR1 switches the capture on and off
+static void capture_switch(int signum) {
+    (void) signum;
+    NetDevice* device = g_states.device;
+    if (device && device->capture) capture_toggle(device->capture);
+}
+
+/// @brief  Periodic rebalancing of the flows over the workers
+static void rss_rebalance_task(void* device) {
+    DeviceRss* rss = ((NetDevice*)device)->rss;
+    if (rss) rss_rebalance(rss);
+}
+
+/// @brief  Periodic report of the pieces of every pool held for longer than the threshold in ms, given as the argument
+static void pool_track_report(void* threshold_ms) {
+    uint64_t threshold_ns = (uint64_t)(uintptr_t)threshold_ms * 1000000;
+    for (size_t node = 0; node < MEMPOOL_MAX_NODES; node++) {
+        if (g_states.node_pools[node]) mempool_report_held(g_states.node_pools[node], threshold_ns);
+    }
+}
+
 static errval_t signal_set_handler(void) {
 
     // Setup SIGINT handler
@@ -29,7 +53,14 @@ static errval_t signal_set_handler(void) {
         return EVENT_ERR_SIGNAL_INIT;
     }
 
-    EVENT_NOTE("The handler for SIGINT and SIGTERM is set to driver_exit");
+    // Setup SIGUSR1 handler
+    if (signal(SIGUSR1, capture_switch) == SIG_ERR) {
+        const char *error_msg = strerror(errno);
+        LOG_FATAL("Unable to set signal handler for SIGUSR1: %s", error_msg);
+        return EVENT_ERR_SIGNAL_INIT;
+    }
+
+    EVENT_NOTE("The handler for SIGINT and SIGTERM is set to driver_exit, SIGUSR1 switches the capture");
     return SYS_ERR_OK;
 }
 
@@ -45,6 +76,38 @@ static ko_longopt_t longopts[] = {
     { "log-file",  ko_optional_argument,  0  },
     { "log-ansi",  ko_optional_argument,  0  },
     { "queue-size",ko_optional_argument,  0  },
+    { "rx-batch",  ko_optional_argument,  0  },
+    { "poll-timeout", ko_optional_argument, 0 },
+    { "rx-queues", ko_optional_argument,  0  },
+    { "device",    ko_optional_argument,  0  },
+    { "vnet-hdr",  ko_optional_argument,  0  },
+    { "pcap",      ko_optional_argument,  0  },
+    { "replay-speed", ko_optional_argument, 0 },
+    { "replay-loops", ko_optional_argument, 0 },
+    { "tx-sink",   ko_optional_argument,  0  },
+    { "capture",   ko_optional_argument,  0  },
+    { "capture-snaplen",   ko_optional_argument, 0 },
+    { "capture-ethertype", ko_optional_argument, 0 },
+    { "capture-ip",        ko_optional_argument, 0 },
+    { "capture-port",      ko_optional_argument, 0 },
+    { "capture-off",       ko_optional_argument, 0 },
+    { "busy-poll",         ko_optional_argument, 0 },
+    { "busy-poll-adaptive",ko_optional_argument, 0 },
+    { "shm-name",  ko_optional_argument,  0  },
+    { "shm-side",  ko_optional_argument,  0  },
+    { "mac",       ko_optional_argument,  0  },
+    { "mtu",       ko_optional_argument,  0  },
+    { "magazine",  ko_optional_argument,  0  },
+    { "hugepage",  ko_optional_argument,  0  },
+    { "numa",      ko_optional_argument,  0  },
+    { "pool-policy",       ko_optional_argument, 0 },
+    { "pool-watermarks",   ko_optional_argument, 0 },
+    { "pool-reserve",      ko_optional_argument, 0 },
+    { "pool-grow",         ko_optional_argument, 0 },
+    { "pool-populate",     ko_optional_argument, 0 },
+    { "pool-track",        ko_optional_argument, 0 },
+    { "rss",               ko_optional_argument, 0 },
+    { "rss-rebalance",     ko_optional_argument, 0 },
     { NULL,        0,                     0  }
 };
 
@@ -59,6 +122,33 @@ int main(int argc, char *argv[]) {
     int log_level = LOG_LEVEL_VERBOSE; // default log level
     bool ansi_log = false;
     rlim_t queue_size = 256273;     // The default by ulimit on my machine is 256273, thus we don't need root to run this program 
+    int rx_batch = DEVICE_DEFAULT_RX_BATCH;         // How many frames to drain per wakeup
+    int poll_timeout = DEVICE_DEFAULT_POLL_TIMEOUT; // In milli-seconds
+    int rx_queues = DEVICE_DEFAULT_RX_QUEUES;       // Queues of the TAP device, each has a RX thread
+    char *backend_name = "tap";                     // "tap" (poll + read/write), "uring", "packet" (AF_PACKET on tap-name), "pcap" (replay) or "shm" (wire to another instance)
+    bool vnet_hdr = false;                          // Checksum offload and TSO through virtio-net header
+    char *pcap_path = NULL, *tx_sink = NULL;        // Capture to replay, and where to record the sent frames
+    double replay_speed = 0;                        // 0: as fast as possible, 1: original timing, N: N times faster
+    int replay_loops = 1;                           // 0: forever
+    char *capture_path = NULL, *capture_ip = NULL;  // pcapng of what we send and receive, switched by SIGUSR1
+    int capture_snaplen = CAPTURE_DEFAULT_SNAPLEN;
+    CaptureFilter capture_filter = { 0 };
+    bool capture_on = true;
+    int busy_poll_us = 0;                           // Spin before blocking, in RX threads and workers, 0: always block
+    bool busy_poll_adaptive = false;                // Only spin when the arrivals come faster than the budget
+    char *shm_name = NULL, *mac_str = NULL;         // In-memory wire between two instances, and our MAC on it
+    int shm_side = 0;                               // 0 creates the wire, 1 attaches to it
+    int mtu = 0;                                    // 0: ETHER_MTU
+    int magazine = MEMPOOL_MAGAZINE;                // Pieces of the memory pool cached per thread, 0: none
+    bool hugepage = false;                          // Back the memory pool by huge pages
+    bool numa = false;                              // One memory pool per NUMA node
+    bool pool_populate = false;                     // Fault the memory pool in at startup, instead of on first use
+    char *pool_policy = "drop";                     // Memory pool running low: "malloc", "grow" or "drop" the received frames
+    char *pool_watermarks = NULL;                   // "low,high" in percent of each class, pressure below low until back to high
+    int pool_reserve = -1, pool_grow = -1;          // Percent kept for the control traffic, chunks a class may grow by, -1: default
+    int pool_track = 0;                             // Owner of each piece of the memory pool, report those held longer than it in ms, 0: off
+    bool rss = false;                               // Steer the frames of a flow to the same worker
+    int rss_rebalance = 0;                          // Move flows away from a hot worker every this many ms, 0: never
 
     while ((c = ketopt(&opt, argc, argv, 1, "ho:v", longopts)) >= 0) {
         switch (c) {
@@ -83,6 +173,71 @@ int main(int argc, char *argv[]) {
                 ansi_log = true;
             } else if (opt.longidx == 8) { // size of signal queue
                 queue_size = atoi(opt.arg);
+            } else if (opt.longidx == 9) { // frames drained per wakeup
+                rx_batch = atoi(opt.arg);
+            } else if (opt.longidx == 10) { // poll timeout of device
+                poll_timeout = atoi(opt.arg);
+            } else if (opt.longidx == 11) { // queues of TAP device
+                rx_queues = atoi(opt.arg);
+            } else if (opt.longidx == 12) { // backend of device
+                backend_name = opt.arg;
+            } else if (opt.longidx == 13) { // virtio-net header on TAP
+                vnet_hdr = true;
+            } else if (opt.longidx == 14) { // capture to replay
+                pcap_path = opt.arg;
+            } else if (opt.longidx == 15) { // speed of replay
+                replay_speed = atof(opt.arg);
+            } else if (opt.longidx == 16) { // passes of replay
+                replay_loops = atoi(opt.arg);
+            } else if (opt.longidx == 17) { // sink of sent frames
+                tx_sink = opt.arg;
+            } else if (opt.longidx == 18) { // capture file
+                capture_path = opt.arg;
+            } else if (opt.longidx == 19) { // bytes captured per frame
+                capture_snaplen = atoi(opt.arg);
+            } else if (opt.longidx == 20) { // capture filter: ethertype
+                capture_filter.ethertype = (uint16_t)strtol(opt.arg, NULL, 0);
+            } else if (opt.longidx == 21) { // capture filter: IP address
+                capture_ip = opt.arg;
+            } else if (opt.longidx == 22) { // capture filter: TCP/UDP port
+                capture_filter.port = (uint16_t)atoi(opt.arg);
+            } else if (opt.longidx == 23) { // capture starts switched off
+                capture_on = false;
+            } else if (opt.longidx == 24) { // busy-poll budget
+                busy_poll_us = atoi(opt.arg);
+            } else if (opt.longidx == 25) { // busy-poll driven by the arrival rate
+                busy_poll_adaptive = true;
+            } else if (opt.longidx == 26) { // shared memory of the wire
+                shm_name = opt.arg;
+            } else if (opt.longidx == 27) { // end of the wire
+                shm_side = atoi(opt.arg);
+            } else if (opt.longidx == 28) { // MAC on the wire
+                mac_str = opt.arg;
+            } else if (opt.longidx == 29) { // MTU on the wire
+                mtu = atoi(opt.arg);
+            } else if (opt.longidx == 30) { // magazine of the memory pool
+                magazine = atoi(opt.arg);
+            } else if (opt.longidx == 31) { // memory pool on huge pages
+                hugepage = true;
+            } else if (opt.longidx == 32) { // memory pool per NUMA node
+                numa = true;
+            } else if (opt.longidx == 33) { // overload policy of the memory pool
+                pool_policy = opt.arg;
+            } else if (opt.longidx == 34) { // watermarks of the memory pool
+                pool_watermarks = opt.arg;
+            } else if (opt.longidx == 35) { // reserve of the memory pool
+                pool_reserve = atoi(opt.arg);
+            } else if (opt.longidx == 36) { // growth of the memory pool
+                pool_grow = atoi(opt.arg);
+            } else if (opt.longidx == 37) { // memory pool faulted in at startup
+                pool_populate = true;
+            } else if (opt.longidx == 38) { // owners of the memory pool pieces
+                pool_track = atoi(opt.arg);
+            } else if (opt.longidx == 39) { // flow affinity of the workers
+                rss = true;
+            } else if (opt.longidx == 40) { // rebalancing of the flows
+                rss = true;
+                rss_rebalance = atoi(opt.arg);
             }
             break;
         case '?': // Unknown option
@@ -140,15 +295,110 @@ int main(int argc, char *argv[]) {
     }
 
     // 4. Initialize the network device
+    if (rx_batch <= 0 || rx_batch > DEVICE_MAX_RX_BATCH) {
+        LOG_FATAL("The RX batch size %d should be in (0, %d]", rx_batch, DEVICE_MAX_RX_BATCH);
+        return -1;
+    }
+    const DeviceOps* ops = device_find_ops(backend_name);
+    if (ops == NULL) {
+        LOG_FATAL("Unknown device backend %s, should be tap, uring, packet, pcap or shm", backend_name);
+        return -1;
+    }
+    if (rx_queues <= 0 || rx_queues > DEVICE_MAX_RX_QUEUES) {
+        LOG_FATAL("The number of RX queues %d should be in (0, %d]", rx_queues, DEVICE_MAX_RX_QUEUES);
+        return -1;
+    }
+    if (replay_speed < 0 || replay_loops < 0) {
+        LOG_FATAL("The replay speed %.2f and loops %d can't be negative", replay_speed, replay_loops);
+        return -1;
+    }
+    if (busy_poll_us < 0) {
+        LOG_FATAL("The busy-poll budget %d us can't be negative", busy_poll_us);
+        return -1;
+    }
+    mac_addr mac = MAC_NULL;
+    if (mac_str && !parse_mac_addr(mac_str, &mac)) {
+        LOG_FATAL("Can't parse the MAC address %s", mac_str);
+        return -1;
+    }
+    if (mtu < 0) {
+        LOG_FATAL("The MTU %d can't be negative", mtu);
+        return -1;
+    }
+    if (magazine < 0) {
+        LOG_FATAL("The magazine of %d pieces can't be negative", magazine);
+        return -1;
+    }
+    MemOverload overload = MEMPOOL_OVERLOAD_DEFAULT;
+    if (strcmp(pool_policy, "malloc") == 0) {
+        overload.policy = MEMPOOL_POLICY_MALLOC;
+    } else if (strcmp(pool_policy, "grow") == 0) {
+        overload.policy   = MEMPOOL_POLICY_GROW;
+        overload.grow_max = MEMPOOL_MAX_GROW;
+    } else if (strcmp(pool_policy, "drop") == 0) {
+        overload.policy = MEMPOOL_POLICY_DROP;
+    } else {
+        LOG_FATAL("Unknown memory pool policy %s, should be malloc, grow or drop", pool_policy);
+        return -1;
+    }
+    if (pool_watermarks && sscanf(pool_watermarks, "%u,%u", &overload.low, &overload.high) != 2) {
+        LOG_FATAL("Can't parse the memory pool watermarks %s, should be low,high", pool_watermarks);
+        return -1;
+    }
+    if (pool_reserve >= 0) overload.reserve = (unsigned)pool_reserve;
+    if (pool_grow >= 0) overload.grow_max = (size_t)pool_grow;
+    BusyPollConfig busy_poll = {
+        .budget_ns = (uint64_t)busy_poll_us * 1000,
+        .adaptive  = busy_poll_adaptive,
+    };
     NetDevice* device = calloc(1, sizeof(NetDevice));
     assert(device);
-    err = device_init(device, tap_path, tap_name);
+    DeviceConfig config = {
+        .tap_path     = tap_path,
+        .if_name      = tap_name,
+        .queue_num    = (size_t)rx_queues,
+        .rx_batch     = (size_t)rx_batch,
+        .poll_timeout = poll_timeout,
+        .vnet_hdr     = vnet_hdr,
+        .busy_poll    = busy_poll,
+        .pcap_path    = pcap_path,
+        .replay_speed = replay_speed,
+        .replay_loops = (size_t)replay_loops,
+        .tx_sink      = tx_sink,
+        .shm_name     = shm_name,
+        .shm_side     = shm_side,
+        .mac          = mac,
+        .mtu          = (size_t)mtu,
+    };
+    err = device_init(device, ops, &config);
     if (err_is_fail(err)) {
         DEBUG_ERR(err, "Can't Initialize the Network Device");
         return -1;
     }
     g_states.device = device;
 
+    if (capture_path) {
+        if (capture_snaplen <= 0) {
+            LOG_FATAL("The capture snaplen %d should be positive", capture_snaplen);
+            return -1;
+        }
+        if (capture_ip) {
+            if (!parse_ip_addr(capture_ip, &capture_filter.ip)) {
+                LOG_FATAL("Can't parse the capture filter IP %s", capture_ip);
+                return -1;
+            }
+            capture_filter.has_ip = true;
+        }
+        Capture* capture = calloc(1, sizeof(Capture));
+        assert(capture);
+        err = capture_init(capture, capture_path, (uint32_t)capture_snaplen, capture_filter, capture_on);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "Can't Initialize the Capture");
+            return -1;
+        }
+        device->capture = capture;
+    }
+
     // pass configuration to the network module through global states
     g_states.max_workers_for_single_tcp_server = workers;
     g_states.max_workers_for_single_udp_server = workers;
@@ -163,24 +413,58 @@ int main(int argc, char *argv[]) {
     }
     g_states.network = net;
 
-    // 6. Initialize the memory pool
-    MemPool* mempool = aligned_alloc(ATOMIC_ISOLATION, sizeof(MemPool));
-    memset(mempool, 0x00, sizeof(MemPool));
-    err = mempool_init(mempool, MEMPOOL_BYTES, MEMPOOL_AMOUNT);
-    if (err_is_fail(err)) {
-        DEBUG_ERR(err, "Can't Initialize the memory mempool");
-        return -1;
+    // 6. Initialize the memory pool, one per NUMA node if asked and there are several
+    MemClassConfig mempool_classes[] = MEMPOOL_DEFAULT_CLASSES;
+    for (size_t i = 0; i < sizeof(mempool_classes) / sizeof(mempool_classes[0]); i++) {
+        if (mempool_classes[i].magazine != 0) mempool_classes[i].magazine = (size_t)magazine;
     }
-    g_states.mempool = mempool;
+    size_t node_num = numa ? mempool_node_num() : 1;
+    if (node_num > MEMPOOL_MAX_NODES) {
+        LOG_WARN("Only the first %d of the %d NUMA nodes have a memory pool", MEMPOOL_MAX_NODES, node_num);
+        node_num = MEMPOOL_MAX_NODES;
+    }
+    for (size_t node = 0; node < node_num; node++) {
+        MemPool* mempool = aligned_alloc(ATOMIC_ISOLATION, sizeof(MemPool));
+        memset(mempool, 0x00, sizeof(MemPool));
+        MemBacking backing = {
+            .hugepage = hugepage,
+            .node     = (node_num > 1) ? (int)node : -1,
+            .populate = pool_populate,
+        };
+        err = mempool_init(mempool, mempool_classes, sizeof(mempool_classes) / sizeof(mempool_classes[0]), backing, overload);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "Can't Initialize the memory mempool");
+            return -1;
+        }
+        if (pool_track > 0) {
+            err = mempool_track(mempool);
+            if (err_is_fail(err)) {
+                DEBUG_ERR(err, "Can't track the owners of the memory mempool");
+                return -1;
+            }
+        }
+        g_states.node_pools[node] = mempool;
+    }
+    g_states.mempool  = g_states.node_pools[0];
+    g_states.node_num = (node_num > 1) ? node_num : 0;
 
     // 7. Initialize the thread pool
-    err = thread_pool_init(workers);
+    err = thread_pool_init(workers, busy_poll);
     if (err_is_fail(err)) {
         DEBUG_ERR(err, "Can't Initialize the thread mempool");
         return -1;
     }
     g_states.threadpool = &g_threadpool;
 
+    // 7.1 The frames of a flow always go to the same worker
+    if (rss && workers > 1) {
+        err = device_rss_enable(device, (size_t)workers);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "Can't steer the frames to the workers");
+            return -1;
+        }
+    }
+
     // 8. Initialize the timer thread (timed event)
     err = timer_thread_init(g_states.timer);
     if (err_is_fail(err)) {
@@ -189,7 +473,19 @@ int main(int argc, char *argv[]) {
     }
     g_states.timer_count = TIMER_NUM;
 
-    err = device_loop(device, net, mempool);
+    // 8.1 Move flows away from a hot worker
+    if (device->rss && rss_rebalance > 0) {
+        delayed_us period = (delayed_us)rss_rebalance * 1000;
+        submit_periodic_task(MK_DELAY_TASK(period, NULL, MK_NORM_TASK(rss_rebalance_task, device)), period);
+    }
+
+    // 8.2 Report the pieces held for too long, as often as the threshold
+    if (pool_track > 0) {
+        delayed_us period = (delayed_us)pool_track * 1000;
+        submit_periodic_task(MK_DELAY_TASK(period, NULL, MK_NORM_TASK(pool_track_report, (void*)(uintptr_t)pool_track)), period);
+    }
+
+    err = device_loop(device, net, g_states.mempool);
     if (err_is_fail(err)) {
         DEBUG_ERR(err, "Bad thing happened in the device, loop going to shutdown!");
         return -1;
@@ -205,13 +501,18 @@ void driver_exit(int signum) {
 
     device_close(g_states.device);
 
-    mempool_destroy(g_states.mempool);
+    for (size_t node = 0; node < MEMPOOL_MAX_NODES; node++) {
+        if (g_states.node_pools[node]) mempool_destroy(g_states.node_pools[node]);
+    }
 
     timer_thread_destroy(g_states.timer);
     // Prior to the thread pool destrcution, because there may be some timed event
 
     thread_pool_destroy();
 
+    // The objects still in flight may be used by the cancelled threads, the slabs are only reported
+    slab_report_all();
+
     LOG_NOTE("Bye Bye !");
     
     log_close(g_states.log_file);
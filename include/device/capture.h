@@ -0,0 +1,79 @@
+#ifndef __DEVICE_CAPTURE_H__
+#define __DEVICE_CAPTURE_H__
+
+#include <common.h>
+#include <event/buffer.h>
+#include <netutil/pcap.h>
+#include <netutil/ip.h>       // ip_context_t
+#include <lock_free/defs.h>   // ATOMIC_ISOLATION
+#include <stdatomic.h>
+#include <pthread.h>
+
+/// Frames each thread can have in flight to the writer, must be power of 2
+#define CAPTURE_RING_SLOTS      1024
+/// Threads that can capture (RX threads and the senders), the frames of the others are dropped
+#define CAPTURE_MAX_RINGS       64
+#define CAPTURE_DEFAULT_SNAPLEN 1536
+/// The writer sleeps this long when all the rings are empty, in micro-seconds
+#define CAPTURE_IDLE_SLEEP      1000
+
+/// Direction of a frame, same values as the pcapng epb_flags
+#define CAPTURE_RX              PCAPNG_EPB_INBOUND
+#define CAPTURE_TX              PCAPNG_EPB_OUTBOUND
+
+/// @brief  What to capture, 0 (or has_ip == false) matches anything
+typedef struct capture_filter {
+    uint16_t        ethertype;
+    bool            has_ip;        ///< Source or destination
+    ip_context_t    ip;
+    uint16_t        port;          ///< Source or destination, TCP or UDP
+} CaptureFilter;
+
+typedef struct capture_slot {
+    uint64_t        ts_ns;
+    uint32_t        caplen;
+    uint32_t        wire_len;
+    uint32_t        direction;
+    uint8_t         data[];        ///< snaplen bytes
+} CaptureSlot;
+
+/// @brief  Single producer (the thread owning it), single consumer (the writer thread)
+typedef struct capture_ring {
+    alignas(ATOMIC_ISOLATION)
+        atomic_size_t head;        ///< Next slot to write out, moved by the writer
+    alignas(ATOMIC_ISOLATION)
+        atomic_size_t tail;        ///< Next slot to fill, moved by the owner
+    atomic_size_t   dropped;       ///< The ring was full
+    size_t          reported;      ///< Drops already reported by the writer
+    char            owner[32];
+    size_t          slot_size;
+    uint8_t        *slots;
+} CaptureRing __attribute__((aligned(ATOMIC_ISOLATION)));
+
+typedef struct capture {
+    PcapWriter      writer;
+    uint32_t        snaplen;
+    CaptureFilter   filter;
+    atomic_bool     enabled;       ///< Switched at runtime, even from a signal handler
+    atomic_bool     running;       ///< The writer thread keeps going
+    pthread_t       thread;
+    _Atomic(CaptureRing*) rings[CAPTURE_MAX_RINGS];
+    atomic_size_t   ring_num;
+    atomic_size_t   no_ring;       ///< Dropped, the thread couldn't get a ring
+    size_t          written;
+} Capture;
+
+__BEGIN_DECLS
+
+errval_t capture_init(Capture* capture, const char* path, uint32_t snaplen, CaptureFilter filter, bool enabled);
+void     capture_destroy(Capture* capture);
+/// Async-signal-safe
+void     capture_set_enabled(Capture* capture, bool enabled);
+bool     capture_toggle(Capture* capture);
+/// Copy the frame to the ring of this thread if it passes the filter, never blocks
+void     capture_frame(Capture* capture, const Buffer* frame, uint32_t direction);
+bool     capture_match(const CaptureFilter* filter, const uint8_t* frame, size_t len);
+
+__END_DECLS
+
+#endif // __DEVICE_CAPTURE_H__
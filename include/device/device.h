@@ -4,33 +4,155 @@
 #include <common.h>
 #include <netstack/ethernet.h>
 #include <time.h>       // For clock_gettime and struct timespec
+#include <pthread.h>
+#include <stdatomic.h>
+#include <lock_free/defs.h> // ATOMIC_ISOLATION
+#include <event/busypoll.h>
+#include <device/rss.h>
 
 #include <linux/if.h>   //struct ifreq
 typedef struct memory_pool MemPool;
 typedef struct net_work    NetWork;
+typedef struct capture     Capture;
+typedef struct buffer_chain BufChain;
 
 /// IPv4: Max 60, 
 /// TCP : Max 60, UDP : 8, ICMP : 8
-#define DEVICE_HEADER_RESERVE   128
+/// Plus the descriptor of the packet (PktDesc, IP_send) at the start of the piece, in front of the headers
+#define DEVICE_HEADER_RESERVE   256
 /// Round up to 8
 
-typedef struct net_device {
-    int             tap_fd;  ///< TAP device file descriptor
-    struct ifreq    ifr;     ///< Interface request structure used for socket ioctl's
-    size_t          recvd;   ///< How many packets have we received
+/// How many frames we drain from the device after one wakeup
+#define DEVICE_DEFAULT_RX_BATCH     32
+#define DEVICE_MAX_RX_BATCH         256
+/// -1 means wait indefinitely
+#define DEVICE_DEFAULT_POLL_TIMEOUT -1
+
+/// Each queue has its own RX thread, the backend (or the kernel) spreads the flows across queues
+#define DEVICE_DEFAULT_RX_QUEUES    1
+#define DEVICE_MAX_RX_QUEUES        16
+
+/// Capabilities of a backend (DeviceOps.caps), or of an opened device (NetDevice.caps)
+#define DEVICE_CAP_CSUM             0x01    ///< TX: finishes partial TCP/UDP checksums (BUFFER_CSUM_PARTIAL)
+#define DEVICE_CAP_TSO              0x02    ///< TX: cuts TCP segments larger than MTU (BUFFER_GSO_TCP)
+#define DEVICE_CAP_RX_CSUM          0x04    ///< RX: tells which checksums are already verified (BUFFER_CSUM_VALID)
+#define DEVICE_CAP_BATCH            0x08    ///< tx_burst() hands the whole burst to the kernel at once
+#define DEVICE_CAP_ZERO_COPY        0x10    ///< RX: frames are referenced in place, not copied
+#define DEVICE_CAP_VNET_HDR         0x20    ///< Can prefix every frame by a struct virtio_net_hdr, which brings CSUM, TSO and RX_CSUM
+#define DEVICE_CAP_BUSY_POLL        0x40    ///< rx_burst() finds the frames without rx_wait(), so the RX thread can spin on it
+#define DEVICE_CAP_TX_ASYNC         0x80    ///< tx_burst() may only queue the frames, the backend counts them as sent once submitted
+
+typedef struct net_device   NetDevice;
+typedef struct device_queue DeviceQueue;
+
+/// What the backends need to open a device, not all fields are used by every backend
+typedef struct device_config {
+    const char*     tap_path;      ///< Clone device of TUN/TAP
+    const char*     if_name;       ///< Name of the TAP interface to create, or the existing interface to attach to
+    size_t          queue_num;
+    size_t          rx_batch;      ///< Max frames per rx_burst(), handed to workers as one task
+    int             poll_timeout;  ///< Timeout of waiting in milli-seconds
+    bool            vnet_hdr;      ///< Ask for the virtio-net header (DEVICE_CAP_VNET_HDR)
+    BusyPollConfig  busy_poll;     ///< Spin on rx_burst() before rx_wait() (DEVICE_CAP_BUSY_POLL)
+    // Replay of a capture (pcap backend)
+    const char*     pcap_path;     ///< .pcap or .pcapng file to inject
+    double          replay_speed;  ///< 0: as fast as possible, 1: original timing, N: N times faster
+    size_t          replay_loops;  ///< How many times to replay the file, 0 means forever
+    const char*     tx_sink;       ///< Write the sent frames to this pcap file, NULL to only count them
+    // In-memory wire between two instances (shm backend)
+    const char*     shm_name;      ///< POSIX shared memory object, NULL for DEVICE_SHM_DEFAULT_NAME
+    int             shm_side;      ///< 0 creates the wire, 1 attaches to it
+    mac_addr        mac;           ///< MAC_NULL for a default one
+    size_t          mtu;           ///< 0 for ETHER_MTU
+} DeviceConfig;
+
+/// @brief  I/O engine behind a NetDevice. The RX functions are only called by the RX thread of the queue,
+///         tx_burst() is called concurrently by any thread
+typedef struct device_ops {
+    const char*     name;
+    uint8_t         caps;          ///< DEVICE_CAP_*
+    /// Open one queue, set queue->fd (if any) and queue->priv
+    errval_t      (*open)    (DeviceQueue* queue, const DeviceConfig* config);
+    /// Release queue->priv, the fd is closed by the device
+    void          (*close)   (DeviceQueue* queue);
+    /// Block until there may be frames to receive, or the timeout
+    errval_t      (*rx_wait) (DeviceQueue* queue);
+    /// Receive at most max frames without blocking, return how many are in bufs
+    size_t        (*rx_burst)(DeviceQueue* queue, Buffer* bufs, size_t max);
+    /// Send the frames in order, return how many are accepted, the caller keeps the buffers
+    size_t        (*tx_burst)(DeviceQueue* queue, Buffer* bufs, size_t count);
+    errval_t      (*get_mac) (DeviceQueue* queue, mac_addr* ret_mac);
+    /// Optional: log the statistics only known by the backend
+    void          (*stats)   (DeviceQueue* queue);
+    /// Optional: wake up an RX thread that isn't blocked in a cancellation point
+    void          (*wakeup)  (DeviceQueue* queue);
+    /// Optional: send one frame gathered from the segments of the chain, the caller keeps the chain
+    errval_t      (*tx_chain)(DeviceQueue* queue, const BufChain* chain);
+} DeviceOps;
+
+typedef struct device_queue {
+    NetDevice*      device;
+    size_t          id;
+    int             fd;            ///< File descriptor of this queue, -1 if the backend has none
+    pthread_t       thread;        ///< RX thread, queue 0 runs in the thread calling device_loop()
+    void*           priv;          ///< State of the backend
+    // Only touched by the RX thread of this queue
+    size_t          recvd;         ///< How many packets have we received
+    size_t          recvd_batch;   ///< How many batches have we submitted
     size_t          fail_process;
-    size_t          sent;    // Maybe inaccurate because multi-threading
-    size_t          fail_sent;
+    size_t          rx_shed;       ///< Dropped before reaching the stack, the memory pool refused a piece for them
+    size_t          rss_spill;     ///< Steered to a worker with a full queue, given to any worker instead
+    struct ether_batch **steered;  ///< Frames of a burst for each worker, NULL without RSS
+    BusyPoll        busy;
+    // Any thread can send through this queue
+    alignas(ATOMIC_ISOLATION)
+    atomic_size_t   sent;          ///< Accepted by the backend
+    atomic_size_t   fail_sent;
+} DeviceQueue __attribute__((aligned(ATOMIC_ISOLATION)));
+
+typedef struct net_device {
+    struct ifreq    ifr;           ///< Interface request structure used for socket ioctl's
+    const DeviceOps* ops;
+    uint8_t         caps;          ///< DEVICE_CAP_* of this device
+    bool            vnet_hdr;      ///< Every frame is prefixed by a struct virtio_net_hdr
+    size_t          queue_num;
+    DeviceQueue*    queues;
+    atomic_size_t   next_tx_queue; ///< Round-robin assignment of the TX queue to sending threads
+    size_t          rx_batch;      ///< Max frames read per wakeup, handed to workers as one task
+    int             poll_timeout;  ///< Timeout of waiting in milli-seconds
+    bool            looping;       ///< device_loop() has started the RX threads
+    NetWork*        net;           ///< Set by device_loop(), used by the RX threads
+    MemPool*        mempool;
+    Capture*        capture;       ///< NULL if we don't capture, owned by the device
+    DeviceRss*      rss;           ///< NULL if the frames go to any worker, owned by the device
     struct timespec start_time;
 } NetDevice ;
 
+/// Backends
+extern const DeviceOps tap_ops;
+extern const DeviceOps uring_ops;
+extern const DeviceOps packet_ops;
+extern const DeviceOps replay_ops;
+extern const DeviceOps shm_ops;
+
 __BEGIN_DECLS
 
-errval_t device_init(NetDevice* device, const char* tap_path, const char* tap_name);
+const DeviceOps* device_find_ops(const char* name);
+
+errval_t device_init(NetDevice* device, const DeviceOps* ops, const DeviceConfig* config);
 void     device_close(NetDevice* device);
+size_t   device_tx_burst(NetDevice* device, Buffer* bufs, size_t count);
 errval_t device_send(NetDevice* device, Buffer buf);
+errval_t device_send_chain(NetDevice* device, BufChain* chain);
 errval_t device_get_mac(NetDevice* device, mac_addr* ret_mac);
 errval_t device_loop(NetDevice* device, NetWork* net, MemPool* mempool);
+/// Steer the frames of each flow to the same worker from now on, before device_loop()
+errval_t device_rss_enable(NetDevice* device, size_t workers);
+
+// Helpers for the backends
+errval_t device_ioctl_mac(DeviceQueue* queue, mac_addr* ret_mac);
+/// A NULL_BUFFER when the memory pool sheds the received frames, the backend drops the frame and counts it in rx_shed
+Buffer   device_alloc_rx_buffer(NetDevice* device);
 
 __END_DECLS
 
@@ -0,0 +1,44 @@
+#ifndef __DEVICE_PACKET_H__
+#define __DEVICE_PACKET_H__
+
+#include <common.h>
+#include <event/buffer.h>
+#include <lock_free/defs.h>   // ATOMIC_ISOLATION
+#include <stdatomic.h>
+#include <pthread.h>
+
+/// RX ring: the kernel fills a whole block before handing it to us (or retires it after the timeout)
+#define DEVICE_PACKET_BLOCK_SIZE     (1 << 20)
+#define DEVICE_PACKET_RX_BLOCKS      16
+/// In milli-seconds
+#define DEVICE_PACKET_BLOCK_TIMEOUT  1
+/// TX ring: fixed size slots, must hold TPACKET3_HDRLEN + ETHER_MAX_SIZE
+#define DEVICE_PACKET_TX_FRAME_SIZE  2048
+#define DEVICE_PACKET_TX_BLOCKS      4
+
+struct tpacket_block_desc;
+
+/// @brief  State of the packet backend (DeviceQueue.priv): one AF_PACKET socket per device queue, with a TPACKET_V3 RX ring and TX ring mapped together.
+///         The RX ring is only touched by the RX thread of the queue, the TX ring is shared by the senders
+typedef struct device_packet {
+    uint8_t        *map;
+    size_t          map_len;
+    // RX: block based, owned by the RX thread
+    uint8_t        *rx_ring;
+    size_t          rx_block_num;
+    size_t          rx_block_size;
+    size_t          rx_current;
+    struct tpacket_block_desc *rx_block; ///< Block being walked, NULL if we wait for rx_current
+    uint32_t        rx_pkts_left;
+    uint8_t        *rx_pkt;        ///< Next frame in rx_block
+    // TX: frame based, senders fill the slots in order under the lock
+    uint8_t        *tx_ring;
+    size_t          tx_frame_num;
+    size_t          tx_frame_size;
+    size_t          tx_current;
+    pthread_spinlock_t tx_lock;
+    alignas(ATOMIC_ISOLATION)
+        atomic_size_t tx_pending;  ///< Frames marked since the last kick, the one who brings it from 0 kicks
+} DevicePacket __attribute__((aligned(ATOMIC_ISOLATION)));
+
+#endif // __DEVICE_PACKET_H__
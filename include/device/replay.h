@@ -0,0 +1,49 @@
+#ifndef __DEVICE_REPLAY_H__
+#define __DEVICE_REPLAY_H__
+
+#include <common.h>
+#include <event/buffer.h>
+#include <netutil/pcap.h>
+#include <netutil/etharp.h>   // mac_addr
+#include <pthread.h>
+
+/// How many frames we look at to guess our MAC address (the destination of the first unicast frame)
+#define DEVICE_REPLAY_MAC_PROBE     64
+
+/// @brief  The sent frames of all queues go to one file
+typedef struct replay_sink {
+    PcapWriter      writer;
+    pthread_mutex_t lock;
+    size_t          written;
+} ReplaySink;
+
+/// @brief  State of the pcap backend (DeviceQueue.priv): every queue reads the whole file,
+///         and keeps the frames steered to it (by IP addresses), so a flow stays on one queue.
+///         Only touched by the RX thread of the queue, except the sink
+typedef struct device_replay {
+    PcapReader      reader;
+    mac_addr        mac;           ///< What we pretend to be
+    double          speed;
+    size_t          loops;         ///< 0 means forever
+    size_t          pass;          ///< Passes finished
+    bool            done;
+    // The next frame, read but not due yet
+    Buffer          pending;
+    bool            has_pending;
+    uint64_t        pending_ts;
+    // Timing of the current pass, in nano seconds
+    bool            base_set;
+    uint64_t        base_ts;       ///< Timestamp of the first frame in the file
+    uint64_t        base_wall;     ///< When we injected it (CLOCK_MONOTONIC)
+    // Statistics
+    uint64_t        start_wall;
+    size_t          frames;
+    size_t          bytes;
+    size_t          pass_frames;   ///< Frames (for all queues) in this pass, stop if a pass has none
+    size_t          too_large;
+    size_t          truncated;
+    // Shared by all queues, owned by queue 0
+    ReplaySink     *sink;
+} DeviceReplay;
+
+#endif // __DEVICE_REPLAY_H__
@@ -0,0 +1,50 @@
+#ifndef __DEVICE_RSS_H__
+#define __DEVICE_RSS_H__
+
+#include <common.h>
+#include <stdatomic.h>
+
+/*
+ * Receive Side Scaling in software: the RX threads hash the addresses and ports of each frame and steer it through
+ * an indirection table to a fixed worker, so the frames of a flow are processed in order, by the same core.
+ * A hot worker gives some of its buckets to the coldest one, as a NIC would be reprogrammed.
+ */
+
+/// Buckets of the indirection table, must be power of 2
+#define RSS_TABLE_SIZE          128
+/// Most workers frames are steered to
+#define RSS_MAX_WORKERS         64
+/// A worker is hot when it receives more than this percent of the average
+#define RSS_HOT_PERCENT         150
+
+typedef struct device_rss {
+    size_t          workers;
+    _Atomic(uint16_t) table[RSS_TABLE_SIZE];    ///< Worker of each bucket
+    atomic_size_t   hits[RSS_TABLE_SIZE];       ///< Frames of each bucket, halved at each rebalancing
+    size_t          moves;                      ///< Buckets given to another worker
+} DeviceRss;
+
+__BEGIN_DECLS
+
+/// Spread the buckets evenly over the workers
+errval_t rss_init(DeviceRss* rss, size_t workers);
+/// Hash of the flow of a frame starting at its Ethernet header: addresses and ports, or the IPv6 flow label.
+/// Fragments only hash the addresses, the frames that aren't IP are all in flow 0
+uint32_t rss_hash(const uint8_t* frame, size_t len);
+/// Give the bucket to another worker, the frames of it already queued may run at the same time as the next ones
+void     rss_move(DeviceRss* rss, size_t bucket, size_t worker);
+/// Move buckets from the hottest worker to the coldest one while it's hot, return how many
+size_t   rss_rebalance(DeviceRss* rss);
+/// Log the share of the frames each worker gets
+void     rss_report(DeviceRss* rss);
+
+/// The worker of the frame, counted for the rebalancing
+static inline size_t rss_steer(DeviceRss* rss, uint32_t hash) {
+    size_t bucket = hash & (RSS_TABLE_SIZE - 1);
+    atomic_fetch_add_explicit(&rss->hits[bucket], 1, memory_order_relaxed);
+    return atomic_load_explicit(&rss->table[bucket], memory_order_relaxed);
+}
+
+__END_DECLS
+
+#endif // __DEVICE_RSS_H__
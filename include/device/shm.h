@@ -0,0 +1,77 @@
+#ifndef __DEVICE_SHM_H__
+#define __DEVICE_SHM_H__
+
+#include <common.h>
+#include <netstack/ethernet.h>   // ETHER_MAX_SIZE
+#include <netutil/etharp.h>      // mac_addr
+#include <lock_free/defs.h>      // ATOMIC_ISOLATION
+#include <stdatomic.h>
+
+/*
+ * An in-memory "wire" between two ends (side 0 and side 1), in a POSIX shared memory object,
+ * so two NetCore processes, or two devices in one process, talk without the kernel in between.
+ * Every queue has one ring per direction, a ring is a bounded MPSC queue (Vyukov) of fixed size slots:
+ * any thread of the sending end pushes, the RX thread of the same queue on the other end pops.
+ */
+
+#define DEVICE_SHM_MAGIC            0x4E435752  ///< "NCWR", set once the creator initialized the rings
+#define DEVICE_SHM_VERSION          1
+#define DEVICE_SHM_DEFAULT_NAME     "/netcore-wire"
+/// Frames in flight per direction per queue, must be power of 2
+#define DEVICE_SHM_SLOTS            1024
+/// Largest frame on the wire, a configured MTU can only be smaller
+#define DEVICE_SHM_SLOT_SIZE        ETHER_MAX_SIZE
+/// How long side 1 waits for side 0 to create the wire, in milli-seconds
+#define DEVICE_SHM_ATTACH_TIMEOUT   5000
+
+typedef struct shm_cell {
+    atomic_size_t   seq;           ///< Vyukov sequence: index + 1 when full, index + SLOTS when free again
+    uint32_t        len;
+    uint8_t         data[DEVICE_SHM_SLOT_SIZE];
+} ShmCell;
+
+typedef struct shm_ring {
+    alignas(ATOMIC_ISOLATION)
+        atomic_size_t tail;        ///< Claimed by the senders
+    alignas(ATOMIC_ISOLATION)
+        size_t      head;          ///< Only moved by the receiver
+    alignas(ATOMIC_ISOLATION)
+        atomic_uint bell;          ///< futex, bumped to wake up the receiver
+    atomic_uint     sleeping;      ///< The receiver is (going to be) blocked on bell
+    ShmCell         cells[DEVICE_SHM_SLOTS];
+} ShmRing;
+
+typedef struct shm_end {
+    mac_addr        mac;
+    uint16_t        mtu;
+    atomic_bool     attached;
+} ShmEnd;
+
+/// @brief  Header of the shared memory object, followed by 2 rings per queue, rings[2 * queue + side] carries what side sends
+typedef struct shm_wire {
+    atomic_uint     magic;
+    uint32_t        version;
+    uint32_t        queue_num;
+    uint32_t        slots;
+    ShmEnd          ends[2];
+    alignas(ATOMIC_ISOLATION)
+        ShmRing     rings[];
+} ShmWire;
+
+/// @brief  State of the shm backend (DeviceQueue.priv), every queue maps the whole wire
+typedef struct device_shm {
+    ShmWire        *wire;
+    size_t          map_len;
+    char            name[64];
+    int             side;
+    mac_addr        mac;
+    uint16_t        mtu;
+    ShmRing        *tx;            ///< What we send
+    ShmRing        *rx;            ///< What the other end sends
+    // Statistics
+    size_t          rx_too_large;  ///< Larger than our MTU, dropped
+    atomic_size_t   tx_too_large;
+    atomic_size_t   tx_full;       ///< The other end doesn't keep up
+} DeviceShm;
+
+#endif // __DEVICE_SHM_H__
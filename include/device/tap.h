@@ -0,0 +1,21 @@
+#ifndef __DEVICE_TAP_H__
+#define __DEVICE_TAP_H__
+
+#include <common.h>
+#include <event/buffer.h>
+
+typedef struct device_queue  DeviceQueue;
+typedef struct device_config DeviceConfig;
+
+/// @brief  State of a TAP queue, only touched by the RX thread
+typedef struct tap_queue {
+    Buffer          spare;         ///< Kept across wakeups, so we don't allocate and free one when read() returns EAGAIN
+} TapQueue;
+
+__BEGIN_DECLS
+
+errval_t tap_attach(DeviceQueue* queue, const DeviceConfig* config);
+
+__END_DECLS
+
+#endif // __DEVICE_TAP_H__
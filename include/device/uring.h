@@ -0,0 +1,59 @@
+#ifndef __DEVICE_URING_H__
+#define __DEVICE_URING_H__
+
+#include <common.h>
+#include <event/buffer.h>
+#include <lock_free/bdqueue.h>
+#include <stdatomic.h>
+
+/// Entries of the submission queue, the completion queue is twice as large,
+/// must hold all the RX reads (rx_batch), the eventfd read, and the TX writes in flight
+#define DEVICE_URING_ENTRIES        512
+/// Frames waiting for the ring owner to submit, must be power of 2
+#define DEVICE_URING_TX_QUEUE       1024
+
+/// @brief  State of the uring backend (DeviceQueue.priv): one io_uring per device queue, owned by the RX thread of that queue.
+///         Only the owner touches the rings, other threads send by pushing frames to tx_queue
+typedef struct device_uring {
+    int             ring_fd;
+    int             wake_fd;       ///< eventfd, wakes up the owner when there are frames to send
+    uint64_t        wake_count;    ///< Target of the read on wake_fd
+    // Submission queue
+    unsigned       *sq_head;
+    unsigned       *sq_tail;
+    unsigned       *sq_mask;
+    unsigned       *sq_entries;
+    unsigned       *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned        sqe_tail;      ///< Local tail, published to sq_tail before io_uring_enter()
+    unsigned        sqe_submitted;
+    // Completion queue
+    unsigned       *cq_head;
+    unsigned       *cq_tail;
+    unsigned       *cq_mask;
+    struct io_uring_cqe *cqes;
+    // Mapped memory
+    void           *sq_ptr;
+    size_t          sq_len;
+    void           *cq_ptr;
+    size_t          cq_len;
+    size_t          sqes_len;
+    // RX: one read in flight per slot, every slot owns a buffer from the memory pool
+    size_t          rx_depth;
+    Buffer         *rx_bufs;
+    Buffer         *rx_ready;      ///< Completed reads, waiting for the next rx_burst()
+    size_t          rx_ready_num;
+    bool            started;       ///< The reads are posted, on the first rx_wait()
+    /// Read by the slots the memory pool refused a buffer to, the frames are shed
+    uint8_t         discard[MEMPOOL_BYTES - DEVICE_HEADER_RESERVE];
+    // TX: frames copied into memory pool, written by the owner in batch
+    size_t          tx_inflight;
+    size_t          tx_limit;
+    BQelem         *tx_elems;
+    alignas(ATOMIC_ISOLATION)
+        BdQueue     tx_queue;      //ALARM: alignment required !
+    alignas(ATOMIC_ISOLATION)
+        atomic_bool sleeping;      ///< The owner is (going to be) blocked in io_uring_enter()
+} DeviceUring __attribute__((aligned(ATOMIC_ISOLATION)));
+
+#endif // __DEVICE_URING_H__
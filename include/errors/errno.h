@@ -45,6 +45,12 @@ typedef uintptr_t errval_t;
     X(NET_ERR_DEVICE_SEND,             "Can't send raw packet by network device") \
     X(NET_ERR_DEVICE_FAIL_POLL,        "Can't poll on the device !") \
     X(NET_ERR_DEVICE_GET_MAC,          "Can't get MAC address of my network device") \
+    X(NET_ERR_DEVICE_VNET_HDR,         "Bad or unsupported virtio-net header of the frame") \
+    X(NET_ERR_DEVICE_URING,            "Can't set up or submit to the io_uring of the network device") \
+    X(NET_ERR_PCAP_IO,                 "Can't open, read or write the pcap file") \
+    X(NET_ERR_PCAP_FORMAT,             "Malformed or unsupported pcap / pcapng file") \
+    X(NET_ERR_PCAP_EOF,                "No more frames in the pcap file") \
+    X(NET_ERR_PCAP_TOO_LARGE,          "The frame in the pcap file doesn't fit in the buffer") \
     X(NET_ERR_ETHER_NULL_MAC,          "Destination MAC address of received message is a NULL MAC") \
     X(NET_ERR_ETHER_WRONG_MAC,         "Destination MAC address of received message doesn't meet with our MAC") \
     X(NET_ERR_ETHER_NO_MAC,            "Can't get MAC address of my ethernet") \
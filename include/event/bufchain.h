@@ -0,0 +1,104 @@
+#ifndef __EVENT_BUFCHAIN_H__
+#define __EVENT_BUFCHAIN_H__
+
+#include <common.h>
+#include <event/buffer.h>
+
+/*
+ * One message scattered over several pieces (scatter-gather), every segment is a Buffer:
+ * the piece it lives in, the offset in it (from_hdr) and the length (valid_size).
+ * The fragments of an IP datagram are delivered as they arrived instead of being copied into one piece,
+ * and the headers of an outgoing frame can live in a piece of their own, in front of a shared payload.
+ */
+
+/// A 64 KiB datagram in fragments of a 1500 bytes MTU (45 of them), smaller fragments are copied into one piece
+#define BUFCHAIN_MAX_SEGS      48
+
+typedef struct buffer_chain {
+    uint32_t       len;       ///< Bytes in all the segments
+    uint16_t       count;
+    Buffer         segs[BUFCHAIN_MAX_SEGS];
+} BufChain;
+
+/// @brief  Position in a chain, only valid while the chain isn't modified
+typedef struct bufchain_iter {
+    const BufChain *chain;
+    size_t         seg;
+    uint32_t       offset;    ///< In the current segment
+} BufChainIter;
+
+__BEGIN_DECLS
+
+static inline void bufchain_init(BufChain* chain) {
+    assert(chain);
+    chain->len   = 0;
+    chain->count = 0;
+}
+
+/// @brief  The chain owns the segment from now on, false if it's full
+static inline bool bufchain_append(BufChain* chain, Buffer seg) {
+    assert(chain);
+    if (chain->count == BUFCHAIN_MAX_SEGS) return false;
+    assert(UINT16_MAX - chain->len >= seg.valid_size);
+    chain->segs[chain->count++] = seg;
+    chain->len += seg.valid_size;
+    return true;
+}
+
+/// @brief  Drop the first size bytes (a header that has been parsed), they must be in the first segment
+static inline void bufchain_pull(BufChain* chain, uint16_t size) {
+    assert(chain && chain->count > 0);
+    buffer_add_ptr(&chain->segs[0], size);
+    chain->len -= size;
+}
+
+/// @brief  Take size bytes in front of the first segment, for a header, from its headroom
+static inline void bufchain_push(BufChain* chain, uint16_t size) {
+    assert(chain && chain->count > 0);
+    buffer_sub_ptr(&chain->segs[0], size);
+    chain->len += size;
+}
+
+/// @brief  Every segment changes hands, for the accounting of a tracked pool
+static inline void bufchain_set_owner(const BufChain* chain, MemOwner owner) {
+    assert(chain);
+    for (size_t i = 0; i < chain->count; i++)
+        buffer_set_owner(chain->segs[i], owner);
+}
+
+/// @brief  Free every segment, the chain itself stays
+static inline void bufchain_release(BufChain* chain) {
+    assert(chain);
+    for (size_t i = 0; i < chain->count; i++)
+        free_buffer(chain->segs[i]);
+    chain->count = 0;
+    chain->len   = 0;
+}
+
+/// @brief  Free every segment and the chain, for a chain from malloc()
+static inline void bufchain_free(BufChain* chain) {
+    bufchain_release(chain);
+    free(chain);
+}
+
+/// @brief  Iterator at offset bytes of the chain
+BufChainIter bufchain_iter(const BufChain* chain, uint32_t offset);
+/// @brief  Next contiguous span, at most max bytes
+/// @return Its size, 0 at the end of the chain
+uint32_t bufchain_next(BufChainIter* iter, const uint8_t** ret_data, uint32_t max);
+/// @brief  Copy size bytes from offset of the chain to dst
+/// @return How many bytes are copied, less than size if the chain is shorter
+uint32_t bufchain_copy_out(const BufChain* chain, uint32_t offset, void* dst, uint32_t size);
+/// @brief  The whole chain in a single piece of the pool, with headroom bytes in front of it
+Buffer   bufchain_linearize(const BufChain* chain, MemPool* pool, uint16_t headroom);
+/// @brief  A private piece of hdr_size bytes (with headroom bytes in front of them), followed by a view of size bytes
+///         from offset of buf, so headers are prepended without writing to, or copying, a shared buffer
+/// @return The header bytes to fill
+void*    bufchain_with_header(BufChain* chain, Buffer buf, uint32_t offset, uint32_t size, uint16_t headroom, uint16_t hdr_size);
+/// @brief  Internet checksum sum of the bytes from offset to the end, not folded nor complemented,
+///         a segment of odd size doesn't shift the bytes after it
+uint32_t bufchain_sum(const BufChain* chain, uint32_t offset);
+
+__END_DECLS
+
+#endif // __EVENT_BUFCHAIN_H__
@@ -3,6 +3,15 @@
 
 #include <common.h>
 #include <event/memorypool.h>
+#include <string.h>
+
+/// Checksum offload state, set by the device on RX, by TCP/UDP on TX (only if the device supports it)
+#define BUFFER_CSUM_VALID      0x01  ///< RX: the kernel verified the checksum, or it never hit the wire
+#define BUFFER_CSUM_PARTIAL    0x02  ///< TX: L4 checksum field holds the pseudo header sum, kernel finishes it
+#define BUFFER_GSO_TCP         0x04  ///< TX: TCP segment larger than the MTU, kernel cuts it into MSS-sized ones
+
+/// The pieces aren't aligned (odd sizes), ipv6_addr_t wants 16
+#define BUFFER_DESC_ALIGN      16
 
 typedef struct buffer {
     uint8_t       *data;      // Not the real start
@@ -12,6 +21,7 @@ typedef struct buffer {
     uint32_t       whole_size; 
 
     bool           from_pool;
+    uint8_t        offload;   // BUFFER_CSUM_*, BUFFER_GSO_*
     MemPool       *mempool;
 } Buffer ;
 
@@ -19,7 +29,7 @@ typedef struct buffer {
     (struct buffer)        \
     {   NULL, 0,           \
         0, 0,              \
-        false, NULL        \
+        false, 0, NULL     \
     }
 
 
@@ -27,10 +37,11 @@ __BEGIN_DECLS
 
 static inline void dump_buffer(Buffer buf)
 {
-    printf("Buffer: data: %p, \tfrom_hdr: %d, \tvalid_size: %d, \twhole_size: %d, \n\tfrom_pool: %d, \tmempool: %p\n",
-        (void*)buf.data, buf.from_hdr, buf.valid_size, buf.whole_size, buf.from_pool, (void *)buf.mempool);
+    printf("Buffer: data: %p, \tfrom_hdr: %d, \tvalid_size: %d, \twhole_size: %d, \n\tfrom_pool: %d, \toffload: 0x%02x, \tmempool: %p\n",
+        (void*)buf.data, buf.from_hdr, buf.valid_size, buf.whole_size, buf.from_pool, buf.offload, (void *)buf.mempool);
 }
 
+/// @brief  Drop this view, the piece of a pool goes back when its last view is freed
 static inline void free_buffer(Buffer buf) {
     uint8_t* original_data = buf.data - (size_t)buf.from_hdr;
     if (buf.from_pool) {
@@ -44,8 +55,9 @@ static inline void free_buffer(Buffer buf) {
 
 static inline Buffer buffer_create(uint8_t *data, uint32_t from_hdr, uint32_t valid_size, uint32_t whole_size, bool from_pool, MemPool *mempool) {
     assert(data);
-    assert(from_hdr <= UINT16_MAX && valid_size <= UINT16_MAX && whole_size <= UINT16_MAX);
-    assert(from_hdr <= whole_size && valid_size <= whole_size); // Overflow check, although we use uint32_t, we check the uint16_t part
+    // The stack handles at most UINT16_MAX bytes, but the whole piece can be larger (a reassembled datagram with the reserved space)
+    assert(from_hdr <= UINT16_MAX && valid_size <= UINT16_MAX);
+    assert(from_hdr <= whole_size && valid_size <= whole_size); // Overflow check
     if (from_pool) assert(mempool); else assert(mempool == NULL);
     return (Buffer) {
         .data       = data,
@@ -53,6 +65,7 @@ static inline Buffer buffer_create(uint8_t *data, uint32_t from_hdr, uint32_t va
         .valid_size = valid_size,
         .whole_size = whole_size,
         .from_pool  = from_pool,
+        .offload    = 0,
         .mempool    = mempool,
     };
 }
@@ -98,6 +111,68 @@ static inline Buffer buffer_reclaim(Buffer buf, uint16_t from_hdr, uint16_t vali
     return buf;
 }
 
+/// @brief  Another view of the same bytes, freed on its own. Only the pieces of a pool are shared, the others are copied
+static inline Buffer buffer_clone(Buffer buf) {
+    uint8_t* original_data = buf.data - (size_t)buf.from_hdr;
+    if (buf.from_pool) {
+        pool_ref(buf.mempool, original_data);
+        return buf;
+    }
+    uint8_t* copy = malloc(buf.whole_size); assert(copy);
+    memcpy(copy + buf.from_hdr, buf.data, buf.valid_size);
+    buf.data = copy + buf.from_hdr;
+    return buf;
+}
+
+/// @brief  The layer now responsible for freeing the buffer, for the accounting of a tracked pool
+static inline void buffer_set_owner(Buffer buf, MemOwner owner) {
+    if (buf.from_pool && buf.mempool->track) pool_set_owner(buf.mempool, buf.data - (size_t)buf.from_hdr, owner);
+}
+
+/// @brief  Other views see the bytes, neither the data nor the headroom may be written
+static inline bool buffer_shared(Buffer buf) {
+    return buf.from_pool && pool_shared(buf.mempool, buf.data - (size_t)buf.from_hdr);
+}
+
+/// @brief  A private piece holding size bytes from offset of the data, with headroom bytes in front of them
+static inline Buffer buffer_copy(Buffer buf, uint32_t offset, uint32_t size, uint16_t headroom) {
+    assert(buf.from_pool && offset + size <= buf.valid_size);
+    Buffer copy;
+    errval_t err = pool_alloc(buf.mempool, (size_t)headroom + size, &copy);
+    assert(err_is_ok(err) && copy.data);
+    buffer_reclaim_ptr(&copy, headroom, size);
+    memcpy(copy.data, buf.data + offset, size);
+    copy.offload = buf.offload;
+    return copy;
+}
+
+/// @brief  Copy on write: a private piece with the same layout if others share this one, our view of the old one is dropped
+static inline void buffer_unshare(Buffer* buf) {
+    assert(buf);
+    if (!buffer_shared(*buf)) return;
+
+    Buffer copy;
+    errval_t err = pool_alloc(buf->mempool, buf->whole_size, &copy);
+    assert(err_is_ok(err) && copy.data);
+    assert(copy.whole_size >= buf->whole_size);
+    buffer_reclaim_ptr(&copy, buf->from_hdr, buf->valid_size);
+    memcpy(copy.data, buf->data, buf->valid_size);
+    copy.offload = buf->offload;
+
+    free_buffer(*buf);
+    *buf = copy;
+}
+
+/// @brief  Room for per-packet metadata at the start of the piece, so it doesn't need a malloc()
+/// @param  keep  Bytes in front of the data left for the headers written while the metadata is still in use
+/// @return NULL if the headroom is too small, or other views of the piece would put theirs at the same place
+static inline void* buffer_desc(Buffer buf, size_t size, size_t keep) {
+    if (buffer_shared(buf)) return NULL;
+    uintptr_t start = ROUND_UP((uintptr_t)(buf.data - buf.from_hdr), (uintptr_t)BUFFER_DESC_ALIGN);
+    if (start + size + keep > (uintptr_t)buf.data) return NULL;
+    return (void*)start;
+}
+
 
 __END_DECLS
 
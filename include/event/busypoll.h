@@ -0,0 +1,59 @@
+#ifndef __EVENT_BUSYPOLL_H__
+#define __EVENT_BUSYPOLL_H__
+
+#include <common.h>
+
+/*
+ * Spin on a non-blocking check for a while before parking the thread (poll(), a futex),
+ * so a frame or a task arriving shortly after the last one doesn't pay for a wakeup.
+ * Adaptive: only spin when the recent arrivals came faster than the budget.
+ */
+
+/// A gap between arrivals counts at most this many budgets in the average, so a busy period is detected quickly
+#define BUSYPOLL_GAP_CAP        4
+/// Weight of a new gap in the average is 1 / 2^BUSYPOLL_EWMA_SHIFT
+#define BUSYPOLL_EWMA_SHIFT     3
+
+typedef struct busy_poll_config {
+    uint64_t        budget_ns;     ///< Longest spin before parking, 0 disables busy-poll
+    bool            adaptive;      ///< Skip the spin when the arrivals are sparser than the budget
+} BusyPollConfig;
+
+/// @brief  Owned by one thread, the statistics are read by others for the report
+typedef struct busy_poll {
+    BusyPollConfig  config;
+    uint64_t        last_arrival;  ///< CLOCK_MONOTONIC, 0 before the first one
+    uint64_t        gap_avg;       ///< Average time between arrivals (EWMA)
+    // Statistics
+    uint64_t        spin_ns;
+    uint64_t        park_ns;
+    size_t          spins;
+    size_t          spin_hits;     ///< Found something before the budget ran out
+    size_t          spin_skips;    ///< Adaptive: parked without spinning
+    size_t          parks;
+} BusyPoll;
+
+static inline void busypoll_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+__BEGIN_DECLS
+
+void     busypoll_init(BusyPoll* busy, BusyPollConfig config);
+/// Call poll(arg) until it returns true or the budget runs out, return what it found
+bool     busypoll_spin(BusyPoll* busy, bool (*poll)(void*), void* arg);
+/// Around the blocking call: start returns the time to give back to end
+uint64_t busypoll_park_start(const BusyPoll* busy);
+void     busypoll_park_end(BusyPoll* busy, uint64_t start);
+/// Something arrived (spinning or not), feeds the adaptive policy
+void     busypoll_arrival(BusyPoll* busy);
+/// Add the statistics of busy into total
+void     busypoll_merge(BusyPoll* total, const BusyPoll* busy);
+
+__END_DECLS
+
+#endif // __EVENT_BUSYPOLL_H__
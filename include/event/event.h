@@ -5,6 +5,8 @@
 #include <stddef.h>
 #include <event/memorypool.h>
 #include <event/buffer.h>
+#include <event/bufchain.h>
+#include <event/threadpool.h>
 
 typedef struct ethernet_state Ethernet;
 typedef struct memory_pool MemPool;
@@ -15,6 +17,15 @@ typedef struct {
 
 } Ether_unmarshal ;
 
+/// A batch of frames drained from the device in one wakeup, processed by a single task
+typedef struct ether_batch {
+    Task      task;     ///< Submitted as is, borrowed
+    Buffer    self;     ///< The piece of the memory pool the batch lives in
+    Ethernet *ether;
+    size_t    count;
+    Buffer    bufs[];
+} Ether_batch ;
+
 #include <netstack/arp.h>
 
 typedef struct {
@@ -39,6 +50,7 @@ typedef struct {
     ip_addr_t src_ip;
     uint8_t   proto;
     Buffer    buf;
+    BufChain *chain;    ///< The fragments of the datagram, buf is unused if it's set
 } IP_handle ;
 
 #include <netstack/icmp.h>
@@ -63,8 +75,56 @@ typedef struct {
     Buffer      buf;
 } NDP_marshal;
 
+/// @brief  Metadata of a packet (mbuf style): the next handler and what it works on, at the start of the piece of its own buffer.
+///         It's only valid until the handler runs, the handler copies its argument before it writes to the buffer
+typedef struct packet_desc {
+    Task      task;
+    union {
+        IP_handle     ip_handle;
+        IP_segment    ip_segment;
+        ARP_marshal   arp_marshal;
+        ICMP_marshal  icmp_marshal;
+        NDP_marshal   ndp_marshal;
+    };
+} PktDesc;
+
+static_assert(sizeof(PktDesc) + BUFFER_DESC_ALIGN <= DEVICE_HEADER_RESERVE, "The descriptor doesn't fit in the reserved space");
+
 __BEGIN_DECLS
 
+/// @brief  The descriptor of the packet in buf, on the heap if its headroom is too small
+static inline PktDesc* pktdesc_get(Buffer buf)
+{
+    PktDesc* desc = buffer_desc(buf, sizeof(PktDesc), 0);
+    bool borrowed = (desc != NULL);
+    if (!borrowed) {
+        desc = malloc(sizeof(PktDesc)); assert(desc);
+    }
+    desc->task.borrowed = borrowed;
+    return desc;
+}
+
+/// @brief  Task of a descriptor on the heap: its argument lives in it until the run
+static inline void pktdesc_run_and_free(void* arg)
+{
+    PktDesc* desc = arg;
+    (*desc->task.process)(desc->task.arg);
+    free(desc);
+}
+
+/// @brief  Submit the descriptor as the task, nothing is allocated for it. If it fails, the buffer still belongs to the caller
+static inline errval_t submit_pktdesc(PktDesc* desc, Task task)
+{
+    assert(desc && task.arg);
+    task.borrowed = desc->task.borrowed;
+    desc->task = task;
+    if (task.borrowed) return submit_task_ptr(&desc->task);
+
+    errval_t err = submit_task(MK_TASK(task.queue, task.event, pktdesc_run_and_free, desc));
+    if (err_is_fail(err)) free(desc);
+    return err;
+}
+
 static inline void free_ether_unmarshal(Ether_unmarshal* unmarshal) 
 {
     assert(unmarshal);
@@ -72,21 +132,16 @@ static inline void free_ether_unmarshal(Ether_unmarshal* unmarshal)
     free(unmarshal);
 }
 
-static inline void free_icmp_marshal(ICMP_marshal* marshal)
-{
-    assert(marshal);
-    free_buffer(marshal->buf);
-    free(marshal);
-}
-
-static inline void free_arp_marshal(ARP_marshal* marshal)
+static inline void free_ether_batch(Ether_batch* batch) 
 {
-    assert(marshal);
-    free_buffer(marshal->buf);
-    free(marshal);
+    assert(batch);
+    for (size_t i = 0; i < batch->count; i++)
+        free_buffer(batch->bufs[i]);
+    free_buffer(batch->self);
 }
 
 void event_ether_unmarshal(void* unmarshal);
+void event_ether_batch(void* batch);
 void event_arp_marshal(void* marshal);
 void event_icmp_marshal(void* marshal);
 void event_ip_assemble(void* assemble);
@@ -2,29 +2,200 @@
 #define __MEMORY_POOL_H__
 
 #include <lock_free/bdqueue.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
-typedef struct memory_pool {
-    // Use Bounded MPMC Queue as backend
+/// Small, frame-sized and datagram-sized pieces
+#define MEMPOOL_CLASS_NUM    3
+/// Most pieces a thread keeps per class, must be power of 2
+#define MEMPOOL_MAGAZINE_MAX 128
+/// Threads with a magazine cache, the others always go to the shared queue
+#define MEMPOOL_MAX_CACHES   64
+/// NUMA nodes with a pool of their own
+#define MEMPOOL_MAX_NODES    8
+/// Hugepage backed pieces are mapped in multiples of it
+#define MEMPOOL_HUGEPAGE_SIZE   (2 * 1024 * 1024)
+/// Chunks a class can grow by, each has 1 / 2^MEMPOOL_GROW_SHIFT of its initial pieces
+#define MEMPOOL_MAX_GROW        16
+#define MEMPOOL_GROW_SHIFT      2
+
+/// @brief  Where the pieces of a pool live
+typedef struct memory_backing {
+    bool        hugepage;       ///< mmap(MAP_HUGETLB), or transparent huge pages if none is reserved
+    int         node;           ///< NUMA node the pieces are bound to, -1 for the policy of the process
+    bool        populate;       ///< Fault the pages in at initialization, always done for huge pages
+} MemBacking;
+
+#define MEMPOOL_BACKING_DEFAULT ((MemBacking) { .hugepage = false, .node = -1, .populate = false })
+
+/// @brief  What a class does when it runs low
+typedef enum memory_policy {
+    MEMPOOL_POLICY_MALLOC = 0,  ///< malloc() outside the pool once it's empty, for every allocation
+    MEMPOOL_POLICY_GROW,        ///< Map another chunk below the low watermark, up to grow_max, then the received frames are dropped
+    MEMPOOL_POLICY_DROP,        ///< The received frames are dropped under pressure, before they are read
+} MemPolicy;
+
+/// @brief  Overload policy of a pool, the watermarks and the reserve are in percent of the initial pieces of each class.
+///         Only the received frames (MEMPOOL_PRIO_RX) are ever refused, the other allocations malloc() as the last resort
+typedef struct memory_overload {
+    MemPolicy   policy;
+    unsigned    low;            ///< Fewer free pieces: the class is under pressure
+    unsigned    high;           ///< As many free pieces again: the pressure is over
+    unsigned    reserve;        ///< Never given to the received frames, left for ARP, NDP, ACK and the other control traffic
+    size_t      grow_max;       ///< Chunks a class may add with MEMPOOL_POLICY_GROW, up to MEMPOOL_MAX_GROW
+} MemOverload;
+
+#define MEMPOOL_OVERLOAD_DEFAULT ((MemOverload) { .policy = MEMPOOL_POLICY_DROP, .low = 10, .high = 25, .reserve = 5, .grow_max = 0 })
+
+/// @brief  Who asks for a piece
+typedef enum memory_priority {
+    MEMPOOL_PRIO_CONTROL = 0,   ///< Never refused, may take the reserve
+    MEMPOOL_PRIO_RX,            ///< A frame about to be received, shed first under overload
+} MemPrio;
+
+/// @brief  Layer holding a piece, only recorded once mempool_track() is on
+typedef enum memory_owner {
+    MEMPOOL_OWNER_FREE = 0,     ///< In the pool, or never handed out
+    MEMPOOL_OWNER_POOL,         ///< Allocated, not claimed by any layer yet
+    MEMPOOL_OWNER_DEVICE,
+    MEMPOOL_OWNER_ETHERNET,
+    MEMPOOL_OWNER_ARP,
+    MEMPOOL_OWNER_IPV4,
+    MEMPOOL_OWNER_ASSEMBLER,    ///< Waiting for the other fragments of its datagram
+    MEMPOOL_OWNER_ICMP,
+    MEMPOOL_OWNER_NDP,
+    MEMPOOL_OWNER_TCP,
+    MEMPOOL_OWNER_APP,          ///< Given to a server callback
+    MEMPOOL_OWNER_TX,           ///< Waiting to be sent
+    MEMPOOL_OWNER_NUM,
+} MemOwner;
+
+/// @brief  Pieces added to a class after its initialization
+typedef struct memory_chunk {
+    uint8_t    *start;
+    size_t      map_len;        ///< mmap()ed, 0 if malloc()ed
+} MemChunk;
+
+/// @brief  Half of a thread cache, moved between the thread and the depot in one operation
+typedef struct magazine {
+    size_t      rounds;
+    void       *pieces[];
+} Magazine;
+
+/// @brief  Pieces of one size, kept in a Bounded MPMC Queue, and in the magazines of the depot
+typedef struct memory_class {
     alignas(ATOMIC_ISOLATION)
         BdQueue queue;  //ALARM: alignment required !
     BQelem     *elems;
-    // Pointer to memory pool
+    // Pointer to the pieces, contiguous, so a freed address tells its class
     void       *pool;
+    size_t      map_len;        ///< mmap()ed, 0 if malloc()ed
+    bool        huge;           ///< Backed by reserved huge pages
+    atomic_uint *refs;          ///< References to each piece beyond the first, 0 when it has a single owner
+    size_t      capacity;       ///< Pieces it may have with every chunk it may grow by
+    // Accounting, NULL unless the pool is tracked
+    _Atomic(uint8_t)  *owner;   ///< MemOwner of each piece
+    _Atomic(uint64_t) *since;   ///< When it got its owner, CLOCK_MONOTONIC_COARSE ns
     // Metadata
     size_t      bytes;
-    size_t      amount;
+    size_t      amount;         ///< Initial pieces, in pool
+    atomic_size_t carved;       ///< Initial pieces handed out at least once, the queue only has the freed ones
+    atomic_size_t fallback;     ///< The class was empty, malloc() instead
+    // Overload, the free pieces are those in the queue and in the depot, not in the thread caches
+    alignas(ATOMIC_ISOLATION)
+        atomic_size_t avail;
+    atomic_bool pressure;       ///< Went below the low watermark, and not yet back to the high one
+    size_t      low;
+    size_t      high;
+    size_t      reserve;
+    atomic_size_t shed;         ///< Received frames refused
+    atomic_size_t pressures;    ///< Times it went under pressure
+    // Growth, the chunks are never given back before the pool is destroyed
+    size_t      chunk;          ///< Pieces per chunk
+    MemChunk    grown[MEMPOOL_MAX_GROW];
+    atomic_size_t grown_num;
+    pthread_mutex_t grow_lock;
+    // Depot (Bonwick): full and empty magazines of batch pieces, 0 if the threads don't cache this class
+    size_t      magazine;       ///< Pieces a thread keeps
+    size_t      batch;          ///< Pieces moved at once, half of the magazine
+    alignas(ATOMIC_ISOLATION)
+        BdQueue full;   //ALARM: alignment required !
+    alignas(ATOMIC_ISOLATION)
+        BdQueue empty;  //ALARM: alignment required !
+    BQelem     *full_elems;
+    BQelem     *empty_elems;
+    uint8_t    *mags;
+    size_t      mag_num;
+} MemClass __attribute__((aligned(ATOMIC_ISOLATION)));
+
+typedef struct memory_class_config {
+    size_t      bytes;
+    size_t      amount;         ///< Must be power of 2
+    size_t      magazine;       ///< Pieces cached per thread, power of 2 up to MEMPOOL_MAGAZINE_MAX, 0 disables the cache
+} MemClassConfig;
+
+/// @brief  Pieces of one class owned by one thread, only touched by it
+typedef struct magazine_cache {
+    size_t      count;
+    void       *pieces[MEMPOOL_MAGAZINE_MAX];
+    // Statistics, read by others for the report
+    size_t      hits;           ///< Served without touching the shared queues
+    size_t      misses;         ///< Refilled from the depot or the queue
+    size_t      flushes;        ///< Given back to the depot or the queue
+    size_t      class_id;
+    char        owner[32];
+} MagCache;
+
+typedef struct memory_pool {
+    // Sorted by size, an allocation takes the smallest class that fits
+    MemClass    classes[MEMPOOL_CLASS_NUM];
+    size_t      class_num;
+    atomic_size_t oversize;     ///< Larger than the largest class, malloc() instead
+    MemBacking  backing;
+    MemOverload overload;
+    // Registered thread caches
+    _Atomic(MagCache*) caches[MEMPOOL_MAX_CACHES];
+    atomic_size_t cache_num;
+    size_t      id;             ///< Tells the threads their caches belong to a destroyed pool
+    // Accounting of the pieces handed out, per layer holding them
+    bool        track;
+    atomic_size_t held[MEMPOOL_OWNER_NUM];
 } MemPool __attribute__((aligned(ATOMIC_ISOLATION)));
 
 typedef struct buffer Buffer;
 
 __BEGIN_DECLS
 
-errval_t mempool_init(MemPool* pool, size_t bytes, size_t amount);
+errval_t mempool_init(MemPool* pool, const MemClassConfig* classes, size_t class_num, MemBacking backing, MemOverload overload);
 void     mempool_destroy(MemPool* pool);
+/// Pick the smallest class that holds need_size bytes, the Buffer spans the whole piece, never refused
 errval_t pool_alloc(MemPool* pool, size_t need_size, Buffer *ret_buf);
+/// Same as pool_alloc(), EVENT_MEMPOOL_EMPTY and a NULL_BUFFER if the overload policy refuses it
+errval_t pool_alloc_prio(MemPool* pool, size_t need_size, MemPrio prio, Buffer *ret_buf);
+/// Drop a reference to the piece, it goes back to its class with the last one
 void pool_free(MemPool* pool, void* addr);
+/// One more owner of the piece
+void pool_ref(MemPool* pool, void* addr);
+/// The piece has more than one owner, it must not be written
+bool pool_shared(MemPool* pool, void* addr);
 void pool_destroy(MemPool* pool);
 
+/// Record the owner and the age of every piece from now on, before the first allocation
+errval_t mempool_track(MemPool* pool);
+/// The piece at addr changes hands, nothing if the pool isn't tracked
+void   pool_set_owner(MemPool* pool, void* addr, MemOwner owner);
+/// Pieces the layer holds now, 0 if the pool isn't tracked
+size_t mempool_held(MemPool* pool, MemOwner owner);
+/// Log what each layer holds, and the pieces held for longer than older_than_ns
+void   mempool_report_held(MemPool* pool, uint64_t older_than_ns);
+/// Name of the layer, for the reports
+const char* mempool_owner_name(MemOwner owner);
+
+/// Online NUMA nodes, 1 if the machine doesn't tell
+size_t mempool_node_num(void);
+/// NUMA node of the CPU the calling thread runs on
+int    mempool_current_node(void);
+
 __END_DECLS
 
 #include <netstack/ethernet.h>
@@ -34,6 +205,20 @@ __END_DECLS
 #define  MEMPOOL_BYTES       ETHER_MAX_SIZE + DEVICE_HEADER_RESERVE
 // Give 2048 peices in Memory pool
 #define  MEMPOOL_AMOUNT      8192
+/// ARP, NDP, pure TCP ACK, small ICMP, with the reserved space
+#define  MEMPOOL_SMALL_BYTES    512
+#define  MEMPOOL_SMALL_AMOUNT   4096
+/// Reassembled IP datagram, 64 KiB with the reserved space
+#define  MEMPOOL_LARGE_BYTES    (64 * 1024 + DEVICE_HEADER_RESERVE)
+#define  MEMPOOL_LARGE_AMOUNT   64
+/// Pieces cached per thread, the large class is too small to be spread over the threads
+#define  MEMPOOL_MAGAZINE       64
 
+#define  MEMPOOL_DEFAULT_CLASSES                                            \
+    {                                                                       \
+        { MEMPOOL_SMALL_BYTES, MEMPOOL_SMALL_AMOUNT, MEMPOOL_MAGAZINE },    \
+        { MEMPOOL_BYTES,       MEMPOOL_AMOUNT,       MEMPOOL_MAGAZINE },    \
+        { MEMPOOL_LARGE_BYTES, MEMPOOL_LARGE_AMOUNT, 0                },    \
+    }
 
-#endif // __MEMORY_POOL_H__
\ No newline at end of file
+#endif // __MEMORY_POOL_H__
@@ -0,0 +1,103 @@
+#ifndef __EVENT_SLAB_H__
+#define __EVENT_SLAB_H__
+
+#include <common.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/*
+ * Object caches for the small structures the stack allocates and frees on every packet (Task, IP_recv, Mseg ...),
+ * one Slab per type. Each thread keeps a magazine of free objects and only takes the lock of the depot to move
+ * half of it at once (Bonwick), the objects are carved from large chunks and never given back to malloc().
+ */
+
+/// Objects a thread keeps per slab, must be even
+#define SLAB_MAGAZINE       64
+/// Objects moved between a thread and the depot at once
+#define SLAB_BATCH          (SLAB_MAGAZINE / 2)
+/// Threads with a magazine, the others share one under the lock
+#define SLAB_MAX_CACHES     64
+/// Slabs the threads can cache, the next ones only have the shared magazine
+#define SLAB_MAX_TYPES      32
+/// Objects are carved from chunks of this size, or of a batch of objects if larger
+#define SLAB_CHUNK_BYTES    (64 * 1024)
+/// Id of a destroyed slab, the thread caches that pointed to it are gone
+#define SLAB_DESTROYED      SIZE_MAX
+
+/// @brief  Free objects of a slab owned by one thread
+typedef struct slab_cache {
+    size_t      count;
+    void       *objs[SLAB_MAGAZINE];
+    // Statistics, read by others for the report
+    size_t      allocs;
+    size_t      frees;
+    size_t      refills;        ///< Took a batch from the depot
+    size_t      flushes;        ///< Gave a batch to the depot
+    char        owner[32];
+} SlabCache;
+
+/// @brief  A batch of free objects in the depot
+typedef struct slab_magazine {
+    struct slab_magazine *next;
+    void       *objs[SLAB_BATCH];
+} SlabMag;
+
+typedef struct slab {
+    const char *name;
+    size_t      size;
+    size_t      align;
+    atomic_size_t id;           ///< Index of the thread caches, 0 until the first allocation, SLAB_DESTROYED after
+    // Depot, under the lock
+    pthread_mutex_t lock;
+    SlabMag    *full;
+    SlabMag    *empty;
+    uint8_t    *carve;          ///< Never allocated objects of the last chunk
+    size_t      carve_left;
+    void       *chunks;         ///< Linked through their first bytes
+    size_t      chunk_num;
+    size_t      obj_num;
+    SlabCache   shared;         ///< For the threads without a cache of their own
+    // Registered thread caches
+    _Atomic(SlabCache*) caches[SLAB_MAX_CACHES];
+    atomic_size_t cache_num;
+} Slab;
+
+/// @brief  A slab of objects of the type, usable from any thread without initialization
+#define SLAB_INITIALIZER(type)                  SLAB_INITIALIZER_ALIGNED(type, alignof(type))
+#define SLAB_INITIALIZER_ALIGNED(type, alignment)                               \
+    {                                                                           \
+        .name  = #type,                                                         \
+        .size  = sizeof(type),                                                  \
+        .align = (alignment),                                                   \
+        .lock  = PTHREAD_MUTEX_INITIALIZER,                                     \
+    }
+
+/// @brief  Typed allocation, checks the slab holds objects of this type
+#define SLAB_NEW(slab, type)    ((type*)slab_alloc_sized((slab), sizeof(type)))
+
+__BEGIN_DECLS
+
+/// Never fails, the content is undefined
+void* slab_alloc(Slab* slab);
+/// Same as slab_alloc(), zeroed
+void* slab_zalloc(Slab* slab);
+/// Any thread can free an object allocated by another one
+void  slab_free(Slab* slab, void* obj);
+/// Objects allocated and not freed yet, from the statistics of every thread
+size_t slab_in_use(Slab* slab);
+/// Log the statistics of the slab and its thread caches
+void  slab_report(Slab* slab);
+/// Log the statistics of every slab that has been used
+void  slab_report_all(void);
+/// Free the chunks and the thread caches, every object must have been freed. The slab can never be used again,
+/// not even by the threads that had a cache of it
+void  slab_destroy(Slab* slab);
+
+static inline void* slab_alloc_sized(Slab* slab, size_t size) {
+    assert(slab && size <= slab->size);
+    return slab_alloc(slab);
+}
+
+__END_DECLS
+
+#endif // __EVENT_SLAB_H__
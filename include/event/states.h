@@ -19,7 +19,9 @@
 typedef struct global_states {
     NetWork        *network;
     NetDevice      *device;
-    MemPool        *mempool;
+    MemPool        *mempool;        ///< Of node 0 if there is one per NUMA node
+    MemPool        *node_pools[MEMPOOL_MAX_NODES];
+    size_t          node_num;       ///< 0 if there is only one pool
     ThreadPool     *threadpool;
 
     /// @brief For TCP 
@@ -61,6 +63,7 @@ typedef struct local_states {
     pid_t        my_pid;
     FILE        *log_file;
     void        *my_state;  // User-defined state
+    MemPool     *mempool;   // Of the NUMA node of this thread, NULL for g_states.mempool
 } LocalState;
 
 // Function prototypes
@@ -68,4 +71,13 @@ void create_thread_state_key();
 void set_local_state(LocalState* new_state);
 LocalState* get_local_state();
 
+/// The memory pool of the NUMA node the calling thread runs on, NULL if there is only one pool
+MemPool* node_mempool(void);
+
+/// The pool the calling thread allocates from
+static inline MemPool* local_mempool(void) {
+    LocalState* local = get_local_state();
+    return (local && local->mempool) ? local->mempool : g_states.mempool;
+}
+
 #endif // __EVENT_STATES_H__
\ No newline at end of file
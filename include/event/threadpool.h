@@ -1,41 +1,91 @@
 #ifndef __EVENT_THREADPOOL_H__
 #define __EVENT_THREADPOOL_H__
 
+/// Overflow of the worker queues, shared by all of them
 #define TASK_QUEUE_SIZE     512
+/// Tasks a worker submits to itself, must be power of 2
+#define WORKER_DEQUE_SIZE   1024
+/// Tasks submitted to a worker by the other threads (RX, timers), must be power of 2
+#define WORKER_INBOX_SIZE   256
+/// Tasks that only this worker may run, in order (the frames steered to it), must be power of 2
+#define WORKER_PINNED_SIZE  256
+/// Most tasks a worker takes from a queue at once and runs back to back
+#define TASK_BATCH          8
 
 #include <common.h>
 #include <pthread.h>
-#include <semaphore.h>
-#include <lock_free/bdqueue.h>
+#include <lock_free/deque.h>
+#include <lock_free/ring.h>
+#include <lock_free/eventcount.h>
+#include <event/busypoll.h>
+#include <event/slab.h>
 
-typedef struct {
-    BdQueue     queue;  //ALRAM: Alignment required !
-    BQelem      elements[TASK_QUEUE_SIZE];
-    sem_t       sem;
+typedef struct thread_pool ThreadPool;
+
+/// What a worker thread owns, the other workers steal from its deque and its inbox when they run out of tasks
+typedef struct worker {
+    WsDeque     deque;  ///< Submitted by the worker itself, run newest first
+    MpmcRing    inbox;
+    MpmcRing    pinned;
+    EventCount  event;  ///< Sleeps on it while parked
+    alignas(ATOMIC_ISOLATION)
+        atomic_bool parked;
+    ThreadPool *pool;
+    size_t      id;
+    BusyPoll    busy;   ///< Spin on the queues before parking
+    // Statistics, read by others for the report
+    size_t      runs;
+    size_t      steals;         ///< Tasks taken from the other workers
+    size_t      depth_max;      ///< Most tasks seen in its deque
+} Worker __attribute__((aligned(ATOMIC_ISOLATION)));
+
+typedef struct thread_pool {
+    MpmcRing    queue;
     pthread_t  *threads;
+    Worker     *slaves;
     size_t      workers;
+    alignas(ATOMIC_ISOLATION)
+        atomic_size_t next;     ///< Round-robin over the inboxes for the tasks from outside the pool
+    alignas(ATOMIC_ISOLATION)
+        atomic_size_t idle;     ///< Parked workers, the others are woken up only if it's not 0
+    atomic_bool stop;           ///< The workers return once they see it, thread_pool_destroy() joins them
 } ThreadPool __attribute__((aligned(ATOMIC_ISOLATION))) ;
 
 extern ThreadPool g_threadpool;
+/// Copies of the tasks a worker submits to its own deque, freed once taken out of it
+extern Slab g_task_slab;
 
 typedef struct {
-    BdQueue *queue;     // Which queue to submit
-    sem_t   *sem;       // Which semaphore to notify
-    void   (*process)(void *);
-    void    *arg;
+    MpmcRing   *queue;      // Which queue to submit, &g_threadpool.queue for the workers
+    EventCount *event;      // Which consumer to notify, unused for the workers
+    void      (*process)(void *);
+    void       *arg;
+    bool        borrowed;   // Lives in the memory of its argument (headroom of a buffer), not a g_task_slab copy
 } Task;
 
-#define MK_NORM_TASK(proc, arg)       (Task){ &g_threadpool.queue, &g_threadpool.sem, (proc), (arg)}
-#define MK_TASK(que, sem, proc, arg)  (Task){ (que), (sem),  (proc), (arg) }
+static_assert(sizeof(Task) + sizeof(size_t) <= RING_CELL_SIZE, "A Task takes more than one cell of the rings");
+
+#define MK_NORM_TASK(proc, arg)         (Task){ &g_threadpool.queue, NULL, (proc), (arg), false }
+#define MK_TASK(que, event, proc, arg)  (Task){ (que), (event), (proc), (arg), false }
 
 __BEGIN_DECLS
 
-errval_t thread_pool_init(size_t workers);
+errval_t thread_pool_init(size_t workers, BusyPollConfig busy_poll);
 void thread_pool_destroy(void);
+/// Log the depth of the queues of every worker, and how many tasks it ran and stole
+void thread_pool_report(void);
 
 // Function declarations
-void* thread_function(void* arg) __attribute__((noreturn));
+void* thread_function(void* arg);
 errval_t submit_task(Task task);
+/// Same as submit_task(), a worker queues the pointer itself in its deque. Unless borrowed, it is a g_task_slab object
+/// given to the pool, freed once copied into a ring or out of the deque
+errval_t submit_task_ptr(Task* task);
+/// Same as submit_task_ptr() for a task of the workers, only run by the given one, after the ones pinned to it before
+errval_t submit_task_to(Task* task, size_t worker);
+/// @brief  Submit copies of tasks of the same queue at once, waking up only as many sleeping threads as they need
+/// @return How many were submitted, the queues were full for the others
+size_t submit_task_batch(const Task* tasks, size_t count);
 
 __END_DECLS
 
@@ -18,12 +18,13 @@ typedef uint64_t delayed_us;
 
 typedef void (*task_fail) (void* delayed_task);
 
-#define MK_DELAY_TASK(delay, fail, task)  (DelayedTask) { (delay), (fail), (task) }
+#define MK_DELAY_TASK(delay, fail, task)  (DelayedTask) { (delay), (fail), (task), false }
 
 typedef struct delayed_task {
     delayed_us delay;
     task_fail  fail;
     Task       task;
+    bool       periodic;    ///< Kept by the timer for every expiration, set by submit_periodic_task()
 } DelayedTask;
 
 typedef struct timer_state {
@@ -19,6 +19,12 @@ errval_t bdqueue_init(BdQueue* queue, BQelem *element_array, size_t number_elems
 void bdqueue_destroy(BdQueue* queue, bool element_on_heap);
 errval_t enbdqueue(BdQueue* queue, void* key, void* data);
 errval_t debdqueue(BdQueue* queue, void** ret_key, void**ret_data);
+/// Enqueue up to count elements in order, return how many fit
+size_t enbdqueue_batch(BdQueue* queue, void* const* data, size_t count);
+/// Dequeue up to max elements in order, return how many
+size_t debdqueue_batch(BdQueue* queue, void** ret_data, size_t max);
+/// Elements in the queue, may be inaccurate while others use it
+size_t bdqueue_size(BdQueue* queue);
 
 __END_DECLS
 
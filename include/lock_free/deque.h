@@ -0,0 +1,38 @@
+#ifndef __LOCK_FREE_DEQUE_H__
+#define __LOCK_FREE_DEQUE_H__
+
+#include <common.h>      // BEGIN, END DECLS
+#include "defs.h"
+#include <stdatomic.h>
+
+/*
+ * Bounded work-stealing deque (Chase-Lev, with the C11 orderings of Le et al.): the owner thread pushes and pops
+ * at the bottom without any locked instruction but the last element, the other threads steal the oldest one at the top.
+ */
+
+typedef struct {
+    alignas(ATOMIC_ISOLATION)
+        _Atomic(int64_t) top;       ///< Stolen from, by any thread
+    alignas(ATOMIC_ISOLATION)
+        _Atomic(int64_t) bottom;    ///< Pushed to and popped from, only by the owner
+    _Atomic(void*)  *slots;
+    size_t           mask;
+} WsDeque __attribute__((aligned(ATOMIC_ISOLATION)));
+
+__BEGIN_DECLS
+
+/// The capacity must be power of 2
+errval_t wsdeque_init(WsDeque* deque, size_t capacity);
+void     wsdeque_destroy(WsDeque* deque);
+/// Owner only, EVENT_ENQUEUE_FULL if there is no room
+errval_t wsdeque_push(WsDeque* deque, void* data);
+/// Owner only, the last pushed, EVENT_DEQUEUE_EMPTY if there is none
+errval_t wsdeque_pop(WsDeque* deque, void** ret_data);
+/// Any thread, the first pushed, EVENT_DEQUEUE_EMPTY if there is none or another thread took it first
+errval_t wsdeque_steal(WsDeque* deque, void** ret_data);
+/// Elements in the deque, may be stale
+size_t   wsdeque_size(WsDeque* deque);
+
+__END_DECLS
+
+#endif // __LOCK_FREE_DEQUE_H__
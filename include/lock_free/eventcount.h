@@ -0,0 +1,41 @@
+#ifndef __LOCK_FREE_EVENTCOUNT_H__
+#define __LOCK_FREE_EVENTCOUNT_H__
+
+#include <common.h>      // BEGIN, END DECLS
+#include "defs.h"
+#include <stdatomic.h>
+
+/*
+ * Eventcount on a futex: a consumer that found its queue empty announces itself with eventcount_prepare(), looks at
+ * the queue once more and only then sleeps on the key it got. A producer notifies after enqueuing, and only enters
+ * the kernel when someone announced itself, so nothing is lost between the last look and the sleep.
+ */
+
+/// Looks at the queue before announcing itself in eventcount_await()
+#define EVENTCOUNT_SPIN     256
+
+typedef struct event_count {
+    _Atomic(uint32_t)   epoch;      ///< Futex word, bumped by a notify that sees a waiter
+    _Atomic(uint32_t)   waiters;    ///< Between prepare and the end of wait or cancel
+} EventCount;
+
+__BEGIN_DECLS
+
+void     eventcount_init(EventCount* event);
+/// Announce the caller is about to sleep, it looks at its queue again before eventcount_wait() with the key
+uint32_t eventcount_prepare(EventCount* event);
+/// Found something after all
+void     eventcount_cancel(EventCount* event);
+/// Sleep until a notify after the prepare that gave the key. A cancellation point: pthread_cancel() the thread,
+/// then eventcount_notify_all() to wake it up
+void     eventcount_wait(EventCount* event, uint32_t key);
+/// Wake up one waiter, after the item is enqueued. Return false without a syscall when nobody waits
+bool     eventcount_notify(EventCount* event);
+/// Wake up every waiter
+void     eventcount_notify_all(EventCount* event);
+/// Spin on poll(arg), then sleep between the looks, until it returns true
+void     eventcount_await(EventCount* event, bool (*poll)(void*), void* arg);
+
+__END_DECLS
+
+#endif // __LOCK_FREE_EVENTCOUNT_H__
@@ -0,0 +1,46 @@
+#ifndef __LOCK_FREE_RING_H__
+#define __LOCK_FREE_RING_H__
+
+#include <common.h>      // BEGIN, END DECLS
+#include "defs.h"
+#include <stdatomic.h>
+
+/*
+ * Bounded MPMC ring (Vyukov) of fixed-size values stored inline: each cell holds a sequence number and the value,
+ * rounded up to whole cache lines, so a producer and a consumer only share the cell they hand over.
+ * A push or a pop is a CAS on its position and a copy, no pointer to chase and nothing to allocate per element.
+ */
+
+/// Cells are a multiple of this, a Task takes one
+#define RING_CELL_SIZE      64
+
+typedef struct {
+    alignas(ATOMIC_ISOLATION)
+        atomic_size_t enqueue_pos;
+    alignas(ATOMIC_ISOLATION)
+        atomic_size_t dequeue_pos;
+    uint8_t         *cells;
+    size_t           cell_size;
+    size_t           elem_size;
+    size_t           mask;
+} MpmcRing __attribute__((aligned(ATOMIC_ISOLATION)));
+
+__BEGIN_DECLS
+
+/// The capacity must be power of 2
+errval_t mpmcring_init(MpmcRing* ring, size_t capacity, size_t elem_size);
+void     mpmcring_destroy(MpmcRing* ring);
+/// Copy the value in, EVENT_ENQUEUE_FULL if there is no room
+errval_t mpmcring_push(MpmcRing* ring, const void* elem);
+/// Copy the oldest value out, EVENT_DEQUEUE_EMPTY if there is none
+errval_t mpmcring_pop(MpmcRing* ring, void* ret_elem);
+/// Push up to count values in order, return how many fit
+size_t   mpmcring_push_batch(MpmcRing* ring, const void* elems, size_t count);
+/// Pop up to max values in order, return how many
+size_t   mpmcring_pop_batch(MpmcRing* ring, void* ret_elems, size_t max);
+/// Values in the ring, may be stale
+size_t   mpmcring_size(MpmcRing* ring);
+
+__END_DECLS
+
+#endif // __LOCK_FREE_RING_H__
@@ -12,6 +12,7 @@ __BEGIN_DECLS
 #define ETHER_MAX_SIZE       1536
 
 typedef struct net_device NetDevice;
+typedef struct buffer_chain BufChain;
 
 typedef struct ethernet_state {
     struct net_work   *net;
@@ -34,6 +35,11 @@ errval_t ethernet_marshal(
     Ethernet* ether, mac_addr dst_mac, uint16_t type, Buffer buf
 );
 
+/// The header goes in front of the first segment, the device gathers the others after it
+errval_t ethernet_marshal_chain(
+    Ethernet* ether, mac_addr dst_mac, uint16_t type, BufChain* chain
+);
+
 errval_t ethernet_unmarshal(
     Ethernet* ether, Buffer buf
 );
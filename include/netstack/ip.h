@@ -3,6 +3,7 @@
 #include <stdatomic.h>      // seg_count
 
 #include <event/buffer.h>  // Buffer
+#include <event/bufchain.h> // BufChain
 #include <netutil/ip.h>
 #include "ethernet.h"
 #include "arp.h"
@@ -11,7 +12,8 @@
 #include "icmp.h"
 #include "udp.h"
 #include "tcp.h"
-#include <semaphore.h>  
+#include <lock_free/eventcount.h>
+#include <lock_free/ring.h>
 #include "khash.h"      // Hash table for IP segmentation
 #include "kavl-lite.h"  // AVL tree for segmentation
 #include <pthread.h>    // pthread_t, spinlock_t
@@ -62,8 +64,8 @@ KHASH_MAP_INIT_INT64(ip_msg, IP_recv*)
 
 typedef struct ip_assembler {
     alignas(ATOMIC_ISOLATION)
-        BdQueue       event_que;
-    sem_t             event_come;
+        MpmcRing      event_que;
+    EventCount        event_come;
     size_t            queue_size;
     pthread_t         self;
     
@@ -75,8 +77,8 @@ typedef struct ip_assembler {
 /***************************************************
 *         IP Message (Contains Segments)
 * All the segments are stored in a AVL tree, sorted, 
-* after all the segments are received, we can create 
-* a single IP_segment to hold all the data and pass it
+* after all the segments are received, they are chained
+* in order and passed without copying the data
 ****************************************************/
 #define SIZE_DONT_KNOW  0xFFFFFFFF
 
@@ -98,6 +100,7 @@ typedef struct ip_recv {
     uint32_t         whole_size;  ///< Size of the whole message
     uint32_t         recvd_size;  ///< How many bytes have we received (no duplicate)
     Mseg            *seg;         ///< AVL tree of segments
+    uint16_t         seg_num;     ///< Segments in the tree, more than a chain holds are copied into one piece
 
     timer_t          timer;
     int              times_to_live;
@@ -182,6 +185,10 @@ errval_t ipv4_handle(
     IP* ip, uint8_t proto, ip_addr_t src_ip, Buffer buf
 );
 
+errval_t ipv4_handle_chain(
+    IP* ip, uint8_t proto, ip_addr_t src_ip, BufChain* chain
+);
+
 __END_DECLS
 
 #endif  //__VNET_IP_H__
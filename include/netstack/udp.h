@@ -2,6 +2,7 @@
 #define __VNET_UDP_H__
 
 #include <event/buffer.h>
+#include <event/bufchain.h>
 #include <netutil/udp.h>
 #include <lock_free/hash_table.h>
 #include <ipc/rpc.h>
@@ -20,6 +21,13 @@ typedef void (*udp_server_callback) (
     const ip_context_t src_ip, const udp_port_t src_port
 );
 
+/// A datagram delivered in fragments, the server gathers the payload itself instead of having it copied into one piece
+typedef void (*udp_server_chain_callback) (
+    struct udp_server* server,
+    const BufChain* chain,
+    const ip_context_t src_ip, const udp_port_t src_port
+);
+
 typedef struct udp_state {
     alignas(ATOMIC_ISOLATION) 
         HashTable    servers;
@@ -46,6 +54,10 @@ errval_t udp_unmarshal(
     UDP* udp, const ip_context_t src_ip, Buffer buf
 );
 
+errval_t udp_unmarshal_chain(
+    UDP* udp, const ip_context_t src_ip, BufChain* chain
+);
+
 __END_DECLS
 
 #endif  //__VNET_UDP_H__
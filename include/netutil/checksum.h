@@ -2,12 +2,24 @@
 #define _CHECKSUM_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 
 /**
  * Calculate the internet checksum according to RFC1071
  */
 uint16_t inet_checksum_in_net_order(void *dataptr, uint16_t len);
 
+/**
+ * Sum of a part of the message, neither folded nor complemented, to be accumulated over scattered parts.
+ * odd: the part starts at an odd offset of the message, its first byte is the low one of a word
+ */
+uint32_t inet_partial_sum_in_net_order(const void *dataptr, uint16_t len, bool odd);
+
+/**
+ * Fold and complement the accumulated sum, it's the checksum
+ */
+uint16_t inet_fold_checksum_in_net_order(uint32_t sum);
+
 #include <netutil/ip.h>
 
 struct pseudo_ip_header_in_net_order {
@@ -43,6 +55,12 @@ uint16_t udp_checksum_in_net_order(const void *data_no_iph, struct pseudo_ip_hea
  */
 uint16_t tcp_checksum_in_net_order(const void *data_no_iph, struct pseudo_ip_header_in_net_order pheader);
 
+/**
+ * Sum of the pseudo header only, folded but NOT complemented, it's what the checksum field must hold
+ * when the device (kernel) is asked to finish the TCP/UDP checksum (VIRTIO_NET_HDR_F_NEEDS_CSUM)
+ */
+uint16_t pseudo_checksum_in_net_order(struct pseudo_ip_header_in_net_order pheader);
+
 #include <netutil/htons.h>
 
 #define PSEUDO_HEADER_IPv4(ipv4_src, ipv4_dst, proto, len) \
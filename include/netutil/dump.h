@@ -47,6 +47,11 @@ int format_ipv4_header(const struct ip_hdr *ip_header, char *buffer, size_t max_
 int format_ipv6_header(const struct ipv6_hdr *ipv6_header, char *buffer, size_t max_len);
 int format_packet_info(const void *packet_start, char *buffer, size_t max_len);
 
+/// IPv4 or IPv6 address in text to host order, return false if it's neither
+bool parse_ip_addr(const char *str, ip_context_t *ret_ip);
+/// xx:xx:xx:xx:xx:xx, return false if it isn't one
+bool parse_mac_addr(const char *str, mac_addr *ret_mac);
+
 static inline void dump_packet_info(const void* packet_start) {
     char buffer[1024];
     format_packet_info(packet_start, buffer, sizeof(buffer));
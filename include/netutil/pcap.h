@@ -0,0 +1,133 @@
+#ifndef _PCAP_H_
+#define _PCAP_H_
+
+#include <common.h>
+#include <stdio.h>
+
+/*
+ * Classic pcap: https://www.ietf.org/archive/id/draft-gharris-opsawg-pcap-01.html
+ * pcapng:       https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng-01.html
+ * Only the parts needed to replay (or record) Ethernet frames, no libpcap
+ */
+
+/// Classic pcap, as written by the host, a swapped magic means the other byte order
+#define PCAP_MAGIC_USEC         0xA1B2C3D4
+#define PCAP_MAGIC_NSEC         0xA1B23C4D
+#define PCAP_VERSION_MAJOR      2
+#define PCAP_VERSION_MINOR      4
+
+#define PCAP_LINKTYPE_ETHERNET  1
+
+struct pcap_file_hdr {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t  thiszone;      ///< Always 0
+    uint32_t sigfigs;       ///< Always 0
+    uint32_t snaplen;
+    uint32_t link_type;
+} __attribute__((packed));
+static_assert(sizeof(struct pcap_file_hdr) == 24, "The size of pcap file header should be 24");
+
+struct pcap_record_hdr {
+    uint32_t ts_sec;
+    uint32_t ts_frac;       ///< Micro or nano seconds, depends on the magic
+    uint32_t caplen;        ///< Bytes in the file
+    uint32_t len;           ///< Bytes on the wire
+} __attribute__((packed));
+static_assert(sizeof(struct pcap_record_hdr) == 16, "The size of pcap record header should be 16");
+
+/// pcapng: a file is a sequence of blocks, each one ends with its length again, padded to 32 bits
+#define PCAPNG_BLOCK_SHB        0x0A0D0D0A  ///< Section Header Block, same in both byte orders
+#define PCAPNG_BLOCK_IDB        0x00000001  ///< Interface Description Block
+#define PCAPNG_BLOCK_SPB        0x00000003  ///< Simple Packet Block, no timestamp, always interface 0
+#define PCAPNG_BLOCK_EPB        0x00000006  ///< Enhanced Packet Block
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+
+#define PCAPNG_OPT_END          0
+#define PCAPNG_OPT_IF_TSRESOL   9
+#define PCAPNG_OPT_EPB_FLAGS    2
+/// Direction in epb_flags
+#define PCAPNG_EPB_INBOUND      0x01
+#define PCAPNG_EPB_OUTBOUND     0x02
+
+/// Interfaces we remember per section, the frames of the others are skipped
+#define PCAPNG_MAX_INTERFACES   16
+
+struct pcapng_block_hdr {
+    uint32_t type;
+    uint32_t total_len;
+} __attribute__((packed));
+
+struct pcapng_shb {
+    uint32_t byte_order_magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int64_t  section_len;   ///< -1 if unknown
+} __attribute__((packed));
+
+struct pcapng_idb {
+    uint16_t link_type;
+    uint16_t reserved;
+    uint32_t snaplen;
+} __attribute__((packed));
+
+struct pcapng_epb {
+    uint32_t if_id;
+    uint32_t ts_high;
+    uint32_t ts_low;
+    uint32_t caplen;
+    uint32_t len;
+} __attribute__((packed));
+
+struct pcapng_opt_hdr {
+    uint16_t code;
+    uint16_t len;
+} __attribute__((packed));
+
+typedef struct pcap_reader {
+    FILE*       file;
+    bool        is_ng;
+    bool        swapped;       ///< The file is in the other byte order
+    // Classic pcap
+    bool        nsec;
+    uint32_t    link_type;
+    // pcapng: interfaces of the current section
+    size_t      if_num;
+    uint16_t    if_link_type[PCAPNG_MAX_INTERFACES];
+    uint8_t     if_tsresol[PCAPNG_MAX_INTERFACES];
+} PcapReader;
+
+typedef struct pcap_writer {
+    FILE*       file;
+    bool        is_ng;
+} PcapWriter;
+
+__BEGIN_DECLS
+
+errval_t pcap_reader_open(PcapReader* reader, const char* path);
+void     pcap_reader_close(PcapReader* reader);
+/// Go back to the first frame
+errval_t pcap_reader_rewind(PcapReader* reader);
+/**
+ * Read the next Ethernet frame into data, the frames of other link types are skipped
+ * ret_ts_ns: timestamp in nano seconds, 0 if the file doesn't have one
+ * ret_wire_len: length on the wire, larger than ret_len if the capture was truncated
+ * Return NET_ERR_PCAP_EOF at the end of the file, NET_ERR_PCAP_TOO_LARGE (and skip the frame) if it's larger than max
+ */
+errval_t pcap_reader_next(PcapReader* reader, uint8_t* data, size_t max, size_t* ret_len, size_t* ret_wire_len, uint64_t* ret_ts_ns);
+
+/// Classic pcap, nano seconds, Ethernet
+errval_t pcap_writer_open(PcapWriter* writer, const char* path, uint32_t snaplen);
+void     pcap_writer_close(PcapWriter* writer);
+/// Not thread-safe, the caller serializes the writers
+errval_t pcap_writer_write(PcapWriter* writer, const uint8_t* data, size_t len, uint64_t ts_ns);
+
+/// pcapng, one Ethernet interface with nano seconds timestamps, closed by pcap_writer_close()
+errval_t pcapng_writer_open(PcapWriter* writer, const char* path, uint32_t snaplen);
+/// flags: PCAPNG_EPB_INBOUND / PCAPNG_EPB_OUTBOUND, 0 if unknown
+errval_t pcapng_writer_write(PcapWriter* writer, const uint8_t* data, size_t caplen, size_t wire_len, uint64_t ts_ns, uint32_t flags);
+
+__END_DECLS
+
+#endif //_PCAP_H_
@@ -0,0 +1,268 @@
+#include <device/capture.h>
+#include <device/device.h>
+#include <netutil/htons.h>
+#include <netutil/etharp.h>
+#include <netutil/ip.h>
+
+#include <sys/syscall.h>   //syscall
+#include <errno.h>         //strerror
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>       //thread_local
+#include <time.h>
+
+#include <event/states.h>
+
+/// The ring of this thread, registered on its first captured frame
+static thread_local CaptureRing* my_ring    = NULL;
+static thread_local Capture*     my_capture = NULL;
+
+static inline CaptureSlot* ring_slot(CaptureRing* ring, size_t index) {
+    return (CaptureSlot*)(ring->slots + (index & (CAPTURE_RING_SLOTS - 1)) * ring->slot_size);
+}
+
+bool capture_match(const CaptureFilter* filter, const uint8_t* frame, size_t len) {
+    assert(filter && frame);
+    if (filter->ethertype == 0 && !filter->has_ip && filter->port == 0) return true;
+    if (len < sizeof(struct eth_hdr)) return false;
+
+    const struct eth_hdr* ether = (const struct eth_hdr*)frame;
+    uint16_t type = ntohs(ether->type);
+    if (filter->ethertype != 0 && type != filter->ethertype) return false;
+    if (!filter->has_ip && filter->port == 0) return true;
+
+    const uint8_t* l3 = frame + sizeof(struct eth_hdr);
+    size_t l3_len = len - sizeof(struct eth_hdr);
+    const uint8_t* l4;
+    uint8_t proto;
+    switch (type) {
+    case ETH_TYPE_IPv4: {
+        if (l3_len < sizeof(struct ip_hdr)) return false;
+        const struct ip_hdr* ip = (const struct ip_hdr*)l3;
+        if (filter->has_ip) {
+            if (filter->ip.is_ipv6) return false;
+            if (ntohl(ip->src) != filter->ip.ipv4 && ntohl(ip->dest) != filter->ip.ipv4) return false;
+        }
+        if (filter->port == 0) return true;
+        // Only the first fragment has the ports
+        if ((ntohs(ip->offset) & IP_OFFMASK) != 0 || l3_len < (size_t)IPH_HL(ip) + 4) return false;
+        proto = ip->proto;
+        l4    = l3 + IPH_HL(ip);
+        break;
+    }
+    case ETH_TYPE_IPv6: {
+        if (l3_len < sizeof(struct ipv6_hdr)) return false;
+        const struct ipv6_hdr* ip = (const struct ipv6_hdr*)l3;
+        if (filter->has_ip) {
+            if (!filter->ip.is_ipv6) return false;
+            if (ntoh16(ip->src) != filter->ip.ipv6 && ntoh16(ip->dest) != filter->ip.ipv6) return false;
+        }
+        if (filter->port == 0) return true;
+        // We don't walk the extension headers
+        if (l3_len < sizeof(struct ipv6_hdr) + 4) return false;
+        proto = ip->next_header;
+        l4    = l3 + sizeof(struct ipv6_hdr);
+        break;
+    }
+    default:
+        return false;
+    }
+
+    if (proto != IP_PROTO_TCP && proto != IP_PROTO_UDP) return false;
+    // Source and destination ports are the first 4 bytes of both TCP and UDP
+    uint16_t ports[2];
+    memcpy(ports, l4, sizeof(ports));
+    return ntohs(ports[0]) == filter->port || ntohs(ports[1]) == filter->port;
+}
+
+static CaptureRing* capture_register(Capture* capture) {
+    size_t index = atomic_fetch_add_explicit(&capture->ring_num, 1, memory_order_relaxed);
+    if (index >= CAPTURE_MAX_RINGS) {
+        DEVICE_WARN("Too many threads capture frames, the frames of this one are dropped");
+        return NULL;
+    }
+
+    CaptureRing* ring = aligned_alloc(ATOMIC_ISOLATION, sizeof(CaptureRing)); assert(ring);
+    memset(ring, 0x00, sizeof(CaptureRing));
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->dropped, 0);
+    ring->slot_size = (sizeof(CaptureSlot) + capture->snaplen + 7) & ~(size_t)7;
+    ring->slots     = malloc(CAPTURE_RING_SLOTS * ring->slot_size); assert(ring->slots);
+
+    LocalState* local = get_local_state();
+    snprintf(ring->owner, sizeof(ring->owner), "%s", (local && local->my_name) ? local->my_name : "Unknown");
+
+    atomic_store_explicit(&capture->rings[index], ring, memory_order_release);
+    return ring;
+}
+
+void capture_frame(Capture* capture, const Buffer* frame, uint32_t direction) {
+    assert(capture && frame);
+    if (!atomic_load_explicit(&capture->enabled, memory_order_relaxed)) return;
+    if (!capture_match(&capture->filter, frame->data, frame->valid_size)) return;
+
+    if (my_capture != capture) {
+        my_capture = capture;
+        my_ring    = capture_register(capture);
+    }
+    CaptureRing* ring = my_ring;
+    if (ring == NULL) {
+        atomic_fetch_add_explicit(&capture->no_ring, 1, memory_order_relaxed);
+        return;
+    }
+
+    // Never wait for the writer, drop and count instead
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head >= CAPTURE_RING_SLOTS) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    CaptureSlot* slot = ring_slot(ring, tail);
+    slot->ts_ns     = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    slot->wire_len  = frame->valid_size;
+    slot->caplen    = (frame->valid_size < capture->snaplen) ? frame->valid_size : capture->snaplen;
+    slot->direction = direction;
+    memcpy(slot->data, frame->data, slot->caplen);
+
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+/// @brief  Write out what the rings have now, and report the new drops
+/// @return How many frames are written
+static size_t capture_drain(Capture* capture) {
+    size_t written = 0;
+    size_t ring_num = atomic_load_explicit(&capture->ring_num, memory_order_acquire);
+    if (ring_num > CAPTURE_MAX_RINGS) ring_num = CAPTURE_MAX_RINGS;
+
+    for (size_t i = 0; i < ring_num; i++) {
+        CaptureRing* ring = atomic_load_explicit(&capture->rings[i], memory_order_acquire);
+        if (ring == NULL) continue;     // Being registered
+
+        size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        for (; head != tail; head++) {
+            CaptureSlot* slot = ring_slot(ring, head);
+            errval_t err = pcapng_writer_write(&capture->writer, slot->data, slot->caplen, slot->wire_len, slot->ts_ns, slot->direction);
+            if (err_is_fail(err)) {
+                DEVICE_ERR("Can't write the captured frame: %s", strerror(errno));
+                continue;
+            }
+            written += 1;
+        }
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+
+        size_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        if (dropped != ring->reported) {
+            DEVICE_WARN("Capture ring of %s overflowed, %zu frames dropped (%zu in total)", ring->owner, dropped - ring->reported, dropped);
+            ring->reported = dropped;
+        }
+    }
+    capture->written += written;
+    return written;
+}
+
+static void* capture_thread(void* state) {
+    LocalState* local = state; assert(local);
+    local->my_pid = syscall(SYS_gettid);
+    set_local_state(local);
+
+    Capture* capture = local->my_state; assert(capture);
+    DEVICE_NOTE("%s started with pid %d", local->my_name, local->my_pid);
+
+    const struct timespec idle = {
+        .tv_sec  = 0,
+        .tv_nsec = CAPTURE_IDLE_SLEEP * 1000,
+    };
+    while (atomic_load_explicit(&capture->running, memory_order_acquire)) {
+        if (capture_drain(capture) == 0) {
+            fflush(capture->writer.file);
+            nanosleep(&idle, NULL);
+        }
+    }
+    // What's left after the stop
+    capture_drain(capture);
+    return NULL;
+}
+
+errval_t capture_init(Capture* capture, const char* path, uint32_t snaplen, CaptureFilter filter, bool enabled) {
+    assert(capture && path && snaplen > 0);
+    errval_t err;
+
+    memset(capture, 0x00, sizeof(Capture));
+    err = pcapng_writer_open(&capture->writer, path, snaplen);
+    if (err_is_fail(err)) {
+        DEVICE_FATAL("Can't create the capture file %s: %s", path, strerror(errno));
+        return err;
+    }
+
+    capture->snaplen = snaplen;
+    capture->filter  = filter;
+    capture->written = 0;
+    atomic_init(&capture->enabled, enabled);
+    atomic_init(&capture->running, true);
+    atomic_init(&capture->ring_num, 0);
+    atomic_init(&capture->no_ring, 0);
+    for (size_t i = 0; i < CAPTURE_MAX_RINGS; i++) {
+        atomic_init(&capture->rings[i], NULL);
+    }
+
+    char* name = calloc(16, sizeof(char));
+    sprintf(name, "Capture");
+
+    LocalState* local = calloc(1, sizeof(LocalState));
+    *local = (LocalState) {
+        .my_name  = name,
+        .my_pid   = (pid_t)-1,      // Don't know yet
+        .log_file = (g_states.log_file == NULL) ? stdout : g_states.log_file,
+        .my_state = capture,
+    };
+
+    if (pthread_create(&capture->thread, NULL, capture_thread, (void*)local) != 0) {
+        DEVICE_FATAL("Can't create the capture thread");
+        free(name); free(local);
+        pcap_writer_close(&capture->writer);
+        return EVENT_ERR_THREAD_CREATE;
+    }
+
+    DEVICE_NOTE("Capture to %s, snaplen %d, filter: ethertype 0x%04x, IP %s, port %d, enabled: %d",
+                path, snaplen, filter.ethertype, filter.has_ip ? "set" : "any", filter.port, enabled);
+    return SYS_ERR_OK;
+}
+
+void capture_destroy(Capture* capture) {
+    assert(capture);
+
+    atomic_store_explicit(&capture->running, false, memory_order_release);
+    pthread_join(capture->thread, NULL);
+
+    size_t dropped = atomic_load_explicit(&capture->no_ring, memory_order_relaxed);
+    for (size_t i = 0; i < CAPTURE_MAX_RINGS; i++) {
+        CaptureRing* ring = atomic_load_explicit(&capture->rings[i], memory_order_acquire);
+        if (ring == NULL) continue;
+        dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        free(ring->slots);
+        free(ring);
+    }
+    pcap_writer_close(&capture->writer);
+
+    DEVICE_NOTE("Capture closed: %zu frames written, %zu dropped", capture->written, dropped);
+}
+
+void capture_set_enabled(Capture* capture, bool enabled) {
+    assert(capture);
+    atomic_store_explicit(&capture->enabled, enabled, memory_order_relaxed);
+}
+
+bool capture_toggle(Capture* capture) {
+    assert(capture);
+    bool enabled = atomic_load_explicit(&capture->enabled, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&capture->enabled, &enabled, !enabled, memory_order_relaxed, memory_order_relaxed));
+    return !enabled;
+}
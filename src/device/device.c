@@ -1,59 +1,127 @@
 #include <device/device.h>
+#include <device/capture.h>
 #include <netstack/network.h>
 #include <netutil/dump.h>
 #include <netutil/htons.h>
+#include <netutil/ip.h>
+#include <netutil/tcp.h>
+#include <netutil/udp.h>
 
-#include <fcntl.h>
 #include <sys/ioctl.h>
-#include <linux/if_tun.h>
-#include <poll.h>
+#include <sys/syscall.h>   //syscall
+#include <linux/virtio_net.h>
 
 #include <unistd.h>
 #include <errno.h>      //strerror
 #include <stdio.h>      //perror
 #include <stdlib.h>
 #include <string.h>
+#include <threads.h>    //thread_local
 
 #include <event/event.h>
+#include <event/bufchain.h>
 #include <event/threadpool.h>
 #include <event/memorypool.h>
+#include <event/states.h>
+
+/// Every backend we know, the first one is the default
+static const DeviceOps* all_ops[] = {
+    &tap_ops,
+    &uring_ops,
+    &packet_ops,
+    &replay_ops,
+    &shm_ops,
+};
+
+const DeviceOps* device_find_ops(const char* name) {
+    assert(name);
+    for (size_t i = 0; i < sizeof(all_ops) / sizeof(all_ops[0]); i++) {
+        if (strcmp(all_ops[i]->name, name) == 0) return all_ops[i];
+    }
+    return NULL;
+}
+
+static void close_queues(NetDevice* device, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        DeviceQueue* queue = &device->queues[i];
+        if (queue->priv) device->ops->close(queue);
+        queue->priv = NULL;
+        if (queue->fd >= 0) close(queue->fd);
+        queue->fd = -1;
+    }
+}
 
-errval_t device_init(NetDevice* device, const char* tap_path, const char* tap_name) {
-    // errval_t err;
+errval_t device_init(NetDevice* device, const DeviceOps* ops, const DeviceConfig* config) {
+    assert(device && ops && config && config->if_name);
+    assert(config->queue_num > 0 && config->queue_num <= DEVICE_MAX_RX_QUEUES);
+    assert(config->rx_batch > 0 && config->rx_batch <= DEVICE_MAX_RX_BATCH);
+    errval_t err;
 
-    // Open TAP device
-    int tap_fd = open(tap_path, O_RDWR);
-    if (tap_fd < 0) {
-        DEVICE_FATAL("Failed to open %s, because %s", tap_path, strerror(errno));
+    if (config->vnet_hdr && !(ops->caps & DEVICE_CAP_VNET_HDR)) {
+        DEVICE_FATAL("The %s backend doesn't support the virtio-net header", ops->name);
         return NET_ERR_DEVICE_INIT;
     }
 
-    // Flags: IFF_TUN   - TUN device (no Ethernet headers) 
-    //        IFF_TAP   - TAP device  
-    //        IFF_NO_PI - Do not provide packet information  
-    struct ifreq ifr = { 0 };
-    ifr.ifr_flags = IFF_TAP | IFF_NO_PI; 
-    strncpy(ifr.ifr_name, tap_name, IFNAMSIZ);
+    // The virtio-net header brings the offloads, the backend only carries it
+    uint8_t caps = ops->caps & ~DEVICE_CAP_VNET_HDR;
+    if (config->vnet_hdr) caps |= DEVICE_CAP_VNET_HDR | DEVICE_CAP_CSUM | DEVICE_CAP_TSO | DEVICE_CAP_RX_CSUM;
 
-    if (ioctl(tap_fd, TUNSETIFF, (void *) &ifr) < 0) {
-        DEVICE_FATAL("ioctl(TUNSETIFF): %s", strerror(errno));
-        close(tap_fd);
-        return NET_ERR_DEVICE_INIT;
+    BusyPollConfig busy_poll = config->busy_poll;
+    if (busy_poll.budget_ns > 0 && !(ops->caps & DEVICE_CAP_BUSY_POLL)) {
+        DEVICE_WARN("The %s backend can't busy-poll, its RX threads always block", ops->name);
+        busy_poll.budget_ns = 0;
     }
 
-    DEVICE_NOTE("TAP device %s opened, tapfd = %d", ifr.ifr_name, tap_fd);
+    DeviceQueue* queues = aligned_alloc(ATOMIC_ISOLATION, config->queue_num * sizeof(DeviceQueue));
+    assert(queues);
+    memset(queues, 0x00, config->queue_num * sizeof(DeviceQueue));
 
     *device = (NetDevice) {
-        .tap_fd       = tap_fd,
-        .ifr          = ifr,
-        .recvd        = 0,
-        .fail_process = 0,
-        .sent         = 0,
-        .fail_sent    = 0,
+        .ops          = ops,
+        .caps         = caps,
+        .vnet_hdr     = config->vnet_hdr,
+        .queue_num    = config->queue_num,
+        .queues       = queues,
+        .rx_batch     = config->rx_batch,
+        .poll_timeout = config->poll_timeout,
+        .looping      = false,
+        .net          = NULL,
+        .mempool      = NULL,
+        .capture      = NULL,
         .start_time   = { 0 },
     };
-    clock_gettime(CLOCK_REALTIME, &device->start_time);
-    
+    atomic_init(&device->next_tx_queue, 0);
+    strncpy(device->ifr.ifr_name, config->if_name, IFNAMSIZ - 1);
+
+    for (size_t i = 0; i < config->queue_num; i++) {
+        queues[i] = (DeviceQueue) {
+            .device       = device,
+            .id           = i,
+            .fd           = -1,
+            .priv         = NULL,
+            .recvd        = 0,
+            .recvd_batch  = 0,
+            .fail_process = 0,
+            .rx_shed      = 0,
+        };
+        busypoll_init(&queues[i].busy, busy_poll);
+        atomic_init(&queues[i].sent, 0);
+        atomic_init(&queues[i].fail_sent, 0);
+
+        err = ops->open(&queues[i], config);
+        if (err_is_fail(err)) {
+            // The failed queue may still hold its fd, but not its private state
+            close_queues(device, i + 1);
+            free(queues);
+            device->queues = NULL;
+            DEBUG_FAIL_RETURN(err, "Can't open the queue %d of the device", i);
+        }
+    }
+
+    DEVICE_NOTE("Device %s opened with %d queue(s) (%s backend, caps 0x%02x), drain %d frames per wakeup, poll timeout %d ms, virtio-net header: %d, busy-poll %d us%s",
+                device->ifr.ifr_name, device->queue_num, ops->name, caps, device->rx_batch, device->poll_timeout, device->vnet_hdr,
+                (int)(busy_poll.budget_ns / 1000), busy_poll.adaptive ? " (adaptive)" : "");
+
     char start_time_str[64];
     
     clock_gettime(CLOCK_REALTIME, &device->start_time);
@@ -65,13 +133,44 @@ errval_t device_init(NetDevice* device, const char* tap_path, const char* tap_na
     return SYS_ERR_OK;
 }
 
+/// @brief  Stop the RX threads of the first count queues, except ourselves if we are one of them
+static void stop_queues(NetDevice* device, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        DeviceQueue* queue = &device->queues[i];
+        if (pthread_equal(queue->thread, pthread_self())) continue;
+
+        pthread_cancel(queue->thread);
+        if (device->ops->wakeup) device->ops->wakeup(queue);
+        pthread_join(queue->thread, NULL);
+    }
+}
+
 void device_close(NetDevice* device) {
     assert(device);
     
-    // Close the TAP device
-    assert(device->tap_fd >= 0);
-    close(device->tap_fd);
-    DEVICE_NOTE("Closed TAP device %s (fd: %d)", device->ifr.ifr_name, device->tap_fd);
+    // Stop the RX threads before tearing down their queues
+    if (device->looping) stop_queues(device, device->queue_num);
+
+    // Close the queues, after collecting what only the backend knows
+    for (size_t i = 0; i < device->queue_num; i++) {
+        DeviceQueue* queue = &device->queues[i];
+        if (device->ops->stats) device->ops->stats(queue);
+        DEVICE_NOTE("Closing device %s queue %d (fd: %d)", device->ifr.ifr_name, i, queue->fd);
+    }
+    close_queues(device, device->queue_num);
+
+    if (device->rss) {
+        rss_report(device->rss);
+        free(device->rss);
+        device->rss = NULL;
+    }
+
+    // Nobody captures any more
+    if (device->capture) {
+        capture_destroy(device->capture);
+        free(device->capture);
+        device->capture = NULL;
+    }
     
     // Record the end time
     struct timespec end_time;
@@ -93,121 +192,529 @@ void device_close(NetDevice* device) {
         start_time_str, end_time_str, elapsed_time
     );
 
-    
     // Print device statistics
+    size_t recvd = 0, recvd_batch = 0, fail_process = 0, rx_shed = 0, sent = 0, fail_sent = 0;
+    for (size_t i = 0; i < device->queue_num; i++) {
+        DeviceQueue* queue = &device->queues[i];
+        size_t q_sent      = atomic_load_explicit(&queue->sent, memory_order_relaxed);
+        size_t q_fail_sent = atomic_load_explicit(&queue->fail_sent, memory_order_relaxed);
+        DEVICE_INFO("  Queue %d: Received %zu (in %zu batches), Failed to Process %zu, Shed %zu, Sent %zu, Failed to Send %zu",
+                    i, queue->recvd, queue->recvd_batch, queue->fail_process, queue->rx_shed, q_sent, q_fail_sent);
+        if (queue->steered) {
+            DEVICE_INFO("  Queue %d: %zu frames not run by the worker of their flow, its queue was full", i, queue->rss_spill);
+            free(queue->steered);
+        }
+        const BusyPoll* busy = &queue->busy;
+        if (busy->config.budget_ns > 0) {
+            DEVICE_INFO("  Queue %d: Spent %.3f ms spinning (%zu of %zu spins found frames, %zu skipped), %.3f ms blocked (%zu times)",
+                        i, busy->spin_ns / 1e6, busy->spin_hits, busy->spins, busy->spin_skips, busy->park_ns / 1e6, busy->parks);
+        }
+        recvd        += queue->recvd;
+        recvd_batch  += queue->recvd_batch;
+        fail_process += queue->fail_process;
+        rx_shed      += queue->rx_shed;
+        sent         += q_sent;
+        fail_sent    += q_fail_sent;
+    }
+
     DEVICE_NOTE(
-        "Device Statistics for %s:\\n"
-        "  Packets Received: %zu\\n"
+        "Device Statistics for %s (%zu queues, %s backend):\\n"
+        "  Packets Received: %zu (in %zu batches)\\n"
         "  Packets Failed to Process: %zu\\n"
-        "  Packets Sent (In-accurate): %zu\\n"
+        "  Packets Shed by the Memory Pool: %zu\\n"
+        "  Packets Sent: %zu\\n"
         "  Packets Failed to Send: %zu",
         device->ifr.ifr_name,
-        device->recvd,
-        device->fail_process,
-        device->sent,
-        device->fail_sent
+        device->queue_num,
+        device->ops->name,
+        recvd,
+        recvd_batch,
+        fail_process,
+        rx_shed,
+        sent,
+        fail_sent
     );
 
+    free(device->queues);
     memset(device, 0, sizeof(NetDevice));
     free(device);
     device = NULL;
 }
 
+/// Devices a thread remembers its TX queue for, a thread sending on more of them picks again for the oldest
+#define DEVICE_TX_THREAD_DEVICES    4
+
+/// The TX queue of this thread on one device
+typedef struct {
+    NetDevice*  device;
+    size_t      queue;
+} TxQueueSlot;
+
+static thread_local TxQueueSlot my_tx_queues[DEVICE_TX_THREAD_DEVICES];
+static thread_local size_t      my_tx_next = 0;
+
+/// @brief  Every sending thread sticks to one queue of each device, picked round-robin the first time it sends,
+///         so the writes of one thread (thus one flow, mostly) stay in order
+static DeviceQueue* device_tx_queue(NetDevice* device) {
+    TxQueueSlot* slot = NULL;
+    for (size_t i = 0; i < DEVICE_TX_THREAD_DEVICES; i++) {
+        if (my_tx_queues[i].device == device) {
+            slot = &my_tx_queues[i];
+            break;
+        }
+    }
+    if (slot == NULL) {
+        slot = &my_tx_queues[my_tx_next++ % DEVICE_TX_THREAD_DEVICES];
+        slot->device = device;
+        slot->queue  = atomic_fetch_add_explicit(&device->next_tx_queue, 1, memory_order_relaxed);
+    }
+    // Still in range if another device was allocated at the address of a closed one
+    return &device->queues[slot->queue % device->queue_num];
+}
+
+/// @brief  Parse the headers of an outgoing frame, and tell the kernel what to finish for us
+static errval_t push_vnet_hdr(Buffer* buf) {
+    struct virtio_net_hdr hdr = {
+        .flags    = 0,
+        .gso_type = VIRTIO_NET_HDR_GSO_NONE,
+    };
+
+    if (buf->offload & (BUFFER_CSUM_PARTIAL | BUFFER_GSO_TCP)) {
+        struct eth_hdr* ether = (struct eth_hdr*)buf->data;
+        uint16_t l3_size;
+        uint8_t  proto;
+        bool     is_ipv6;
+        switch (ntohs(ether->type)) {
+        case ETH_TYPE_IPv4: {
+            struct ip_hdr* ip = (struct ip_hdr*)(buf->data + sizeof(struct eth_hdr));
+            l3_size = IPH_HL(ip);
+            proto   = ip->proto;
+            is_ipv6 = false;
+            break;
+        }
+        case ETH_TYPE_IPv6: {
+            // We never send extension headers
+            struct ipv6_hdr* ip = (struct ipv6_hdr*)(buf->data + sizeof(struct eth_hdr));
+            l3_size = sizeof(struct ipv6_hdr);
+            proto   = ip->next_header;
+            is_ipv6 = true;
+            break;
+        }
+        default:
+            DEVICE_ERR("Offload requested for a frame of type 0x%04x", ntohs(ether->type));
+            return NET_ERR_DEVICE_VNET_HDR;
+        }
+        if (proto != IP_PROTO_TCP && proto != IP_PROTO_UDP) {
+            DEVICE_ERR("Offload requested for protocol %d", proto);
+            return NET_ERR_DEVICE_VNET_HDR;
+        }
+
+        // The kernel sums from csum_start to the end, and stores the result at csum_start + csum_offset
+        hdr.flags       = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr.csum_start  = sizeof(struct eth_hdr) + l3_size;
+        hdr.csum_offset = (proto == IP_PROTO_TCP) ? offsetof(struct tcp_hdr, chksum) : offsetof(struct udp_hdr, chksum);
+
+        if (buf->offload & BUFFER_GSO_TCP) {
+            assert(proto == IP_PROTO_TCP);
+            struct tcp_hdr* tcp = (struct tcp_hdr*)(buf->data + hdr.csum_start);
+            hdr.gso_type = is_ipv6 ? VIRTIO_NET_HDR_GSO_TCPV6 : VIRTIO_NET_HDR_GSO_TCPV4;
+            hdr.hdr_len  = hdr.csum_start + TCP_HLEN(tcp);
+            hdr.gso_size = IP_MTU - TCP_HLEN(tcp);
+        }
+    }
+
+    assert(buf->from_hdr >= sizeof(struct virtio_net_hdr));
+    buffer_sub_ptr(buf, sizeof(struct virtio_net_hdr));
+    memcpy(buf->data, &hdr, sizeof(struct virtio_net_hdr));
+    return SYS_ERR_OK;
+}
+
+static errval_t strip_vnet_hdr(NetDevice* device, Buffer* frame) {
+    assert(device && device->vnet_hdr && frame);
+
+    if (frame->valid_size < sizeof(struct virtio_net_hdr)) {
+        DEVICE_ERR("Frame of %d bytes is too small for the virtio-net header", frame->valid_size);
+        return NET_ERR_DEVICE_VNET_HDR;
+    }
+    struct virtio_net_hdr hdr;
+    memcpy(&hdr, frame->data, sizeof(struct virtio_net_hdr));
+    buffer_add_ptr(frame, sizeof(struct virtio_net_hdr));
+
+    if (hdr.gso_type != VIRTIO_NET_HDR_GSO_NONE) {
+        DEVICE_ERR("We didn't enable TSO on receive, but got a GSO frame of type %d", hdr.gso_type);
+        return NET_ERR_DEVICE_VNET_HDR;
+    }
+    // NEEDS_CSUM: generated by the local kernel and never hit the wire, the checksum is only partial
+    if (hdr.flags & (VIRTIO_NET_HDR_F_DATA_VALID | VIRTIO_NET_HDR_F_NEEDS_CSUM)) {
+        frame->offload |= BUFFER_CSUM_VALID;
+    }
+    return SYS_ERR_OK;
+}
+
+/// @brief  Send the frames in order through the queue of this thread, the caller keeps the buffers.
+///         With the virtio-net header, it's pushed in place (in the reserved header space of every buffer)
+/// @return How many frames (from the first one) are accepted by the backend
+size_t device_tx_burst(NetDevice* device, Buffer* bufs, size_t count) {
+    assert(device && bufs);
+    if (count == 0) return 0;
+
+    // As the stack built them, before the virtio-net header
+    if (device->capture) {
+        for (size_t i = 0; i < count; i++) capture_frame(device->capture, &bufs[i], CAPTURE_TX);
+    }
+
+    size_t ready = count;
+    if (device->vnet_hdr) {
+        for (size_t i = 0; i < count; i++) {
+            if (err_is_fail(push_vnet_hdr(&bufs[i]))) {
+                DEVICE_ERR("Can't build the virtio-net header of frame %d in the burst", i);
+                ready = i;
+                break;
+            }
+        }
+    }
+
+    DeviceQueue* queue = device_tx_queue(device);
+    size_t accepted = (ready == 0) ? 0 : device->ops->tx_burst(queue, bufs, ready);
+    assert(accepted <= ready);
+
+    if (!(device->ops->caps & DEVICE_CAP_TX_ASYNC)) {
+        atomic_fetch_add_explicit(&queue->sent, accepted, memory_order_relaxed);
+    }
+    if (accepted < count) {
+        atomic_fetch_add_explicit(&queue->fail_sent, count - accepted, memory_order_relaxed);
+    }
+    return accepted;
+}
+
 errval_t device_send(NetDevice* device, Buffer buf) {
     assert(device);
 
-    ///TODO: if two threads write at the same time, will there be problem ?
-    ssize_t written = write(device->tap_fd, buf.data, (size_t)buf.valid_size);
-    if (written < 0) {
-        const char *error_msg = strerror(errno);
-        DEVICE_ERR("write to TAP device: %s", error_msg);
-        device->fail_sent += 1;
+    if (device_tx_burst(device, &buf, 1) != 1) {
         return NET_ERR_DEVICE_SEND;
     }
-    assert((size_t)written == buf.valid_size);
-    device->sent += 1;
+    return SYS_ERR_OK;
+}
+
+/// @brief  Send one frame scattered over the segments of the chain, the backend gathers them (writev) if it can,
+///         otherwise they are copied into a single piece. The headers must be in the first segment, the caller keeps the chain
+errval_t device_send_chain(NetDevice* device, BufChain* chain) {
+    assert(device && chain && chain->count > 0);
+    errval_t err;
+
+    // The capture, and the kernel cutting a TCP segment (it parses the TCP header), want the frame in one piece
+    if (device->ops->tx_chain == NULL || device->capture || (chain->segs[0].offload & BUFFER_GSO_TCP)) {
+        Buffer frame = bufchain_linearize(chain, local_mempool(), DEVICE_HEADER_RESERVE);
+        err = device_send(device, frame);
+        free_buffer(frame);
+        return err;
+    }
+
+    // The virtio-net header goes in the headroom of the first segment, our view of it is restored once sent
+    DeviceQueue* queue = device_tx_queue(device);
+    Buffer   head = chain->segs[0];
+    uint32_t len  = chain->len;
+    if (device->vnet_hdr) {
+        err = push_vnet_hdr(&chain->segs[0]);
+        if (err_is_fail(err)) {
+            chain->segs[0] = head;
+            atomic_fetch_add_explicit(&queue->fail_sent, 1, memory_order_relaxed);
+            DEBUG_FAIL_RETURN(err, "Can't build the virtio-net header of a chained frame");
+        }
+        chain->len += sizeof(struct virtio_net_hdr);
+    }
 
+    err = device->ops->tx_chain(queue, chain);
+    chain->segs[0] = head;
+    chain->len     = len;
+    if (err_is_fail(err)) {
+        atomic_fetch_add_explicit(&queue->fail_sent, 1, memory_order_relaxed);
+        return NET_ERR_DEVICE_SEND;
+    }
+    atomic_fetch_add_explicit(&queue->sent, 1, memory_order_relaxed);
     return SYS_ERR_OK;
 }
 
 errval_t device_get_mac(NetDevice* device, mac_addr* restrict ret_mac) {
     assert(device && ret_mac);
+    return device->ops->get_mac(&device->queues[0], ret_mac);
+}
 
-    // Get MAC address
-    if (ioctl(device->tap_fd, SIOCGIFHWADDR, &device->ifr) < 0) {
+/// @brief  For the backends bound to a network interface: ask the kernel for its MAC address
+errval_t device_ioctl_mac(DeviceQueue* queue, mac_addr* restrict ret_mac) {
+    assert(queue && queue->fd >= 0 && ret_mac);
+
+    struct ifreq ifr = queue->device->ifr;
+    if (ioctl(queue->fd, SIOCGIFHWADDR, &ifr) < 0) {
         const char *error_msg = strerror(errno);
         DEVICE_ERR("ioctl(SIOCGIFHWADDR): %s", error_msg);
         return NET_ERR_DEVICE_GET_MAC;
     }
-    *ret_mac = (mem2mac(device->ifr.ifr_hwaddr.sa_data));
+    *ret_mac = (mem2mac(ifr.ifr_hwaddr.sa_data));
 
     return SYS_ERR_OK;
 }
 
-static errval_t handle_frame(NetDevice* device, NetWork* net, MemPool* mempool) {
+/// @brief  A buffer from the memory pool to receive a frame in, with the header space reserved,
+///         a NULL_BUFFER if the pool is overloaded and keeps its last pieces for the traffic we send
+Buffer device_alloc_rx_buffer(NetDevice* device) {
+    assert(device && device->mempool);
+
+    // From the NUMA node of the RX thread, the stack will touch the frame there
+    LocalState* local = get_local_state();
+    MemPool* pool = (local && local->mempool) ? local->mempool : device->mempool;
+
+    Buffer buf;
+    errval_t err = pool_alloc_prio(pool, MEMPOOL_BYTES, MEMPOOL_PRIO_RX, &buf);
+    if (err_no(err) == EVENT_MEMPOOL_EMPTY) return NULL_BUFFER;
+    assert(err_is_ok(err));
+    assert(buf.valid_size == MEMPOOL_BYTES);
+    assert(buf.data);
+    buffer_add_ptr(&buf, DEVICE_HEADER_RESERVE);
+    buffer_set_owner(buf, MEMPOOL_OWNER_DEVICE);
+    return buf;
+}
+
+/// @brief  An empty batch of rx_batch frames, in a piece of the memory pool of this thread
+static Ether_batch* batch_alloc(NetDevice* device) {
+    LocalState* local = get_local_state();
+    MemPool* pool = (local && local->mempool) ? local->mempool : device->mempool;
+
+    // The pieces aren't aligned
+    size_t size = sizeof(Ether_batch) + device->rx_batch * sizeof(Buffer);
+    Buffer self;
+    errval_t err = pool_alloc(pool, size + alignof(Ether_batch), &self);
+    assert(err_is_ok(err) && self.data);
+    Ether_batch* batch = (Ether_batch*)ROUND_UP((uintptr_t)self.data, alignof(Ether_batch));
+    assert((uint8_t*)batch + size <= self.data + self.whole_size);
+    batch->self  = self;
+    batch->ether = device->net->ether;
+    batch->count = 0;
+    return batch;
+}
+
+static void device_submit_batch(DeviceQueue* queue, Ether_batch* batch) {
+    assert(queue && batch);
     errval_t err;
 
-    Ether_unmarshal* frame = malloc(sizeof(Ether_unmarshal)); assert(frame);
-    *frame = (Ether_unmarshal) {
-        .ether   = net->ether,
-        .buf     = { 0 }, 
-    };
+    queue->recvd       += batch->count;
+    queue->recvd_batch += 1;
 
-    assert(pool_alloc(mempool, MEMPOOL_BYTES, &frame->buf) == SYS_ERR_OK);
-    assert(frame->buf.valid_size == MEMPOOL_BYTES);
-    assert(frame->buf.data);
+    // The task is in the batch, nothing to allocate
+    batch->task = MK_NORM_TASK(event_ether_batch, batch);
+    batch->task.borrowed = true;
+    err = submit_task_ptr(&batch->task);
+    if (err_is_fail(err)) {
 
-    buffer_add_ptr(&frame->buf, DEVICE_HEADER_RESERVE);
-    int nbytes = read(device->tap_fd, frame->buf.data, frame->buf.valid_size);
-    if (nbytes <= 0) 
-    {
-        const char *error_msg = strerror(errno);
-        DEVICE_ERR("read packet from TAP device failed: %s, but the loop continue", error_msg);
-        free_ether_unmarshal(frame);
+        assert(err_no(err) == EVENT_ENQUEUE_FULL);
+        EVENT_WARN("The task queue is full, we need to drop these %d packets!", batch->count);
+
+        queue->fail_process += batch->count;
+        free_ether_batch(batch);
     }
-    else
-    {
-        assert(frame->buf.valid_size == MEMPOOL_BYTES - DEVICE_HEADER_RESERVE);
-        frame->buf.valid_size = nbytes;
-        device->recvd += 1;
+    // free(batch); Can't free it here, thread need it, must be free'd in task thread
+}
 
-        err = submit_task(MK_NORM_TASK(event_ether_unmarshal, frame));
-        if (err_is_fail(err)) {
+/// @brief  Split the burst by flow, each worker gets the frames of its flows in one task, in the order they came.
+///         The frames are moved out of the burst, which is kept for the next one
+static void device_steer_batch(DeviceQueue* queue, Ether_batch* burst) {
+    NetDevice* device = queue->device;
+    DeviceRss* rss = device->rss;
+    errval_t err;
 
+    for (size_t i = 0; i < burst->count; i++) {
+        Buffer frame = burst->bufs[i];
+        size_t worker = rss_steer(rss, rss_hash(frame.data, frame.valid_size));
+        Ether_batch* batch = queue->steered[worker];
+        if (batch == NULL) batch = queue->steered[worker] = batch_alloc(device);
+        batch->bufs[batch->count++] = frame;
+    }
+    queue->recvd += burst->count;
+    burst->count  = 0;
+
+    for (size_t worker = 0; worker < rss->workers; worker++) {
+        Ether_batch* batch = queue->steered[worker];
+        if (batch == NULL) continue;
+        queue->steered[worker] = NULL;
+        queue->recvd_batch += 1;
+
+        batch->task = MK_NORM_TASK(event_ether_batch, batch);
+        batch->task.borrowed = true;
+        err = submit_task_to(&batch->task, worker);
+        if (err_no(err) == EVENT_ENQUEUE_FULL) {
+            // Out of order rather than lost
+            queue->rss_spill += batch->count;
+            err = submit_task_ptr(&batch->task);
+        }
+        if (err_is_fail(err)) {
             assert(err_no(err) == EVENT_ENQUEUE_FULL);
-            EVENT_WARN("The task queue is full, we need to drop this packet!");
+            EVENT_WARN("The task queue is full, we need to drop these %d packets!", batch->count);
+            queue->fail_process += batch->count;
+            free_ether_batch(batch);
+        }
+    }
+}
 
-            free_ether_unmarshal(frame);
-            device->fail_process += 1;
+/// @brief  Strip the virtio-net header of every frame, drop the broken ones and keep the rest in order
+static void strip_batch(DeviceQueue* queue, Ether_batch* batch) {
+    size_t kept = 0;
+    for (size_t i = 0; i < batch->count; i++) {
+        Buffer frame = batch->bufs[i];
+        if (err_is_fail(strip_vnet_hdr(queue->device, &frame))) {
+            queue->fail_process += 1;
+            free_buffer(frame);
+            continue;
         }
+        batch->bufs[kept++] = frame;
     }
-    // free(buffer); Can't free it here, thread need it, must be free'd in task thread
-    return SYS_ERR_OK;
+    batch->count = kept;
 }
 
-errval_t device_loop(NetDevice* device, NetWork* net, MemPool* mempool) {
-    assert(device && net);
+/// One burst of an RX queue, also spun on by busy-poll
+typedef struct {
+    DeviceQueue*    queue;
+    Ether_batch*    batch;
+    size_t          count;         ///< Frames given by the backend, before stripping the virtio-net header
+} RxPoll;
+
+static bool rx_poll(void* arg) {
+    RxPoll* poll = arg;
+    DeviceQueue* queue = poll->queue;
+    NetDevice* device = queue->device;
+
+    // From the memory pool as the frames, the worker gives it back
+    if (poll->batch == NULL) poll->batch = batch_alloc(device);
+    poll->batch->ether = device->net->ether;
+    poll->batch->count = 0;
+
+    poll->count = device->ops->rx_burst(queue, poll->batch->bufs, device->rx_batch);
+    assert(poll->count <= device->rx_batch);
+    poll->batch->count = poll->count;
+
+    if (device->vnet_hdr) strip_batch(queue, poll->batch);
+    return poll->count > 0;
+}
+
+/// @brief  Wait on a single queue and drain it in batches of rx_batch, every queue runs this loop in its own thread
+static errval_t queue_loop(DeviceQueue* queue) {
+    assert(queue && queue->device);
+    NetDevice* device = queue->device;
+    const DeviceOps* ops = device->ops;
     errval_t err;
 
-    // Set up polling
-    struct pollfd pfd[1];
-    pfd[0].fd = device->tap_fd;
-    pfd[0].events = POLLIN;
-    
-    EVENT_NOTE("Device loop starting !");
+    // The batch is kept across wakeups if nothing was received, so we don't allocate and free one on every timeout
+    RxPoll poll = { .queue = queue, .batch = NULL, .count = 0 };
 
     while (true) {
-        int ret = poll(pfd, 1, -1); // Wait indefinitely
-        if (ret < 0) {
-            const char *error_msg = strerror(errno);
-            DEVICE_ERR("poll faild %s", error_msg);
-            close(device->tap_fd);
-            return NET_ERR_DEVICE_FAIL_POLL;
+        // A full burst means there may be more, otherwise spin for a while before blocking
+        if (poll.count == device->rx_batch) {
+            rx_poll(&poll);
+        } else if (!busypoll_spin(&queue->busy, rx_poll, &poll)) {
+            uint64_t start = busypoll_park_start(&queue->busy);
+            err = ops->rx_wait(queue);
+            busypoll_park_end(&queue->busy, start);
+            if (err_is_fail(err)) {
+                if (poll.batch) free_buffer(poll.batch->self);
+                DEBUG_FAIL_RETURN(err, "Can't wait for the frames of queue %d", queue->id);
+            }
+            rx_poll(&poll);
+        }
+        if (poll.count == 0) continue;
+        busypoll_arrival(&queue->busy);
+
+        Ether_batch* batch = poll.batch;
+        if (batch->count == 0) continue;
+
+        if (device->capture) {
+            for (size_t i = 0; i < batch->count; i++) capture_frame(device->capture, &batch->bufs[i], CAPTURE_RX);
         }
 
-        if (pfd[0].revents & POLLIN) {
-            err = handle_frame(device, net, mempool);
-            DEBUG_FAIL_RETURN(err, "Can't handle this frame");
+        if (device->rss) {
+            device_steer_batch(queue, batch);
+        } else {
+            device_submit_batch(queue, batch);
+            poll.batch = NULL;
         }
     }
-}
\ No newline at end of file
+}
+
+static void* queue_thread(void* state) {
+    LocalState* local = state; assert(local);
+    local->my_pid = syscall(SYS_gettid);
+    set_local_state(local);
+
+    DeviceQueue* queue = local->my_state; assert(queue);
+    local->mempool = node_mempool();
+    DEVICE_NOTE("%s started with pid %d, polling fd %d", local->my_name, local->my_pid, queue->fd);
+
+    CORES_SYNC_BARRIER;
+
+    errval_t err = queue_loop(queue);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "RX queue %d stopped !", queue->id);
+    }
+    return NULL;
+}
+
+errval_t device_rss_enable(NetDevice* device, size_t workers) {
+    assert(device && !device->looping);
+    errval_t err;
+
+    DeviceRss* rss = calloc(1, sizeof(DeviceRss));
+    if (rss == NULL) return SYS_ERR_ALLOC_FAIL;
+    err = rss_init(rss, workers);
+    if (err_is_fail(err)) {
+        free(rss);
+        DEBUG_FAIL_RETURN(err, "Can't steer the frames to %d workers", workers);
+    }
+    for (size_t i = 0; i < device->queue_num; i++) {
+        device->queues[i].steered = calloc(workers, sizeof(Ether_batch*));
+        if (device->queues[i].steered == NULL) {
+            for (size_t j = 0; j < i; j++) {
+                free(device->queues[j].steered);
+                device->queues[j].steered = NULL;
+            }
+            free(rss);
+            DEVICE_FATAL("Can't allocate the batches steered to %d workers", workers);
+            return SYS_ERR_ALLOC_FAIL;
+        }
+    }
+    device->rss = rss;
+    return SYS_ERR_OK;
+}
+
+errval_t device_loop(NetDevice* device, NetWork* net, MemPool* mempool) {
+    assert(device && net && mempool);
+
+    device->net     = net;
+    device->mempool = mempool;
+    device->queues[0].thread = pthread_self();
+
+    // Queue 1..n-1 get their own RX thread
+    for (size_t i = 1; i < device->queue_num; i++) {
+        char* name = calloc(16, sizeof(char));
+        sprintf(name, "RxQueue%d", (int)i);
+
+        LocalState* local = calloc(1, sizeof(LocalState));
+        *local = (LocalState) {
+            .my_name  = name,
+            .my_pid   = (pid_t)-1,      // Don't know yet
+            .log_file = (g_states.log_file == NULL) ? stdout : g_states.log_file,
+            .my_state = &device->queues[i],
+        };
+
+        if (pthread_create(&device->queues[i].thread, NULL, queue_thread, (void*)local) != 0) {
+            DEVICE_FATAL("Can't create the RX thread for queue %d", i);
+            free(name); free(local);
+            // Not looping yet, device_close() wouldn't stop the ones already running
+            stop_queues(device, i);
+            return EVENT_ERR_THREAD_CREATE;
+        }
+    }
+    device->looping = true;
+
+    EVENT_NOTE("Device loop starting with %d RX queue(s) !", device->queue_num);
+
+    // Queue 0 is served by the calling thread
+    return queue_loop(&device->queues[0]);
+}
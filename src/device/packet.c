@@ -0,0 +1,312 @@
+#include <device/packet.h>
+#include <device/device.h>
+#include <netstack/network.h>
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>   // ETH_P_ALL
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>            //strerror
+#include <string.h>
+
+#include <event/event.h>
+#include <event/memorypool.h>
+
+/// Without PACKET_TX_HAS_OFF, the kernel takes the frame right after the aligned tpacket3_hdr
+#define TX_DATA_OFFSET  (TPACKET3_HDRLEN - sizeof(struct sockaddr_ll))
+
+static inline struct tpacket_block_desc* rx_block(DevicePacket* ring, size_t index) {
+    return (struct tpacket_block_desc*)(ring->rx_ring + index * ring->rx_block_size);
+}
+
+static inline struct tpacket3_hdr* tx_frame(DevicePacket* ring, size_t index) {
+    return (struct tpacket3_hdr*)(ring->tx_ring + index * ring->tx_frame_size);
+}
+
+static errval_t packet_open(DeviceQueue* queue, const DeviceConfig* config) {
+    assert(queue && config && config->if_name);
+    const char* if_name = config->if_name;
+    size_t queue_num    = config->queue_num;
+    static_assert(TPACKET3_HDRLEN + ETHER_MAX_SIZE <= DEVICE_PACKET_TX_FRAME_SIZE, "TX slot can't hold a frame");
+
+    int fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (fd < 0) {
+        DEVICE_FATAL("Can't create the AF_PACKET socket: %s", strerror(errno));
+        return NET_ERR_DEVICE_INIT;
+    }
+
+    struct ifreq ifr = { 0 };
+    strncpy(ifr.ifr_name, if_name, IFNAMSIZ - 1);
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+        DEVICE_FATAL("Can't find the interface %s: %s", if_name, strerror(errno));
+        close(fd);
+        return NET_ERR_DEVICE_INIT;
+    }
+    int if_index = ifr.ifr_ifindex;
+
+    // 1. Rings: TPACKET_V3, drop the malformed TX frames instead of stalling the ring
+    int version = TPACKET_V3, loss = 1;
+    struct tpacket_req3 rx_req = {
+        .tp_block_size       = DEVICE_PACKET_BLOCK_SIZE,
+        .tp_block_nr         = DEVICE_PACKET_RX_BLOCKS,
+        .tp_frame_size       = DEVICE_PACKET_TX_FRAME_SIZE,   // Meaningless for V3 RX, but checked
+        .tp_frame_nr         = DEVICE_PACKET_BLOCK_SIZE / DEVICE_PACKET_TX_FRAME_SIZE * DEVICE_PACKET_RX_BLOCKS,
+        .tp_retire_blk_tov   = DEVICE_PACKET_BLOCK_TIMEOUT,
+        .tp_sizeof_priv      = 0,
+        .tp_feature_req_word = 0,
+    };
+    struct tpacket_req3 tx_req = {
+        .tp_block_size       = DEVICE_PACKET_BLOCK_SIZE,
+        .tp_block_nr         = DEVICE_PACKET_TX_BLOCKS,
+        .tp_frame_size       = DEVICE_PACKET_TX_FRAME_SIZE,
+        .tp_frame_nr         = DEVICE_PACKET_BLOCK_SIZE / DEVICE_PACKET_TX_FRAME_SIZE * DEVICE_PACKET_TX_BLOCKS,
+    };
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0 ||
+        setsockopt(fd, SOL_PACKET, PACKET_LOSS, &loss, sizeof(loss)) < 0 ||
+        setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &rx_req, sizeof(rx_req)) < 0 ||
+        setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &tx_req, sizeof(tx_req)) < 0) {
+        DEVICE_FATAL("Can't set up the rings of the AF_PACKET socket: %s", strerror(errno));
+        close(fd);
+        return NET_ERR_DEVICE_INIT;
+    }
+
+    // 2. Map both rings at once, RX ring first
+    size_t rx_len = (size_t)rx_req.tp_block_size * rx_req.tp_block_nr;
+    size_t tx_len = (size_t)tx_req.tp_block_size * tx_req.tp_block_nr;
+    uint8_t* map = mmap(NULL, rx_len + tx_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (map == MAP_FAILED) {
+        DEVICE_FATAL("Can't map the rings of the AF_PACKET socket: %s", strerror(errno));
+        close(fd);
+        return NET_ERR_DEVICE_INIT;
+    }
+
+    // 3. Attach to the interface, and spread the flows across the queues
+    struct sockaddr_ll addr = {
+        .sll_family   = AF_PACKET,
+        .sll_protocol = htons(ETH_P_ALL),
+        .sll_ifindex  = if_index,
+    };
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        DEVICE_FATAL("Can't bind the AF_PACKET socket to %s: %s", if_name, strerror(errno));
+        munmap(map, rx_len + tx_len);
+        close(fd);
+        return NET_ERR_DEVICE_INIT;
+    }
+    if (queue_num > 1) {
+        int fanout = (getpid() & 0xFFFF) | (PACKET_FANOUT_HASH << 16);
+        if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) < 0) {
+            DEVICE_FATAL("Can't join the fanout group of %s: %s", if_name, strerror(errno));
+            munmap(map, rx_len + tx_len);
+            close(fd);
+            return NET_ERR_DEVICE_INIT;
+        }
+    }
+
+    // 4. Optional: don't see what we (or others) send, and skip the qdisc
+    int one = 1;
+    if (setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one)) < 0) {
+        DEVICE_WARN("Can't ignore the outgoing frames, filter them by ourself: %s", strerror(errno));
+    }
+    if (setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one)) < 0) {
+        DEVICE_WARN("Can't bypass the qdisc: %s", strerror(errno));
+    }
+
+    DevicePacket* ring = aligned_alloc(ATOMIC_ISOLATION, sizeof(DevicePacket));
+    assert(ring);
+    memset(ring, 0x00, sizeof(DevicePacket));
+    *ring = (DevicePacket) {
+        .map           = map,
+        .map_len       = rx_len + tx_len,
+        .rx_ring       = map,
+        .rx_block_num  = rx_req.tp_block_nr,
+        .rx_block_size = rx_req.tp_block_size,
+        .rx_current    = 0,
+        .rx_block      = NULL,
+        .rx_pkts_left  = 0,
+        .rx_pkt        = NULL,
+        .tx_ring       = map + rx_len,
+        .tx_frame_num  = tx_req.tp_frame_nr,
+        .tx_frame_size = tx_req.tp_frame_size,
+        .tx_current    = 0,
+    };
+    pthread_spin_init(&ring->tx_lock, PTHREAD_PROCESS_PRIVATE);
+    atomic_init(&ring->tx_pending, 0);
+
+    queue->fd   = fd;
+    queue->priv = ring;
+
+    DEVICE_NOTE("AF_PACKET queue %d attached to %s (index %d): %d RX blocks of %d KiB, %d TX slots",
+                queue->id, if_name, if_index, ring->rx_block_num, ring->rx_block_size / 1024, ring->tx_frame_num);
+    return SYS_ERR_OK;
+}
+
+static void packet_close(DeviceQueue* queue) {
+    assert(queue);
+    DevicePacket* ring = queue->priv;
+    if (ring == NULL) return;
+
+    munmap(ring->map, ring->map_len);
+    pthread_spin_destroy(&ring->tx_lock);
+
+    DEVICE_NOTE("AF_PACKET rings of queue %d unmapped", queue->id);
+
+    free(ring);
+}
+
+/// @brief  Ask the kernel to send every slot marked as TP_STATUS_SEND_REQUEST
+static void packet_kick(DeviceQueue* queue) {
+    if (sendto(queue->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+        errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) {
+        DEVICE_ERR("Kick the TX ring of queue %d failed: %s", queue->id, strerror(errno));
+    }
+}
+
+/// @brief  Copy the frames to the next TX slots, and kick the kernel once for all of them, the caller keeps its buffers
+static size_t packet_tx_burst(DeviceQueue* queue, Buffer* bufs, size_t count) {
+    assert(queue && queue->priv);
+    DevicePacket* ring = queue->priv;
+
+    // 1. Slots must be filled in order, the kernel stops at the first one not requested
+    size_t filled = 0;
+    pthread_spin_lock(&ring->tx_lock);
+    for (; filled < count; filled++) {
+        Buffer buf = bufs[filled];
+        if (buf.valid_size > ring->tx_frame_size - TX_DATA_OFFSET) {
+            DEVICE_ERR("Frame of %d bytes doesn't fit in a TX slot of queue %d", buf.valid_size, queue->id);
+            break;
+        }
+
+        struct tpacket3_hdr* frame = tx_frame(ring, ring->tx_current);
+        if (__atomic_load_n(&frame->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+            DEVICE_WARN("The TX ring of queue %d is full, drop %d frames", queue->id, count - filled);
+            break;
+        }
+        memcpy((uint8_t*)frame + TX_DATA_OFFSET, buf.data, buf.valid_size);
+        frame->tp_len     = buf.valid_size;
+        frame->tp_snaplen = buf.valid_size;
+        __atomic_store_n(&frame->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+        ring->tx_current = (ring->tx_current + 1) % ring->tx_frame_num;
+    }
+    pthread_spin_unlock(&ring->tx_lock);
+
+    // 2. Only one thread kicks, for all the frames marked before it reads tx_pending,
+    //    the frames marked during the kick make it kick again. A full ring needs a kick too
+    if (atomic_fetch_add_explicit(&ring->tx_pending, 1, memory_order_acq_rel) == 0) {
+        size_t kicked;
+        do {
+            kicked = atomic_load_explicit(&ring->tx_pending, memory_order_acquire);
+            packet_kick(queue);
+        } while (atomic_fetch_sub_explicit(&ring->tx_pending, kicked, memory_order_acq_rel) != kicked);
+    }
+
+    return filled;
+}
+
+/// @brief  Give the current block back to the kernel, and move to the next one
+static void release_block(DevicePacket* ring) {
+    __atomic_store_n(&ring->rx_block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    ring->rx_block   = NULL;
+    ring->rx_current = (ring->rx_current + 1) % ring->rx_block_num;
+}
+
+/// @brief  Wait until the kernel hands us a block (or retires one after the timeout)
+static errval_t packet_rx_wait(DeviceQueue* queue) {
+    assert(queue && queue->priv);
+    DevicePacket* ring = queue->priv;
+
+    // A block is still being walked, or the next one is ready
+    if (ring->rx_block != NULL) return SYS_ERR_OK;
+    struct tpacket_block_desc* block = rx_block(ring, ring->rx_current);
+    if (__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) return SYS_ERR_OK;
+
+    struct pollfd pfd[1];
+    pfd[0].fd = queue->fd;
+    pfd[0].events = POLLIN | POLLERR;
+
+    int ret = poll(pfd, 1, queue->device->poll_timeout);
+    if (ret < 0 && errno != EINTR) {
+        DEVICE_ERR("poll on queue %d faild %s", queue->id, strerror(errno));
+        return NET_ERR_DEVICE_FAIL_POLL;
+    }
+    return SYS_ERR_OK;
+}
+
+/// @brief  Copy the frames of the ready blocks into the memory pool, a block may be left half walked for the next burst
+static size_t packet_rx_burst(DeviceQueue* queue, Buffer* bufs, size_t max) {
+    assert(queue && queue->priv);
+    DevicePacket* ring = queue->priv;
+    size_t count = 0;
+
+    while (count < max) {
+        if (ring->rx_block == NULL) {
+            struct tpacket_block_desc* block = rx_block(ring, ring->rx_current);
+            if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) break;
+
+            ring->rx_block     = block;
+            ring->rx_pkts_left = block->hdr.bh1.num_pkts;
+            ring->rx_pkt       = (uint8_t*)block + block->hdr.bh1.offset_to_first_pkt;
+        }
+        if (ring->rx_pkts_left == 0) {
+            release_block(ring);
+            continue;
+        }
+
+        struct tpacket3_hdr* pkt = (struct tpacket3_hdr*)ring->rx_pkt;
+        struct sockaddr_ll*  sll = (struct sockaddr_ll*)(ring->rx_pkt + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+        ring->rx_pkt       += pkt->tp_next_offset;
+        ring->rx_pkts_left -= 1;
+
+        if (sll->sll_pkttype == PACKET_OUTGOING) continue;
+        if (pkt->tp_snaplen > ETHER_MAX_SIZE || pkt->tp_snaplen != pkt->tp_len) {
+            DEVICE_ERR("Frame of %d bytes (captured %d) is too large for us", pkt->tp_len, pkt->tp_snaplen);
+            queue->fail_process += 1;
+            continue;
+        }
+
+        Buffer frame = device_alloc_rx_buffer(queue->device);
+        if (frame.data == NULL) {
+            queue->rx_shed += 1;
+            continue;
+        }
+        memcpy(frame.data, (uint8_t*)pkt + pkt->tp_mac, pkt->tp_snaplen);
+        frame.valid_size = pkt->tp_snaplen;
+        // Verified by the NIC, or generated locally and never hit the wire
+        if (pkt->tp_status & (TP_STATUS_CSUM_VALID | TP_STATUS_CSUMNOTREADY)) {
+            frame.offload |= BUFFER_CSUM_VALID;
+        }
+        bufs[count++] = frame;
+    }
+
+    // Don't hold an exhausted block until the next wakeup
+    if (ring->rx_block != NULL && ring->rx_pkts_left == 0) release_block(ring);
+    return count;
+}
+
+static void packet_stats(DeviceQueue* queue) {
+    struct tpacket_stats_v3 stats = { 0 };
+    socklen_t len = sizeof(stats);
+    // Reading the statistics resets them, we only do it once
+    if (getsockopt(queue->fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) < 0) {
+        DEVICE_ERR("Can't get the statistics of queue %d: %s", queue->id, strerror(errno));
+        return;
+    }
+    DEVICE_INFO("  Queue %d (AF_PACKET): Kernel received %u, Dropped %u, Ring frozen %u times",
+                queue->id, stats.tp_packets, stats.tp_drops, stats.tp_freeze_q_cnt);
+}
+
+const DeviceOps packet_ops = {
+    .name     = "packet",
+    .caps     = DEVICE_CAP_RX_CSUM | DEVICE_CAP_BATCH | DEVICE_CAP_BUSY_POLL,
+    .open     = packet_open,
+    .close    = packet_close,
+    .rx_wait  = packet_rx_wait,
+    .rx_burst = packet_rx_burst,
+    .tx_burst = packet_tx_burst,
+    .get_mac  = device_ioctl_mac,
+    .stats    = packet_stats,
+    .wakeup   = NULL,
+    .tx_chain = NULL,
+};
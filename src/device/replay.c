@@ -0,0 +1,330 @@
+#include <device/replay.h>
+#include <device/device.h>
+#include <netutil/htons.h>
+#include <netutil/ip.h>
+#include <netutil/dump.h>
+
+#include <poll.h>
+#include <time.h>
+#include <errno.h>            //strerror
+#include <stdlib.h>
+#include <string.h>
+
+#include <event/memorypool.h>
+
+static inline uint64_t now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/// @brief  Which queue a frame belongs to: the same pair of IP addresses (in both directions) always goes to the same queue
+static size_t replay_steer(const uint8_t* frame, size_t len, size_t queue_num) {
+    if (queue_num == 1 || len < sizeof(struct eth_hdr)) return 0;
+
+    const struct eth_hdr* ether = (const struct eth_hdr*)frame;
+    const uint8_t* addrs;
+    size_t addr_len;
+    switch (ntohs(ether->type)) {
+    case ETH_TYPE_IPv4:
+        if (len < sizeof(struct eth_hdr) + sizeof(struct ip_hdr)) return 0;
+        addrs    = frame + sizeof(struct eth_hdr) + offsetof(struct ip_hdr, src);
+        addr_len = sizeof(uint32_t);
+        break;
+    case ETH_TYPE_IPv6:
+        if (len < sizeof(struct eth_hdr) + sizeof(struct ipv6_hdr)) return 0;
+        addrs    = frame + sizeof(struct eth_hdr) + offsetof(struct ipv6_hdr, src);
+        addr_len = sizeof(ipv6_addr_t);
+        break;
+    default:
+        return 0;   // ARP, NDP goes with IPv6
+    }
+
+    // Symmetric: sum the hashes of source and destination
+    uint64_t hash = 0;
+    for (size_t i = 0; i < 2; i++) {
+        uint64_t h = 0xcbf29ce484222325ULL;     // FNV-1a
+        for (size_t j = 0; j < addr_len; j++) {
+            h = (h ^ addrs[i * addr_len + j]) * 0x100000001b3ULL;
+        }
+        hash += h;
+    }
+    return (size_t)(hash % queue_num);
+}
+
+/// @brief  Guess our MAC address: the destination of the first unicast frame
+static mac_addr replay_guess_mac(PcapReader* reader) {
+    // Locally administered, if the capture doesn't tell
+    mac_addr mac = {{ 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 }};
+
+    uint8_t frame[ETHER_MAX_SIZE];
+    size_t len, wire_len;
+    uint64_t ts;
+    for (size_t i = 0; i < DEVICE_REPLAY_MAC_PROBE; i++) {
+        errval_t err = pcap_reader_next(reader, frame, sizeof(frame), &len, &wire_len, &ts);
+        if (err_no(err) == NET_ERR_PCAP_TOO_LARGE) continue;
+        if (err_is_fail(err)) break;
+        if (len < sizeof(struct eth_hdr)) continue;
+        if ((frame[0] & 0x01) == 0) {
+            mac = mem2mac(frame);
+            break;
+        }
+    }
+    return mac;
+}
+
+static errval_t replay_open(DeviceQueue* queue, const DeviceConfig* config) {
+    assert(queue && config);
+    errval_t err;
+
+    if (config->pcap_path == NULL) {
+        DEVICE_FATAL("The pcap backend needs a file to replay");
+        return NET_ERR_DEVICE_INIT;
+    }
+
+    DeviceReplay* replay = calloc(1, sizeof(DeviceReplay)); assert(replay);
+    err = pcap_reader_open(&replay->reader, config->pcap_path);
+    if (err_is_fail(err)) {
+        DEVICE_FATAL("Can't open %s for queue %d", config->pcap_path, queue->id);
+        free(replay);
+        DEBUG_FAIL_RETURN(err, "Can't open the capture to replay");
+    }
+
+    replay->mac = replay_guess_mac(&replay->reader);
+    err = pcap_reader_rewind(&replay->reader);
+    if (err_is_fail(err)) {
+        pcap_reader_close(&replay->reader);
+        free(replay);
+        DEBUG_FAIL_RETURN(err, "Can't rewind the capture to replay");
+    }
+
+    replay->speed       = config->replay_speed;
+    replay->loops       = config->replay_loops;
+    replay->pending     = NULL_BUFFER;
+    replay->has_pending = false;
+
+    // Queue 0 owns the sink, the others are opened after it
+    if (queue->id == 0 && config->tx_sink) {
+        ReplaySink* sink = calloc(1, sizeof(ReplaySink)); assert(sink);
+        err = pcap_writer_open(&sink->writer, config->tx_sink, ETHER_MAX_SIZE);
+        if (err_is_fail(err)) {
+            DEVICE_FATAL("Can't create the TX sink %s: %s", config->tx_sink, strerror(errno));
+            free(sink);
+            pcap_reader_close(&replay->reader);
+            free(replay);
+            return err;
+        }
+        pthread_mutex_init(&sink->lock, NULL);
+        replay->sink = sink;
+    } else if (queue->id > 0) {
+        replay->sink = ((DeviceReplay*)queue->device->queues[0].priv)->sink;
+    }
+
+    queue->priv = replay;
+
+    if (queue->id == 0) {
+        char mac_str[MAC_ADDRESTRLEN];
+        format_mac_address(&replay->mac, mac_str, sizeof(mac_str));
+        DEVICE_NOTE("Replay %s (%s) as %s, speed %.2f (0: as fast as possible), %d loop(s) (0: forever), TX sink: %s",
+                    config->pcap_path, replay->reader.is_ng ? "pcapng" : "pcap", mac_str,
+                    replay->speed, replay->loops, config->tx_sink ? config->tx_sink : "none");
+    }
+    return SYS_ERR_OK;
+}
+
+static void replay_close(DeviceQueue* queue) {
+    DeviceReplay* replay = queue->priv; assert(replay);
+
+    if (replay->pending.data) free_buffer(replay->pending);
+    pcap_reader_close(&replay->reader);
+
+    if (queue->id == 0 && replay->sink) {
+        DEVICE_NOTE("TX sink closed, %zu frames written", replay->sink->written);
+        pcap_writer_close(&replay->sink->writer);
+        pthread_mutex_destroy(&replay->sink->lock);
+        free(replay->sink);
+    }
+    free(replay);
+}
+
+static void replay_report(DeviceQueue* queue) {
+    DeviceReplay* replay = queue->priv;
+    double elapsed = (double)(now_ns(CLOCK_MONOTONIC) - replay->start_wall) / 1E9;
+    if (elapsed <= 0) elapsed = 1E-9;
+
+    DEVICE_NOTE("Replay of queue %d done after %zu pass(es): %zu frames, %zu bytes in %.3f seconds, %.0f pps, %.1f Mbps",
+                queue->id, replay->pass, replay->frames, replay->bytes, elapsed,
+                replay->frames / elapsed, replay->bytes * 8 / elapsed / 1E6);
+}
+
+/// @brief  Read the next frame of this queue into replay->pending, go to the next pass at the end of the file
+/// @return false if the replay is done
+static bool replay_next(DeviceQueue* queue) {
+    DeviceReplay* replay = queue->priv;
+    errval_t err;
+    // Shed by the memory pool: the frame is still read, and lost as on the wire
+    uint8_t discard[MEMPOOL_BYTES - DEVICE_HEADER_RESERVE];
+
+    while (!replay->done) {
+        if (replay->pending.data == NULL) {
+            replay->pending = device_alloc_rx_buffer(queue->device);
+        }
+        bool shed = (replay->pending.data == NULL);
+        uint8_t* data = shed ? discard : replay->pending.data;
+
+        size_t len, wire_len;
+        uint64_t ts;
+        err = pcap_reader_next(&replay->reader, data, shed ? sizeof(discard) : replay->pending.valid_size, &len, &wire_len, &ts);
+        switch (err_no(err)) {
+        case SYS_ERR_OK:
+            break;
+        case NET_ERR_PCAP_TOO_LARGE:
+            replay->too_large += 1;
+            continue;
+        case NET_ERR_PCAP_EOF:
+            replay->pass += 1;
+            if ((replay->loops != 0 && replay->pass >= replay->loops) || replay->pass_frames == 0) {
+                replay->done = true;
+                replay_report(queue);
+                break;
+            }
+            replay->pass_frames = 0;
+            replay->base_set    = false;
+            err = pcap_reader_rewind(&replay->reader);
+            if (err_is_fail(err)) {
+                DEVICE_ERR("Can't rewind the capture of queue %d", queue->id);
+                replay->done = true;
+            }
+            continue;
+        default:
+            DEBUG_ERR(err, "Can't read the capture of queue %d, stop the replay", queue->id);
+            replay->done = true;
+            continue;
+        }
+        if (replay->done) break;
+
+        replay->pass_frames += 1;
+        // Truncated by the snap length, the stack would see broken headers
+        if (len < wire_len) {
+            replay->truncated += 1;
+            continue;
+        }
+        if (replay_steer(data, len, queue->device->queue_num) != queue->id) continue;
+        if (shed) {
+            queue->rx_shed += 1;
+            continue;
+        }
+
+        if (!replay->base_set) {
+            replay->base_set  = true;
+            replay->base_ts   = ts;
+            replay->base_wall = now_ns(CLOCK_MONOTONIC);
+        }
+        replay->pending.valid_size = (uint32_t)len;
+        replay->pending_ts  = ts;
+        replay->has_pending = true;
+        return true;
+    }
+
+    if (replay->pending.data) free_buffer(replay->pending);
+    replay->pending = NULL_BUFFER;
+    return false;
+}
+
+/// @brief  When the pending frame should be injected, on CLOCK_MONOTONIC
+static uint64_t replay_due(DeviceReplay* replay) {
+    if (replay->speed <= 0 || replay->pending_ts <= replay->base_ts) return replay->base_wall;
+    return replay->base_wall + (uint64_t)((double)(replay->pending_ts - replay->base_ts) / replay->speed);
+}
+
+static errval_t replay_rx_wait(DeviceQueue* queue) {
+    DeviceReplay* replay = queue->priv;
+    if (replay->start_wall == 0) replay->start_wall = now_ns(CLOCK_MONOTONIC);
+
+    // Nothing more to inject, behave like an idle device
+    if (!replay->has_pending && !replay_next(queue)) {
+        poll(NULL, 0, queue->device->poll_timeout);
+        return SYS_ERR_OK;
+    }
+
+    if (replay->speed > 0) {
+        uint64_t due = replay_due(replay);
+        struct timespec ts = {
+            .tv_sec  = (time_t)(due / 1000000000ULL),
+            .tv_nsec = (long)(due % 1000000000ULL),
+        };
+        // Interrupted: the burst will find nothing (or something) due
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    return SYS_ERR_OK;
+}
+
+static size_t replay_rx_burst(DeviceQueue* queue, Buffer* bufs, size_t max) {
+    DeviceReplay* replay = queue->priv;
+    size_t count = 0;
+
+    // As fast as possible, we may never come back to rx_wait() until the end
+    pthread_testcancel();
+    // Busy-poll may get here before rx_wait()
+    if (replay->start_wall == 0) replay->start_wall = now_ns(CLOCK_MONOTONIC);
+
+    uint64_t now = (replay->speed > 0) ? now_ns(CLOCK_MONOTONIC) : 0;
+    while (count < max) {
+        if (!replay->has_pending && !replay_next(queue)) break;
+        if (replay->speed > 0 && replay_due(replay) > now) break;
+
+        replay->frames += 1;
+        replay->bytes  += replay->pending.valid_size;
+        bufs[count++] = replay->pending;
+        replay->pending     = NULL_BUFFER;
+        replay->has_pending = false;
+    }
+    return count;
+}
+
+/// @brief  Nothing goes on a wire, the frames are counted, or recorded in the sink
+static size_t replay_tx_burst(DeviceQueue* queue, Buffer* bufs, size_t count) {
+    DeviceReplay* replay = queue->priv;
+    ReplaySink* sink = replay->sink;
+    if (sink == NULL) return count;
+
+    uint64_t now = now_ns(CLOCK_REALTIME);
+    pthread_mutex_lock(&sink->lock);
+    for (size_t i = 0; i < count; i++) {
+        errval_t err = pcap_writer_write(&sink->writer, bufs[i].data, bufs[i].valid_size, now);
+        if (err_is_fail(err)) {
+            pthread_mutex_unlock(&sink->lock);
+            DEVICE_ERR("Can't write to the TX sink: %s", strerror(errno));
+            return i;
+        }
+        sink->written += 1;
+    }
+    pthread_mutex_unlock(&sink->lock);
+    return count;
+}
+
+static errval_t replay_get_mac(DeviceQueue* queue, mac_addr* ret_mac) {
+    DeviceReplay* replay = queue->priv; assert(replay && ret_mac);
+    *ret_mac = replay->mac;
+    return SYS_ERR_OK;
+}
+
+static void replay_stats(DeviceQueue* queue) {
+    DeviceReplay* replay = queue->priv;
+    DEVICE_INFO("  Queue %d (pcap): Injected %zu frames in %zu pass(es), Skipped %zu too large and %zu truncated",
+                queue->id, replay->frames, replay->pass, replay->too_large, replay->truncated);
+}
+
+const DeviceOps replay_ops = {
+    .name     = "pcap",
+    .caps     = DEVICE_CAP_BATCH | DEVICE_CAP_BUSY_POLL,
+    .open     = replay_open,
+    .close    = replay_close,
+    .rx_wait  = replay_rx_wait,
+    .rx_burst = replay_rx_burst,
+    .tx_burst = replay_tx_burst,
+    .get_mac  = replay_get_mac,
+    .stats    = replay_stats,
+    .wakeup   = NULL,
+    .tx_chain = NULL,
+};
@@ -0,0 +1,163 @@
+#include <device/rss.h>
+#include <device/device.h>
+#include <netutil/htons.h>
+#include <netutil/ip.h>
+
+#include <string.h>
+
+errval_t rss_init(DeviceRss* rss, size_t workers) {
+    assert(rss);
+    if (workers == 0 || workers > RSS_MAX_WORKERS) {
+        DEVICE_FATAL("Frames can be steered to 1 to %d workers, not %d", RSS_MAX_WORKERS, workers);
+        return SYS_ERR_WRONG_CONFIG;
+    }
+    rss->workers = workers;
+    rss->moves   = 0;
+    for (size_t i = 0; i < RSS_TABLE_SIZE; i++) {
+        atomic_init(&rss->table[i], (uint16_t)(i % workers));
+        atomic_init(&rss->hits[i], 0);
+    }
+    DEVICE_NOTE("RSS: %d buckets steered to %d workers", RSS_TABLE_SIZE, workers);
+    return SYS_ERR_OK;
+}
+
+/// @brief  Cheaper than Toeplitz, only the same flow has to give the same hash
+static inline uint32_t hash_words(uint32_t hash, const uint8_t* data, size_t words) {
+    for (size_t i = 0; i < words; i++) {
+        uint32_t word;
+        memcpy(&word, data + i * sizeof(uint32_t), sizeof(uint32_t));
+        hash = (hash ^ word) * 0x9E3779B1U;
+        hash = (hash << 13) | (hash >> 19);
+    }
+    return hash;
+}
+
+/// @brief  Final avalanche (murmur3), every bit of the input moves the low bits indexing the table
+static inline uint32_t hash_finish(uint32_t hash) {
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6BU;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35U;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static inline bool has_ports(uint8_t proto) {
+    return proto == IP_PROTO_TCP || proto == IP_PROTO_UDP;
+}
+
+uint32_t rss_hash(const uint8_t* frame, size_t len) {
+    assert(frame);
+    if (len < sizeof(struct eth_hdr)) return 0;
+    const struct eth_hdr* ether = (const struct eth_hdr*)frame;
+    const uint8_t* l3 = frame + sizeof(struct eth_hdr);
+    len -= sizeof(struct eth_hdr);
+
+    uint32_t hash = 0;
+    switch (ntohs(ether->type)) {
+    case ETH_TYPE_IPv4:
+    {
+        if (len < sizeof(struct ip_hdr)) return 0;
+        const struct ip_hdr* ip = (const struct ip_hdr*)l3;
+        size_t ihl = (size_t)ip->ihl * 4;
+        // Addresses, then the protocol
+        hash = hash_words(hash, l3 + offsetof(struct ip_hdr, src), 2);
+        hash = hash_words(hash, (const uint8_t[4]){ ip->proto }, 1);
+        // Only the first fragment has the ports, all of them go to the assembler of the same worker
+        bool fragment = (ntohs(ip->offset) & (IP_MF | IP_OFFMASK)) != 0;
+        if (!fragment && has_ports(ip->proto) && ihl >= IP_LEN_MIN && len >= ihl + sizeof(uint32_t)) {
+            hash = hash_words(hash, l3 + ihl, 1);
+        }
+        break;
+    }
+    case ETH_TYPE_IPv6:
+    {
+        if (len < sizeof(struct ipv6_hdr)) return 0;
+        const struct ipv6_hdr* ip = (const struct ipv6_hdr*)l3;
+        hash = hash_words(hash, l3 + offsetof(struct ipv6_hdr, src), 2 * sizeof(ipv6_addr_t) / sizeof(uint32_t));
+        // The sender tells the flow, no need to look for the ports behind the extension headers
+        uint32_t label = IP6H_FL(ip);
+        if (label != 0) {
+            hash = hash_words(hash, (const uint8_t*)&label, 1);
+        } else if (has_ports(ip->next_header) && len >= sizeof(struct ipv6_hdr) + sizeof(uint32_t)) {
+            hash = hash_words(hash, l3 + sizeof(struct ipv6_hdr), 1);
+        }
+        break;
+    }
+    default:
+        return 0;   // ARP, and the others
+    }
+    return hash_finish(hash);
+}
+
+void rss_move(DeviceRss* rss, size_t bucket, size_t worker) {
+    assert(rss && bucket < RSS_TABLE_SIZE && worker < rss->workers);
+    size_t from = atomic_exchange_explicit(&rss->table[bucket], (uint16_t)worker, memory_order_relaxed);
+    if (from == worker) return;
+    rss->moves += 1;
+    DEVICE_INFO("RSS: bucket %d moved from worker %d to %d", bucket, from, worker);
+}
+
+size_t rss_rebalance(DeviceRss* rss) {
+    assert(rss);
+    size_t hits[RSS_TABLE_SIZE];
+    size_t load[RSS_MAX_WORKERS] = { 0 };
+    size_t total = 0;
+    for (size_t i = 0; i < RSS_TABLE_SIZE; i++) {
+        hits[i] = atomic_load_explicit(&rss->hits[i], memory_order_relaxed);
+        load[atomic_load_explicit(&rss->table[i], memory_order_relaxed)] += hits[i];
+        total += hits[i];
+    }
+
+    size_t moved = 0;
+    while (total > 0 && moved < RSS_TABLE_SIZE) {
+        size_t hot = 0, cold = 0;
+        for (size_t w = 1; w < rss->workers; w++) {
+            if (load[w] > load[hot])  hot  = w;
+            if (load[w] < load[cold]) cold = w;
+        }
+        if (load[hot] * rss->workers * 100 <= total * RSS_HOT_PERCENT) break;
+
+        // The largest bucket that closes at most half of the gap, else the smallest one that still narrows it
+        size_t gap = load[hot] - load[cold];
+        size_t best = RSS_TABLE_SIZE;
+        for (size_t i = 0; i < RSS_TABLE_SIZE; i++) {
+            if (hits[i] == 0 || hits[i] >= gap) continue;
+            if (atomic_load_explicit(&rss->table[i], memory_order_relaxed) != hot) continue;
+            if (best == RSS_TABLE_SIZE) {
+                best = i;
+            } else if (hits[i] <= gap / 2) {
+                if (hits[best] > gap / 2 || hits[i] > hits[best]) best = i;
+            } else if (hits[best] > gap / 2 && hits[i] < hits[best]) {
+                best = i;
+            }
+        }
+        // A single flow hotter than the others can't be split
+        if (best == RSS_TABLE_SIZE) break;
+
+        rss_move(rss, best, cold);
+        load[hot]  -= hits[best];
+        load[cold] += hits[best];
+        moved += 1;
+    }
+
+    // The past counts less and less
+    for (size_t i = 0; i < RSS_TABLE_SIZE; i++) {
+        atomic_fetch_sub_explicit(&rss->hits[i], hits[i] / 2, memory_order_relaxed);
+    }
+    return moved;
+}
+
+void rss_report(DeviceRss* rss) {
+    assert(rss);
+    size_t load[RSS_MAX_WORKERS] = { 0 }, buckets[RSS_MAX_WORKERS] = { 0 };
+    for (size_t i = 0; i < RSS_TABLE_SIZE; i++) {
+        size_t worker = atomic_load_explicit(&rss->table[i], memory_order_relaxed);
+        load[worker]    += atomic_load_explicit(&rss->hits[i], memory_order_relaxed);
+        buckets[worker] += 1;
+    }
+    for (size_t w = 0; w < rss->workers; w++) {
+        DEVICE_INFO("  RSS worker %d: %d buckets, %d recent frames", w, buckets[w], load[w]);
+    }
+    DEVICE_NOTE("RSS: %d buckets over %d workers, %d moved by rebalancing", RSS_TABLE_SIZE, rss->workers, rss->moves);
+}
@@ -0,0 +1,314 @@
+#include <device/shm.h>
+#include <device/device.h>
+#include <netutil/dump.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>   //syscall
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>         //strerror
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <event/memorypool.h>
+
+static_assert(DEVICE_SHM_SLOT_SIZE >= ETHER_MTU + sizeof(struct eth_hdr), "A slot can't hold a frame");
+static_assert((DEVICE_SHM_SLOTS & (DEVICE_SHM_SLOTS - 1)) == 0, "The slots of a ring must be power of 2");
+
+static inline size_t wire_size(size_t queue_num) {
+    return sizeof(ShmWire) + 2 * queue_num * sizeof(ShmRing);
+}
+
+/// Shared futex, the other end may be another process
+static inline long futex(atomic_uint* addr, int op, unsigned val, const struct timespec* timeout) {
+    return syscall(SYS_futex, (uint32_t*)addr, op, val, timeout, NULL, 0);
+}
+
+static inline bool ring_empty(const ShmRing* ring) {
+    const ShmCell* cell = &ring->cells[ring->head & (DEVICE_SHM_SLOTS - 1)];
+    return atomic_load_explicit(&cell->seq, memory_order_acquire) != ring->head + 1;
+}
+
+static void ring_init(ShmRing* ring) {
+    atomic_init(&ring->tail, 0);
+    ring->head = 0;
+    atomic_init(&ring->bell, 0);
+    atomic_init(&ring->sleeping, 0);
+    for (size_t i = 0; i < DEVICE_SHM_SLOTS; i++) {
+        atomic_init(&ring->cells[i].seq, i);
+    }
+}
+
+/// @brief  Claim a slot and copy the frame in, false if the ring is full
+static bool ring_push(ShmRing* ring, const uint8_t* data, uint32_t len) {
+    size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (true) {
+        ShmCell* cell = &ring->cells[pos & (DEVICE_SHM_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                cell->len = len;
+                memcpy(cell->data, data, len);
+                atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;   // The receiver hasn't freed it yet
+        } else {
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+}
+
+/// @brief  Wake up the receiver if it sleeps, the frames are already published
+static void ring_kick(ShmRing* ring) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->sleeping, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&ring->bell, 1, memory_order_release);
+        futex(&ring->bell, FUTEX_WAKE, 1, NULL);
+    }
+}
+
+/// @brief  Side 0 creates the wire, side 1 waits for it
+static errval_t wire_map(DeviceShm* shm, size_t queue_id, size_t queue_num) {
+    size_t size = wire_size(queue_num);
+    bool create = (shm->side == 0 && queue_id == 0);
+    int fd = -1;
+
+    if (create) {
+        fd = shm_open(shm->name, O_CREAT | O_TRUNC | O_RDWR, 0600);
+        if (fd < 0 || ftruncate(fd, (off_t)size) < 0) {
+            DEVICE_FATAL("Can't create the shared memory %s: %s", shm->name, strerror(errno));
+            if (fd >= 0) close(fd);
+            return NET_ERR_DEVICE_INIT;
+        }
+    } else {
+        const struct timespec retry = { .tv_sec = 0, .tv_nsec = 10 * 1000 * 1000 };
+        for (int waited = 0; ; waited += 10) {
+            fd = shm_open(shm->name, O_RDWR, 0600);
+            struct stat st;
+            if (fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ShmWire)) break;
+            if (fd >= 0) close(fd);
+            if (waited >= DEVICE_SHM_ATTACH_TIMEOUT) {
+                DEVICE_FATAL("Side 0 of the wire %s doesn't show up, start it first", shm->name);
+                return NET_ERR_DEVICE_INIT;
+            }
+            nanosleep(&retry, NULL);
+        }
+    }
+
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        DEVICE_FATAL("Can't map the shared memory %s: %s", shm->name, strerror(errno));
+        return NET_ERR_DEVICE_INIT;
+    }
+    shm->wire    = map;
+    shm->map_len = size;
+    ShmWire* wire = shm->wire;
+
+    if (create) {
+        memset(wire, 0x00, sizeof(ShmWire));
+        wire->version   = DEVICE_SHM_VERSION;
+        wire->queue_num = (uint32_t)queue_num;
+        wire->slots     = DEVICE_SHM_SLOTS;
+        for (size_t i = 0; i < 2 * queue_num; i++) ring_init(&wire->rings[i]);
+        atomic_store_explicit(&wire->magic, DEVICE_SHM_MAGIC, memory_order_release);
+        return SYS_ERR_OK;
+    }
+
+    // Mapped before the rings are ready
+    const struct timespec retry = { .tv_sec = 0, .tv_nsec = 1000 * 1000 };
+    for (int waited = 0; atomic_load_explicit(&wire->magic, memory_order_acquire) != DEVICE_SHM_MAGIC; waited++) {
+        if (waited >= DEVICE_SHM_ATTACH_TIMEOUT) {
+            DEVICE_FATAL("The wire %s is never initialized", shm->name);
+            munmap(map, size);
+            return NET_ERR_DEVICE_INIT;
+        }
+        nanosleep(&retry, NULL);
+    }
+    if (wire->version != DEVICE_SHM_VERSION || wire->slots != DEVICE_SHM_SLOTS || wire->queue_num != queue_num) {
+        DEVICE_FATAL("The wire %s (version %d, %d slots, %d queues) doesn't match ours (version %d, %d slots, %d queues)",
+                     shm->name, wire->version, wire->slots, wire->queue_num, DEVICE_SHM_VERSION, DEVICE_SHM_SLOTS, queue_num);
+        munmap(map, size);
+        return NET_ERR_DEVICE_INIT;
+    }
+    return SYS_ERR_OK;
+}
+
+static errval_t shm_open_queue(DeviceQueue* queue, const DeviceConfig* config) {
+    assert(queue && config);
+    errval_t err;
+
+    if (config->shm_side != 0 && config->shm_side != 1) {
+        DEVICE_FATAL("The side of the wire should be 0 or 1, not %d", config->shm_side);
+        return NET_ERR_DEVICE_INIT;
+    }
+    size_t mtu = (config->mtu == 0) ? ETHER_MTU : config->mtu;
+    if (mtu < 68 || mtu > ETHER_MTU) {
+        DEVICE_FATAL("The MTU %d of the wire should be in [68, %d]", mtu, ETHER_MTU);
+        return NET_ERR_DEVICE_INIT;
+    }
+
+    DeviceShm* shm = calloc(1, sizeof(DeviceShm)); assert(shm);
+    snprintf(shm->name, sizeof(shm->name), "%s", config->shm_name ? config->shm_name : DEVICE_SHM_DEFAULT_NAME);
+    shm->side = config->shm_side;
+    shm->mtu  = (uint16_t)mtu;
+    // Locally administered, different on each end, if not given
+    shm->mac  = maccmp(config->mac, MAC_NULL) ? (mac_addr) {{ 0x02, 0x00, 0x00, 0x00, 0x00, (uint8_t)(0x0A + shm->side) }} : config->mac;
+    atomic_init(&shm->tx_too_large, 0);
+    atomic_init(&shm->tx_full, 0);
+
+    err = wire_map(shm, queue->id, config->queue_num);
+    if (err_is_fail(err)) {
+        free(shm);
+        DEBUG_FAIL_RETURN(err, "Can't attach queue %d to the wire %s", queue->id, config->shm_name);
+    }
+    shm->tx = &shm->wire->rings[2 * queue->id + shm->side];
+    shm->rx = &shm->wire->rings[2 * queue->id + (1 - shm->side)];
+
+    if (queue->id == 0) {
+        ShmEnd* end = &shm->wire->ends[shm->side];
+        end->mac = shm->mac;
+        end->mtu = shm->mtu;
+        atomic_store_explicit(&end->attached, true, memory_order_release);
+
+        char mac_str[MAC_ADDRESTRLEN];
+        format_mac_address(&shm->mac, mac_str, sizeof(mac_str));
+        DEVICE_NOTE("Side %d of the wire %s as %s, MTU %d, %d slots per direction per queue",
+                    shm->side, shm->name, mac_str, shm->mtu, DEVICE_SHM_SLOTS);
+    }
+
+    queue->fd   = -1;
+    queue->priv = shm;
+    return SYS_ERR_OK;
+}
+
+static void shm_close(DeviceQueue* queue) {
+    DeviceShm* shm = queue->priv; assert(shm);
+
+    if (queue->id == 0) {
+        atomic_store_explicit(&shm->wire->ends[shm->side].attached, false, memory_order_release);
+        // The creator removes the name, the mapping of the other end stays valid
+        if (shm->side == 0) shm_unlink(shm->name);
+    }
+    munmap(shm->wire, shm->map_len);
+    free(shm);
+}
+
+static errval_t shm_rx_wait(DeviceQueue* queue) {
+    DeviceShm* shm = queue->priv;
+    ShmRing* ring = shm->rx;
+    if (!ring_empty(ring)) return SYS_ERR_OK;
+
+    // Announce that we sleep, then check again, a sender either sees us sleeping or we see its frame
+    unsigned bell = atomic_load_explicit(&ring->bell, memory_order_acquire);
+    atomic_store_explicit(&ring->sleeping, 1, memory_order_seq_cst);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (ring_empty(ring)) {
+        int timeout_ms = queue->device->poll_timeout;
+        struct timespec timeout = {
+            .tv_sec  = timeout_ms / 1000,
+            .tv_nsec = (long)(timeout_ms % 1000) * 1000000,
+        };
+        long ret = futex(&ring->bell, FUTEX_WAIT, bell, (timeout_ms < 0) ? NULL : &timeout);
+        if (ret < 0 && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT) {
+            atomic_store_explicit(&ring->sleeping, 0, memory_order_relaxed);
+            DEVICE_ERR("futex on queue %d failed: %s", queue->id, strerror(errno));
+            return NET_ERR_DEVICE_FAIL_POLL;
+        }
+    }
+    atomic_store_explicit(&ring->sleeping, 0, memory_order_relaxed);
+
+    // futex() isn't a cancellation point
+    pthread_testcancel();
+    return SYS_ERR_OK;
+}
+
+/// @brief  Copy the frames out of the ring into the memory pool, and give the slots back to the senders
+static size_t shm_rx_burst(DeviceQueue* queue, Buffer* bufs, size_t max) {
+    DeviceShm* shm = queue->priv;
+    ShmRing* ring = shm->rx;
+    size_t count = 0;
+
+    while (count < max && !ring_empty(ring)) {
+        ShmCell* cell = &ring->cells[ring->head & (DEVICE_SHM_SLOTS - 1)];
+        uint32_t len = cell->len;
+
+        if (len > shm->mtu + sizeof(struct eth_hdr)) {
+            shm->rx_too_large += 1;
+        } else {
+            Buffer frame = device_alloc_rx_buffer(queue->device);
+            if (frame.data == NULL) {
+                queue->rx_shed += 1;
+            } else {
+                memcpy(frame.data, cell->data, len);
+                frame.valid_size = len;
+                bufs[count++] = frame;
+            }
+        }
+
+        atomic_store_explicit(&cell->seq, ring->head + DEVICE_SHM_SLOTS, memory_order_release);
+        ring->head += 1;
+    }
+    return count;
+}
+
+/// @brief  Push the frames in order, one wakeup for the whole burst
+static size_t shm_tx_burst(DeviceQueue* queue, Buffer* bufs, size_t count) {
+    DeviceShm* shm = queue->priv;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (bufs[i].valid_size > shm->mtu + sizeof(struct eth_hdr)) {
+            atomic_fetch_add_explicit(&shm->tx_too_large, 1, memory_order_relaxed);
+            break;
+        }
+        if (!ring_push(shm->tx, bufs[i].data, bufs[i].valid_size)) {
+            atomic_fetch_add_explicit(&shm->tx_full, 1, memory_order_relaxed);
+            break;
+        }
+    }
+
+    if (i > 0) ring_kick(shm->tx);
+    return i;
+}
+
+static errval_t shm_get_mac(DeviceQueue* queue, mac_addr* ret_mac) {
+    DeviceShm* shm = queue->priv; assert(shm && ret_mac);
+    *ret_mac = shm->mac;
+    return SYS_ERR_OK;
+}
+
+static void shm_stats(DeviceQueue* queue) {
+    DeviceShm* shm = queue->priv;
+    DEVICE_INFO("  Queue %d (shm side %d): Dropped %zu received and %zu sent frames larger than the MTU, Wire full %zu times",
+                queue->id, shm->side, shm->rx_too_large,
+                atomic_load_explicit(&shm->tx_too_large, memory_order_relaxed),
+                atomic_load_explicit(&shm->tx_full, memory_order_relaxed));
+}
+
+/// @brief  Get the RX thread out of futex(), to see its cancellation
+static void shm_wakeup(DeviceQueue* queue) {
+    DeviceShm* shm = queue->priv;
+    atomic_fetch_add_explicit(&shm->rx->bell, 1, memory_order_release);
+    futex(&shm->rx->bell, FUTEX_WAKE, 1, NULL);
+}
+
+const DeviceOps shm_ops = {
+    .name     = "shm",
+    .caps     = DEVICE_CAP_BATCH | DEVICE_CAP_BUSY_POLL,
+    .open     = shm_open_queue,
+    .close    = shm_close,
+    .rx_wait  = shm_rx_wait,
+    .rx_burst = shm_rx_burst,
+    .tx_burst = shm_tx_burst,
+    .get_mac  = shm_get_mac,
+    .stats    = shm_stats,
+    .wakeup   = shm_wakeup,
+    .tx_chain = NULL,
+};
@@ -0,0 +1,173 @@
+#include <device/tap.h>
+#include <device/device.h>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>    //writev
+#include <linux/if_tun.h>
+#include <linux/virtio_net.h>
+#include <poll.h>
+
+#include <unistd.h>
+#include <errno.h>      //strerror
+#include <stdlib.h>
+#include <string.h>
+
+#include <event/memorypool.h>
+#include <event/bufchain.h>
+
+/// @brief  Attach one more queue to the TAP interface, set queue->fd
+errval_t tap_attach(DeviceQueue* queue, const DeviceConfig* config) {
+    assert(queue && config && config->tap_path && config->if_name);
+
+    // Open TAP device, non-blocking so that we can drain it until EAGAIN
+    int tap_fd = open(config->tap_path, O_RDWR | O_NONBLOCK);
+    if (tap_fd < 0) {
+        DEVICE_FATAL("Failed to open %s for queue %d, because %s", config->tap_path, queue->id, strerror(errno));
+        return NET_ERR_DEVICE_INIT;
+    }
+
+    // Flags: IFF_TUN   - TUN device (no Ethernet headers) 
+    //        IFF_TAP   - TAP device  
+    //        IFF_NO_PI - Do not provide packet information  
+    //        IFF_MULTI_QUEUE - Every TUNSETIFF on the same name attaches one more queue
+    //        IFF_VNET_HDR    - Prefix every frame by a struct virtio_net_hdr (checksum and GSO offload)
+    struct ifreq ifr = { 0 };
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI; 
+    if (config->queue_num > 1) ifr.ifr_flags |= IFF_MULTI_QUEUE;
+    if (config->vnet_hdr)      ifr.ifr_flags |= IFF_VNET_HDR;
+    strncpy(ifr.ifr_name, config->if_name, IFNAMSIZ - 1);
+
+    if (ioctl(tap_fd, TUNSETIFF, (void *) &ifr) < 0) {
+        DEVICE_FATAL("ioctl(TUNSETIFF) for queue %d: %s", queue->id, strerror(errno));
+        close(tap_fd);
+        return NET_ERR_DEVICE_INIT;
+    }
+
+    // We only accept partially checksummed frames from the kernel, not TSO ones: they don't fit in the memory pool
+    int hdr_size = sizeof(struct virtio_net_hdr);
+    if (config->vnet_hdr && (ioctl(tap_fd, TUNSETVNETHDRSZ, &hdr_size) < 0 || ioctl(tap_fd, TUNSETOFFLOAD, TUN_F_CSUM) < 0)) {
+        DEVICE_FATAL("ioctl(TUNSETVNETHDRSZ / TUNSETOFFLOAD) for queue %d: %s", queue->id, strerror(errno));
+        close(tap_fd);
+        return NET_ERR_DEVICE_INIT;
+    }
+
+    queue->fd = tap_fd;
+    return SYS_ERR_OK;
+}
+
+static errval_t tap_open(DeviceQueue* queue, const DeviceConfig* config) {
+    errval_t err = tap_attach(queue, config);
+    DEBUG_FAIL_RETURN(err, "Can't attach the queue %d to the TAP device", queue->id);
+
+    TapQueue* tap = calloc(1, sizeof(TapQueue)); assert(tap);
+    tap->spare  = NULL_BUFFER;
+    queue->priv = tap;
+    return SYS_ERR_OK;
+}
+
+static void tap_close(DeviceQueue* queue) {
+    TapQueue* tap = queue->priv; assert(tap);
+    if (tap->spare.data) free_buffer(tap->spare);
+    free(tap);
+}
+
+static errval_t tap_rx_wait(DeviceQueue* queue) {
+    struct pollfd pfd[1];
+    pfd[0].fd = queue->fd;
+    pfd[0].events = POLLIN;
+
+    int ret = poll(pfd, 1, queue->device->poll_timeout);
+    if (ret < 0 && errno != EINTR) {
+        const char *error_msg = strerror(errno);
+        DEVICE_ERR("poll on queue %d faild %s", queue->id, error_msg);
+        return NET_ERR_DEVICE_FAIL_POLL;
+    }
+    // Timeout or interrupted: the burst will find nothing
+    return SYS_ERR_OK;
+}
+
+/// @brief  Read from the (non-blocking) TAP queue until it's drained, or we have max frames
+static size_t tap_rx_burst(DeviceQueue* queue, Buffer* bufs, size_t max) {
+    TapQueue* tap = queue->priv;
+    size_t count = 0, shed = 0;
+
+    while (count + shed < max) {
+        if (tap->spare.data == NULL) {
+            tap->spare = device_alloc_rx_buffer(queue->device);
+        }
+        if (tap->spare.data == NULL) {
+            // Shed: still read the frame out of the kernel, or the queue stays readable
+            uint8_t discard[MEMPOOL_BYTES - DEVICE_HEADER_RESERVE];
+            if (read(queue->fd, discard, sizeof(discard)) <= 0) break;
+            queue->rx_shed += 1;
+            shed += 1;
+            continue;
+        }
+
+        ssize_t nbytes = read(queue->fd, tap->spare.data, tap->spare.valid_size);
+        if (nbytes < 0 && errno == EAGAIN) {    // EWOULDBLOCK is the same on Linux
+            break;  // Drained
+        }
+        if (nbytes <= 0) {
+            const char *error_msg = strerror(errno);
+            DEVICE_ERR("read packet from TAP device queue %d failed: %s, but the loop continue", queue->id, error_msg);
+            break;
+        }
+
+        assert(tap->spare.valid_size == MEMPOOL_BYTES - DEVICE_HEADER_RESERVE);
+        Buffer frame = tap->spare;
+        frame.valid_size = (uint32_t)nbytes;
+        tap->spare = NULL_BUFFER;
+
+        bufs[count++] = frame;
+    }
+    return count;
+}
+
+/// @brief  One write() per frame, a single write() on a TAP fd is atomic, the kernel serialize the writers on the same queue
+static size_t tap_tx_burst(DeviceQueue* queue, Buffer* bufs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        ssize_t written = write(queue->fd, bufs[i].data, (size_t)bufs[i].valid_size);
+        if (written < 0) {
+            const char *error_msg = strerror(errno);
+            DEVICE_ERR("write to TAP device queue %d: %s", queue->id, error_msg);
+            return i;
+        }
+        assert((size_t)written == bufs[i].valid_size);
+    }
+    return count;
+}
+
+/// @brief  One writev() per frame, atomic as a write()
+static errval_t tap_tx_chain(DeviceQueue* queue, const BufChain* chain) {
+    struct iovec iov[BUFCHAIN_MAX_SEGS];
+    for (size_t i = 0; i < chain->count; i++) {
+        iov[i] = (struct iovec) {
+            .iov_base = chain->segs[i].data,
+            .iov_len  = chain->segs[i].valid_size,
+        };
+    }
+    ssize_t written = writev(queue->fd, iov, (int)chain->count);
+    if (written < 0) {
+        const char *error_msg = strerror(errno);
+        DEVICE_ERR("writev to TAP device queue %d: %s", queue->id, error_msg);
+        return NET_ERR_DEVICE_SEND;
+    }
+    assert((size_t)written == chain->len);
+    return SYS_ERR_OK;
+}
+
+const DeviceOps tap_ops = {
+    .name     = "tap",
+    .caps     = DEVICE_CAP_VNET_HDR | DEVICE_CAP_BUSY_POLL,
+    .open     = tap_open,
+    .close    = tap_close,
+    .rx_wait  = tap_rx_wait,
+    .rx_burst = tap_rx_burst,
+    .tx_burst = tap_tx_burst,
+    .get_mac  = device_ioctl_mac,
+    .stats    = NULL,
+    .wakeup   = NULL,
+    .tx_chain = tap_tx_chain,
+};
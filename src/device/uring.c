@@ -0,0 +1,457 @@
+#include <device/uring.h>
+#include <device/device.h>
+#include <device/tap.h>
+#include <netstack/network.h>
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>   //syscall
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>         //strerror
+#include <string.h>
+#include <pthread.h>
+
+#include <event/event.h>
+#include <event/threadpool.h>
+#include <event/memorypool.h>
+
+/// What a completion belongs to, stored in the top byte of user_data
+#define URING_TAG_SHIFT     56
+#define URING_TAG_RX        1ULL
+#define URING_TAG_TX        2ULL
+#define URING_TAG_WAKE      3ULL
+#define URING_TAG_TX_HEAP   4ULL    ///< Larger than any class of the pool, the copy is freed by free()
+#define URING_DATA_MASK     ((1ULL << URING_TAG_SHIFT) - 1)
+
+/// Set in the key of a frame in tx_queue (its size) when the copy comes from the heap
+#define URING_TX_HEAP       (1ULL << 32)
+
+static inline int io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static struct io_uring_sqe* uring_get_sqe(DeviceUring* ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= *ring->sq_entries) return NULL;
+
+    unsigned index = ring->sqe_tail & *ring->sq_mask;
+    ring->sq_array[index] = index;
+    ring->sqe_tail++;
+
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+static void uring_prep_rw(struct io_uring_sqe* sqe, uint8_t opcode, int fd, void* addr, uint32_t len, uint64_t tag, uint64_t data) {
+    sqe->opcode    = opcode;
+    sqe->fd        = fd;
+    sqe->off       = (uint64_t)-1;    // Use (and ignore) the file position, TAP is a character device
+    sqe->addr      = (uint64_t)(uintptr_t)addr;
+    sqe->len       = len;
+    sqe->user_data = (tag << URING_TAG_SHIFT) | (data & URING_DATA_MASK);
+}
+
+/// @brief  Publish the prepared SQEs to the kernel, and optionally wait for at least one completion
+static errval_t uring_submit(DeviceUring* ring, unsigned wait_nr) {
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = ring->sqe_tail - ring->sqe_submitted;
+
+    if (to_submit == 0 && wait_nr == 0) return SYS_ERR_OK;
+
+    int ret = io_uring_enter(ring->ring_fd, to_submit, wait_nr, (wait_nr > 0) ? IORING_ENTER_GETEVENTS : 0);
+    if (ret < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) return SYS_ERR_OK;
+        DEVICE_ERR("io_uring_enter failed: %s", strerror(errno));
+        return NET_ERR_DEVICE_URING;
+    }
+    ring->sqe_submitted += (unsigned)ret;
+    return SYS_ERR_OK;
+}
+
+static void uring_post_rx(DeviceQueue* queue, size_t slot) {
+    DeviceUring* ring = queue->priv;
+    Buffer* buf = &ring->rx_bufs[slot];
+
+    if (buf->data == NULL) {
+        *buf = device_alloc_rx_buffer(queue->device);
+    }
+    // Shed: the slot keeps reading, into the discard area, and asks the pool again on the next frame
+    void*    data = buf->data ? buf->data : ring->discard;
+    uint32_t size = buf->data ? buf->valid_size : (uint32_t)sizeof(ring->discard);
+
+    // We reserved enough entries for every slot, never fails
+    struct io_uring_sqe* sqe = uring_get_sqe(ring); assert(sqe);
+    uring_prep_rw(sqe, IORING_OP_READ, queue->fd, data, size, URING_TAG_RX, slot);
+}
+
+static void uring_post_wake(DeviceUring* ring) {
+    struct io_uring_sqe* sqe = uring_get_sqe(ring); assert(sqe);
+    uring_prep_rw(sqe, IORING_OP_READ, ring->wake_fd, &ring->wake_count, sizeof(uint64_t), URING_TAG_WAKE, 0);
+}
+
+static void uring_close(DeviceQueue* queue);
+
+/// @brief  Attach the queue to the TAP device, and set up an io_uring on it
+static errval_t uring_open(DeviceQueue* queue, const DeviceConfig* config) {
+    assert(queue && config);
+    errval_t err;
+
+    // io_uring keeps rx_batch reads in flight per queue, instead of draining after poll()
+    size_t rx_depth = config->rx_batch;
+    assert(rx_depth > 0 && rx_depth + 1 < DEVICE_URING_ENTRIES);
+
+    err = tap_attach(queue, config);
+    DEBUG_FAIL_RETURN(err, "Can't attach the queue %d to the TAP device", queue->id);
+
+    DeviceUring* ring = aligned_alloc(ATOMIC_ISOLATION, sizeof(DeviceUring));
+    assert(ring);
+    memset(ring, 0x00, sizeof(DeviceUring));
+    ring->ring_fd = -1;
+    ring->wake_fd = -1;
+
+    // 1. io_uring arms its own poll on a blocking file, but returns -EAGAIN for an O_NONBLOCK one
+    int flags = fcntl(queue->fd, F_GETFL);
+    if (flags < 0 || fcntl(queue->fd, F_SETFL, flags & ~O_NONBLOCK) < 0) {
+        DEVICE_FATAL("Can't make the queue %d blocking: %s", queue->id, strerror(errno));
+        free(ring);
+        return NET_ERR_DEVICE_URING;
+    }
+
+    // 2. Create the ring
+    struct io_uring_params params = { 0 };
+    ring->ring_fd = io_uring_setup(DEVICE_URING_ENTRIES, &params);
+    if (ring->ring_fd < 0) {
+        DEVICE_FATAL("io_uring_setup failed: %s", strerror(errno));
+        free(ring);
+        return NET_ERR_DEVICE_URING;
+    }
+
+    // 3. Map the submission queue, completion queue and the SQE array
+    ring->sq_len   = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_len   = params.cq_off.cqes  + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+    ring->sqes   = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        DEVICE_FATAL("Can't map the io_uring: %s", strerror(errno));
+        if (ring->sq_ptr != MAP_FAILED) munmap(ring->sq_ptr, ring->sq_len);
+        if (ring->cq_ptr != MAP_FAILED) munmap(ring->cq_ptr, ring->cq_len);
+        if (ring->sqes   != MAP_FAILED) munmap(ring->sqes, ring->sqes_len);
+        close(ring->ring_fd);
+        free(ring);
+        return NET_ERR_DEVICE_URING;
+    }
+
+    uint8_t* sq = ring->sq_ptr;
+    ring->sq_head    = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail    = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask    = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = (unsigned*)(sq + params.sq_off.ring_entries);
+    ring->sq_array   = (unsigned*)(sq + params.sq_off.array);
+    ring->sqe_tail      = *ring->sq_tail;
+    ring->sqe_submitted = *ring->sq_tail;
+
+    uint8_t* cq = ring->cq_ptr;
+    ring->cq_head    = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail    = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask    = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes       = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // 4. The eventfd for other threads to wake up the owner
+    ring->wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (ring->wake_fd < 0) {
+        DEVICE_FATAL("Can't create the eventfd: %s", strerror(errno));
+        queue->priv = ring;
+        uring_close(queue);
+        queue->priv = NULL;
+        return NET_ERR_DEVICE_URING;
+    }
+
+    // 5. Frames waiting to be sent
+    ring->tx_elems = calloc(DEVICE_URING_TX_QUEUE, sizeof(BQelem));
+    assert(ring->tx_elems);
+    err = bdqueue_init(&ring->tx_queue, ring->tx_elems, DEVICE_URING_TX_QUEUE);
+    if (err_is_fail(err)) {
+        DEVICE_FATAL("Can't initialize the TX queue of io_uring");
+        // Not a queue to drain yet
+        free(ring->tx_elems);
+        ring->tx_elems = NULL;
+        queue->priv = ring;
+        uring_close(queue);
+        queue->priv = NULL;
+        return err_push(err, NET_ERR_DEVICE_URING);
+    }
+
+    // 6. Slots of RX, the buffers are allocated when the loop starts (memory pool isn't ready yet)
+    ring->rx_depth    = rx_depth;
+    ring->rx_bufs     = calloc(rx_depth, sizeof(Buffer));
+    assert(ring->rx_bufs);
+    ring->rx_ready    = calloc(rx_depth, sizeof(Buffer));
+    assert(ring->rx_ready);
+    ring->rx_ready_num = 0;
+    ring->started     = false;
+    ring->tx_inflight = 0;
+    ring->tx_limit    = params.sq_entries - rx_depth - 1;
+    atomic_init(&ring->sleeping, false);
+
+    queue->priv = ring;
+
+    DEVICE_NOTE("io_uring of queue %d set up: %d SQ entries, %d CQ entries, %d reads in flight, at most %d writes in flight",
+                queue->id, params.sq_entries, params.cq_entries, rx_depth, ring->tx_limit);
+    return SYS_ERR_OK;
+}
+
+static void uring_close(DeviceQueue* queue) {
+    assert(queue);
+    DeviceUring* ring = queue->priv;
+    if (ring == NULL) return;
+
+    if (ring->rx_bufs) {
+        for (size_t i = 0; i < ring->rx_depth; i++) {
+            if (ring->rx_bufs[i].data) free_buffer(ring->rx_bufs[i]);
+        }
+        free(ring->rx_bufs);
+    }
+    if (ring->rx_ready) {
+        for (size_t i = 0; i < ring->rx_ready_num; i++) {
+            free_buffer(ring->rx_ready[i]);
+        }
+        free(ring->rx_ready);
+    }
+
+    if (ring->tx_elems) {
+        void *key = NULL, *data = NULL;
+        while (debdqueue(&ring->tx_queue, &key, &data) == SYS_ERR_OK) {
+            if ((uintptr_t)key & URING_TX_HEAP) free(data);
+            else pool_free(queue->device->mempool, data);
+        }
+        bool queue_elements_from_heap = true;
+        bdqueue_destroy(&ring->tx_queue, queue_elements_from_heap);
+    }
+    // Writes still in flight keep their buffer, they are lost with the ring
+
+    munmap(ring->sqes, ring->sqes_len);
+    munmap(ring->cq_ptr, ring->cq_len);
+    munmap(ring->sq_ptr, ring->sq_len);
+    if (ring->wake_fd >= 0) close(ring->wake_fd);
+    close(ring->ring_fd);
+
+    DEVICE_NOTE("io_uring of queue %d destroyed", queue->id);
+
+    free(ring);
+}
+
+static void uring_wakeup(DeviceQueue* queue) {
+    assert(queue && queue->priv);
+    DeviceUring* ring = queue->priv;
+    uint64_t one = 1;
+    if (write(ring->wake_fd, &one, sizeof(one)) < 0) {
+        DEVICE_ERR("Can't wake up the io_uring of queue %d: %s", queue->id, strerror(errno));
+    }
+}
+
+/// @brief  Copy the frames and hand them to the owner of the ring, the caller keeps its buffers.
+///         Before the loop starts (no memory pool, nobody owns the ring) we write directly. Once a frame doesn't fit
+///         in the TX queue we stop there, writing it directly would send it before the ones still queued
+static size_t uring_tx_burst(DeviceQueue* queue, Buffer* bufs, size_t count) {
+    assert(queue && queue->priv);
+    errval_t err;
+    DeviceUring* ring = queue->priv;
+    MemPool* mempool  = queue->device->mempool;
+    bool enqueued = false;
+
+    for (size_t i = 0; i < count; i++) {
+        Buffer buf = bufs[i];
+
+        if (mempool == NULL) {
+            // A single write() on a TAP fd is atomic, safe with other writers
+            ssize_t written = write(queue->fd, buf.data, (size_t)buf.valid_size);
+            if (written < 0) {
+                DEVICE_ERR("write to TAP device queue %d: %s", queue->id, strerror(errno));
+                count = i;
+                break;
+            }
+            atomic_fetch_add_explicit(&queue->sent, 1, memory_order_relaxed);
+            continue;
+        }
+
+        // A frame larger than any class (GSO) is copied on the heap, the owner frees it by free() instead of pool_free()
+        Buffer copy;
+        err = pool_alloc(mempool, buf.valid_size, &copy);
+        assert(err_is_ok(err) && copy.data);
+        memcpy(copy.data, buf.data, buf.valid_size);
+
+        // key: size of the frame, data: the copy
+        uint64_t key = buf.valid_size | (copy.from_pool ? 0 : URING_TX_HEAP);
+        err = enbdqueue(&ring->tx_queue, (void*)(uintptr_t)key, copy.data);
+        if (err_is_fail(err)) {
+            assert(err_no(err) == EVENT_ENQUEUE_FULL);
+            free_buffer(copy);
+            count = i;
+            break;
+        }
+        enqueued = true;
+    }
+
+    // Only wake up the owner if it's sleeping, otherwise it will pick the frames in this round
+    if (enqueued && atomic_exchange_explicit(&ring->sleeping, false, memory_order_acq_rel)) {
+        uring_wakeup(queue);
+    }
+    return count;
+}
+
+/// @brief  Submit the write of a frame taken from tx_queue, it's counted as sent from now on
+static void uring_post_tx(DeviceQueue* queue, void* key, void* data) {
+    DeviceUring* ring = queue->priv;
+    uint64_t tag = ((uintptr_t)key & URING_TX_HEAP) ? URING_TAG_TX_HEAP : URING_TAG_TX;
+
+    struct io_uring_sqe* sqe = uring_get_sqe(ring); assert(sqe);
+    uring_prep_rw(sqe, IORING_OP_WRITE, queue->fd, data, (uint32_t)(uintptr_t)key, tag, (uint64_t)(uintptr_t)data);
+    ring->tx_inflight += 1;
+    atomic_fetch_add_explicit(&queue->sent, 1, memory_order_relaxed);
+}
+
+/// @brief  Move the frames waiting in tx_queue to the submission queue
+static void uring_fill_tx(DeviceQueue* queue) {
+    DeviceUring* ring = queue->priv;
+
+    while (ring->tx_inflight < ring->tx_limit) {
+        void *key = NULL, *data = NULL;
+        if (debdqueue(&ring->tx_queue, &key, &data) != SYS_ERR_OK) break;
+        uring_post_tx(queue, key, data);
+    }
+}
+
+/// @brief  Reap all the completions, RX frames wait in rx_ready for the next burst and the slots are re-posted with a new buffer
+static void uring_reap(DeviceQueue* queue) {
+    DeviceUring* ring = queue->priv;
+    NetDevice* device = queue->device;
+
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        uint64_t tag  = cqe->user_data >> URING_TAG_SHIFT;
+        uint64_t data = cqe->user_data & URING_DATA_MASK;
+
+        switch (tag) {
+        case URING_TAG_RX: {
+            size_t slot = (size_t)data;
+            assert(slot < ring->rx_depth);
+            if (cqe->res > 0 && ring->rx_bufs[slot].data == NULL) {
+                queue->rx_shed += 1;
+            } else if (cqe->res > 0) {
+                // One read in flight per slot, and the slots are re-posted after rx_ready is drained
+                assert(ring->rx_ready_num < ring->rx_depth);
+                Buffer frame = ring->rx_bufs[slot];
+                frame.valid_size = (uint32_t)cqe->res;
+                ring->rx_bufs[slot] = NULL_BUFFER;
+                ring->rx_ready[ring->rx_ready_num++] = frame;
+            } else if (cqe->res != -EAGAIN && cqe->res != -EINTR) {
+                DEVICE_ERR("read packet from TAP device queue %d failed: %s, but the loop continue", queue->id, strerror(-cqe->res));
+            }
+            uring_post_rx(queue, slot);
+            break;
+        }
+        case URING_TAG_TX:
+        case URING_TAG_TX_HEAP:
+            // Already counted as sent when it was submitted, count it as failed as well
+            if (cqe->res < 0) {
+                DEVICE_ERR("write to TAP device queue %d: %s", queue->id, strerror(-cqe->res));
+                atomic_fetch_add_explicit(&queue->fail_sent, 1, memory_order_relaxed);
+            }
+            if (tag == URING_TAG_TX) pool_free(device->mempool, (void*)(uintptr_t)data);
+            else free((void*)(uintptr_t)data);
+            ring->tx_inflight -= 1;
+            break;
+        case URING_TAG_WAKE:
+            if (cqe->res < 0 && cqe->res != -EINTR) {
+                DEVICE_ERR("read the eventfd of queue %d failed: %s", queue->id, strerror(-cqe->res));
+            }
+            uring_post_wake(ring);
+            break;
+        default:
+            USER_PANIC("Unknown completion of io_uring: %p", (void*)(uintptr_t)cqe->user_data);
+        }
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/// @brief  Submit the writes and re-posted reads, and wait for at least one completion in one syscall
+static errval_t uring_rx_wait(DeviceQueue* queue) {
+    assert(queue && queue->priv && queue->device->mempool);
+    errval_t err;
+    DeviceUring* ring = queue->priv;
+
+    // Pre-post a read in every slot, and the eventfd, the memory pool is only ready now
+    if (!ring->started) {
+        for (size_t i = 0; i < ring->rx_depth; i++) {
+            uring_post_rx(queue, i);
+        }
+        uring_post_wake(ring);
+        ring->started = true;
+    }
+
+    while (true) {
+        uring_fill_tx(queue);
+
+        // Tell the senders to wake us up, and check again to not miss a frame enqueued in between
+        atomic_store_explicit(&ring->sleeping, true, memory_order_release);
+        void *key = NULL, *data = NULL;
+        bool tx_pending = (ring->tx_inflight < ring->tx_limit)
+                       && (debdqueue(&ring->tx_queue, &key, &data) == SYS_ERR_OK);
+        if (!tx_pending) break;
+
+        atomic_store_explicit(&ring->sleeping, false, memory_order_relaxed);
+        uring_post_tx(queue, key, data);
+    }
+
+    err = uring_submit(ring, 1);
+    atomic_store_explicit(&ring->sleeping, false, memory_order_relaxed);
+    DEBUG_FAIL_RETURN(err, "Can't submit to the io_uring");
+
+    // io_uring_enter() isn't a cancellation point
+    pthread_testcancel();
+
+    uring_reap(queue);
+    return SYS_ERR_OK;
+}
+
+static size_t uring_rx_burst(DeviceQueue* queue, Buffer* bufs, size_t max) {
+    DeviceUring* ring = queue->priv;
+
+    size_t count = (ring->rx_ready_num < max) ? ring->rx_ready_num : max;
+    memcpy(bufs, ring->rx_ready, count * sizeof(Buffer));
+    ring->rx_ready_num -= count;
+    memmove(ring->rx_ready, ring->rx_ready + count, ring->rx_ready_num * sizeof(Buffer));
+    return count;
+}
+
+static void uring_stats(DeviceQueue* queue) {
+    DeviceUring* ring = queue->priv;
+    DEVICE_INFO("  Queue %d (io_uring): %zu writes still in flight, %zu frames received but not handed over",
+                queue->id, ring->tx_inflight, ring->rx_ready_num);
+}
+
+const DeviceOps uring_ops = {
+    .name     = "uring",
+    .caps     = DEVICE_CAP_VNET_HDR | DEVICE_CAP_BATCH | DEVICE_CAP_TX_ASYNC,
+    .open     = uring_open,
+    .close    = uring_close,
+    .rx_wait  = uring_rx_wait,
+    .rx_burst = uring_rx_burst,
+    .tx_burst = uring_tx_burst,
+    .get_mac  = device_ioctl_mac,
+    .stats    = uring_stats,
+    .wakeup   = uring_wakeup,
+    .tx_chain = NULL,
+};
@@ -0,0 +1,95 @@
+#include <event/bufchain.h>
+#include <netutil/checksum.h>
+
+BufChainIter bufchain_iter(const BufChain* chain, uint32_t offset) {
+    assert(chain);
+    BufChainIter iter = { .chain = chain, .seg = 0, .offset = 0 };
+    while (iter.seg < chain->count && offset >= chain->segs[iter.seg].valid_size) {
+        offset -= chain->segs[iter.seg].valid_size;
+        iter.seg += 1;
+    }
+    iter.offset = offset;
+    return iter;
+}
+
+uint32_t bufchain_next(BufChainIter* iter, const uint8_t** ret_data, uint32_t max) {
+    assert(iter && iter->chain && ret_data);
+    const BufChain* chain = iter->chain;
+
+    // Empty segments (a pulled header) are skipped
+    while (iter->seg < chain->count && iter->offset == chain->segs[iter->seg].valid_size) {
+        iter->seg   += 1;
+        iter->offset = 0;
+    }
+    if (iter->seg == chain->count) return 0;
+
+    const Buffer* seg = &chain->segs[iter->seg];
+    uint32_t size = seg->valid_size - iter->offset;
+    if (size > max) size = max;
+
+    *ret_data     = seg->data + iter->offset;
+    iter->offset += size;
+    return size;
+}
+
+uint32_t bufchain_copy_out(const BufChain* chain, uint32_t offset, void* dst, uint32_t size) {
+    assert(chain && dst);
+    BufChainIter iter = bufchain_iter(chain, offset);
+    uint8_t* to = dst;
+    uint32_t copied = 0;
+
+    const uint8_t* span;
+    uint32_t span_size;
+    while (copied < size && (span_size = bufchain_next(&iter, &span, size - copied)) != 0) {
+        memcpy(to + copied, span, span_size);
+        copied += span_size;
+    }
+    return copied;
+}
+
+Buffer bufchain_linearize(const BufChain* chain, MemPool* pool, uint16_t headroom) {
+    assert(chain && pool);
+    Buffer buf;
+    errval_t err = pool_alloc(pool, (size_t)headroom + chain->len, &buf);
+    assert(err_is_ok(err) && buf.data);
+
+    buffer_reclaim_ptr(&buf, headroom, (uint16_t)chain->len);
+    uint32_t copied = bufchain_copy_out(chain, 0, buf.data, chain->len);
+    assert(copied == chain->len);
+    buf.offload = (chain->count > 0) ? chain->segs[0].offload : 0;
+    return buf;
+}
+
+void* bufchain_with_header(BufChain* chain, Buffer buf, uint32_t offset, uint32_t size, uint16_t headroom, uint16_t hdr_size) {
+    assert(chain && buf.from_pool && offset + size <= buf.valid_size);
+    bufchain_init(chain);
+
+    Buffer head;
+    errval_t err = pool_alloc(buf.mempool, (size_t)headroom + hdr_size, &head);
+    assert(err_is_ok(err) && head.data);
+    buffer_reclaim_ptr(&head, headroom, hdr_size);
+    head.offload = buf.offload;
+
+    Buffer view = buffer_clone(buf);
+    buffer_add_ptr(&view, (uint16_t)offset);
+    view.valid_size = size;
+
+    bufchain_append(chain, head);
+    bufchain_append(chain, view);
+    return head.data;
+}
+
+uint32_t bufchain_sum(const BufChain* chain, uint32_t offset) {
+    assert(chain);
+    BufChainIter iter = bufchain_iter(chain, offset);
+    uint32_t sum = 0;
+    bool odd = false;
+
+    const uint8_t* span;
+    uint32_t span_size;
+    while ((span_size = bufchain_next(&iter, &span, UINT16_MAX)) != 0) {
+        sum += inet_partial_sum_in_net_order(span, (uint16_t)span_size, odd);
+        odd ^= (span_size & 1);
+    }
+    return sum;
+}
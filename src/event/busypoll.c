@@ -0,0 +1,89 @@
+#include <event/busypoll.h>
+#include <time.h>
+
+static inline uint64_t busypoll_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+void busypoll_init(BusyPoll* busy, BusyPollConfig config) {
+    assert(busy);
+    *busy = (BusyPoll) {
+        .config       = config,
+        .last_arrival = 0,
+        .gap_avg      = 0,
+    };
+}
+
+/// @brief  How long to spin now, 0 to park right away
+static uint64_t spin_budget(const BusyPoll* busy, uint64_t now) {
+    uint64_t budget = busy->config.budget_ns;
+    if (!busy->config.adaptive || busy->last_arrival == 0) return budget;
+
+    // Sparse arrivals, or already idle for longer than the budget: spinning would only burn the core
+    if (busy->gap_avg > budget || now - busy->last_arrival > budget) return 0;
+    return budget;
+}
+
+bool busypoll_spin(BusyPoll* busy, bool (*poll)(void*), void* arg) {
+    assert(busy && poll);
+    if (busy->config.budget_ns == 0) return false;
+
+    uint64_t start  = busypoll_now();
+    uint64_t budget = spin_budget(busy, start);
+    if (budget == 0) {
+        busy->spin_skips += 1;
+        return false;
+    }
+
+    bool found = false;
+    do {
+        if (poll(arg)) {
+            found = true;
+            break;
+        }
+        busypoll_relax();
+    } while (busypoll_now() - start < budget);
+
+    busy->spin_ns   += busypoll_now() - start;
+    busy->spins     += 1;
+    busy->spin_hits += found;
+    return found;
+}
+
+uint64_t busypoll_park_start(const BusyPoll* busy) {
+    assert(busy);
+    return (busy->config.budget_ns == 0) ? 0 : busypoll_now();
+}
+
+void busypoll_park_end(BusyPoll* busy, uint64_t start) {
+    assert(busy);
+    if (start == 0) return;
+    busy->park_ns += busypoll_now() - start;
+    busy->parks   += 1;
+}
+
+void busypoll_arrival(BusyPoll* busy) {
+    assert(busy);
+    if (busy->config.budget_ns == 0 || !busy->config.adaptive) return;
+
+    uint64_t now = busypoll_now();
+    if (busy->last_arrival != 0) {
+        uint64_t gap = now - busy->last_arrival;
+        uint64_t cap = busy->config.budget_ns * BUSYPOLL_GAP_CAP;
+        if (gap > cap) gap = cap;
+        busy->gap_avg = busy->gap_avg - (busy->gap_avg >> BUSYPOLL_EWMA_SHIFT) + (gap >> BUSYPOLL_EWMA_SHIFT);
+    }
+    busy->last_arrival = now;
+}
+
+void busypoll_merge(BusyPoll* total, const BusyPoll* busy) {
+    assert(total && busy);
+    total->spin_ns    += busy->spin_ns;
+    total->park_ns    += busy->park_ns;
+    total->spins      += busy->spins;
+    total->spin_hits  += busy->spin_hits;
+    total->spin_skips += busy->spin_skips;
+    total->parks      += busy->parks;
+}
@@ -2,18 +2,15 @@
 #include <netstack/ethernet.h>
 #include <event/event.h>
 
-void event_ether_unmarshal(void* unmarshal) {
-    
-    // TODO: copy the argument to stack, and free the argument
-    assert(unmarshal);
-    Ether_unmarshal frame = *(Ether_unmarshal*) unmarshal; 
-    free(unmarshal);
+static void ether_unmarshal_and_free(Ethernet* ether, Buffer buf) {
 
-    errval_t err = ethernet_unmarshal(frame.ether, frame.buf);
+    buffer_set_owner(buf, MEMPOOL_OWNER_ETHERNET);
+    errval_t err = ethernet_unmarshal(ether, buf);
     switch (err_no(err))
     {
     case NET_THROW_TCP_ENQUEUE:
     {
+        buffer_set_owner(buf, MEMPOOL_OWNER_TCP);
         EVENT_INFO("A TCP message is successfully enqueued, Can't free the buffer now");
         break;
     }
@@ -26,17 +23,17 @@ void event_ether_unmarshal(void* unmarshal) {
     {
         assert(err_pop(err) == EVENT_ENQUEUE_FULL);
         EVENT_WARN("This should be a TCP message that has its queue full, drop it");
-        free_buffer(frame.buf);
+        free_buffer(buf);
         break;
     }
     case SYS_ERR_NOT_IMPLEMENTED:
     case NET_ERR_ETHER_WRONG_MAC:
     case NET_ERR_ETHER_NO_MAC:
-        free_buffer(frame.buf);
+        free_buffer(buf);
         DEBUG_ERR(err, "A known error happend, the process continue");
         break;
     case SYS_ERR_OK:
-        free_buffer(frame.buf);
+        free_buffer(buf);
         break;
     case NET_THROW_IPv4_SEG:
     default:
@@ -44,11 +41,33 @@ void event_ether_unmarshal(void* unmarshal) {
     }
 }
 
+void event_ether_unmarshal(void* unmarshal) {
+    
+    // TODO: copy the argument to stack, and free the argument
+    assert(unmarshal);
+    Ether_unmarshal frame = *(Ether_unmarshal*) unmarshal; 
+    free(unmarshal);
+
+    ether_unmarshal_and_free(frame.ether, frame.buf);
+}
+
+void event_ether_batch(void* batch) {
+    assert(batch);
+    Ether_batch* frames = batch;
+
+    // Run the frames back to back, the buffers are owned by the layers below from now on
+    for (size_t i = 0; i < frames->count; i++) {
+        ether_unmarshal_and_free(frames->ether, frames->bufs[i]);
+    }
+    free_buffer(frames->self);
+}
+
 void event_arp_marshal(void* send) {
     errval_t err; assert(send);
 
+    // Copied out of the PktDesc before the buffer is written
     ARP_marshal marshal = *(ARP_marshal*) send;
-    free(send);
+    buffer_set_owner(marshal.buf, MEMPOOL_OWNER_ARP);
 
     err = arp_marshal(marshal.arp, marshal.opration, marshal.dst_ip, marshal.dst_mac, marshal.buf);
     switch (err_no(err))
@@ -65,7 +84,7 @@ void event_icmp_marshal(void* send) {
     errval_t err; assert(send);
 
     ICMP_marshal marshal = *(ICMP_marshal*) send;
-    free(send);
+    buffer_set_owner(marshal.buf, MEMPOOL_OWNER_ICMP);
 
     err = icmp_marshal(marshal.icmp, marshal.dst_ip, marshal.type, marshal.code, marshal.field, marshal.buf);
     switch (err_no(err))
@@ -90,7 +109,7 @@ void event_ip_assemble(void* recvd_segment) {
     errval_t err; assert(recv);
 
     IP_segment seg = *(IP_segment*) recvd_segment;
-    free(recvd_segment);
+    buffer_set_owner(seg.buf, MEMPOOL_OWNER_ASSEMBLER);
 
     err = ip_assemble(&seg);
     switch (err_no(err))
@@ -116,18 +135,24 @@ void event_ipv4_handle(void* recv) {
     errval_t err; assert(recv);
 
     IP_handle handle = *(IP_handle*) recv;
-    free(recv);
+    if (handle.chain) bufchain_set_owner(handle.chain, MEMPOOL_OWNER_IPV4);
+    else              buffer_set_owner(handle.buf, MEMPOOL_OWNER_IPV4);
 
-    err = ipv4_handle(handle.ip, handle.proto, handle.src_ip, handle.buf);
+    if (handle.chain) 
+        err = ipv4_handle_chain(handle.ip, handle.proto, handle.src_ip, handle.chain);
+    else
+        err = ipv4_handle(handle.ip, handle.proto, handle.src_ip, handle.buf);
     switch (err_no(err))
     {
     case NET_THROW_SUBMIT_EVENT:
     {
+        assert(handle.chain == NULL);
         EVENT_INFO("An Event is submitted, and the buffer is re-used, can't free now");
         break;
     }
     case SYS_ERR_OK:
-        free_buffer(handle.buf); 
+        if (handle.chain) bufchain_free(handle.chain);
+        else              free_buffer(handle.buf); 
         break;
     default:
         USER_PANIC_ERR(err, "Unknown error");
@@ -138,7 +163,7 @@ void event_ndp_marshal(void* send) {
     errval_t err; assert(send);
 
     NDP_marshal marshal = *(NDP_marshal*) send;
-    free(send);
+    buffer_set_owner(marshal.buf, MEMPOOL_OWNER_NDP);
 
     err = ndp_marshal(marshal.icmp, marshal.dst_ip, marshal.type, marshal.code, marshal.buf);
     switch (err_no(err))
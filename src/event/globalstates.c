@@ -2,6 +2,12 @@
 
 GlobalStates g_states;
 
+MemPool* node_mempool(void) {
+    if (g_states.node_num == 0) return NULL;
+    int node = mempool_current_node();
+    return (node >= 0 && (size_t)node < g_states.node_num) ? g_states.node_pools[node] : NULL;
+}
+
 //TODO: move all global states to one place
 // // Global variable defined in threadpool.h
 // alignas(ATOMIC_ISOLATION) ThreadPool g_threadpool;
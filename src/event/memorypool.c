@@ -1,125 +1,822 @@
 #include <event/memorypool.h>
 #include <event/buffer.h>      // Buffer
+#include <event/states.h>      // LocalState
+#include <threads.h>           // thread_local
+#include <sys/mman.h>          // mmap
+#include <sys/syscall.h>       // syscall
+#include <linux/mempolicy.h>   // MPOL_BIND
+#include <unistd.h>
+#include <errno.h>             // strerror
+#include <time.h>              // clock_gettime
 
-errval_t mempool_init(MemPool* pool, size_t bytes, size_t amount) {
-    assert(pool && bytes > 0 && amount > 0);
+static atomic_size_t pool_ids = 1;
+
+/// Pools a thread keeps its caches for at once: one per node, and the default one
+#define MEMPOOL_THREAD_POOLS    (MEMPOOL_MAX_NODES + 1)
+
+/// @brief  The caches of this thread for one pool, registered on the first use of each class
+typedef struct {
+    size_t      pool_id;        ///< 0 if unused
+    size_t      last_use;       ///< The oldest one is given to another pool
+    MagCache   *caches[MEMPOOL_CLASS_NUM];
+    bool        no_cache[MEMPOOL_CLASS_NUM];
+} ThreadCaches;
+
+static thread_local ThreadCaches  my_caches[MEMPOOL_THREAD_POOLS];
+static thread_local ThreadCaches *my_last = NULL;
+static thread_local size_t        my_switches = 0;
+
+/// Only the first UINT16_MAX bytes of a large piece are valid
+static inline uint32_t buffer_max_valid(size_t bytes) {
+    return (bytes > UINT16_MAX) ? UINT16_MAX : (uint32_t)bytes;
+}
+
+/// @brief  Fault the pages of a block in now, once they are bound to their node
+static void block_populate(void* addr, size_t len) {
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(addr, len, MADV_POPULATE_WRITE) == 0) return;
+    EVENT_WARN("Can't populate %d KiB of the memory pool (%s), touch every page instead", len / 1024, strerror(errno));
+#endif
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    for (size_t offset = 0; offset < len; offset += page) {
+        ((volatile uint8_t*)addr)[offset] = 0;
+    }
+}
+
+/// @brief  Map a block of pieces, hugepages first, and bind it to the node before it's touched
+/// @return NULL if it can't, ret_map_len is 0 if it's malloc()ed
+static void* block_map(size_t len, MemBacking backing, size_t* ret_map_len, bool* ret_huge) {
+    *ret_huge    = false;
+    *ret_map_len = 0;
+    // A reserved huge page that isn't there is a SIGBUS on the first use, rather find out now
+    bool populate  = backing.populate || backing.hugepage;
+    bool populated = false;
+    if (!backing.hugepage && backing.node < 0 && !populate) {
+        return malloc(len);
+    }
+
+    void* addr = MAP_FAILED;
+    if (backing.hugepage) {
+        len  = (len + MEMPOOL_HUGEPAGE_SIZE - 1) & ~((size_t)MEMPOOL_HUGEPAGE_SIZE - 1);
+        // Bound to a node, it's populated after mbind()
+        populated = (backing.node < 0);
+        addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (populated ? MAP_POPULATE : 0), -1, 0);
+        *ret_huge = (addr != MAP_FAILED);
+        if (addr == MAP_FAILED) {
+            EVENT_WARN("No huge page reserved for %d KiB (%s), try transparent huge pages", len / 1024, strerror(errno));
+        }
+    }
+    if (addr == MAP_FAILED) {
+        // Transparent huge pages are only used by the pages faulted after madvise()
+        populated = false;
+        addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            EVENT_FATAL("Can't map %d KiB for the memory pool: %s", len / 1024, strerror(errno));
+            return NULL;
+        }
+        if (backing.hugepage && madvise(addr, len, MADV_HUGEPAGE) != 0) {
+            EVENT_WARN("Can't use transparent huge pages: %s", strerror(errno));
+        }
+    }
+
+    if (backing.node >= 0) {
+        unsigned long mask = 1UL << backing.node;
+        if (syscall(SYS_mbind, addr, len, MPOL_BIND, &mask, sizeof(mask) * 8 + 1, 0) != 0) {
+            EVENT_WARN("Can't bind the memory pool to node %d: %s", backing.node, strerror(errno));
+        }
+    }
+    if (populate && !populated) block_populate(addr, len);
+
+    *ret_map_len = len;
+    return addr;
+}
+
+static void block_unmap(void* start, size_t map_len) {
+    if (map_len == 0) free(start);
+    else munmap(start, map_len);
+}
+
+static errval_t class_map(MemClass* class, size_t len, MemBacking backing) {
+    class->pool = block_map(len, backing, &class->map_len, &class->huge);
+    return (class->pool == NULL) ? SYS_ERR_ALLOC_FAIL : SYS_ERR_OK;
+}
+
+static void class_unmap(MemClass* class) {
+    block_unmap(class->pool, class->map_len);
+    class->pool = NULL;
+
+    size_t grown_num = atomic_load_explicit(&class->grown_num, memory_order_acquire);
+    for (size_t i = 0; i < grown_num; i++) {
+        block_unmap(class->grown[i].start, class->grown[i].map_len);
+    }
+}
+
+/// @brief  Fill the pieces of a block with 0xCC in debug builds, and enqueue them
+static errval_t class_fill(MemClass* class, uint8_t* start, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint8_t* piece = start + i * class->bytes;
+#ifndef NDEBUG
+        memset(piece, 0xCC, class->bytes);
+#endif
+
+        errval_t err = enbdqueue(&class->queue, NULL, (void*)piece);
+        if (err_is_fail(err)) {
+            EVENT_FATAL("Can't enqueue the memory");
+            return SYS_ERR_INIT_FAIL;
+        }
+    }
+    return SYS_ERR_OK;
+}
+
+/// @brief  Hand out up to max initial pieces never used before, they are only touched by the thread taking them
+/// @return How many, 0 once they have all been handed out
+static size_t class_carve(MemClass* class, void** pieces, size_t max) {
+    if (atomic_load_explicit(&class->carved, memory_order_relaxed) >= class->amount) return 0;
+    size_t first = atomic_fetch_add_explicit(&class->carved, max, memory_order_relaxed);
+    if (first >= class->amount) return 0;
+
+    size_t count = (class->amount - first < max) ? class->amount - first : max;
+    for (size_t i = 0; i < count; i++) {
+        pieces[i] = (uint8_t*)class->pool + (first + i) * class->bytes;
+#ifndef NDEBUG
+        memset(pieces[i], 0xCC, class->bytes);
+#endif
+    }
+    return count;
+}
+
+/// @brief  Pieces left the queue or the depot
+static inline void avail_take(MemClass* class, size_t count) {
+    size_t avail = atomic_fetch_sub_explicit(&class->avail, count, memory_order_relaxed) - count;
+    if (avail < class->low && !atomic_load_explicit(&class->pressure, memory_order_relaxed)) {
+        if (!atomic_exchange_explicit(&class->pressure, true, memory_order_relaxed)) {
+            atomic_fetch_add_explicit(&class->pressures, 1, memory_order_relaxed);
+        }
+    }
+}
+
+/// @brief  Pieces are going back to the queue or the depot, counted before they are there, so avail never underflows
+static inline void avail_give(MemClass* class, size_t count) {
+    size_t avail = atomic_fetch_add_explicit(&class->avail, count, memory_order_relaxed) + count;
+    if (avail >= class->high && atomic_load_explicit(&class->pressure, memory_order_relaxed)) {
+        atomic_store_explicit(&class->pressure, false, memory_order_relaxed);
+    }
+}
+
+/// @brief  A received frame may take count more pieces from the shared structures
+static inline bool class_admit(const MemPool* pool, MemClass* class, size_t count) {
+    if (pool->overload.policy == MEMPOOL_POLICY_DROP && atomic_load_explicit(&class->pressure, memory_order_relaxed)) {
+        return false;
+    }
+    return atomic_load_explicit(&class->avail, memory_order_relaxed) >= class->reserve + count;
+}
+
+/// @brief  Map one more chunk of pieces for a class under pressure
+/// @return false if it can't grow anymore
+static bool class_grow(MemPool* pool, MemClass* class) {
+    if (pool->overload.policy != MEMPOOL_POLICY_GROW) return false;
+    size_t seen = atomic_load_explicit(&class->grown_num, memory_order_relaxed);
+    if (seen >= pool->overload.grow_max) return false;
+
+    pthread_mutex_lock(&class->grow_lock);
+    size_t grown_num = atomic_load_explicit(&class->grown_num, memory_order_relaxed);
+    // Another thread grew it meanwhile
+    bool grown = (grown_num != seen);
+    if (!grown && grown_num < pool->overload.grow_max) {
+        MemChunk* chunk = &class->grown[grown_num];
+        bool huge;
+        chunk->start = block_map(class->bytes * class->chunk, pool->backing, &chunk->map_len, &huge);
+        if (chunk->start != NULL) {
+            // Published before any of its pieces can be freed
+            atomic_store_explicit(&class->grown_num, grown_num + 1, memory_order_release);
+            avail_give(class, class->chunk);
+            errval_t err = class_fill(class, chunk->start, class->chunk);
+            if (err_is_fail(err)) USER_PANIC_ERR(err, "The queue of the class is sized for every chunk");
+            grown = true;
+            EVENT_NOTE("Memory Pool class of %d bytes grew by %d pieces (chunk %d of %d)",
+                       class->bytes, class->chunk, grown_num + 1, pool->overload.grow_max);
+        }
+    }
+    pthread_mutex_unlock(&class->grow_lock);
+    return grown;
+}
+
+static errval_t memclass_init(MemClass* class, size_t bytes, size_t amount, size_t capacity, MemBacking backing) {
+    assert(class && bytes > 0 && amount > 0 && capacity >= amount);
     errval_t err;
 
-    // 1.1 
-    pool->elems = calloc(amount, sizeof(BQelem));
-    if (pool->elems == NULL) {
+    // 1.1 Room for the pieces of every chunk it may grow by
+    class->elems = calloc(capacity, sizeof(BQelem));
+    if (class->elems == NULL) {
         EVENT_FATAL("Can't allocate memory for the Queue");
         return SYS_ERR_ALLOC_FAIL;
     }
 
     // 1.2 Initialize the backend queue
-    err = bdqueue_init(&pool->queue, pool->elems, amount);
+    err = bdqueue_init(&class->queue, class->elems, capacity);
     DEBUG_FAIL_RETURN(err, "Can't initialize the Bounded Queue");
 
-    // 2.1 
-    pool->pool = malloc(bytes * amount);
-    if (pool->pool == NULL) {
+    // 2.1
+    err = class_map(class, bytes * amount, backing);
+    if (err_is_fail(err)) {
         EVENT_FATAL("Can't allocate memory for the memory pool");
+        return err;
+    }
+    class->refs = calloc(capacity, sizeof(atomic_uint));
+    if (class->refs == NULL) {
+        EVENT_FATAL("Can't allocate the reference counts of the memory pool");
         return SYS_ERR_ALLOC_FAIL;
     }
 
-    // 2.2 Fill the allocated memory with 0xCC and enqueue 
-    for (size_t i = 0; i < amount * bytes; i+= bytes) {
-        uint8_t* piece = (uint8_t*)pool->pool + i;
-        memset(piece, 0xCC, bytes);
+    class->bytes = bytes;
+    class->amount = amount;
+    class->capacity = capacity;
+    class->owner = NULL;
+    class->since = NULL;
+    atomic_init(&class->fallback, 0);
+    atomic_init(&class->grown_num, 0);
+    pthread_mutex_init(&class->grow_lock, NULL);
+
+    // 2.2 Nothing is enqueued nor touched, the pieces are carved on demand by the threads allocating them
+    atomic_init(&class->carved, 0);
+    atomic_init(&class->avail, amount);
 
-        err = enbdqueue(&pool->queue, NULL, (void*)piece);
+    EVENT_NOTE("Memory Pool class initialized at %p, has %d pieces, each has %d bytes, add up to %d KiB, %s, node %d",
+               class->pool, amount, bytes, amount * bytes / 1024,
+               class->huge ? "huge pages" : (backing.hugepage ? "transparent huge pages" : "normal pages"), backing.node);
+
+    return SYS_ERR_OK;
+}
+
+/// @brief  Empty magazines for the depot, twice as many as it takes to hold the whole class
+static errval_t depot_init(MemClass* class, size_t magazine, size_t capacity) {
+    assert(class);
+    errval_t err;
+
+    class->magazine = magazine;
+    class->batch    = magazine / 2;
+    if (magazine == 0) return SYS_ERR_OK;
+
+    class->mag_num     = 2 * capacity / class->batch;
+    class->full_elems  = calloc(class->mag_num, sizeof(BQelem));
+    class->empty_elems = calloc(class->mag_num, sizeof(BQelem));
+    class->mags        = calloc(class->mag_num, sizeof(Magazine) + class->batch * sizeof(void*));
+    if (class->full_elems == NULL || class->empty_elems == NULL || class->mags == NULL) {
+        EVENT_FATAL("Can't allocate memory for the depot");
+        return SYS_ERR_ALLOC_FAIL;
+    }
+
+    err = bdqueue_init(&class->full, class->full_elems, class->mag_num);
+    DEBUG_FAIL_RETURN(err, "Can't initialize the Bounded Queue of full magazines");
+    err = bdqueue_init(&class->empty, class->empty_elems, class->mag_num);
+    DEBUG_FAIL_RETURN(err, "Can't initialize the Bounded Queue of empty magazines");
+
+    for (size_t i = 0; i < class->mag_num; i++) {
+        Magazine* mag = (Magazine*)(class->mags + i * (sizeof(Magazine) + class->batch * sizeof(void*)));
+        mag->rounds = 0;
+        err = enbdqueue(&class->empty, NULL, mag);
         if (err_is_fail(err)) {
-            EVENT_FATAL("Can't enqueue the memory");
+            EVENT_FATAL("Can't enqueue the magazine");
             return SYS_ERR_INIT_FAIL;
         }
     }
+    return SYS_ERR_OK;
+}
+
+static MagCache* cache_register(MemPool* pool, size_t class_id) {
+    size_t index = atomic_fetch_add_explicit(&pool->cache_num, 1, memory_order_relaxed);
+    if (index >= MEMPOOL_MAX_CACHES) {
+        EVENT_WARN("Too many threads use the memory pool, this one goes to the shared queue");
+        return NULL;
+    }
+
+    MagCache* cache = calloc(1, sizeof(MagCache)); assert(cache);
+    cache->class_id = class_id;
+    LocalState* local = get_local_state();
+    snprintf(cache->owner, sizeof(cache->owner), "%s", (local && local->my_name) ? local->my_name : "Unknown");
+
+    atomic_store_explicit(&pool->caches[index], cache, memory_order_release);
+    return cache;
+}
+
+/// @brief  The caches of this thread for the pool. A thread freeing the frames of another node keeps both sets,
+///         only a pool unused for the longest is forgotten when it uses more than MEMPOOL_THREAD_POOLS of them
+static ThreadCaches* thread_caches(MemPool* pool) {
+    ThreadCaches* oldest = &my_caches[0];
+    for (size_t i = 0; i < MEMPOOL_THREAD_POOLS; i++) {
+        ThreadCaches* mine = &my_caches[i];
+        if (mine->pool_id == pool->id) {
+            oldest = mine;
+            break;
+        }
+        if (mine->last_use < oldest->last_use) oldest = mine;
+    }
+    if (oldest->pool_id != pool->id) {
+        // Destroyed by now (the driver has one pool per node for its whole life), its caches are gone with it
+        memset(oldest, 0x00, sizeof(ThreadCaches));
+        oldest->pool_id = pool->id;
+    }
+    oldest->last_use = ++my_switches;
+    my_last = oldest;
+    return oldest;
+}
 
-    pool->bytes = bytes;
-    pool->amount = amount;
+/// @brief  The cache of this thread for the class, NULL if it doesn't have one
+static inline MagCache* class_cache(MemPool* pool, size_t class_id) {
+    if (pool->classes[class_id].magazine == 0) return NULL;
+    ThreadCaches* mine = my_last;
+    if (mine == NULL || mine->pool_id != pool->id) mine = thread_caches(pool);
+    if (mine->caches[class_id] == NULL && !mine->no_cache[class_id]) {
+        mine->caches[class_id]   = cache_register(pool, class_id);
+        mine->no_cache[class_id] = (mine->caches[class_id] == NULL);
+    }
+    return mine->caches[class_id];
+}
 
-    EVENT_NOTE("Memory Pool initialized at %p, has %d pieces, each has %d bytes, add up to %d KiB",
-               pool->pool, amount, bytes, amount * bytes / 1024);
+/// @brief  Take a batch of pieces: a full magazine of the depot in one go, or one by one from the queue,
+///         then never used ones
+static void cache_refill(MemClass* class, MagCache* cache) {
+    cache->misses += 1;
 
+    Magazine* mag = NULL;
+    if (debdqueue(&class->full, NULL, (void**)&mag) == SYS_ERR_OK) {
+        assert(mag && mag->rounds == class->batch);
+        avail_take(class, mag->rounds);
+        memcpy(cache->pieces + cache->count, mag->pieces, mag->rounds * sizeof(void*));
+        cache->count += mag->rounds;
+        mag->rounds = 0;
+        if (err_is_fail(enbdqueue(&class->empty, NULL, mag))) {
+            USER_PANIC("Enqueue to the depot shouldn't fail!");
+        }
+        return;
+    }
+
+    void* piece = NULL;
+    size_t taken = 0;
+    while (cache->count < class->batch && debdqueue(&class->queue, NULL, &piece) == SYS_ERR_OK) {
+        cache->pieces[cache->count++] = piece;
+        taken += 1;
+    }
+    if (cache->count < class->batch) {
+        size_t carved = class_carve(class, cache->pieces + cache->count, class->batch - cache->count);
+        cache->count += carved;
+        taken        += carved;
+    }
+    if (taken > 0) avail_take(class, taken);
+}
+
+/// @brief  Give a batch of pieces back: a full magazine to the depot in one go, or one by one to the queue
+static void cache_flush(MemClass* class, MagCache* cache) {
+    cache->flushes += 1;
+    assert(cache->count >= class->batch);
+    cache->count -= class->batch;
+    void** pieces = cache->pieces + cache->count;
+    avail_give(class, class->batch);
+
+    Magazine* mag = NULL;
+    if (debdqueue(&class->empty, NULL, (void**)&mag) == SYS_ERR_OK) {
+        assert(mag && mag->rounds == 0);
+        memcpy(mag->pieces, pieces, class->batch * sizeof(void*));
+        mag->rounds = class->batch;
+        if (err_is_fail(enbdqueue(&class->full, NULL, mag))) {
+            USER_PANIC("Enqueue to the depot shouldn't fail!");
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < class->batch; i++) {
+        if (err_is_fail(enbdqueue(&class->queue, NULL, pieces[i]))) {
+            USER_PANIC("Enqueue to memory pool shouldn't fail!");
+        }
+    }
+}
+
+errval_t mempool_init(MemPool* pool, const MemClassConfig* classes, size_t class_num, MemBacking backing, MemOverload overload) {
+    assert(pool && classes);
+    assert(class_num > 0 && class_num <= MEMPOOL_CLASS_NUM);
+    errval_t err;
+
+    if (backing.node >= MEMPOOL_MAX_NODES) {
+        EVENT_FATAL("The memory pool can only be bound to the first %d NUMA nodes, not %d", MEMPOOL_MAX_NODES, backing.node);
+        return SYS_ERR_WRONG_CONFIG;
+    }
+    if (overload.policy > MEMPOOL_POLICY_DROP || overload.low > overload.high || overload.high > 100 ||
+        overload.reserve > overload.low || overload.grow_max > MEMPOOL_MAX_GROW) {
+        EVENT_FATAL("The overload policy %d needs reserve (%d%%) <= low (%d%%) <= high (%d%%) <= 100%%, and at most %d chunks to grow (%d)",
+                    overload.policy, overload.reserve, overload.low, overload.high, MEMPOOL_MAX_GROW, overload.grow_max);
+        return SYS_ERR_WRONG_CONFIG;
+    }
+    if (overload.policy != MEMPOOL_POLICY_GROW) overload.grow_max = 0;
+    pool->class_num = class_num;
+    pool->backing   = backing;
+    pool->overload  = overload;
+    pool->track     = false;
+    atomic_init(&pool->oversize, 0);
+    for (size_t i = 0; i < MEMPOOL_OWNER_NUM; i++) {
+        atomic_init(&pool->held[i], 0);
+    }
+    for (size_t i = 0; i < class_num; i++) {
+        if (i > 0 && classes[i].bytes <= classes[i - 1].bytes) {
+            EVENT_FATAL("The memory pool classes must be sorted by size, %d after %d", classes[i].bytes, classes[i - 1].bytes);
+            return SYS_ERR_WRONG_CONFIG;
+        }
+        size_t magazine = classes[i].magazine;
+        if (magazine > 0 && (magazine > MEMPOOL_MAGAZINE_MAX || (magazine & (magazine - 1)) != 0 || magazine / 2 > classes[i].amount)) {
+            EVENT_FATAL("The magazine of %d pieces should be a power of 2 up to %d, and fit in the class of %d pieces",
+                        magazine, MEMPOOL_MAGAZINE_MAX, classes[i].amount);
+            return SYS_ERR_WRONG_CONFIG;
+        }
+        // The queues hold every piece the class may grow to, their size must be power of 2
+        MemClass* class = &pool->classes[i];
+        class->chunk = (classes[i].amount >> MEMPOOL_GROW_SHIFT) ? (classes[i].amount >> MEMPOOL_GROW_SHIFT) : 1;
+        size_t capacity = classes[i].amount;
+        while (capacity < classes[i].amount + overload.grow_max * class->chunk) capacity *= 2;
+
+        err = memclass_init(class, classes[i].bytes, classes[i].amount, capacity, backing);
+        DEBUG_FAIL_RETURN(err, "Can't initialize the class %d of the memory pool", i);
+        err = depot_init(class, classes[i].magazine, capacity);
+        DEBUG_FAIL_RETURN(err, "Can't initialize the depot of class %d of the memory pool", i);
+
+        class->low     = classes[i].amount * overload.low / 100;
+        class->high    = classes[i].amount * overload.high / 100;
+        class->reserve = classes[i].amount * overload.reserve / 100;
+        atomic_init(&class->pressure, false);
+        atomic_init(&class->shed, 0);
+        atomic_init(&class->pressures, 0);
+    }
+
+    pool->id = atomic_fetch_add_explicit(&pool_ids, 1, memory_order_relaxed);
+    atomic_init(&pool->cache_num, 0);
+    for (size_t i = 0; i < MEMPOOL_MAX_CACHES; i++) {
+        atomic_init(&pool->caches[i], NULL);
+    }
     return SYS_ERR_OK;
 }
 
 void mempool_destroy(MemPool* mempool) {
-    bool queue_elements_from_heap = true;
-    bdqueue_destroy(&mempool->queue, queue_elements_from_heap);
-    // already freed by bdqueue_destroy
-    // free(mempool->elems);
-    
-    assert(&mempool->pool);
-    free(mempool->pool);
-
-    EVENT_NOTE("Memory Pool destroyed, it has %d pieces, each has %d bytes, add up to %d KiB",
-               mempool->amount, mempool->bytes, mempool->amount * mempool->bytes / 1024);
-    
     assert(mempool);
+    // Whatever a layer still holds now is a leak
+    if (mempool->track) mempool_report_held(mempool, 0);
+
+    // The pieces in the caches go away with the classes
+    for (size_t i = 0; i < MEMPOOL_MAX_CACHES; i++) {
+        MagCache* cache = atomic_load_explicit(&mempool->caches[i], memory_order_acquire);
+        if (cache == NULL) continue;
+        EVENT_INFO("Magazine of %s for %d bytes: %d hits, %d misses, %d flushes, %d pieces left",
+                   cache->owner, mempool->classes[cache->class_id].bytes, cache->hits, cache->misses, cache->flushes, cache->count);
+        free(cache);
+    }
+
+    for (size_t i = 0; i < mempool->class_num; i++) {
+        MemClass* class = &mempool->classes[i];
+
+        bool queue_elements_from_heap = true;
+        bdqueue_destroy(&class->queue, queue_elements_from_heap);
+        // already freed by bdqueue_destroy
+        // free(class->elems);
+
+        assert(class->pool);
+        class_unmap(class);
+        free(class->refs);
+        free(class->owner);
+        free(class->since);
+
+        if (class->magazine > 0) {
+            bdqueue_destroy(&class->full, queue_elements_from_heap);
+            bdqueue_destroy(&class->empty, queue_elements_from_heap);
+            free(class->mags);
+        }
+        pthread_mutex_destroy(&class->grow_lock);
+
+        EVENT_NOTE("Memory Pool class destroyed, it has %d pieces, each has %d bytes, add up to %d KiB, %d times empty",
+                   class->amount, class->bytes, class->amount * class->bytes / 1024,
+                   atomic_load_explicit(&class->fallback, memory_order_relaxed));
+        size_t carved = atomic_load_explicit(&class->carved, memory_order_relaxed);
+        EVENT_NOTE("  Under pressure %d times, %d received frames shed, grew by %d chunks of %d pieces, %d pieces never used",
+                   atomic_load_explicit(&class->pressures, memory_order_relaxed),
+                   atomic_load_explicit(&class->shed, memory_order_relaxed),
+                   atomic_load_explicit(&class->grown_num, memory_order_relaxed), class->chunk,
+                   (carved < class->amount) ? class->amount - carved : 0);
+    }
+    EVENT_NOTE("Memory Pool destroyed, %d allocations larger than any class",
+               atomic_load_explicit(&mempool->oversize, memory_order_relaxed));
+
     memset(mempool, 0, sizeof(MemPool));
     free(mempool);
     mempool = NULL;
 }
 
+/// @brief  Nothing left for this allocation: refuse a received frame, unless the legacy policy lets it go to the heap as the others
+static errval_t class_overload(MemPool* pool, MemClass* class, bool rx, Buffer *ret_buf) {
+    if (rx && pool->overload.policy != MEMPOOL_POLICY_MALLOC) {
+        atomic_fetch_add_explicit(&class->shed, 1, memory_order_relaxed);
+        *ret_buf = NULL_BUFFER;
+        return EVENT_MEMPOOL_EMPTY;
+    }
+    // Not from the pool: the class queue only has room for its own pieces
+    void* ret_addr = malloc(class->bytes);   assert(ret_addr);
+    atomic_fetch_add_explicit(&class->fallback, 1, memory_order_relaxed);
+    EVENT_ERR("No more %d bytes pieces in the pool ! Directly malloc and return Buffer", class->bytes);
+    *ret_buf = buffer_create(ret_addr, 0, buffer_max_valid(class->bytes), class->bytes, false, NULL);
+    return SYS_ERR_OK;
+}
+
 errval_t pool_alloc(MemPool* pool, size_t need_size, Buffer *ret_buf) {
+    return pool_alloc_prio(pool, need_size, MEMPOOL_PRIO_CONTROL, ret_buf);
+}
+
+errval_t pool_alloc_prio(MemPool* pool, size_t need_size, MemPrio prio, Buffer *ret_buf) {
     errval_t err;
     assert(pool && ret_buf);
     void *ret_addr = NULL;
-    bool from_pool = false;
 
-    err = debdqueue(&pool->queue, NULL, &ret_addr);
+    MemClass* class = NULL;
+    size_t class_id;
+    for (class_id = 0; class_id < pool->class_num; class_id++) {
+        if (pool->classes[class_id].bytes >= need_size) {
+            class = &pool->classes[class_id];
+            break;
+        }
+    }
+    if (class == NULL) {
+        atomic_fetch_add_explicit(&pool->oversize, 1, memory_order_relaxed);
+        EVENT_ERR("We need %d bytes, but the largest class only has %d bytes, directly malloc", need_size, pool->classes[pool->class_num - 1].bytes);
+        ret_addr = malloc(need_size);   assert(ret_addr);
+        *ret_buf = buffer_create(ret_addr, 0, buffer_max_valid(need_size), need_size, false, NULL);
+        return SYS_ERR_OK;
+    }
+    bool rx = (prio == MEMPOOL_PRIO_RX);
+
+    // Most of the time from the magazine of this thread, a received frame only refills it above the reserve
+    MagCache* cache = class_cache(pool, class_id);
+    if (cache != NULL) {
+        if (cache->count > 0) {
+            cache->hits += 1;
+        } else if (!rx || class_admit(pool, class, class->batch)) {
+            cache_refill(class, cache);
+        }
+        if (cache->count > 0) {
+            ret_addr = cache->pieces[--cache->count];
+            if (pool->track) pool_set_owner(pool, ret_addr, MEMPOOL_OWNER_POOL);
+            *ret_buf = buffer_create(ret_addr, 0, buffer_max_valid(class->bytes), class->bytes, true, pool);
+            return SYS_ERR_OK;
+        }
+    }
+
+    // Below the low watermark: grow before it's empty, or shed the received frames
+    if (atomic_load_explicit(&class->avail, memory_order_relaxed) < class->low) class_grow(pool, class);
+    if (rx && !class_admit(pool, class, 1)) return class_overload(pool, class, rx, ret_buf);
+
+    err = debdqueue(&class->queue, NULL, &ret_addr);
+    if (err_no(err) == EVENT_DEQUEUE_EMPTY && class_carve(class, &ret_addr, 1) == 1) {
+        err = SYS_ERR_OK;
+    }
+    if (err_no(err) == EVENT_DEQUEUE_EMPTY && class_grow(pool, class)) {
+        err = debdqueue(&class->queue, NULL, &ret_addr);
+    }
     switch (err_no(err))
     {
-    case EVENT_DEQUEUE_EMPTY: 
+    case EVENT_DEQUEUE_EMPTY:
         assert(ret_addr == NULL);
-        ret_addr = malloc(MEMPOOL_BYTES);   assert(ret_addr);
-        from_pool = true;
-        EVENT_ERR("No more memory in the pool ! Directly malloc and return Buffer");
-        break;
+        return class_overload(pool, class, rx, ret_buf);
     case SYS_ERR_OK:
-        from_pool = true;
+        avail_take(class, 1);
         break;
     default:
         USER_PANIC_ERR(err, "Unknown error");
     }
     assert(ret_addr);
-    
-    //TODO: have multiple sized memory pool !
-    if (need_size != MEMPOOL_BYTES) {
-        EVENT_ERR("We need %d bytes, but we only have %d bytes", need_size, MEMPOOL_BYTES);
-    }
+    if (pool->track) pool_set_owner(pool, ret_addr, MEMPOOL_OWNER_POOL);
+
     *ret_buf = buffer_create(
         ret_addr,
         0,
-        MEMPOOL_BYTES,
-        MEMPOOL_BYTES,
-        from_pool,
-        (from_pool) ? pool : NULL
+        buffer_max_valid(class->bytes),
+        class->bytes,
+        true,
+        pool
     );
 
     return SYS_ERR_OK;
+
+}
+
+/// @brief  Every class is one contiguous block and the chunks it grew by, the address tells the class and the piece
+static MemClass* class_of(MemPool* pool, void* addr, size_t* ret_class, size_t* ret_piece) {
+    for (size_t i = 0; i < pool->class_num; i++) {
+        MemClass* class = &pool->classes[i];
+        uint8_t* start = class->pool;
+        if ((uint8_t*)addr >= start && (uint8_t*)addr < start + class->bytes * class->amount) {
+            assert(((uint8_t*)addr - start) % class->bytes == 0);
+            *ret_class = i;
+            *ret_piece = ((uint8_t*)addr - start) / class->bytes;
+            return class;
+        }
+
+        size_t grown_num = atomic_load_explicit(&class->grown_num, memory_order_acquire);
+        for (size_t k = 0; k < grown_num; k++) {
+            start = class->grown[k].start;
+            if ((uint8_t*)addr < start || (uint8_t*)addr >= start + class->bytes * class->chunk) continue;
+
+            assert(((uint8_t*)addr - start) % class->bytes == 0);
+            *ret_class = i;
+            *ret_piece = class->amount + k * class->chunk + ((uint8_t*)addr - start) / class->bytes;
+            return class;
+        }
+    }
+    USER_PANIC("The address %p doesn't belong to the memory pool", addr);
+}
+
+static inline uint64_t track_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/// @brief  Move the piece to another layer, its age restarts only when the layer changes
+static void piece_set_owner(MemPool* pool, MemClass* class, size_t piece, MemOwner owner) {
+    assert(owner < MEMPOOL_OWNER_NUM && piece < class->capacity);
+    uint8_t prev = atomic_exchange_explicit(&class->owner[piece], (uint8_t)owner, memory_order_relaxed);
+    if (prev == owner) return;
+
+    atomic_store_explicit(&class->since[piece], track_now(), memory_order_relaxed);
+    if (prev  != MEMPOOL_OWNER_FREE) atomic_fetch_sub_explicit(&pool->held[prev], 1, memory_order_relaxed);
+    if (owner != MEMPOOL_OWNER_FREE) atomic_fetch_add_explicit(&pool->held[owner], 1, memory_order_relaxed);
+}
+
+void pool_ref(MemPool* pool, void* addr) {
+    assert(pool && addr);
+    size_t class_id, piece;
+    MemClass* class = class_of(pool, addr, &class_id, &piece);
+    atomic_fetch_add_explicit(&class->refs[piece], 1, memory_order_relaxed);
+}
+
+bool pool_shared(MemPool* pool, void* addr) {
+    assert(pool && addr);
+    size_t class_id, piece;
+    MemClass* class = class_of(pool, addr, &class_id, &piece);
+    return atomic_load_explicit(&class->refs[piece], memory_order_acquire) != 0;
 }
 
 void pool_free(MemPool* pool, void* addr) {
     errval_t err;
     assert(pool && addr);
 
-    err = enbdqueue(&pool->queue, NULL, addr);
+    size_t i, piece;
+    MemClass* class = class_of(pool, addr, &i, &piece);
+
+    // A single owner doesn't pay for the atomic operation, nobody else can take a reference meanwhile
+    atomic_uint* refs = &class->refs[piece];
+    if (atomic_load_explicit(refs, memory_order_acquire) != 0) {
+        if (atomic_fetch_sub_explicit(refs, 1, memory_order_acq_rel) != 0) return;
+        // The others dropped theirs in between, we are the last one
+        atomic_store_explicit(refs, 0, memory_order_relaxed);
+    }
+    if (pool->track) piece_set_owner(pool, class, piece, MEMPOOL_OWNER_FREE);
+
+    MagCache* cache = class_cache(pool, i);
+    if (cache != NULL) {
+        if (cache->count == class->magazine) cache_flush(class, cache);
+        else cache->hits += 1;
+        cache->pieces[cache->count++] = addr;
+        return;
+    }
+
+    avail_give(class, 1);
+    err = enbdqueue(&class->queue, NULL, addr);
     if (err_is_fail(err)) {
         USER_PANIC("Enqueue to memory pool shouldn't fail!");
     }
 }
 
+static const char* owner_names[MEMPOOL_OWNER_NUM] = {
+    [MEMPOOL_OWNER_FREE]      = "free",
+    [MEMPOOL_OWNER_POOL]      = "unclaimed",
+    [MEMPOOL_OWNER_DEVICE]    = "device",
+    [MEMPOOL_OWNER_ETHERNET]  = "ethernet",
+    [MEMPOOL_OWNER_ARP]       = "arp",
+    [MEMPOOL_OWNER_IPV4]      = "ipv4",
+    [MEMPOOL_OWNER_ASSEMBLER] = "ip assembler",
+    [MEMPOOL_OWNER_ICMP]      = "icmp",
+    [MEMPOOL_OWNER_NDP]       = "ndp",
+    [MEMPOOL_OWNER_TCP]       = "tcp",
+    [MEMPOOL_OWNER_APP]       = "application",
+    [MEMPOOL_OWNER_TX]        = "tx",
+};
+
+const char* mempool_owner_name(MemOwner owner) {
+    return (owner < MEMPOOL_OWNER_NUM) ? owner_names[owner] : "unknown";
+}
+
+errval_t mempool_track(MemPool* pool) {
+    assert(pool);
+    if (pool->track) return SYS_ERR_OK;
+
+    for (size_t i = 0; i < pool->class_num; i++) {
+        MemClass* class = &pool->classes[i];
+        // A piece handed out before would never be accounted back
+        if (atomic_load_explicit(&class->carved, memory_order_relaxed) != 0) {
+            EVENT_FATAL("The memory pool must be tracked before its first allocation");
+            return SYS_ERR_WRONG_CONFIG;
+        }
+        class->owner = calloc(class->capacity, sizeof(*class->owner));
+        class->since = calloc(class->capacity, sizeof(*class->since));
+        if (class->owner == NULL || class->since == NULL) {
+            EVENT_FATAL("Can't allocate the owners of %d pieces of the memory pool", class->capacity);
+            return SYS_ERR_ALLOC_FAIL;
+        }
+    }
+    pool->track = true;
+    EVENT_NOTE("Memory Pool tracks the owner of each piece");
+    return SYS_ERR_OK;
+}
+
+void pool_set_owner(MemPool* pool, void* addr, MemOwner owner) {
+    assert(pool && addr);
+    if (!pool->track) return;
+    size_t class_id, piece;
+    MemClass* class = class_of(pool, addr, &class_id, &piece);
+    piece_set_owner(pool, class, piece, owner);
+}
+
+size_t mempool_held(MemPool* pool, MemOwner owner) {
+    assert(pool && owner < MEMPOOL_OWNER_NUM);
+    return atomic_load_explicit(&pool->held[owner], memory_order_relaxed);
+}
+
+/// Pieces held for too long that are logged one by one, per report
+#define MEMPOOL_REPORT_PIECES   8
+
+void mempool_report_held(MemPool* pool, uint64_t older_than_ns) {
+    assert(pool);
+    if (!pool->track) return;
+
+    for (size_t owner = MEMPOOL_OWNER_POOL; owner < MEMPOOL_OWNER_NUM; owner++) {
+        size_t held = atomic_load_explicit(&pool->held[owner], memory_order_relaxed);
+        if (held != 0) EVENT_INFO("Memory Pool: %s holds %d pieces", owner_names[owner], held);
+    }
+
+    // The pieces are scanned without stopping anyone, a piece changing hands meanwhile may be counted in either layer
+    uint64_t now = track_now();
+    size_t   old[MEMPOOL_OWNER_NUM] = { 0 };
+    uint64_t oldest[MEMPOOL_OWNER_NUM] = { 0 };
+    size_t   logged = 0;
+    for (size_t i = 0; i < pool->class_num; i++) {
+        MemClass* class = &pool->classes[i];
+        size_t pieces = class->amount + atomic_load_explicit(&class->grown_num, memory_order_acquire) * class->chunk;
+        for (size_t piece = 0; piece < pieces; piece++) {
+            uint8_t owner = atomic_load_explicit(&class->owner[piece], memory_order_relaxed);
+            if (owner == MEMPOOL_OWNER_FREE) continue;
+            uint64_t since = atomic_load_explicit(&class->since[piece], memory_order_relaxed);
+            uint64_t age = (now > since) ? now - since : 0;
+            if (age < older_than_ns) continue;
+
+            old[owner] += 1;
+            if (age > oldest[owner]) oldest[owner] = age;
+            if (logged++ < MEMPOOL_REPORT_PIECES) {
+                EVENT_WARN("  Piece %d of %d bytes held by %s for %d ms", piece, class->bytes, owner_names[owner], age / 1000000);
+            }
+        }
+    }
+    for (size_t owner = MEMPOOL_OWNER_POOL; owner < MEMPOOL_OWNER_NUM; owner++) {
+        if (old[owner] == 0) continue;
+        EVENT_WARN("Memory Pool: %s holds %d pieces for more than %d ms, the oldest for %d ms",
+                   owner_names[owner], old[owner], older_than_ns / 1000000, oldest[owner] / 1000000);
+    }
+}
+
 void pool_destroy(MemPool* pool) {
-    assert(pool && pool->pool && pool->elems);
+    assert(pool);
+
+    for (size_t i = 0; i < pool->class_num; i++) {
+        MemClass* class = &pool->classes[i];
+        assert(class->pool && class->elems);
 
-    free(pool->pool);
-    pool->pool = NULL;
+        class_unmap(class);
+        free(class->refs);
 
-    free(pool->elems);
-    pool->elems = NULL;
+        free(class->elems);
+        class->elems = NULL;
+    }
 
     free(pool);
     LOG_ERR("NYI");
-}
\ No newline at end of file
+}
+
+size_t mempool_node_num(void) {
+    FILE* online = fopen("/sys/devices/system/node/online", "r");
+    if (online == NULL) return 1;
+
+    // Like "0" or "0-3"
+    int first = 0, last = 0;
+    int matched = fscanf(online, "%d-%d", &first, &last);
+    fclose(online);
+    if (matched <= 0) return 1;
+    return (size_t)((matched == 2) ? last : first) + 1;
+}
+
+int mempool_current_node(void) {
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) return 0;
+    return (int)node;
+}
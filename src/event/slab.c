@@ -0,0 +1,254 @@
+#include <event/slab.h>
+#include <event/states.h>      // LocalState
+#include <threads.h>           // thread_local
+#include <string.h>
+
+static atomic_size_t slab_ids = 1;
+/// Every slab that has been used, at its id - 1
+static _Atomic(Slab*) slabs[SLAB_MAX_TYPES];
+
+/// The caches of this thread, registered on the first use of each slab
+static thread_local SlabCache* my_caches[SLAB_MAX_TYPES];
+static thread_local bool       my_no_cache[SLAB_MAX_TYPES];
+
+static inline size_t round_up(size_t size, size_t align) {
+    return (size + align - 1) / align * align;
+}
+
+/// @brief  Distance between two objects of the slab
+static inline size_t slab_stride(const Slab* slab) {
+    assert(slab->size > 0 && slab->align > 0 && (slab->align & (slab->align - 1)) == 0);
+    return round_up(slab->size, slab->align);
+}
+
+/// @brief  Give the slab an id on its first use, the ones beyond SLAB_MAX_TYPES have no thread caches
+static size_t slab_id(Slab* slab) {
+    size_t id = atomic_load_explicit(&slab->id, memory_order_acquire);
+    assert(id != SLAB_DESTROYED && "The slab is used after slab_destroy()");
+    if (id != 0) return id;
+
+    pthread_mutex_lock(&slab->lock);
+    id = atomic_load_explicit(&slab->id, memory_order_relaxed);
+    if (id == 0) {
+        id = atomic_fetch_add_explicit(&slab_ids, 1, memory_order_relaxed);
+        if (id <= SLAB_MAX_TYPES) {
+            atomic_store_explicit(&slabs[id - 1], slab, memory_order_release);
+        } else {
+            EVENT_WARN("Too many slabs, the objects of %s are always taken under the lock", slab->name);
+        }
+        atomic_store_explicit(&slab->id, id, memory_order_release);
+    }
+    pthread_mutex_unlock(&slab->lock);
+    return id;
+}
+
+static SlabCache* cache_register(Slab* slab) {
+    size_t index = atomic_fetch_add_explicit(&slab->cache_num, 1, memory_order_relaxed);
+    if (index >= SLAB_MAX_CACHES) {
+        EVENT_WARN("Too many threads use the slab of %s, this one shares a magazine under the lock", slab->name);
+        return NULL;
+    }
+
+    SlabCache* cache = calloc(1, sizeof(SlabCache)); assert(cache);
+    LocalState* local = get_local_state();
+    snprintf(cache->owner, sizeof(cache->owner), "%s", (local && local->my_name) ? local->my_name : "Unknown");
+
+    atomic_store_explicit(&slab->caches[index], cache, memory_order_release);
+    return cache;
+}
+
+/// @brief  The cache of this thread for the slab, NULL if it doesn't have one
+static inline SlabCache* slab_cache(Slab* slab) {
+    size_t id = slab_id(slab);
+    if (id > SLAB_MAX_TYPES) return NULL;
+
+    size_t i = id - 1;
+    if (my_caches[i] == NULL && !my_no_cache[i]) {
+        my_caches[i]   = cache_register(slab);
+        my_no_cache[i] = (my_caches[i] == NULL);
+    }
+    return my_caches[i];
+}
+
+/// @brief  One more chunk to carve the objects from, under the lock
+static void depot_grow(Slab* slab) {
+    size_t stride = slab_stride(slab);
+    size_t align  = (slab->align > alignof(void*)) ? slab->align : alignof(void*);
+    // The link to the previous chunk, then the objects
+    size_t head   = round_up(sizeof(void*), align);
+    size_t objs   = (SLAB_CHUNK_BYTES - head) / stride;
+    if (objs < SLAB_BATCH) objs = SLAB_BATCH;
+
+    uint8_t* chunk = aligned_alloc(align, round_up(head + objs * stride, align));
+    if (chunk == NULL) USER_PANIC("Can't allocate a chunk of %d objects for the slab of %s", objs, slab->name);
+    *(void**)chunk = slab->chunks;
+    slab->chunks     = chunk;
+    slab->carve      = chunk + head;
+    slab->carve_left = objs;
+    slab->chunk_num += 1;
+    slab->obj_num   += objs;
+}
+
+/// @brief  Take a batch of objects: a full magazine of the depot, or never allocated ones
+static void cache_refill(Slab* slab, SlabCache* cache, bool locked) {
+    cache->refills += 1;
+    if (!locked) pthread_mutex_lock(&slab->lock);
+
+    SlabMag* mag = slab->full;
+    if (mag != NULL) {
+        slab->full = mag->next;
+        memcpy(cache->objs + cache->count, mag->objs, sizeof(mag->objs));
+        cache->count += SLAB_BATCH;
+        mag->next   = slab->empty;
+        slab->empty = mag;
+    } else {
+        size_t stride = slab_stride(slab);
+        for (size_t i = 0; i < SLAB_BATCH; i++) {
+            if (slab->carve_left == 0) depot_grow(slab);
+            cache->objs[cache->count++] = slab->carve;
+            slab->carve      += stride;
+            slab->carve_left -= 1;
+        }
+    }
+
+    if (!locked) pthread_mutex_unlock(&slab->lock);
+}
+
+/// @brief  Give the oldest half of a full cache to the depot, the recently freed objects are still in the CPU cache
+static void cache_flush(Slab* slab, SlabCache* cache, bool locked) {
+    assert(cache->count == SLAB_MAGAZINE);
+    cache->flushes += 1;
+    if (!locked) pthread_mutex_lock(&slab->lock);
+
+    SlabMag* mag = slab->empty;
+    if (mag != NULL) {
+        slab->empty = mag->next;
+    } else {
+        mag = malloc(sizeof(SlabMag)); assert(mag);
+    }
+    memcpy(mag->objs, cache->objs, sizeof(mag->objs));
+    mag->next  = slab->full;
+    slab->full = mag;
+
+    if (!locked) pthread_mutex_unlock(&slab->lock);
+
+    cache->count -= SLAB_BATCH;
+    memmove(cache->objs, cache->objs + SLAB_BATCH, cache->count * sizeof(void*));
+}
+
+static inline void* cache_alloc(Slab* slab, SlabCache* cache, bool locked) {
+    if (cache->count == 0) cache_refill(slab, cache, locked);
+    cache->allocs += 1;
+    return cache->objs[--cache->count];
+}
+
+static inline void cache_free(Slab* slab, SlabCache* cache, void* obj, bool locked) {
+    if (cache->count == SLAB_MAGAZINE) cache_flush(slab, cache, locked);
+    cache->frees += 1;
+    cache->objs[cache->count++] = obj;
+}
+
+void* slab_alloc(Slab* slab) {
+    assert(slab);
+    SlabCache* cache = slab_cache(slab);
+    if (cache != NULL) return cache_alloc(slab, cache, false);
+
+    pthread_mutex_lock(&slab->lock);
+    void* obj = cache_alloc(slab, &slab->shared, true);
+    pthread_mutex_unlock(&slab->lock);
+    return obj;
+}
+
+void* slab_zalloc(Slab* slab) {
+    void* obj = slab_alloc(slab);
+    memset(obj, 0x00, slab->size);
+    return obj;
+}
+
+void slab_free(Slab* slab, void* obj) {
+    assert(slab);
+    if (obj == NULL) return;
+    SlabCache* cache = slab_cache(slab);
+    if (cache != NULL) {
+        cache_free(slab, cache, obj, false);
+        return;
+    }
+
+    pthread_mutex_lock(&slab->lock);
+    cache_free(slab, &slab->shared, obj, true);
+    pthread_mutex_unlock(&slab->lock);
+}
+
+size_t slab_in_use(Slab* slab) {
+    assert(slab);
+    // An object is often freed by another thread than the one allocating it, only the sum tells
+    pthread_mutex_lock(&slab->lock);
+    size_t allocs = slab->shared.allocs, frees = slab->shared.frees;
+    pthread_mutex_unlock(&slab->lock);
+
+    for (size_t i = 0; i < SLAB_MAX_CACHES; i++) {
+        SlabCache* cache = atomic_load_explicit(&slab->caches[i], memory_order_acquire);
+        if (cache == NULL) continue;
+        allocs += cache->allocs;
+        frees  += cache->frees;
+    }
+    return (allocs > frees) ? allocs - frees : 0;
+}
+
+void slab_report(Slab* slab) {
+    assert(slab);
+    for (size_t i = 0; i < SLAB_MAX_CACHES; i++) {
+        SlabCache* cache = atomic_load_explicit(&slab->caches[i], memory_order_acquire);
+        if (cache == NULL) continue;
+        EVENT_INFO("  Slab cache of %s for %s: %d allocations, %d frees, %d refills, %d flushes, %d objects left",
+                   cache->owner, slab->name, cache->allocs, cache->frees, cache->refills, cache->flushes, cache->count);
+    }
+
+    size_t in_use = slab_in_use(slab);
+    pthread_mutex_lock(&slab->lock);
+    EVENT_NOTE("Slab of %s (%d bytes): %d chunks of %d objects, %d in use, %d allocations without a thread cache",
+               slab->name, slab_stride(slab), slab->chunk_num, slab->obj_num, in_use, slab->shared.allocs);
+    pthread_mutex_unlock(&slab->lock);
+}
+
+void slab_report_all(void) {
+    for (size_t i = 0; i < SLAB_MAX_TYPES; i++) {
+        Slab* slab = atomic_load_explicit(&slabs[i], memory_order_acquire);
+        if (slab != NULL) slab_report(slab);
+    }
+}
+
+static void mag_list_free(SlabMag* mag) {
+    while (mag != NULL) {
+        SlabMag* next = mag->next;
+        free(mag);
+        mag = next;
+    }
+}
+
+void slab_destroy(Slab* slab) {
+    assert(slab);
+    size_t in_use = slab_in_use(slab);
+    if (in_use != 0) EVENT_WARN("The slab of %s is destroyed with %d objects in use", slab->name, in_use);
+
+    // The thread caches of this id point to the freed ones, never look them up again
+    size_t id = atomic_exchange_explicit(&slab->id, SLAB_DESTROYED, memory_order_acq_rel);
+    assert(id != SLAB_DESTROYED);
+    if (id != 0 && id <= SLAB_MAX_TYPES) atomic_store_explicit(&slabs[id - 1], NULL, memory_order_release);
+
+    for (size_t i = 0; i < SLAB_MAX_CACHES; i++) {
+        SlabCache* cache = atomic_load_explicit(&slab->caches[i], memory_order_acquire);
+        free(cache);
+        atomic_store_explicit(&slab->caches[i], NULL, memory_order_relaxed);
+    }
+    mag_list_free(slab->full);
+    mag_list_free(slab->empty);
+    while (slab->chunks != NULL) {
+        void* next = *(void**)slab->chunks;
+        free(slab->chunks);
+        slab->chunks = next;
+    }
+
+    EVENT_NOTE("Slab of %s destroyed, it had %d chunks of %d objects", slab->name, slab->chunk_num, slab->obj_num);
+    pthread_mutex_destroy(&slab->lock);
+}
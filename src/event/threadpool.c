@@ -1,35 +1,60 @@
 #include <common.h>
 #include <event/threadpool.h>
 #include <event/timer.h>
-#include <errno.h>         //sterror
 #include <event/states.h>
+#include <threads.h>       // thread_local
 
 #include <sys/syscall.h>   //syscall
 #include <sys/types.h>     //pid_t
 
 // Global variable defined in threadpool.h
 alignas(ATOMIC_ISOLATION) ThreadPool g_threadpool;
+Slab g_task_slab = SLAB_INITIALIZER(Task);
 // TODO: move to g_states, we don't want to manage many global variables
 
-errval_t thread_pool_init(size_t workers) 
+/// The worker of this thread, NULL out of the pool
+static thread_local Worker* my_worker = NULL;
+
+errval_t thread_pool_init(size_t workers, BusyPollConfig busy_poll) 
 {
     errval_t err;
     assert(workers > 0);
     g_threadpool.workers = workers;
+    atomic_init(&g_threadpool.next, 0);
+    atomic_init(&g_threadpool.idle, 0);
+    atomic_init(&g_threadpool.stop, false);
 
-    // 1. Unbounded, MPMC queue
-    err = bdqueue_init(&g_threadpool.queue, g_threadpool.elements, TASK_QUEUE_SIZE);
+    // 1. Bounded MPMC ring, for the tasks that don't fit in the queues of the workers
+    err = mpmcring_init(&g_threadpool.queue, TASK_QUEUE_SIZE, sizeof(Task));
     DEBUG_FAIL_PUSH(err, SYS_ERR_INIT_FAIL, "Can't initialize the lock free queue");
 
-    // 1.2 Semaphore to notify woker 
-    if (sem_init(&g_threadpool.sem, 0, 0) != 0) {
-        const char *error_msg = strerror(errno);
-        EVENT_FATAL("Can't initialize the semaphore: %s", error_msg);
-        return SYS_ERR_INIT_FAIL;
+    // 2. The queues of each worker, and the eventcount to wake it up
+    g_threadpool.threads  = calloc(workers, sizeof(pthread_t));
+    g_threadpool.slaves   = aligned_alloc(ATOMIC_ISOLATION, workers * sizeof(Worker));
+    if (g_threadpool.threads == NULL || g_threadpool.slaves == NULL) {
+        EVENT_FATAL("Can't allocate %d workers", workers);
+        return SYS_ERR_ALLOC_FAIL;
+    }
+    memset(g_threadpool.slaves, 0x00, workers * sizeof(Worker));
+    for (size_t i = 0; i < workers; i++)
+    {
+        Worker* worker = &g_threadpool.slaves[i];
+        err = wsdeque_init(&worker->deque, WORKER_DEQUE_SIZE);
+        DEBUG_FAIL_PUSH(err, SYS_ERR_INIT_FAIL, "Can't initialize the deque of worker %d", i);
+        err = mpmcring_init(&worker->inbox, WORKER_INBOX_SIZE, sizeof(Task));
+        DEBUG_FAIL_PUSH(err, SYS_ERR_INIT_FAIL, "Can't initialize the inbox of worker %d", i);
+        err = mpmcring_init(&worker->pinned, WORKER_PINNED_SIZE, sizeof(Task));
+        DEBUG_FAIL_PUSH(err, SYS_ERR_INIT_FAIL, "Can't initialize the pinned queue of worker %d", i);
+
+        // 2.1 Eventcount to wake the worker up
+        eventcount_init(&worker->event);
+        atomic_init(&worker->parked, false);
+        worker->pool = &g_threadpool;
+        worker->id   = i;
+        busypoll_init(&worker->busy, busy_poll);
     }
 
     // 3. Create all the workers
-    g_threadpool.threads  = calloc(workers, sizeof(pthread_t));
     LocalState* local = calloc(workers, sizeof(LocalState));
     
     for (size_t i = 0; i < workers; i++)
@@ -41,32 +66,63 @@ errval_t thread_pool_init(size_t workers)
             .my_name  = name,
             .my_pid   = (pid_t)-1,      // Don't know yet
             .log_file = (g_states.log_file == NULL) ? stdout : g_states.log_file,
-            .my_state = &g_threadpool,
+            .my_state = &g_threadpool.slaves[i],
         };
 
         if (pthread_create(&g_threadpool.threads[i], NULL, thread_function, (void*)&local[i]) != 0) {
             LOG_FATAL("Can't create worker thread");
-            free(g_threadpool.threads); free(local);
+            free(g_threadpool.threads); free(g_threadpool.slaves); free(local);
             return EVENT_ERR_THREAD_CREATE;
         }
     }
 
-    EVENT_NOTE("Thread pool: %d slaves initialized", workers);
+    EVENT_NOTE("Thread pool: %d slaves initialized, busy-poll budget %d us%s", workers,
+               (int)(busy_poll.budget_ns / 1000), busy_poll.adaptive ? " (adaptive)" : "");
     return SYS_ERR_OK;
 }
 
+void thread_pool_report(void) {
+    size_t runs = 0, steals = 0;
+    for (size_t i = 0; i < g_threadpool.workers; i++) {
+        Worker* worker = &g_threadpool.slaves[i];
+        EVENT_INFO("  Slave%d: %d tasks in its deque (at most %d), %d in its inbox, %d pinned, ran %d tasks, stole %d of them",
+                   (int)i, wsdeque_size(&worker->deque), worker->depth_max, mpmcring_size(&worker->inbox),
+                   mpmcring_size(&worker->pinned), worker->runs, worker->steals);
+        runs   += worker->runs;
+        steals += worker->steals;
+    }
+    EVENT_NOTE("Thread pool: %d tasks ran, %d stolen, %d in the shared queue", runs, steals, mpmcring_size(&g_threadpool.queue));
+}
+
 void thread_pool_destroy(void) {
-    bool queue_elements_from_heap = false;
-    bdqueue_destroy(&g_threadpool.queue, queue_elements_from_heap);
+    // The workers still use their queues until they return, the tasks left in them are dropped
+    atomic_store_explicit(&g_threadpool.stop, true, memory_order_seq_cst);
+    for (size_t i = 0; i < g_threadpool.workers; i++)
+        eventcount_notify_all(&g_threadpool.slaves[i].event);
+    for (size_t i = 0; i < g_threadpool.workers; i++)
+        pthread_join(g_threadpool.threads[i], NULL);
 
-    for (size_t i = 0; i < g_threadpool.workers; i++) 
-        assert(pthread_cancel(g_threadpool.threads[i]) == 0);
-    EVENT_NOTE("TODO: let the thread itself do some cleaning");
+    thread_pool_report();
 
-    sem_destroy(&g_threadpool.sem);
+    mpmcring_destroy(&g_threadpool.queue);
+
+    BusyPoll total = { 0 };
+    for (size_t i = 0; i < g_threadpool.workers; i++) {
+        Worker* worker = &g_threadpool.slaves[i];
+        busypoll_merge(&total, &worker->busy);
+        wsdeque_destroy(&worker->deque);
+        mpmcring_destroy(&worker->inbox);
+        mpmcring_destroy(&worker->pinned);
+    }
+    if (total.spins + total.spin_skips + total.parks > 0) {
+        EVENT_INFO("Workers spent %.3f ms spinning (%zu of %zu spins found a task, %zu skipped), %.3f ms parked (%zu times)",
+                   total.spin_ns / 1e6, total.spin_hits, total.spins, total.spin_skips, total.park_ns / 1e6, total.parks);
+    }
 
     free(g_threadpool.threads);
     g_threadpool.threads = NULL;
+    free(g_threadpool.slaves);
+    g_threadpool.slaves = NULL;
 
     EVENT_NOTE(
         "Need to free local states !"
@@ -76,46 +132,287 @@ void thread_pool_destroy(void) {
     EVENT_NOTE("Threadpool destroyed !");
 }
 
+/// @brief  Wake the worker up if it's parked
+/// @return false if it wasn't
+static inline bool worker_wake(Worker* worker) {
+    // Only the one that clears the flag counts it as woken up
+    if (!atomic_load_explicit(&worker->parked, memory_order_seq_cst)) return false;
+    if (!atomic_exchange_explicit(&worker->parked, false, memory_order_seq_cst)) return false;
+    eventcount_notify(&worker->event);
+    return true;
+}
+
+/// @brief  A task is waiting for the worker: wake it up, or another parked one to steal the task
+static void pool_notify(ThreadPool* pool, Worker* worker) {
+    // The task is enqueued before the flags are read, as the worker sets its flag before looking at the queues
+    atomic_thread_fence(memory_order_seq_cst);
+    if (worker != NULL && worker_wake(worker)) return;
+    if (atomic_load_explicit(&pool->idle, memory_order_seq_cst) == 0) return;
+
+    size_t first = (worker != NULL) ? worker->id + 1 : 0;
+    for (size_t i = 0; i < pool->workers; i++) {
+        if (worker_wake(&pool->slaves[(first + i) % pool->workers])) return;
+    }
+}
+
+/// Spun on by an idle worker before it parks
+typedef struct {
+    Worker  *worker;
+    size_t   count;
+    Task     tasks[TASK_BATCH];
+} TaskPoll;
+
+/// @brief  Copy the task out of the deque, the slab copy isn't needed anymore
+static inline bool task_take(WsDeque* deque, bool owner, Task* ret_task) {
+    void* task = NULL;
+    errval_t err = owner ? wsdeque_pop(deque, &task) : wsdeque_steal(deque, &task);
+    if (err_is_fail(err)) return false;
+    *ret_task = *(Task*)task;
+    if (!ret_task->borrowed) slab_free(&g_task_slab, task);
+    return true;
+}
+
+/// @brief  Its own tasks newest first while they are in cache, then the ones given to it, the shared ones, and the other workers.
+///         The pinned ones are never stolen. Several are taken from the rings at once, only one from a deque
+///         so the rest can still be stolen
+static bool task_poll(void* arg) {
+    TaskPoll* poll = arg;
+    Worker* worker = poll->worker;
+    ThreadPool* pool = worker->pool;
+
+    if (task_take(&worker->deque, true, &poll->tasks[0])) {
+        poll->count = 1;
+        return true;
+    }
+    if ((poll->count = mpmcring_pop_batch(&worker->pinned, poll->tasks, TASK_BATCH)) > 0 ||
+        (poll->count = mpmcring_pop_batch(&worker->inbox, poll->tasks, TASK_BATCH)) > 0 ||
+        (poll->count = mpmcring_pop_batch(&pool->queue, poll->tasks, TASK_BATCH)) > 0) {
+        return true;
+    }
+
+    for (size_t i = 1; i < pool->workers; i++) {
+        Worker* victim = &pool->slaves[(worker->id + i) % pool->workers];
+        if (task_take(&victim->deque, false, &poll->tasks[0]) ||
+            mpmcring_pop(&victim->inbox, &poll->tasks[0]) == SYS_ERR_OK) {
+            worker->steals += 1;
+            poll->count = 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+/// @brief  Sleep until a task is submitted, or found after announcing it
+/// @return Whether the last look found a task
+static bool worker_park(Worker* worker, TaskPoll* poll) {
+    ThreadPool* pool = worker->pool;
+    uint32_t key = eventcount_prepare(&worker->event);
+    atomic_fetch_add_explicit(&pool->idle, 1, memory_order_seq_cst);
+    atomic_store_explicit(&worker->parked, true, memory_order_seq_cst);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // A task submitted before the flag was seen is found now, any later one notifies after the key was taken.
+    // So does the stop of the pool
+    bool found = task_poll(poll);
+    if (found || atomic_load_explicit(&pool->stop, memory_order_seq_cst)) {
+        eventcount_cancel(&worker->event);
+    } else {
+        uint64_t start = busypoll_park_start(&worker->busy);
+        eventcount_wait(&worker->event, key);
+        busypoll_park_end(&worker->busy, start);
+    }
+    // Up again, whoever cleared the flag or not
+    atomic_store_explicit(&worker->parked, false, memory_order_seq_cst);
+    atomic_fetch_sub_explicit(&pool->idle, 1, memory_order_seq_cst);
+    return found;
+}
+
 void *thread_function(void* localstate) {
     assert(localstate);
     LocalState* local = localstate;
     set_local_state(local);
     local->my_pid = syscall(SYS_gettid);
+    local->mempool = node_mempool();
     EVENT_NOTE("ThreadPool %s started with pid %d", local->my_name, local->my_pid);
 
     // Initialization barrier for lock-free queue
     CORES_SYNC_BARRIER;    
     
-    ThreadPool* pool = local->my_state; assert(pool);
-
-    Task *task = NULL;
-    while(true) {
-        if (debdqueue(&pool->queue, NULL, (void**)&task) == EVENT_DEQUEUE_EMPTY) {
-            sem_wait(&pool->sem);
-        } else {
-            assert(task);
-            (*task->process)(task->arg);
-            free(task);
-            task = NULL;
+    Worker* worker = local->my_state; assert(worker);
+    my_worker = worker;
+
+    TaskPoll poll = { .worker = worker, .count = 0 };
+    while (!atomic_load_explicit(&worker->pool->stop, memory_order_relaxed)) {
+        if (!task_poll(&poll) && !busypoll_spin(&worker->busy, task_poll, &poll) && !worker_park(worker, &poll)) {
+            continue;
         }
+        assert(poll.count > 0 && poll.count <= TASK_BATCH);
+        busypoll_arrival(&worker->busy);
+        worker->runs += poll.count;
+        for (size_t i = 0; i < poll.count; i++) {
+            (*poll.tasks[i].process)(poll.tasks[i].arg);
+        }
+        poll.count = 0;
     }
-    //TODO: let the threads receive a signal and gracefully exit
+    EVENT_NOTE("ThreadPool %s stopped", local->my_name);
+    return NULL;
 }
 
-errval_t submit_task(Task task) {
-    errval_t err;
+/// @brief  A worker keeps its own tasks, the others are spread over the inboxes, the shared queue takes what doesn't fit
+static errval_t pool_submit(ThreadPool* pool, const Task* task) {
+    size_t first = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed);
+    for (size_t i = 0; i < pool->workers; i++) {
+        Worker* worker = &pool->slaves[(first + i) % pool->workers];
+        if (mpmcring_push(&worker->inbox, task) == SYS_ERR_OK) {
+            pool_notify(pool, worker);
+            return SYS_ERR_OK;
+        }
+    }
+
+    errval_t err = mpmcring_push(&pool->queue, task);
+    if (err_no(err) == EVENT_ENQUEUE_FULL) {
+        EVENT_WARN("The Task Queue is full !");
+        return err;
+    }
+    pool_notify(pool, NULL);
+    return SYS_ERR_OK;
+}
 
-    // free after dequeue
-    Task* task_copy = malloc(sizeof(Task));
-    *task_copy = task;
+/// @brief  Push the task on the deque of the worker submitting it, false out of the pool or if it's full
+static bool self_submit(ThreadPool* pool, Task* task) {
+    Worker* self = my_worker;
+    if (self == NULL || self->pool != pool) return false;
+    if (err_is_fail(wsdeque_push(&self->deque, task))) return false;
+
+    size_t depth = wsdeque_size(&self->deque);
+    if (depth > self->depth_max) self->depth_max = depth;
+    // Busy running this one, a parked worker can steal it meanwhile
+    pool_notify(pool, NULL);
+    return true;
+}
 
-    err = enbdqueue(task.queue, NULL, task_copy);
+/// @brief  Copy the task into the ring of another thread
+static errval_t queue_submit(const Task* task) {
+    EventCount* event = task->event;
+    errval_t err = mpmcring_push(task->queue, task);
     if (err_no(err) == EVENT_ENQUEUE_FULL) {
         EVENT_WARN("The Task Queue is full !");
         return err;
-    } 
-    DEBUG_FAIL_RETURN(err, "Error met when trying to enqueue!");
+    }
+    eventcount_notify(event);
+    return SYS_ERR_OK;
+}
+
+errval_t submit_task(Task task) {
+    assert(task.queue);
+    task.borrowed = false;
+    if (task.queue != &g_threadpool.queue) return queue_submit(&task);
+
+    // The deque only takes pointers: free after dequeue
+    if (my_worker != NULL) {
+        Task* task_copy = SLAB_NEW(&g_task_slab, Task);
+        *task_copy = task;
+        if (self_submit(&g_threadpool, task_copy)) return SYS_ERR_OK;
+        slab_free(&g_task_slab, task_copy);
+    }
+    return pool_submit(&g_threadpool, &task);
+}
+
+errval_t submit_task_ptr(Task* task) {
+    errval_t err; assert(task);
+
+    // A borrowed one may already be run and gone once copied
+    bool borrowed = task->borrowed;
+    if (task->queue == &g_threadpool.queue) {
+        if (self_submit(&g_threadpool, task)) return SYS_ERR_OK;
+        err = pool_submit(&g_threadpool, task);
+    } else {
+        err = queue_submit(task);
+    }
+    if (err_is_ok(err) && !borrowed) slab_free(&g_task_slab, task);
+    return err;
+}
+
+/// @brief  Wake up to count parked workers
+static void pool_wake(ThreadPool* pool, size_t count) {
+    atomic_thread_fence(memory_order_seq_cst);
+    size_t first = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed);
+    for (size_t i = 0; i < pool->workers && count > 0; i++) {
+        if (atomic_load_explicit(&pool->idle, memory_order_seq_cst) == 0) return;
+        if (worker_wake(&pool->slaves[(first + i) % pool->workers])) count--;
+    }
+}
+
+/// @brief  Same as pool_submit() for several tasks, an inbox gets TASK_BATCH of them for a single wakeup
+static size_t pool_submit_batch(ThreadPool* pool, const Task* tasks, size_t count) {
+    size_t done = 0;
+    Worker* self = my_worker;
+    if (self != NULL && self->pool == pool) {
+        // The deque only takes pointers: free after dequeue
+        for (; done < count; done++) {
+            Task* task_copy = SLAB_NEW(&g_task_slab, Task);
+            *task_copy = tasks[done];
+            task_copy->borrowed = false;
+            if (err_is_fail(wsdeque_push(&self->deque, task_copy))) {
+                slab_free(&g_task_slab, task_copy);
+                break;
+            }
+        }
+        size_t depth = wsdeque_size(&self->deque);
+        if (depth > self->depth_max) self->depth_max = depth;
+        // It runs one of them, the parked workers steal the others
+        if (done > 1) pool_wake(pool, done - 1);
+        if (done == count) return done;
+    }
+
+    // Each inbox woken up for a whole batch, a busy owner leaves its batch to be stolen by a parked worker
+    size_t busy = 0;
+    size_t first = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed);
+    for (size_t i = 0; i < pool->workers && done < count; i++) {
+        Worker* worker = &pool->slaves[(first + i) % pool->workers];
+        size_t batch = (count - done < TASK_BATCH) ? count - done : TASK_BATCH;
+        size_t queued = mpmcring_push_batch(&worker->inbox, &tasks[done], batch);
+        if (queued == 0) continue;
+        done += queued;
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!worker_wake(worker)) busy += 1;
+    }
+
+    size_t shared = mpmcring_push_batch(&pool->queue, &tasks[done], count - done);
+    if (shared > 0) busy += 1;
+    done += shared;
+    if (done < count) EVENT_WARN("The Task Queue is full !");
+
+    if (busy > 0) pool_wake(pool, busy);
+    return done;
+}
+
+size_t submit_task_batch(const Task* tasks, size_t count) {
+    assert(tasks || count == 0);
+    if (count == 0) return 0;
+    for (size_t i = 1; i < count; i++) assert(tasks[i].queue == tasks[0].queue);
+
+    if (tasks[0].queue == &g_threadpool.queue) return pool_submit_batch(&g_threadpool, tasks, count);
+
+    size_t queued = mpmcring_push_batch(tasks[0].queue, tasks, count);
+    if (queued < count) EVENT_WARN("The Task Queue is full !");
+    // Its thread runs every queued task before waiting again
+    if (queued > 0) eventcount_notify(tasks[0].event);
+    return queued;
+}
+
+errval_t submit_task_to(Task* task, size_t worker) {
+    errval_t err; assert(task);
+    assert(task->queue == &g_threadpool.queue && worker < g_threadpool.workers);
+
+    Worker* target = &g_threadpool.slaves[worker];
+    bool borrowed = task->borrowed;
+    err = mpmcring_push(&target->pinned, task);
+    if (err_no(err) == EVENT_ENQUEUE_FULL) return err;
+    if (!borrowed) slab_free(&g_task_slab, task);
 
-    sem_post(task.sem);
+    // Nobody else can run it
+    atomic_thread_fence(memory_order_seq_cst);
+    worker_wake(target);
     return SYS_ERR_OK;
 }
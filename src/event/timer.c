@@ -1,6 +1,7 @@
 #include <event/event.h>
 #include <event/timer.h>
 #include <event/states.h>
+#include <event/slab.h>
 
 #include <signal.h>
 #include <time.h>
@@ -13,6 +14,9 @@
 static void* timer_thread (void*) __attribute__((noreturn));
 static void timer_thread_cleanup(void* args);
 
+/// Freed by the timer thread once submitted
+static Slab delayed_tasks = SLAB_INITIALIZER(DelayedTask);
+
 static void time_to_submit_task(int sig, siginfo_t *info, void *ucontext) {
     (void) ucontext;
     const uint8_t timer_id = sig - SIG_TIGGER_SUBMIT;
@@ -22,20 +26,22 @@ static void time_to_submit_task(int sig, siginfo_t *info, void *ucontext) {
     if (err_is_fail(err))
     {
         DEBUG_ERR(err, "Failed to submit a Task after delay, will execute the fail function");
-        // TODO: Should I test if fail is NULL ?
-        (dt->fail)((void*) dt);
+        // A periodic task without one just waits for the next expiration
+        if (dt->fail) (dt->fail)((void*) dt);
         g_states.timer[timer_id].count_failed += 1;
     } else {
         g_states.timer[timer_id].count_submitted += 1;
     }
 
-    free(dt);
+    // A periodic task fires again with the same pointer, it lives as long as its timer
+    if (!dt->periodic) slab_free(&delayed_tasks, dt);
 }
 
 timer_t submit_periodic_task(DelayedTask dt, delayed_us repeat) {
      // 1. Should be free'd by timer
-    DelayedTask* dtask = malloc(sizeof(DelayedTask)); assert(dtask);
+    DelayedTask* dtask = SLAB_NEW(&delayed_tasks, DelayedTask);
     *dtask = dt;
+    dtask->periodic = (repeat != 0);
 
     // Randomly choose a timer thread to send signal
     const uint8_t timer_id = rand() % TIMER_NUM;
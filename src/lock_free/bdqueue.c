@@ -49,3 +49,24 @@ errval_t debdqueue(BdQueue* queue, void** ret_key, void** ret_data) {
         return SYS_ERR_OK;
     }
 }
+
+size_t enbdqueue_batch(BdQueue* queue, void* const* data, size_t count) {
+    assert(queue && data);
+    size_t done = 0;
+    while (done < count && lfds711_queue_bmm_enqueue(&queue->queue, NULL, data[done]) != 0) done++;
+    return done;
+}
+
+size_t debdqueue_batch(BdQueue* queue, void** ret_data, size_t max) {
+    assert(queue && ret_data);
+    size_t done = 0;
+    while (done < max && lfds711_queue_bmm_dequeue(&queue->queue, NULL, &ret_data[done]) != 0) done++;
+    return done;
+}
+
+size_t bdqueue_size(BdQueue* queue) {
+    assert(queue);
+    size_t element_count = 0;
+    lfds711_queue_bmm_query(&queue->queue, LFDS711_QUEUE_BMM_QUERY_GET_POTENTIALLY_INACCURATE_COUNT, NULL, &element_count);
+    return element_count;
+}
@@ -0,0 +1,91 @@
+#include <lock_free/deque.h>
+
+errval_t wsdeque_init(WsDeque* deque, size_t capacity) {
+    // Alignment
+    assert((uint64_t)deque % ATOMIC_ISOLATION == 0);
+
+    // assert capacity is power of 2
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+
+    deque->slots = calloc(capacity, sizeof(*deque->slots));
+    if (deque->slots == NULL) {
+        LOG_ERR("Can't allocate a deque of %zu slots", capacity);
+        return SYS_ERR_ALLOC_FAIL;
+    }
+    deque->mask = capacity - 1;
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    return SYS_ERR_OK;
+}
+
+void wsdeque_destroy(WsDeque* deque) {
+    size_t element_count = wsdeque_size(deque);
+    free(deque->slots);
+    deque->slots = NULL;
+
+    LOG_NOTE("work-stealing deque destroyed, whole capacity: %zu, element count: %zu", deque->mask + 1, element_count);
+    deque->mask = 0;
+}
+
+errval_t wsdeque_push(WsDeque* deque, void* data) {
+    assert(deque && data);
+    int64_t b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if ((size_t)(b - t) > deque->mask) return EVENT_ENQUEUE_FULL;
+
+    atomic_store_explicit(&deque->slots[b & deque->mask], data, memory_order_relaxed);
+    // The element is written before the thieves can see it
+    atomic_store_explicit(&deque->bottom, b + 1, memory_order_release);
+    return SYS_ERR_OK;
+}
+
+errval_t wsdeque_pop(WsDeque* deque, void** ret_data) {
+    assert(deque && ret_data);
+    int64_t b = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, b, memory_order_relaxed);
+    // Claim the bottom before looking at the top, a thief does the opposite
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (t > b) {
+        // Empty
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+        *ret_data = NULL;
+        return EVENT_DEQUEUE_EMPTY;
+    }
+
+    void* data = atomic_load_explicit(&deque->slots[b & deque->mask], memory_order_relaxed);
+    if (t == b) {
+        // The last one, race the thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+            data = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+    }
+    *ret_data = data;
+    return (data == NULL) ? EVENT_DEQUEUE_EMPTY : SYS_ERR_OK;
+}
+
+errval_t wsdeque_steal(WsDeque* deque, void** ret_data) {
+    assert(deque && ret_data);
+    *ret_data = NULL;
+    int64_t t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (t >= b) return EVENT_DEQUEUE_EMPTY;
+
+    void* data = atomic_load_explicit(&deque->slots[t & deque->mask], memory_order_relaxed);
+    // Lost to the owner or to another thief, the caller tries elsewhere
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return EVENT_DEQUEUE_EMPTY;
+    }
+    *ret_data = data;
+    return SYS_ERR_OK;
+}
+
+size_t wsdeque_size(WsDeque* deque) {
+    assert(deque);
+    int64_t b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    return (b > t) ? (size_t)(b - t) : 0;
+}
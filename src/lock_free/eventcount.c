@@ -0,0 +1,81 @@
+#include <lock_free/eventcount.h>
+#include <event/busypoll.h>     // busypoll_relax
+
+#include <limits.h>
+#include <pthread.h>            // pthread_testcancel
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static inline long futex(_Atomic(uint32_t)* word, int op, uint32_t value) {
+    return syscall(SYS_futex, (uint32_t*)word, op, value, NULL, NULL, 0);
+}
+
+void eventcount_init(EventCount* event) {
+    assert(event);
+    atomic_init(&event->epoch, 0);
+    atomic_init(&event->waiters, 0);
+}
+
+uint32_t eventcount_prepare(EventCount* event) {
+    assert(event);
+    // Counted before the key is read and the queue looked at again, a producer does the opposite
+    atomic_fetch_add_explicit(&event->waiters, 1, memory_order_seq_cst);
+    return atomic_load_explicit(&event->epoch, memory_order_seq_cst);
+}
+
+void eventcount_cancel(EventCount* event) {
+    assert(event);
+    atomic_fetch_sub_explicit(&event->waiters, 1, memory_order_relaxed);
+}
+
+void eventcount_wait(EventCount* event, uint32_t key) {
+    assert(event);
+    // futex() isn't a cancellation point: a thread cancelled before its prepare wouldn't be woken up for it
+    pthread_testcancel();
+    // Returns at once if a notify came since the prepare, else on a notify or a signal
+    while (atomic_load_explicit(&event->epoch, memory_order_acquire) == key) {
+        futex(&event->epoch, FUTEX_WAIT_PRIVATE, key);
+    }
+    atomic_fetch_sub_explicit(&event->waiters, 1, memory_order_relaxed);
+    // Woken up by the notify_all() that follows a pthread_cancel()
+    pthread_testcancel();
+}
+
+static inline bool has_waiters(EventCount* event) {
+    // The item is enqueued before the waiters are read
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&event->waiters, memory_order_seq_cst) == 0) return false;
+    atomic_fetch_add_explicit(&event->epoch, 1, memory_order_release);
+    return true;
+}
+
+bool eventcount_notify(EventCount* event) {
+    assert(event);
+    if (!has_waiters(event)) return false;
+    futex(&event->epoch, FUTEX_WAKE_PRIVATE, 1);
+    return true;
+}
+
+void eventcount_notify_all(EventCount* event) {
+    assert(event);
+    if (!has_waiters(event)) return;
+    futex(&event->epoch, FUTEX_WAKE_PRIVATE, INT_MAX);
+}
+
+void eventcount_await(EventCount* event, bool (*poll)(void*), void* arg) {
+    assert(event && poll);
+    for (size_t i = 0; i < EVENTCOUNT_SPIN; i++) {
+        if (poll(arg)) return;
+        pthread_testcancel();
+        busypoll_relax();
+    }
+    while (true) {
+        uint32_t key = eventcount_prepare(event);
+        if (poll(arg)) {
+            eventcount_cancel(event);
+            return;
+        }
+        eventcount_wait(event, key);
+    }
+}
@@ -1,4 +1,15 @@
 #include <lock_free/hash_table.h>
+#include <event/slab.h>
+
+/// Elements of every hash table, lfds711 needs them on their own cache lines
+static Slab hash_elements = SLAB_INITIALIZER_ALIGNED(struct lfds711_hash_a_element, ATOMIC_ISOLATION);
+
+static void hash_freelist_cleanup_callback(struct lfds711_freelist_state *fs, struct lfds711_freelist_element *fe) {
+    assert(fs && fe);
+    struct lfds711_hash_a_element* he = LFDS711_FREELIST_GET_VALUE_FROM_ELEMENT(*fe);
+    assert(he);
+    slab_free(&hash_elements, he);
+}
 
 errval_t hash_init(
     HashTable* hash, HashBucket* buckets, size_t buck_num, enum hash_policy policy,
@@ -40,8 +51,7 @@ errval_t hash_init(
     
     struct lfds711_freelist_element* fe = calloc(INIT_FREE, sizeof(struct lfds711_freelist_element));
     for (int i = 0; i < INIT_FREE; i++) {
-        struct lfds711_hash_a_element* he = aligned_alloc(ATOMIC_ISOLATION, sizeof(struct lfds711_hash_a_element));
-        memset(he, 0x00, sizeof(struct lfds711_hash_a_element));
+        struct lfds711_hash_a_element* he = slab_zalloc(&hash_elements);
         LFDS711_FREELIST_SET_VALUE_IN_ELEMENT(fe[i], he);
         lfds711_freelist_push(&hash->freelist, &fe[i], NULL);
     }
@@ -65,7 +75,7 @@ void hash_destroy(HashTable* hash) {
     lfds711_freelist_query(&hash->freelist, LFDS711_FREELIST_QUERY_SINGLETHREADED_GET_COUNT, NULL, &free_count);
 
     // 2.1 Clenup the freelist
-    lfds711_freelist_cleanup(&hash->freelist, freelist_element_cleanup_callback);
+    lfds711_freelist_cleanup(&hash->freelist, hash_freelist_cleanup_callback);
 
     EVENT_NOTE("Hash table destroyed, %d elements in hash, %d elements in freelist", element_count, free_count);
 }
@@ -90,7 +100,7 @@ errval_t hash_insert(HashTable* hash, void* key, void* data) {
     {
     case LFDS711_HASH_A_PUT_RESULT_SUCCESS:
     {
-        he = aligned_alloc(ATOMIC_ISOLATION, sizeof(struct lfds711_hash_a_element));
+        he = slab_alloc(&hash_elements);
         LFDS711_FREELIST_SET_VALUE_IN_ELEMENT(*fe, he);
         lfds711_freelist_push(&hash->freelist, fe, NULL);
         return SYS_ERR_OK;
@@ -0,0 +1,111 @@
+#include <lock_free/ring.h>
+#include <string.h>
+
+/// The sequence number, then the value
+static inline atomic_size_t* cell_seq(MpmcRing* ring, size_t pos) {
+    return (atomic_size_t*)(ring->cells + (pos & ring->mask) * ring->cell_size);
+}
+
+static inline void* cell_data(atomic_size_t* seq) {
+    return (uint8_t*)seq + sizeof(atomic_size_t);
+}
+
+errval_t mpmcring_init(MpmcRing* ring, size_t capacity, size_t elem_size) {
+    // Alignment
+    assert((uint64_t)ring % ATOMIC_ISOLATION == 0);
+
+    // assert capacity is power of 2
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    assert(elem_size > 0);
+
+    ring->elem_size = elem_size;
+    ring->cell_size = (sizeof(atomic_size_t) + elem_size + RING_CELL_SIZE - 1) / RING_CELL_SIZE * RING_CELL_SIZE;
+    ring->cells     = aligned_alloc(RING_CELL_SIZE, capacity * ring->cell_size);
+    if (ring->cells == NULL) {
+        LOG_ERR("Can't allocate a ring of %zu cells of %zu bytes", capacity, ring->cell_size);
+        return SYS_ERR_ALLOC_FAIL;
+    }
+    ring->mask = capacity - 1;
+    // A cell is free for the push at its own position, full for the pop at the next one
+    for (size_t i = 0; i < capacity; i++) atomic_init(cell_seq(ring, i), i);
+    atomic_init(&ring->enqueue_pos, 0);
+    atomic_init(&ring->dequeue_pos, 0);
+    return SYS_ERR_OK;
+}
+
+void mpmcring_destroy(MpmcRing* ring) {
+    size_t element_count = mpmcring_size(ring);
+    free(ring->cells);
+    ring->cells = NULL;
+
+    LOG_NOTE("MPMC ring destroyed, whole capacity: %zu, element count: %zu", ring->mask + 1, element_count);
+    ring->mask = 0;
+}
+
+errval_t mpmcring_push(MpmcRing* ring, const void* elem) {
+    assert(ring && elem);
+    atomic_size_t* seq;
+    size_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    while (true) {
+        seq = cell_seq(ring, pos);
+        intptr_t dif = (intptr_t)atomic_load_explicit(seq, memory_order_acquire) - (intptr_t)pos;
+        if (dif == 0) {
+            // Free, claim it
+            if (atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) break;
+        } else if (dif < 0) {
+            // Not popped yet, a lap behind
+            return EVENT_ENQUEUE_FULL;
+        } else {
+            // Another producer took it
+            pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+        }
+    }
+    memcpy(cell_data(seq), elem, ring->elem_size);
+    // The value is written before a consumer can see the cell full
+    atomic_store_explicit(seq, pos + 1, memory_order_release);
+    return SYS_ERR_OK;
+}
+
+errval_t mpmcring_pop(MpmcRing* ring, void* ret_elem) {
+    assert(ring && ret_elem);
+    atomic_size_t* seq;
+    size_t pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+    while (true) {
+        seq = cell_seq(ring, pos);
+        intptr_t dif = (intptr_t)atomic_load_explicit(seq, memory_order_acquire) - (intptr_t)(pos + 1);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) break;
+        } else if (dif < 0) {
+            return EVENT_DEQUEUE_EMPTY;
+        } else {
+            pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+        }
+    }
+    memcpy(ret_elem, cell_data(seq), ring->elem_size);
+    // Free for the push of the next lap
+    atomic_store_explicit(seq, pos + ring->mask + 1, memory_order_release);
+    return SYS_ERR_OK;
+}
+
+size_t mpmcring_push_batch(MpmcRing* ring, const void* elems, size_t count) {
+    assert(ring && elems);
+    size_t done = 0;
+    while (done < count && mpmcring_push(ring, (const uint8_t*)elems + done * ring->elem_size) == SYS_ERR_OK) done++;
+    return done;
+}
+
+size_t mpmcring_pop_batch(MpmcRing* ring, void* ret_elems, size_t max) {
+    assert(ring && ret_elems);
+    size_t done = 0;
+    while (done < max && mpmcring_pop(ring, (uint8_t*)ret_elems + done * ring->elem_size) == SYS_ERR_OK) done++;
+    return done;
+}
+
+size_t mpmcring_size(MpmcRing* ring) {
+    assert(ring);
+    size_t enqueue = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    size_t dequeue = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+    return (enqueue > dequeue) ? enqueue - dequeue : 0;
+}
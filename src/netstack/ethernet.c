@@ -83,6 +83,27 @@ errval_t ethernet_marshal(
     return SYS_ERR_OK;
 }
 
+errval_t ethernet_marshal_chain(
+    Ethernet* ether, mac_addr dst_mac, uint16_t type, BufChain* chain
+) {
+    errval_t err;
+    assert(ether && chain && (type == ETH_TYPE_IPv4 || type == ETH_TYPE_IPv6)); 
+    
+    bufchain_push(chain, sizeof(struct eth_hdr));
+
+    struct eth_hdr* packet = (struct eth_hdr*) chain->segs[0].data;
+    *packet = (struct eth_hdr){
+        .src  = hton6(ether->my_mac),
+        .dst  = hton6(dst_mac),
+        .type = htons(type),
+    };
+
+    err = device_send_chain(ether->device, chain);
+    DEBUG_FAIL_RETURN(err, "Device can't send the chained ethernet frame");
+
+    return SYS_ERR_OK;
+}
+
 errval_t ethernet_unmarshal(
     Ethernet* ether, Buffer buf
 ) {
@@ -142,7 +142,8 @@ errval_t icmp_unmarshal(
     assert(ret_code != 0xFF);
     assert(ret_type != 0xFF);
 
-    ICMP_marshal* marshal = malloc(sizeof(ICMP_marshal));
+    PktDesc* desc = pktdesc_get(buf);
+    ICMP_marshal* marshal = &desc->icmp_marshal;
     *marshal = (ICMP_marshal) {
         .icmp   = icmp,
         .dst_ip = src_ip,
@@ -152,10 +153,9 @@ errval_t icmp_unmarshal(
         .buf    = buf,
     };
 
-    err = submit_task(MK_NORM_TASK(event_icmp_marshal, (void*) marshal));
+    err = submit_pktdesc(desc, MK_NORM_TASK(event_icmp_marshal, (void*) marshal));
     if (err_is_fail(err))
     {
-        free(marshal);
         assert(0 && "disable for now");
         assert(err_no(err) == EVENT_ENQUEUE_FULL);
         // If the Queue if full, directly send 
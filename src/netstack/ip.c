@@ -100,8 +100,9 @@ errval_t handle_ip_segment_assembly(
     // 2. if the message is segmented, then we need to put it into the assembler
     ip_msg_key_t key = ip_message_hash(src_ip, id);
 
-    // 2.1 Create the message structure
-    IP_segment *msg = calloc(1, sizeof(IP_segment)); assert(msg);
+    // 2.1 Create the message structure, in the headroom of the segment
+    PktDesc *desc = pktdesc_get(buf);
+    IP_segment *msg = &desc->ip_segment;
     *msg = (IP_segment) {
         .assembler  = &ip->assemblers[key],
         .src_ip    = src_ip,
@@ -116,12 +117,11 @@ errval_t handle_ip_segment_assembly(
     // 3. Add the message to the assembler's queue, we do this to ensure the message is handled in a single thread. To handle the 
     //   segmentation in multi-thread is too complicated, requires a lot of synchronization, and it's rarely used, doesn't worth it
     Task task_for_assembler = MK_TASK(&ip->assemblers[key].event_que, &ip->assemblers[key].event_come, event_ip_assemble, (void*)msg);
-    err = submit_task(task_for_assembler);
+    err = submit_pktdesc(desc, task_for_assembler);
     if (err_is_fail(err)) {
         assert(err_no(err) == EVENT_ENQUEUE_FULL);
         // Will be freed in upper module (event caller)
         // free_buffer(buf);
-        free(msg);
         IP_WARN("Too much IP segmentation message for bucket %d, will drop it in upper module", key);
         return err;
     } else {
@@ -162,13 +162,15 @@ errval_t ipv4_unmarshal(
         return NET_ERR_IPv4_WRONG_FIELD;
     }
 
-    // 1.3 Checksum
-    uint16_t packet_checksum = ntohs(packet->chksum);
-    packet->chksum = 0;     // Set the it as 0 to calculate
-    uint16_t checksum = inet_checksum_in_net_order(packet, header_size);
-    if (packet_checksum != ntohs(checksum)) {
-        LOG_ERR("This IPv4 Pacekt Has Wrong Checksum %p, Should be %p", checksum, packet_checksum);
-        return NET_ERR_IPv4_WRONG_CHECKSUM;
+    // 1.3 Checksum, unless the device (kernel) already verified it
+    if (!(buf.offload & BUFFER_CSUM_VALID)) {
+        uint16_t packet_checksum = ntohs(packet->chksum);
+        packet->chksum = 0;     // Set the it as 0 to calculate
+        uint16_t checksum = inet_checksum_in_net_order(packet, header_size);
+        if (packet_checksum != ntohs(checksum)) {
+            LOG_ERR("This IPv4 Pacekt Has Wrong Checksum %p, Should be %p", checksum, packet_checksum);
+            return NET_ERR_IPv4_WRONG_CHECKSUM;
+        }
     }
 
     // 1.4 Destination IP
@@ -220,7 +222,12 @@ errval_t ip_marshal(
     IP* ip, ip_context_t dst_ip, uint8_t proto, Buffer buf
 ) {
     assert(ip); errval_t err = SYS_ERR_OK;
-    IP_send *msg = malloc(sizeof(IP_send)); assert(msg);
+    IP_send *msg = buffer_desc(buf, sizeof(IP_send), IP_SEND_KEEP);
+    bool in_headroom = (msg != NULL);
+    if (!in_headroom) {
+        msg = SLAB_NEW(&g_ip_send_slab, IP_send);
+    }
+    buffer_set_owner(buf, MEMPOOL_OWNER_TX);
 
     // 1. Create the message
     *msg = (IP_send) {
@@ -232,6 +239,7 @@ errval_t ip_marshal(
         .dst_mac        = MAC_NULL,
         .buf            = buf,
         .retry_interval = IP_RETRY_SEND_US,
+        .in_headroom    = in_headroom,
     };
 
     // 3. Get destination MAC
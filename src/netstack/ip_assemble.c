@@ -5,6 +5,11 @@
 #include <event/states.h>
 #include <sys/syscall.h>   //syscall    
 #include <event/event.h>   //event_ip_handle
+#include <event/slab.h>
+
+/// Only touched by the assembler threads
+static Slab ip_recvs = SLAB_INITIALIZER(IP_recv);
+static Slab msegs    = SLAB_INITIALIZER(Mseg);
 
 static void* assemble_thread(void* state);
 
@@ -23,9 +28,8 @@ errval_t assemble_init(
 ) {
     errval_t err = SYS_ERR_OK;
     
-    // 1. Initialize the message queue
-    BQelem * queue_elements = calloc(queue_size, sizeof(BQelem));
-    err = bdqueue_init(&assemble->event_que, queue_elements, queue_size);
+    // 1. Initialize the message queue, the tasks are stored in it
+    err = mpmcring_init(&assemble->event_que, queue_size, sizeof(Task));
     if (err_is_fail(err)) {
         IP_FATAL("Can't Initialize the queues for TCP messages, TODO: free the memory");
         return err_push(err, SYS_ERR_INIT_FAIL);
@@ -34,11 +38,8 @@ errval_t assemble_init(
     // 1.1 initialize the hash table
     assemble->recv_messages = kh_init(ip_msg);
         
-    // 2. Initialize the semaphore for senders
-    if (sem_init(&assemble->event_come, 0, 0) != 0) {
-        IP_FATAL("Can't Initialize the semaphores for IP segmented messages, TODO: free the memory");
-        return SYS_ERR_INIT_FAIL;
-    }
+    // 2. Initialize the eventcount for senders
+    eventcount_init(&assemble->event_come);
 
     // 3.1 Local state for the assemble thread
     char* name = calloc(32, sizeof(char));
@@ -49,7 +50,7 @@ errval_t assemble_init(
         .my_name  = name,
         .my_pid   = (pid_t)-1,      // Don't know yet
         .log_file = (g_states.log_file == NULL) ? stdout : g_states.log_file,
-        .my_state = assemble,             // Provide message queue and semaphore
+        .my_state = assemble,             // Provide message queue and eventcount
     };
 
     // 3.2 Create the assemble thread
@@ -66,7 +67,10 @@ void assembler_destroy(
 ) {
     assert(assemble);
 
+    // Cancelled while it waits for a task, its cleanup frees the queue and the hash table before the join returns
     pthread_cancel(assemble->self);
+    eventcount_notify_all(&assemble->event_come);
+    pthread_join(assemble->self, NULL);
     LOG_NOTE("IP assembler %d destroyed", id);
     
     // free(assemble);
@@ -77,17 +81,25 @@ static void assembler_thread_cleanup(void* args) {
     LocalState *local = args; assert(local);
     IP_assembler* assembler = local->my_state; assert(assembler);
   
-    bool queue_elements_from_heap = false;
-    bdqueue_destroy(&assembler->event_que, queue_elements_from_heap);
+    mpmcring_destroy(&assembler->event_que);
     LOG_NOTE("Bounded queue destroyed");
-
-    sem_destroy(&assembler->event_come);
-    LOG_NOTE("Semaphore destroyed");
     
     kh_destroy(ip_msg, assembler->recv_messages);
     LOG_NOTE("Hash table destroyed");
 }
 
+typedef struct {
+    MpmcRing *queue;
+    size_t    count;
+    Task      tasks[TASK_BATCH];
+} AssemblerPoll;
+
+static bool assembler_poll(void* arg) {
+    AssemblerPoll* poll = arg;
+    poll->count = mpmcring_pop_batch(poll->queue, poll->tasks, TASK_BATCH);
+    return poll->count > 0;
+}
+
 /// @brief     The assembler thread
 /// We need to make sure that the segmented messages are processed in single-thread manner, 
 /// to handle out-of-order, duplicate, and missing segments in multi-thread is too complicated,
@@ -104,16 +116,12 @@ static void* assemble_thread(void* state) {
 
     IP_assembler* assemble = local->my_state; assert(assemble);
     
-    Task* task = NULL;
+    AssemblerPoll poll = { .queue = &assemble->event_que, .count = 0 };
     while (true)
     {
-        if (debdqueue(&assemble->event_que, NULL, (void**)&task) == EVENT_DEQUEUE_EMPTY) {
-            sem_wait(&assemble->event_come);
-        } else {
-            assert(task);
-            (task->process)(task->arg);
-            free(task);
-            task = NULL;
+        eventcount_await(&assemble->event_come, assembler_poll, &poll);
+        for (size_t i = 0; i < poll.count; i++) {
+            (poll.tasks[i].process)(poll.tasks[i].arg);
         }
     }
     
@@ -160,10 +168,45 @@ void drop_recvd_message(void* message) {
         offset = node->offset + node->buf.valid_size;
 
         free_buffer(node->buf);     
-        free((void*)node);
+        slab_free(&msegs, (void*)node);
+    } while (Mseg_itr_next(&seg_itr));
+
+    slab_free(&ip_recvs, message);
+}
+
+/// 1. Assumption: single thread
+/// 2. DO NOT free recv itself
+/// @brief Chain the segments in order, the chain owns their buffers
+static BufChain* segment_chain_and_delete_from_hash(IP_recv* recv) {
+    assert(recv && recv->seg && recv->seg_num <= BUFCHAIN_MAX_SEGS);
+    IP_assembler* assemble = recv->assembler; assert(assemble);
+
+    // 1. remove the message from the hash table
+    delete_msg_from_hash_table(assemble, recv);
+    assert(recv->recvd_size == recv->whole_size);
+
+    BufChain* chain = malloc(sizeof(BufChain)); assert(chain);
+    bufchain_init(chain);
+
+    // 2. Traverse the AVL tree, the segments are sorted by offset
+    Mseg_itr_t seg_itr = { 0 };
+    Mseg_itr_first(recv->seg, &seg_itr); // Initialize the iterator
+
+    uint16_t offset = 0;
+    do {
+        const Mseg *node = kavll_at(&seg_itr);
+        assert(offset == node->offset);
+
+        // TODO: deal with overlap
+        bool appended = bufchain_append(chain, node->buf);
+        assert(appended);
+        offset += node->buf.valid_size;
+
+        slab_free(&msegs, (void*)node);
     } while (Mseg_itr_next(&seg_itr));
 
-    free(message);
+    assert(chain->len == recv->whole_size);
+    return chain;
 }
 
 /// 1. Assumption: single thread
@@ -180,19 +223,14 @@ static Buffer segment_assemble_and_delete_from_hash(IP_recv* recv) {
     uint16_t whole_size = recv->whole_size;
     assert(recv->recvd_size == whole_size);
 
-    // 3. Reserve some space if the receiver want to re-use the buffer
-    uint8_t* all_data = malloc(whole_size + DEVICE_HEADER_RESERVE); assert(all_data);
-    all_data += DEVICE_HEADER_RESERVE;
+    // 3. Reserve some space if the receiver want to re-use the buffer, the large class of the pool holds any datagram
+    Buffer ret_buf;
+    errval_t err = pool_alloc(local_mempool(), whole_size + DEVICE_HEADER_RESERVE, &ret_buf);
+    assert(err_is_ok(err) && ret_buf.data);
     
-    // 4. Create the buffer
-    Buffer ret_buf = buffer_create(
-        all_data,
-        DEVICE_HEADER_RESERVE, 
-        whole_size,
-        whole_size + DEVICE_HEADER_RESERVE,
-        false,
-        NULL
-    );
+    // 4. Make the buffer cover the datagram
+    buffer_reclaim_ptr(&ret_buf, DEVICE_HEADER_RESERVE, whole_size);
+    uint8_t* all_data = ret_buf.data;
 
     // 5. Traverse the AVL tree, and copy the data to the buffer
     Mseg_itr_t seg_itr = { 0 };
@@ -208,7 +246,7 @@ static Buffer segment_assemble_and_delete_from_hash(IP_recv* recv) {
         offset += node->buf.valid_size;
 
         free_buffer(node->buf);
-        free((void*)node);
+        slab_free(&msegs, (void*)node);
     } while (Mseg_itr_next(&seg_itr));
 
     // free(recv); // We don't free it here, because it's not malloc'd here
@@ -243,20 +281,30 @@ void check_recvd_message(void* message) {
             // We don't need to care about duplicate segment here, they are deal in ip_assemble
             IP_DEBUG("We spliced an IP message of size %d, ttl: %d, now let's process it", recv->whole_size, recv->times_to_live / 1000);
             
-            Buffer buf = segment_assemble_and_delete_from_hash(recv);
-            IP_handle* handle = malloc(sizeof(IP_handle)); assert(handle);
+            // The fragments are handed over as they are, only too many small ones are copied into a single piece
+            BufChain* chain = NULL;
+            Buffer    buf   = NULL_BUFFER;
+            if (recv->seg_num <= BUFCHAIN_MAX_SEGS)
+                chain = segment_chain_and_delete_from_hash(recv);
+            else
+                buf = segment_assemble_and_delete_from_hash(recv);
+
+            // The first fragment keeps the headroom of its frame
+            PktDesc* desc = pktdesc_get(chain ? chain->segs[0] : buf);
+            IP_handle* handle = &desc->ip_handle;
             *handle = (IP_handle) {
                 .ip     = assemble->ip,
                 .proto  = recv->proto,
                 .src_ip = recv->src_ip,
                 .buf    = buf,
+                .chain  = chain,
             };
-            free(recv);
-            err = submit_task(MK_NORM_TASK(event_ipv4_handle, (void*)handle));
+            slab_free(&ip_recvs, recv);
+            err = submit_pktdesc(desc, MK_NORM_TASK(event_ipv4_handle, (void*)handle));
             if (err_is_fail(err)) {
                 DEBUG_ERR(err, "We assembled an IP message, but can't submit it as an event, will drop it");
-                free_buffer(buf);
-                free(handle);
+                if (chain) bufchain_free(chain);
+                else       free_buffer(buf);
             }
         }
         else
@@ -289,7 +337,7 @@ errval_t ip_assemble(IP_segment* segment)
     // Try to find if it already exists
     if (key == kh_end(assemble->recv_messages)) {  // This message doesn't exist in the hash table of the assembler
 
-        recv = malloc(sizeof(IP_recv)); assert(recv);
+        recv = SLAB_NEW(&ip_recvs, IP_recv);
         *recv = (IP_recv) {
             .assembler     = segment->assembler,
             .src_ip        = segment->src_ip,
@@ -298,12 +346,13 @@ errval_t ip_assemble(IP_segment* segment)
             .whole_size    = SIZE_DONT_KNOW,    // We don't know the size util the last packet arrives
             .recvd_size    = recvd_size,
             .seg           = 0,                 // Initialize the AVL tree
+            .seg_num       = 1,
             .timer         = 0,
             .times_to_live = IP_RETRY_RECV_US,
         };
 
         // Insert the first segment to the AVL tree
-        Mseg *seg = malloc(sizeof(Mseg)); assert(seg);
+        Mseg *seg = SLAB_NEW(&msegs, Mseg);
         seg->offset = offset;
         seg->buf    = buf;
         assert(seg == Mseg_insert(&recv->seg, seg));    // This is the first segment, so it must be inserted
@@ -313,16 +362,16 @@ errval_t ip_assemble(IP_segment* segment)
         switch (ret) {
         case -1:    // The operation failed
             USER_PANIC("Can't add a new message with seqno: %d to hash table", recv->id);
-            free(recv->seg);
-            free(recv);
+            slab_free(&msegs, recv->seg);
+            slab_free(&ip_recvs, recv);
         case 1:     // the bucket is empty 
         case 2:     // the element in the bucket has been deleted 
             break;
         case 0:     // Already in the hash table
         default: 
             USER_PANIC("Can't be this case: %d", ret);
-            free(recv->seg);
-            free(recv);
+            slab_free(&msegs, recv->seg);
+            slab_free(&ip_recvs, recv);
         }
         // Set the value of key
         kh_value(assemble->recv_messages, key) = recv;
@@ -340,7 +389,7 @@ errval_t ip_assemble(IP_segment* segment)
         ///ALARM: global state, also modified in check_recvd_message()
         recv->times_to_live = IP_RETRY_RECV_US; // Reset the TTL
 
-        Mseg *seg = malloc(sizeof(Mseg)); assert(seg);
+        Mseg *seg = SLAB_NEW(&msegs, Mseg);
         seg->offset = offset;
         seg->buf    = buf;
 
@@ -349,11 +398,12 @@ errval_t ip_assemble(IP_segment* segment)
             IP_ERR("We have duplicate IP message segmentation with offset: %d", seg->offset);
             // Will be freed in upper module (event caller)
             // free_buffer(buf);
-            free(seg);
+            slab_free(&msegs, seg);
             return NET_ERR_IPv4_DUPLITCATE_SEG;
         }
         // The operation above assure there is no duplicate segment
         recv->recvd_size += recvd_size;
+        recv->seg_num    += 1;
     }
 
     // If this the last packet, we now know the final size
@@ -412,3 +462,35 @@ errval_t ipv4_handle(IP* ip, uint8_t proto, ip_addr_t src_ip, Buffer buf) {
         return NET_ERR_IPv4_WRONG_PROTOCOL;
     }
 }
+
+/**
+ * @brief Processes a datagram delivered as the chain of its fragments.
+ *        UDP takes it as is, the other protocols want it in a single piece
+ * @return Returns error code indicating success or failure, the caller frees the chain on success.
+ */
+errval_t ipv4_handle_chain(IP* ip, uint8_t proto, ip_addr_t src_ip, BufChain* chain) {
+    errval_t err = SYS_ERR_OK;
+    assert(ip && chain);
+
+    const ip_context_t src_ip_context = {
+        .is_ipv6 = false,
+        .ipv4    = src_ip,
+    };
+
+    switch (proto) {
+    case IP_PROTO_UDP:
+        IP_VERBOSE("Received a UDP packet of %d fragments", chain->count);
+        err = udp_unmarshal_chain(ip->udp, src_ip_context, chain);
+        DEBUG_FAIL_RETURN(err, "Error when unmarshalling an UDP message");
+        return err;
+    default:
+    {
+        Buffer buf = bufchain_linearize(chain, local_mempool(), DEVICE_HEADER_RESERVE);
+        err = ipv4_handle(ip, proto, src_ip, buf);
+        // The single piece is re-used by the submitted event, the chain isn't
+        if (err_no(err) == NET_THROW_SUBMIT_EVENT) return SYS_ERR_OK;
+        free_buffer(buf);
+        return err;
+    }
+    }
+}
@@ -8,6 +8,8 @@
 #include <event/event.h>
 #include <event/states.h>   // g_states.mem_pool
 
+Slab g_ip_send_slab = SLAB_INITIALIZER(IP_send);
+
 void close_sending_message(void* send) {
     IP_send* msg = send; assert(msg);
 
@@ -23,8 +25,9 @@ void close_sending_message(void* send) {
         }
     }
     // TODO: where can I free it ?
+    bool in_headroom = msg->in_headroom;
     free_buffer(msg->buf);
-    free(msg);
+    if (!in_headroom) slab_free(&g_ip_send_slab, msg);
 }
 
 void check_get_mac(void* send) {
@@ -46,31 +49,36 @@ void check_get_mac(void* send) {
 
         if (msg->dst_ip.is_ipv6)
         {
-            NDP_marshal* request = malloc(sizeof(NDP_marshal));
-            *request = (NDP_marshal) {
+            // NDP reclaims the buffer from its start, the descriptor is taken before it does
+            Buffer buf;
+            pool_alloc(local_mempool(), DEVICE_HEADER_RESERVE + sizeof(struct ndp_neighbor_advertisement) + sizeof(struct ndp_option) + sizeof(mac_addr), &buf);
+            assert(buf.data);
+            buffer_add_ptr(&buf, DEVICE_HEADER_RESERVE);
+            PktDesc* desc = pktdesc_get(buf);
+            desc->ndp_marshal = (NDP_marshal) {
                 .icmp     = ip->icmp,
                 .dst_ip   = msg->dst_ip.ipv6,
                 .type     = ICMPv6_NSA,
                 .code     = 0,
-                .buf      = { 0 },
+                .buf      = buf,
             };
-            pool_alloc(g_states.mempool, sizeof(NDP_marshal), &request->buf);
-            assert(request->buf.data);
-            submit_task(MK_NORM_TASK(event_ndp_marshal, (void*)request));
+            if (err_is_fail(submit_pktdesc(desc, MK_NORM_TASK(event_ndp_marshal, (void*)&desc->ndp_marshal)))) free_buffer(buf);
         }
         else
         {
-            ARP_marshal* request = malloc(sizeof(ARP_marshal));
-            *request = (ARP_marshal) {
+            Buffer buf;
+            pool_alloc(local_mempool(), DEVICE_HEADER_RESERVE + sizeof(struct arp_hdr), &buf);
+            assert(buf.data);
+            buffer_add_ptr(&buf, DEVICE_HEADER_RESERVE);
+            PktDesc* desc = pktdesc_get(buf);
+            desc->arp_marshal = (ARP_marshal) {
                 .arp      = ip->arp,
                 .opration = ARP_OP_REQ,
                 .dst_ip   = msg->dst_ip.ipv4,
                 .dst_mac  = MAC_BROADCAST,
-                .buf      = { 0 },
+                .buf      = buf,
             };
-            pool_alloc(g_states.mempool, sizeof(NDP_marshal), &request->buf);
-            assert(request->buf.data);
-            submit_task(MK_NORM_TASK(event_arp_marshal, (void*)request));
+            if (err_is_fail(submit_pktdesc(desc, MK_NORM_TASK(event_arp_marshal, (void*)&desc->arp_marshal)))) free_buffer(buf);
         }
 
         IP_INFO("Can't find the Corresponding IP address, sent request, retry later in %d ms", msg->retry_interval / 1000);
@@ -160,23 +168,15 @@ errval_t ipv4_send(
 
     uint16_t pkt_size = size_to_send + sizeof(struct ip_hdr);
     // if the packet is less than 576 byte, we set the non-fragment flag
-    bool no_frag = (pkt_size <= IP_MINIMUM_NO_FRAG) && (offset == 0);
+    bool no_frag = ((pkt_size <= IP_MINIMUM_NO_FRAG) && (offset == 0)) || (buf.offload & BUFFER_GSO_TCP);
     OFFSET_DF_SET(flag_offset, no_frag);
 
     // More Fragment Field should be 0 for last fragementation
     if (last_slice) OFFSET_MF_SET(flag_offset, 0);    
     else            OFFSET_MF_SET(flag_offset, 1);
 
-    Buffer send_buf = buffer_add(buf, send_from);
-    send_buf.valid_size = size_to_send;
-    
-    // 2. Prepare the send buffer
-    buffer_sub_ptr(&send_buf, sizeof(struct ip_hdr));
-    /// ALARM: This will destroy the segement before, but since we have sent them, it's ok
-
-    // 3. Fill the header
-    struct ip_hdr *packet = (struct ip_hdr*)send_buf.data;
-    *packet = (struct ip_hdr) {
+    // 2. Fill the header
+    struct ip_hdr header = {
         .ihl       = 0x5 ,
         .version   = 0x4,
         .tos       = 0x00,
@@ -189,10 +189,24 @@ errval_t ipv4_send(
         .src       = htonl(ip->my_ipv4),
         .dest      = htonl(dst_ip),
     };
-    packet->chksum = inet_checksum_in_net_order(packet, sizeof(struct ip_hdr));
+    header.chksum = inet_checksum_in_net_order(&header, sizeof(struct ip_hdr));
 
-    // 4. Send the packet
-    err = ethernet_marshal(ip->ether, dst_mac, ETH_TYPE_IPv4, send_buf);
+    // 3. Send the packet. Others see the bytes (a retransmission, a fan-out): the headers go in a piece of their own,
+    //    the device gathers the slice after them
+    if (buffer_shared(buf)) {
+        BufChain chain;
+        void* hdr = bufchain_with_header(&chain, buf, send_from, size_to_send, DEVICE_HEADER_RESERVE, sizeof(struct ip_hdr));
+        memcpy(hdr, &header, sizeof(struct ip_hdr));
+        err = ethernet_marshal_chain(ip->ether, dst_mac, ETH_TYPE_IPv4, &chain);
+        bufchain_release(&chain);
+    } else {
+        Buffer send_buf = buffer_add(buf, send_from);
+        send_buf.valid_size = size_to_send;
+        /// ALARM: This will destroy the segement before, but since we have sent them and nobody shares them, it's ok
+        buffer_sub_ptr(&send_buf, sizeof(struct ip_hdr));
+        memcpy(send_buf.data, &header, sizeof(struct ip_hdr));
+        err = ethernet_marshal(ip->ether, dst_mac, ETH_TYPE_IPv4, send_buf);
+    }
     DEBUG_FAIL_RETURN(err, "Can't send the IPv4 packet");
 
     IP_VERBOSE("End sending an IP packet with size: %d, offset: %d, no_frag: %d, more_frag: %d, proto: %d, id: %d, src: %0.8X, dst: %0.8X",
@@ -215,7 +229,20 @@ errval_t ipv4_slice(IP_send* msg) {
     assert(sent_size % 8 == 0);
     assert(msg->buf.from_hdr >= IP_HEADER_RESERVE);
 
-    // 2. Marshal and send sliceS
+    // 2. The device cuts the TCP segment for us, send it as a single super-frame
+    if (msg->buf.offload & BUFFER_GSO_TCP) {
+        assert(sent_size == 0);
+        err = ipv4_send(ip, msg->dst_ip.ipv4, msg->dst_mac, msg->id, msg->proto,
+                    msg->buf, 0, whole_size, true);
+        if (err_is_fail(err)) {
+            IP_INFO("Sending a GSO frame failed, will try latter in %d ms", msg->retry_interval / 1000);
+            return err;
+        }
+        msg->sent_size = whole_size;
+        return SYS_ERR_OK;
+    }
+
+    // 3. Marshal and send sliceS
     for (int size_left = (int)(whole_size - sent_size); size_left > 0; size_left -= IP_MTU) {
 
         // 2.1 Calculate packet size
@@ -3,10 +3,13 @@
 
 #include <stdatomic.h> 
 #include <netstack/ip.h>
+#include <event/slab.h>
 
 /// Ethernet Header (14) => round to 8
 #define IP_HEADER_RESERVE    16
 #define IP_MINIMUM_NO_FRAG   576
+/// Written in front of the payload while the IP_send is in the headroom: virtio-net (12), Ethernet (14) and IPv6 (40) headers
+#define IP_SEND_KEEP         ROUND_UP(12 + 14 + 40, 8)
 
 /// @brief Presentation of an IP Sending Message 
 typedef struct ip_send {
@@ -22,8 +25,12 @@ typedef struct ip_send {
     mac_addr         dst_mac;
     Buffer           buf;
     int              retry_interval;
+    bool             in_headroom;   ///< At the start of the piece of buf, goes away with it
 } IP_send;
 
+/// The IP_send of the buffers without room for it in the headroom
+extern Slab g_ip_send_slab;
+
 __BEGIN_DECLS
 
 void close_sending_message(void* send);
@@ -109,22 +109,28 @@ errval_t ipv6_send(
 ) {
     assert(ip); errval_t err = SYS_ERR_OK;
     
-    // 1. Prepare the send buffer
-    buffer_sub_ptr(&buf, sizeof(struct ipv6_hdr));
-
-    // 2. Fill the header
-    struct ipv6_hdr* packet = (struct ipv6_hdr*)buf.data;
-    *packet = (struct ipv6_hdr) {
+    // 1. Fill the header
+    struct ipv6_hdr header = {
         .vtc_flow    = htonl(IP6H_VTCFLOW(6, 0, 0)),
-        .payload_len         = htons(buf.valid_size - sizeof(struct ipv6_hdr)),
+        .payload_len = htons(buf.valid_size),
         .next_header = proto,
         .hop_limit   = 0xFF,
         .src         = hton16(ip->my_ipv6),
         .dest        = hton16(dst_ip),
     };
 
-    // 3. Send the packet
-    err = ethernet_marshal(ip->ether, dst_mac, ETH_TYPE_IPv6, buf);
+    // 2. Send the packet, the headers go in a piece of their own if others see the bytes
+    if (buffer_shared(buf)) {
+        BufChain chain;
+        void* hdr = bufchain_with_header(&chain, buf, 0, buf.valid_size, DEVICE_HEADER_RESERVE, sizeof(struct ipv6_hdr));
+        memcpy(hdr, &header, sizeof(struct ipv6_hdr));
+        err = ethernet_marshal_chain(ip->ether, dst_mac, ETH_TYPE_IPv6, &chain);
+        bufchain_release(&chain);
+    } else {
+        buffer_sub_ptr(&buf, sizeof(struct ipv6_hdr));
+        memcpy(buf.data, &header, sizeof(struct ipv6_hdr));
+        err = ethernet_marshal(ip->ether, dst_mac, ETH_TYPE_IPv6, buf);
+    }
     DEBUG_FAIL_RETURN(err, "Can't send the IPv4 packet");
 
     IP_VERBOSE("End sending an IPv6 packet with size: %d, proto: %d", buf.valid_size, proto);
@@ -113,7 +113,8 @@ errval_t ndp_neighbor_solicitation(
     case NDP_OPTION_SOURCE_LINK_LAYER_ADDRESS:
         ndp_register(icmp, src_ip, ntoh6(mem2mac(option->data)));
 
-        NDP_marshal *marshal = malloc(sizeof(NDP_marshal));
+        PktDesc *desc = pktdesc_get(buf);
+        NDP_marshal *marshal = &desc->ndp_marshal;
         *marshal = (NDP_marshal) {
             .icmp   = icmp,
             .dst_ip = src_ip,
@@ -122,7 +123,7 @@ errval_t ndp_neighbor_solicitation(
             .buf    = buf,
         };
 
-        err = submit_task(MK_NORM_TASK(event_ndp_marshal, (void *)marshal));
+        err = submit_pktdesc(desc, MK_NORM_TASK(event_ndp_marshal, (void *)marshal));
         if (err_is_fail(err)) {
             DEBUG_ERR(err, "Can't submit NDP the task");
             assert(!err_is_throw(err));
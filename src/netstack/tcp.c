@@ -1,5 +1,6 @@
 #include <netstack/tcp.h>
 #include <netstack/ip.h>
+#include <device/device.h>
 #include <netutil/checksum.h>
 #include <netutil/htons.h>
 #include "tcp_server.h"
@@ -62,7 +63,17 @@ errval_t tcp_send(
         ip_header = PSEUDO_HEADER_IPv6(tcp->ip->my_ipv6, dst_ip.ipv6, IP_PROTO_UDP, buf.valid_size);
     else
         ip_header = PSEUDO_HEADER_IPv4(tcp->ip->my_ipv4, dst_ip.ipv4, IP_PROTO_UDP, buf.valid_size);
-    packet->chksum  = tcp_checksum_in_net_order(buf.data, ip_header);
+    // Let the device finish the checksum, and cut the segment if it's larger than MTU
+    uint8_t caps = tcp->ip->ether->device->caps;
+    if (caps & DEVICE_CAP_CSUM) {
+        packet->chksum  = pseudo_checksum_in_net_order(ip_header);
+        buf.offload    |= BUFFER_CSUM_PARTIAL;
+        if ((caps & DEVICE_CAP_TSO) && buf.valid_size > IP_MTU && buf.valid_size <= UINT16_MAX - IPH_LEN_MAX) {
+            buf.offload |= BUFFER_GSO_TCP;
+        }
+    } else {
+        packet->chksum  = tcp_checksum_in_net_order(buf.data, ip_header);
+    }
 
     err = ip_marshal(tcp->ip, dst_ip, IP_PROTO_TCP, buf);
     DEBUG_FAIL_RETURN(err, "Can't marshal the TCP packet and sent by IP");
@@ -99,12 +110,14 @@ errval_t tcp_unmarshal(
         ip_header = PSEUDO_HEADER_IPv6(tcp->ip->my_ipv6, src_ip.ipv6, IP_PROTO_UDP, (uint32_t)buf.valid_size);
     else
         ip_header = PSEUDO_HEADER_IPv4(tcp->ip->my_ipv4, src_ip.ipv4, IP_PROTO_UDP, (uint16_t)buf.valid_size);
-    uint16_t chksum = ntohs(packet->chksum);
-    packet->chksum  = 0;
-    uint16_t tcp_chksum = ntohs(tcp_checksum_in_net_order(buf.data, ip_header));
-    if (chksum != tcp_chksum) {
-        TCP_ERR("The TCP checksum %p should be %p", chksum, tcp_chksum);
-        return NET_ERR_TCP_WRONG_FIELD;
+    if (!(buf.offload & BUFFER_CSUM_VALID)) {
+        uint16_t chksum = ntohs(packet->chksum);
+        packet->chksum  = 0;
+        uint16_t tcp_chksum = ntohs(tcp_checksum_in_net_order(buf.data, ip_header));
+        if (chksum != tcp_chksum) {
+            TCP_ERR("The TCP checksum %p should be %p", chksum, tcp_chksum);
+            return NET_ERR_TCP_WRONG_FIELD;
+        }
     }
 
     // 2. Create the Message
@@ -115,11 +128,9 @@ errval_t tcp_unmarshal(
     uint32_t window = ntohs(packet->window);
     (void) window;
 
-    // 3. Create the Message
+    // 3. Create the Message, copied into the queue of the server
     uint8_t flags = packet->flags;
-    TCP_msg* msg = calloc(1, sizeof(TCP_msg));
-    assert(msg);
-    *msg = (TCP_msg) {
+    TCP_msg msg = {
         .seqno    = seqno,
         .ackno    = ackno,
         .buf      = buffer_add(buf, offset),
@@ -141,19 +152,19 @@ errval_t tcp_unmarshal(
         USER_PANIC("need to consider the server is deregistered during the process");
         if (server->is_live == false)
         {
-            free(msg);
             TCP_ERR("A process try to send message a dead TCP server on this port: %d", dst_port);
             return NET_ERR_TCP_PORT_NOT_REGISTERED;
         }
         else
         {
             // 4.1 If the server is live, then we put the message into the queue
-            err = enbdqueue(&server->msg_queue, NULL, (void*)msg);
+            err = mpmcring_push(&server->msg_queue, &msg);
             if (err_is_fail(err)) {
                 assert(err_no(err) == EVENT_ENQUEUE_FULL);
                 TCP_ERR("The given message queue of TCP message is full, will drop this message in upper level");
                 return err_push(err, NET_ERR_TCP_QUEUE_FULL);
             }
+            eventcount_notify(&server->msg_come);
             return NET_THROW_TCP_ENQUEUE;
         }
         assert(0);
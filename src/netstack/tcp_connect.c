@@ -14,11 +14,9 @@ static errval_t server_callback(TCP_conn* conn, Buffer buf)
     return SYS_ERR_OK;
 }
 
-static void free_message(void* message) {
-    TCP_msg* msg = message;
+static void free_message(TCP_msg* msg) {
+    // The message itself belongs to the server thread
     free_buffer(msg->buf);
-    free(msg);
-    message = NULL;
 }
 
 /// @brief    Manage the Establishment of the connection in server side
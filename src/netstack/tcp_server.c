@@ -10,6 +10,16 @@
 static void* server_thread(void* localstate);
 static void server_destroy(TCP_server* server);
 
+typedef struct {
+    MpmcRing *queue;
+    TCP_msg   msg;
+} ServerPoll;
+
+static bool server_poll(void* arg) {
+    ServerPoll* poll = arg;
+    return mpmcring_pop(poll->queue, &poll->msg) == SYS_ERR_OK;
+}
+
 static void* server_thread(void* localstate) {
     assert(localstate);
     LocalState* local = (LocalState*)localstate;
@@ -19,17 +29,11 @@ static void* server_thread(void* localstate) {
 
     TCP_server* server = local->my_state;
     
-    TCP_msg* msg = NULL;
+    ServerPoll poll = { .queue = &server->msg_queue };
     
     while (true) {
-        if (debdqueue(&server->msg_queue, NULL, (void**)&msg) == EVENT_DEQUEUE_EMPTY) {
-            sem_wait(&server->worker_sem);
-        } else {
-            assert(msg);
-            server_unmarshal(server, msg);
-            free(msg);
-            msg = NULL;
-        }
+        eventcount_await(&server->msg_come, server_poll, &poll);
+        server_unmarshal(server, &poll.msg);
     }
 }
 
@@ -38,18 +42,13 @@ static errval_t server_init(TCP_server* server) {
     
     // 1. Message Queue for single-thread handling of TCP
     server->queue_size = TCP_SERVER_QUEUE_SIZE;
-    BQelem * queue_elements = calloc(server->queue_size, sizeof(BQelem));
-    err = bdqueue_init(&server->msg_queue, queue_elements, server->queue_size);
+    err = mpmcring_init(&server->msg_queue, server->queue_size, sizeof(TCP_msg));
     if (err_is_fail(err)) {
-        free(queue_elements);
         TCP_FATAL("Can't Initialize the queues for TCP messages");
         return err;
     }
     
-    if (sem_init(&server->worker_sem, 0, server->worker_num) != 0){
-        TCP_ERR("Can't initialize the semaphore of TCP server");
-        return SYS_ERR_INIT_FAIL;
-    }
+    eventcount_init(&server->msg_come);
 
     LocalState* local = calloc(server->worker_num, sizeof(LocalState));
     // Now we have a new server, we need to start a new thread(s) for it
@@ -66,8 +65,7 @@ static errval_t server_init(TCP_server* server) {
 
         if (pthread_create(&server->worker[i], NULL, server_thread, (void*)&local[i]) != 0) {
             TCP_FATAL("Can't create worker thread");
-            bool queue_elements_from_heap = true;
-            bdqueue_destroy(&server->msg_queue, queue_elements_from_heap);    
+            mpmcring_destroy(&server->msg_queue);
             free(local);
             free(server);
             return NET_ERR_TCP_CREATE_WORKER;
@@ -78,12 +76,16 @@ static errval_t server_init(TCP_server* server) {
 
 static void server_destroy(TCP_server* server) {
     assert(server->is_live == false);
-    bool queue_elements_from_heap = true;
-    bdqueue_destroy(&server->msg_queue, queue_elements_from_heap);
 
+    // The threads still pop from the queue until they are joined
     for(size_t i = 0; i < server->worker_num; i++) {
         pthread_cancel(server->worker[i]);
     }
+    eventcount_notify_all(&server->msg_come);
+    for(size_t i = 0; i < server->worker_num; i++) {
+        pthread_join(server->worker[i], NULL);
+    }
+    mpmcring_destroy(&server->msg_queue);
     LOG_FATAL("NYI, server_destroy");
 
 }
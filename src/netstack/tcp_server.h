@@ -5,8 +5,8 @@
 #include <netstack/tcp.h>
 #include <ipc/rpc.h>
 #include "tcp_connect.h"
-#include <semaphore.h>
-#include <lock_free/bdqueue.h>
+#include <lock_free/eventcount.h>
+#include <lock_free/ring.h>
 #include <pthread.h>
 #include <netutil/ip.h>
 
@@ -18,12 +18,11 @@ typedef struct tcp_server TCP_server;
 #define TCP_SERVER_QUEUE_SIZE        128
 
 typedef struct tcp_server {
-    alignas(ATOMIC_ISOLATION) 
-        BdQueue         msg_queue; 
+    MpmcRing            msg_queue;      // TCP_msg, stored in it
     size_t              queue_size;
 
     pthread_t          *worker;
-    sem_t               worker_sem;
+    EventCount          msg_come;       // Notified for each message enqueued
     uint8_t             worker_num;
 
     // For the closing of the server
@@ -4,6 +4,8 @@
 
 #include <netstack/udp.h>
 #include <netstack/ip.h>
+#include <device/device.h>
+#include <event/states.h>   // local_mempool
 
 #include "udp_server.h"
 
@@ -58,7 +60,13 @@ errval_t udp_marshal(
         ip_header = PSEUDO_HEADER_IPv6(udp->ip->my_ipv6, dst_ip.ipv6, IP_PROTO_UDP, (uint32_t)buf.valid_size);
     else
         ip_header = PSEUDO_HEADER_IPv4(udp->ip->my_ipv4, dst_ip.ipv4, IP_PROTO_UDP, (uint16_t)buf.valid_size);
-    packet->chksum = udp_checksum_in_net_order(buf.data, ip_header);
+    // A partial checksum can't survive IP fragmentation, and we don't do UDP GSO
+    if ((udp->ip->ether->device->caps & DEVICE_CAP_CSUM) && (dst_ip.is_ipv6 || buf.valid_size <= IP_MTU)) {
+        packet->chksum = pseudo_checksum_in_net_order(ip_header);
+        buf.offload   |= BUFFER_CSUM_PARTIAL;
+    } else {
+        packet->chksum = udp_checksum_in_net_order(buf.data, ip_header);
+    }
 
     err = ip_marshal(udp->ip, dst_ip, IP_PROTO_UDP, buf);
     DEBUG_FAIL_RETURN(err, "Can't marshal the message and sent by IP");
@@ -91,7 +99,7 @@ errval_t udp_unmarshal(
         ip_header = PSEUDO_HEADER_IPv6(udp->ip->my_ipv6, src_ip.ipv6, IP_PROTO_UDP, (uint32_t)buf.valid_size);
     else
         ip_header = PSEUDO_HEADER_IPv4(udp->ip->my_ipv4, src_ip.ipv4, IP_PROTO_UDP, (uint16_t)buf.valid_size);
-    if (pkt_chksum != 0 || src_ip.is_ipv6) {   // UDP over IPv4 has optional checksum
+    if ((pkt_chksum != 0 || src_ip.is_ipv6) && !(buf.offload & BUFFER_CSUM_VALID)) {   // UDP over IPv4 has optional checksum
         packet->chksum = 0;
         uint16_t checksum = ntohs(udp_checksum_in_net_order(buf.data, ip_header));
         if (pkt_chksum != checksum) {
@@ -116,6 +124,7 @@ errval_t udp_unmarshal(
         } 
         else
         {
+            buffer_set_owner(buf, MEMPOOL_OWNER_APP);
             server->callback(server, buf, src_ip, src_port);
             UDP_DEBUG("We handled an UDP packet at port: %d", dst_port);
             return SYS_ERR_OK;
@@ -130,3 +139,79 @@ errval_t udp_unmarshal(
         return err;
     }
 }
+
+/// @brief  Same as udp_unmarshal(), for a datagram in fragments, the header is in the first one
+errval_t udp_unmarshal_chain(
+    UDP* udp, const ip_context_t src_ip, BufChain* chain
+) {
+    errval_t err;
+    assert(udp && chain && chain->count > 0);
+    UDP_DEBUG("Received an UDP packet in %d fragments, source IP: %p, size: %d", chain->count, src_ip, chain->len);
+
+    Buffer* first = &chain->segs[0];
+    if (first->valid_size < sizeof(struct udp_hdr)) {
+        UDP_ERR("The first fragment of %d bytes can't hold the UDP header", first->valid_size);
+        return NET_ERR_UDP_WRONG_FIELD;
+    }
+    struct udp_hdr* packet = (struct udp_hdr*) first->data;
+
+    if (ntohs(packet->len) != chain->len) {
+        UDP_ERR("UDP Packet Size Unmatch %p v.s. %p", ntohs(packet->len), chain->len);
+        return NET_ERR_UDP_WRONG_FIELD;
+    }
+
+    udp_port_t src_port = ntohs(packet->src);
+    udp_port_t dst_port = ntohs(packet->dest);
+
+    // 2. Checksum is optional, summed over the fragments where they are
+    uint16_t pkt_chksum = ntohs(packet->chksum);
+    struct pseudo_ip_header_in_net_order ip_header;
+    if (src_ip.is_ipv6) 
+        ip_header = PSEUDO_HEADER_IPv6(udp->ip->my_ipv6, src_ip.ipv6, IP_PROTO_UDP, chain->len);
+    else
+        ip_header = PSEUDO_HEADER_IPv4(udp->ip->my_ipv4, src_ip.ipv4, IP_PROTO_UDP, (uint16_t)chain->len);
+    if ((pkt_chksum != 0 || src_ip.is_ipv6) && !(first->offload & BUFFER_CSUM_VALID)) {
+        packet->chksum = 0;
+        uint32_t sum = ntohs(pseudo_checksum_in_net_order(ip_header)) + bufchain_sum(chain, 0);
+        uint16_t checksum = ntohs(inet_fold_checksum_in_net_order(sum));
+        if (checksum == 0x0000) checksum = 0xFFFF;
+        if (pkt_chksum != checksum) {
+            UDP_ERR("This UDP Pacekt Has Wrong Checksum 0x%0.4x, Should be 0x%0.4x", pkt_chksum, checksum);
+            return NET_ERR_UDP_WRONG_FIELD;
+        }
+    }
+
+    bufchain_pull(chain, sizeof(struct udp_hdr));
+
+    UDP_server* server = NULL;
+    err = hash_get_by_key(&udp->servers, UDP_HASH_KEY(dst_port), (void**)&server);
+    switch (err_no(err))
+    {
+    case SYS_ERR_OK:
+        if (server->is_live == false)
+        {
+            UDP_ERR("We received packet for a dead UDP server on this port: %d", dst_port);
+            return NET_ERR_UDP_PORT_NOT_REGISTERED;
+        }
+        if (server->chain_callback)
+        {
+            bufchain_set_owner(chain, MEMPOOL_OWNER_APP);
+            server->chain_callback(server, chain, src_ip, src_port);
+        }
+        else
+        {
+            // The server only takes a single piece
+            Buffer buf = bufchain_linearize(chain, local_mempool(), DEVICE_HEADER_RESERVE);
+            server->callback(server, buf, src_ip, src_port);
+            free_buffer(buf);
+        }
+        UDP_DEBUG("We handled an UDP packet at port: %d", dst_port);
+        return SYS_ERR_OK;
+    case EVENT_HASH_NOT_EXIST:
+        UDP_ERR("We don't have UDP server on this port: %d", dst_port);
+        return NET_ERR_UDP_PORT_NOT_REGISTERED;
+    default:
+        DEBUG_ERR(err, "Unknown Error Code");
+        return err;
+    }
+}
@@ -5,6 +5,13 @@
 
 errval_t udp_server_register(
     UDP* udp, rpc_t* rpc, const udp_port_t port, const udp_server_callback callback
+) {
+    return udp_server_register_chain(udp, rpc, port, callback, NULL);
+}
+
+errval_t udp_server_register_chain(
+    UDP* udp, rpc_t* rpc, const udp_port_t port, 
+    const udp_server_callback callback, const udp_server_chain_callback chain_callback
 ) {
     assert(udp);
     errval_t err_get, err_insert;
@@ -17,6 +24,7 @@ errval_t udp_server_register(
         .rpc        = rpc,
         .port       = port,
         .callback   = callback,
+        .chain_callback = chain_callback,
     };
 
     //TODO: reconsider the multithread contention here
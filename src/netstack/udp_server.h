@@ -11,12 +11,19 @@ typedef struct udp_server {
     struct rpc         *rpc;
     udp_port_t          port;
     udp_server_callback callback;
+    udp_server_chain_callback chain_callback;  ///< NULL: a fragmented datagram is copied into one piece for callback
 } UDP_server ;
 
 errval_t udp_server_register(
     UDP* udp, struct rpc* rpc, const udp_port_t port, const udp_server_callback callback
 );
 
+/// chain_callback gets the fragmented datagrams, callback the others
+errval_t udp_server_register_chain(
+    UDP* udp, struct rpc* rpc, const udp_port_t port, 
+    const udp_server_callback callback, const udp_server_chain_callback chain_callback
+);
+
 errval_t udp_server_deregister(
     UDP* udp, const udp_port_t port
 );
@@ -33,6 +33,26 @@ uint16_t inet_checksum_in_net_order(void *dataptr, uint16_t len)
     return htons((uint16_t)(~sum));
 }
 
+uint32_t inet_partial_sum_in_net_order(const void *dataptr, uint16_t len, bool odd)
+{
+    const uint8_t *buffer = (const uint8_t*)dataptr;
+    uint32_t sum = 0;
+    if (odd && len > 0) {
+        sum += *buffer;
+        buffer++;
+        len -= 1;
+    }
+    return sum + part_checksum_in_net_order(buffer, len);
+}
+
+uint16_t inet_fold_checksum_in_net_order(uint32_t sum)
+{
+    sum  = (sum >> 16) + (sum & 0xFFFF);
+    sum += (sum >> 16);
+
+    return htons((uint16_t)(~sum));
+}
+
 uint16_t tcp_checksum_in_net_order(const void *data_no_iph, struct pseudo_ip_header_in_net_order pheader) {
 
     uint32_t sum = 0;
@@ -67,3 +87,16 @@ uint16_t udp_checksum_in_net_order(const void *data_no_iph, struct pseudo_ip_hea
     uint16_t checksum = tcp_checksum_in_net_order(data_no_iph, pheader);
     return (checksum == 0x0000) ? 0xFFFF : checksum;
 }
+
+uint16_t pseudo_checksum_in_net_order(struct pseudo_ip_header_in_net_order pheader) {
+    uint32_t sum = 0;
+    if (pheader.is_ipv6)
+        sum += part_checksum_in_net_order(&pheader, sizeof(pheader.ipv6));
+    else
+        sum += part_checksum_in_net_order(&pheader, sizeof(pheader.ipv4));
+
+    sum  = (sum >> 16) + (sum & 0xFFFF);
+    sum += (sum >> 16);
+
+    return htons((uint16_t)sum);
+}
@@ -1,3 +1,4 @@
+#include <arpa/inet.h>  //inet_pton, before our htons.h
 #include <netutil/dump.h>
 #include <netutil/ip.h>
 #include <netutil/htons.h>
@@ -246,3 +247,32 @@ int format_packet_info(const void *packet_start, char *buffer, size_t max_len) {
 
     return len;
 }
+
+bool parse_ip_addr(const char *str, ip_context_t *ret_ip) {
+    uint8_t addr[16];
+    if (inet_pton(AF_INET, str, addr) == 1) {
+        uint32_t ipv4;
+        memcpy(&ipv4, addr, sizeof(ipv4));
+        *ret_ip = (ip_context_t) { .is_ipv6 = false, .ipv4 = ntohl(ipv4) };
+        return true;
+    }
+    if (inet_pton(AF_INET6, str, addr) == 1) {
+        ipv6_addr_t ipv6;
+        memcpy(&ipv6, addr, sizeof(ipv6));
+        *ret_ip = (ip_context_t) { .is_ipv6 = true, .ipv6 = ntoh16(ipv6) };
+        return true;
+    }
+    return false;
+}
+
+bool parse_mac_addr(const char *str, mac_addr *ret_mac) {
+    unsigned int bytes[ETH_ADDR_LEN];
+    char tail;
+    if (sscanf(str, "%x:%x:%x:%x:%x:%x%c", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5], &tail) != ETH_ADDR_LEN)
+        return false;
+    for (size_t i = 0; i < ETH_ADDR_LEN; i++) {
+        if (bytes[i] > 0xFF) return false;
+        ret_mac->addr[i] = (uint8_t)bytes[i];
+    }
+    return true;
+}
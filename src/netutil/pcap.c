@@ -0,0 +1,378 @@
+#include <netutil/pcap.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+/// A frame (or a pcapng block) larger than this is surely garbage
+#define PCAP_MAX_RECORD         (256 * 1024)
+/// Default resolution of pcapng timestamps: 10^-6 seconds
+#define PCAPNG_DEFAULT_TSRESOL  6
+
+static inline uint16_t rd16(const PcapReader* reader, uint16_t value) {
+    return reader->swapped ? __builtin_bswap16(value) : value;
+}
+
+static inline uint32_t rd32(const PcapReader* reader, uint32_t value) {
+    return reader->swapped ? __builtin_bswap32(value) : value;
+}
+
+static inline errval_t skip(PcapReader* reader, size_t bytes) {
+    if (bytes == 0) return SYS_ERR_OK;
+    return (fseek(reader->file, (long)bytes, SEEK_CUR) == 0) ? SYS_ERR_OK : NET_ERR_PCAP_IO;
+}
+
+/// @brief  if_tsresol: the MSB tells if the rest is a negative power of 10 or of 2
+static uint64_t ts_to_ns(uint64_t ts, uint8_t tsresol) {
+    uint8_t exp = tsresol & 0x7F;
+    if (tsresol & 0x80) {
+        if (exp >= 64) return 0;
+        uint64_t secs = ts >> exp;
+        uint64_t frac = ts & ((1ULL << exp) - 1);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+        return secs * 1000000000ULL + (uint64_t)(((unsigned __int128)frac * 1000000000ULL) >> exp);
+#pragma GCC diagnostic pop
+    }
+    uint64_t scale = 1;
+    if (exp <= 9) {
+        for (uint8_t i = exp; i < 9; i++) scale *= 10;
+        return ts * scale;
+    }
+    for (uint8_t i = 9; i < exp && i < 28; i++) scale *= 10;
+    return ts / scale;
+}
+
+errval_t pcap_reader_open(PcapReader* reader, const char* path) {
+    assert(reader && path);
+    memset(reader, 0x00, sizeof(PcapReader));
+
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL) return NET_ERR_PCAP_IO;
+
+    uint32_t magic;
+    if (fread(&magic, sizeof(magic), 1, reader->file) != 1) {
+        pcap_reader_close(reader);
+        return NET_ERR_PCAP_FORMAT;
+    }
+
+    // pcapng: the sections are parsed as they come
+    if (magic == PCAPNG_BLOCK_SHB) {
+        reader->is_ng = true;
+        return pcap_reader_rewind(reader);
+    }
+
+    struct pcap_file_hdr hdr;
+    hdr.magic = magic;
+    if (fread((uint8_t*)&hdr + sizeof(magic), sizeof(hdr) - sizeof(magic), 1, reader->file) != 1) {
+        pcap_reader_close(reader);
+        return NET_ERR_PCAP_FORMAT;
+    }
+    switch (magic) {
+    case PCAP_MAGIC_USEC:                   reader->swapped = false; reader->nsec = false; break;
+    case PCAP_MAGIC_NSEC:                   reader->swapped = false; reader->nsec = true;  break;
+    case __builtin_bswap32(PCAP_MAGIC_USEC): reader->swapped = true;  reader->nsec = false; break;
+    case __builtin_bswap32(PCAP_MAGIC_NSEC): reader->swapped = true;  reader->nsec = true;  break;
+    default:
+        pcap_reader_close(reader);
+        return NET_ERR_PCAP_FORMAT;
+    }
+    reader->link_type = rd32(reader, hdr.link_type);
+    if (reader->link_type != PCAP_LINKTYPE_ETHERNET) {
+        pcap_reader_close(reader);
+        return NET_ERR_PCAP_FORMAT;
+    }
+    return SYS_ERR_OK;
+}
+
+void pcap_reader_close(PcapReader* reader) {
+    assert(reader);
+    if (reader->file) fclose(reader->file);
+    reader->file = NULL;
+}
+
+errval_t pcap_reader_rewind(PcapReader* reader) {
+    assert(reader && reader->file);
+    long start = reader->is_ng ? 0 : (long)sizeof(struct pcap_file_hdr);
+    if (fseek(reader->file, start, SEEK_SET) != 0) return NET_ERR_PCAP_IO;
+    reader->if_num = 0;
+    return SYS_ERR_OK;
+}
+
+static errval_t read_frame(PcapReader* reader, size_t caplen, size_t rest, uint8_t* data, size_t max, size_t* ret_len) {
+    *ret_len = caplen;
+    if (caplen > max) {
+        errval_t err = skip(reader, caplen + rest);
+        return err_is_fail(err) ? err : NET_ERR_PCAP_TOO_LARGE;
+    }
+    if (caplen > 0 && fread(data, caplen, 1, reader->file) != 1) return NET_ERR_PCAP_EOF;
+    return skip(reader, rest);
+}
+
+static errval_t classic_next(PcapReader* reader, uint8_t* data, size_t max, size_t* ret_len, size_t* ret_wire_len, uint64_t* ret_ts_ns) {
+    struct pcap_record_hdr hdr;
+    if (fread(&hdr, sizeof(hdr), 1, reader->file) != 1) return NET_ERR_PCAP_EOF;
+
+    size_t caplen = rd32(reader, hdr.caplen);
+    if (caplen > PCAP_MAX_RECORD) return NET_ERR_PCAP_FORMAT;
+
+    uint64_t frac = rd32(reader, hdr.ts_frac);
+    *ret_ts_ns    = (uint64_t)rd32(reader, hdr.ts_sec) * 1000000000ULL + (reader->nsec ? frac : frac * 1000);
+    *ret_wire_len = rd32(reader, hdr.len);
+    return read_frame(reader, caplen, 0, data, max, ret_len);
+}
+
+/// @brief  Remember the link type and timestamp resolution of the interface
+static errval_t parse_idb(PcapReader* reader, size_t body_len) {
+    if (body_len < sizeof(struct pcapng_idb) || body_len > PCAP_MAX_RECORD) return NET_ERR_PCAP_FORMAT;
+
+    uint8_t* body = malloc(body_len); assert(body);
+    if (fread(body, body_len, 1, reader->file) != 1) {
+        free(body);
+        return NET_ERR_PCAP_EOF;
+    }
+
+    struct pcapng_idb* idb = (struct pcapng_idb*)body;
+    uint16_t link_type = rd16(reader, idb->link_type);
+    uint8_t  tsresol   = PCAPNG_DEFAULT_TSRESOL;
+
+    size_t offset = sizeof(struct pcapng_idb);
+    while (offset + sizeof(struct pcapng_opt_hdr) <= body_len) {
+        struct pcapng_opt_hdr* opt = (struct pcapng_opt_hdr*)(body + offset);
+        uint16_t code = rd16(reader, opt->code);
+        uint16_t len  = rd16(reader, opt->len);
+        offset += sizeof(struct pcapng_opt_hdr);
+        if (code == PCAPNG_OPT_END || offset + len > body_len) break;
+        if (code == PCAPNG_OPT_IF_TSRESOL && len == 1) tsresol = body[offset];
+        offset += (len + 3) & ~3u;
+    }
+    free(body);
+
+    if (reader->if_num < PCAPNG_MAX_INTERFACES) {
+        reader->if_link_type[reader->if_num] = link_type;
+        reader->if_tsresol[reader->if_num]   = tsresol;
+    }
+    reader->if_num += 1;
+    return SYS_ERR_OK;
+}
+
+static inline bool is_ethernet(const PcapReader* reader, uint32_t if_id) {
+    return if_id < reader->if_num && if_id < PCAPNG_MAX_INTERFACES
+        && reader->if_link_type[if_id] == PCAP_LINKTYPE_ETHERNET;
+}
+
+static errval_t ng_next(PcapReader* reader, uint8_t* data, size_t max, size_t* ret_len, size_t* ret_wire_len, uint64_t* ret_ts_ns) {
+    errval_t err;
+
+    while (true) {
+        struct pcapng_block_hdr hdr;
+        if (fread(&hdr, sizeof(hdr), 1, reader->file) != 1) return NET_ERR_PCAP_EOF;
+
+        // The byte order of a section is only known after reading its header
+        if (hdr.type == PCAPNG_BLOCK_SHB) {
+            uint32_t magic;
+            if (fread(&magic, sizeof(magic), 1, reader->file) != 1) return NET_ERR_PCAP_EOF;
+            if (magic == PCAPNG_BYTE_ORDER_MAGIC)                        reader->swapped = false;
+            else if (magic == __builtin_bswap32(PCAPNG_BYTE_ORDER_MAGIC)) reader->swapped = true;
+            else return NET_ERR_PCAP_FORMAT;
+
+            uint32_t total_len = rd32(reader, hdr.total_len);
+            if (total_len < sizeof(hdr) + sizeof(struct pcapng_shb) + sizeof(uint32_t) || total_len % 4) return NET_ERR_PCAP_FORMAT;
+            reader->if_num = 0;
+            err = skip(reader, total_len - sizeof(hdr) - sizeof(magic));
+            if (err_is_fail(err)) return err;
+            continue;
+        }
+
+        uint32_t type      = rd32(reader, hdr.type);
+        uint32_t total_len = rd32(reader, hdr.total_len);
+        if (total_len < sizeof(hdr) + sizeof(uint32_t) || total_len % 4) return NET_ERR_PCAP_FORMAT;
+        // Without the header and the trailing length
+        size_t body_len = total_len - sizeof(hdr) - sizeof(uint32_t);
+
+        switch (type) {
+        case PCAPNG_BLOCK_IDB:
+            err = parse_idb(reader, body_len);
+            if (err_is_fail(err)) return err;
+            err = skip(reader, sizeof(uint32_t));
+            break;
+        case PCAPNG_BLOCK_EPB: {
+            struct pcapng_epb epb;
+            if (body_len < sizeof(epb)) return NET_ERR_PCAP_FORMAT;
+            if (fread(&epb, sizeof(epb), 1, reader->file) != 1) return NET_ERR_PCAP_EOF;
+
+            uint32_t if_id  = rd32(reader, epb.if_id);
+            size_t   caplen = rd32(reader, epb.caplen);
+            if (caplen > body_len - sizeof(epb)) return NET_ERR_PCAP_FORMAT;
+            size_t   rest   = body_len - sizeof(epb) - caplen + sizeof(uint32_t);
+
+            if (!is_ethernet(reader, if_id)) {
+                err = skip(reader, caplen + rest);
+                break;
+            }
+            uint64_t ts   = ((uint64_t)rd32(reader, epb.ts_high) << 32) | rd32(reader, epb.ts_low);
+            *ret_ts_ns    = ts_to_ns(ts, reader->if_tsresol[if_id]);
+            *ret_wire_len = rd32(reader, epb.len);
+            return read_frame(reader, caplen, rest, data, max, ret_len);
+        }
+        case PCAPNG_BLOCK_SPB: {
+            uint32_t len;
+            if (body_len < sizeof(len)) return NET_ERR_PCAP_FORMAT;
+            if (fread(&len, sizeof(len), 1, reader->file) != 1) return NET_ERR_PCAP_EOF;
+
+            // The frame fills the block, except the padding
+            size_t wire_len = rd32(reader, len);
+            size_t caplen   = (wire_len < body_len - sizeof(len)) ? wire_len : body_len - sizeof(len);
+            size_t rest     = body_len - sizeof(len) - caplen + sizeof(uint32_t);
+
+            if (!is_ethernet(reader, 0)) {
+                err = skip(reader, caplen + rest);
+                break;
+            }
+            *ret_ts_ns    = 0;
+            *ret_wire_len = wire_len;
+            return read_frame(reader, caplen, rest, data, max, ret_len);
+        }
+        default:
+            err = skip(reader, body_len + sizeof(uint32_t));
+            break;
+        }
+        if (err_is_fail(err)) return err;
+    }
+}
+
+errval_t pcap_reader_next(PcapReader* reader, uint8_t* data, size_t max, size_t* ret_len, size_t* ret_wire_len, uint64_t* ret_ts_ns) {
+    assert(reader && reader->file && data && ret_len && ret_wire_len && ret_ts_ns);
+    return reader->is_ng ? ng_next(reader, data, max, ret_len, ret_wire_len, ret_ts_ns)
+                         : classic_next(reader, data, max, ret_len, ret_wire_len, ret_ts_ns);
+}
+
+errval_t pcap_writer_open(PcapWriter* writer, const char* path, uint32_t snaplen) {
+    assert(writer && path);
+
+    writer->file  = fopen(path, "wb");
+    writer->is_ng = false;
+    if (writer->file == NULL) return NET_ERR_PCAP_IO;
+
+    struct pcap_file_hdr hdr = {
+        .magic         = PCAP_MAGIC_NSEC,
+        .version_major = PCAP_VERSION_MAJOR,
+        .version_minor = PCAP_VERSION_MINOR,
+        .thiszone      = 0,
+        .sigfigs       = 0,
+        .snaplen       = snaplen,
+        .link_type     = PCAP_LINKTYPE_ETHERNET,
+    };
+    if (fwrite(&hdr, sizeof(hdr), 1, writer->file) != 1) {
+        pcap_writer_close(writer);
+        return NET_ERR_PCAP_IO;
+    }
+    return SYS_ERR_OK;
+}
+
+void pcap_writer_close(PcapWriter* writer) {
+    assert(writer);
+    if (writer->file) fclose(writer->file);
+    writer->file = NULL;
+}
+
+errval_t pcap_writer_write(PcapWriter* writer, const uint8_t* data, size_t len, uint64_t ts_ns) {
+    assert(writer && writer->file && !writer->is_ng && data);
+
+    struct pcap_record_hdr hdr = {
+        .ts_sec  = (uint32_t)(ts_ns / 1000000000ULL),
+        .ts_frac = (uint32_t)(ts_ns % 1000000000ULL),
+        .caplen  = (uint32_t)len,
+        .len     = (uint32_t)len,
+    };
+    if (fwrite(&hdr, sizeof(hdr), 1, writer->file) != 1 ||
+        (len > 0 && fwrite(data, len, 1, writer->file) != 1)) {
+        return NET_ERR_PCAP_IO;
+    }
+    return SYS_ERR_OK;
+}
+
+static const uint8_t padding[4] = { 0 };
+
+errval_t pcapng_writer_open(PcapWriter* writer, const char* path, uint32_t snaplen) {
+    assert(writer && path);
+
+    writer->file  = fopen(path, "wb");
+    writer->is_ng = true;
+    if (writer->file == NULL) return NET_ERR_PCAP_IO;
+
+    // Section Header Block, without options
+    const uint32_t shb_len = sizeof(struct pcapng_block_hdr) + sizeof(struct pcapng_shb) + sizeof(uint32_t);
+    struct pcapng_block_hdr shb_hdr = { .type = PCAPNG_BLOCK_SHB, .total_len = shb_len };
+    struct pcapng_shb shb = {
+        .byte_order_magic = PCAPNG_BYTE_ORDER_MAGIC,
+        .version_major    = 1,
+        .version_minor    = 0,
+        .section_len      = -1,
+    };
+
+    // Interface Description Block, with if_tsresol = 9 (nano seconds)
+    struct {
+        struct pcapng_opt_hdr tsresol_hdr;
+        uint8_t               tsresol[4];
+        struct pcapng_opt_hdr end;
+    } __attribute__((packed)) idb_opts = {
+        .tsresol_hdr = { .code = PCAPNG_OPT_IF_TSRESOL, .len = 1 },
+        .tsresol     = { 9, 0, 0, 0 },
+        .end         = { .code = PCAPNG_OPT_END, .len = 0 },
+    };
+    const uint32_t idb_len = sizeof(struct pcapng_block_hdr) + sizeof(struct pcapng_idb) + sizeof(idb_opts) + sizeof(uint32_t);
+    struct pcapng_block_hdr idb_hdr = { .type = PCAPNG_BLOCK_IDB, .total_len = idb_len };
+    struct pcapng_idb idb = {
+        .link_type = PCAP_LINKTYPE_ETHERNET,
+        .reserved  = 0,
+        .snaplen   = snaplen,
+    };
+
+    if (fwrite(&shb_hdr, sizeof(shb_hdr), 1, writer->file) != 1 ||
+        fwrite(&shb, sizeof(shb), 1, writer->file) != 1 ||
+        fwrite(&shb_len, sizeof(shb_len), 1, writer->file) != 1 ||
+        fwrite(&idb_hdr, sizeof(idb_hdr), 1, writer->file) != 1 ||
+        fwrite(&idb, sizeof(idb), 1, writer->file) != 1 ||
+        fwrite(&idb_opts, sizeof(idb_opts), 1, writer->file) != 1 ||
+        fwrite(&idb_len, sizeof(idb_len), 1, writer->file) != 1) {
+        pcap_writer_close(writer);
+        return NET_ERR_PCAP_IO;
+    }
+    return SYS_ERR_OK;
+}
+
+errval_t pcapng_writer_write(PcapWriter* writer, const uint8_t* data, size_t caplen, size_t wire_len, uint64_t ts_ns, uint32_t flags) {
+    assert(writer && writer->file && writer->is_ng && data);
+
+    struct {
+        struct pcapng_opt_hdr flags_hdr;
+        uint32_t              flags;
+        struct pcapng_opt_hdr end;
+    } __attribute__((packed)) opts = {
+        .flags_hdr = { .code = PCAPNG_OPT_EPB_FLAGS, .len = sizeof(uint32_t) },
+        .flags     = flags,
+        .end       = { .code = PCAPNG_OPT_END, .len = 0 },
+    };
+    size_t opts_len = (flags != 0) ? sizeof(opts) : 0;
+    size_t pad_len  = ((caplen + 3) & ~(size_t)3) - caplen;
+
+    const uint32_t total_len = (uint32_t)(sizeof(struct pcapng_block_hdr) + sizeof(struct pcapng_epb) + caplen + pad_len + opts_len + sizeof(uint32_t));
+    struct pcapng_block_hdr hdr = { .type = PCAPNG_BLOCK_EPB, .total_len = total_len };
+    struct pcapng_epb epb = {
+        .if_id   = 0,
+        .ts_high = (uint32_t)(ts_ns >> 32),
+        .ts_low  = (uint32_t)ts_ns,
+        .caplen  = (uint32_t)caplen,
+        .len     = (uint32_t)wire_len,
+    };
+
+    if (fwrite(&hdr, sizeof(hdr), 1, writer->file) != 1 ||
+        fwrite(&epb, sizeof(epb), 1, writer->file) != 1 ||
+        (caplen   > 0 && fwrite(data, caplen, 1, writer->file) != 1) ||
+        (pad_len  > 0 && fwrite(padding, pad_len, 1, writer->file) != 1) ||
+        (opts_len > 0 && fwrite(&opts, opts_len, 1, writer->file) != 1) ||
+        fwrite(&total_len, sizeof(total_len), 1, writer->file) != 1) {
+        return NET_ERR_PCAP_IO;
+    }
+    return SYS_ERR_OK;
+}
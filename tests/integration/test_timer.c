@@ -24,7 +24,7 @@ static void timer_setup(void) {
     assert(signal_init(RLIM_INFINITY) == SYS_ERR_OK); 
 
     // 1. Initialize the thread pool
-    assert(thread_pool_init(4) == SYS_ERR_OK);
+    assert(thread_pool_init(4, (BusyPollConfig){ 0 }) == SYS_ERR_OK);
 
     // 2. Initialize the timer thread (timed event)
     assert(timer_thread_init(g_states.timer) == SYS_ERR_OK);
@@ -52,7 +52,7 @@ void test_timer(void) {
 
         Task task = {
             .queue   = &g_threadpool.queue,
-            .sem     = &g_threadpool.sem,
+            .event   = NULL,
             .process = simple_task,
             .arg     = NULL,
         };
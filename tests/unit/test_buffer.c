@@ -1,5 +1,7 @@
 #include "unity.h"
 #include <event/buffer.h>
+#include <event/bufchain.h>
+#include <netutil/checksum.h>
 
 void test_buffer_create(void) {
     uint8_t data[256];
@@ -103,10 +105,71 @@ void test_free_buffer(void) {
     // Here you might want to check if the buffer was returned to the pool.
 }
 
+void test_buffer_desc(void) {
+    alignas(BUFFER_DESC_ALIGN) uint8_t data[512];
+
+    // The piece starts 3 bytes in, the descriptor is aligned after it
+    Buffer buf = buffer_create(data + 3, 0, 500, 500, false, NULL);
+    buffer_add_ptr(&buf, 200);
+    uint8_t* desc = buffer_desc(buf, 100, 50);
+    TEST_ASSERT_EQUAL_PTR(data + BUFFER_DESC_ALIGN, desc);
+
+    // No room left for it, or for the headers in front of the data
+    TEST_ASSERT_NULL(buffer_desc(buf, 200, 0));
+    TEST_ASSERT_NULL(buffer_desc(buf, 100, 100));
+    TEST_ASSERT_NULL(buffer_desc(buffer_sub(buf, 150), 100, 0));
+}
+
+void test_bufchain(void) {
+    uint8_t data[101];
+    for (size_t i = 0; i < sizeof(data); i++) data[i] = (uint8_t)(i * 7 + 3);
+
+    // Odd sized segments, and an empty one
+    const uint32_t sizes[] = { 3, 50, 0, 48 };
+    BufChain chain;
+    bufchain_init(&chain);
+    uint32_t offset = 0;
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        TEST_ASSERT_TRUE(bufchain_append(&chain, buffer_create(data + offset, 0, sizes[i], sizes[i], false, NULL)));
+        offset += sizes[i];
+    }
+    TEST_ASSERT_EQUAL_UINT32(sizeof(data), chain.len);
+
+    // Same sum as the bytes in one piece
+    uint16_t linear = inet_checksum_in_net_order(data, sizeof(data));
+    TEST_ASSERT_EQUAL_UINT16(linear, inet_fold_checksum_in_net_order(bufchain_sum(&chain, 0)));
+    TEST_ASSERT_EQUAL_UINT16(inet_checksum_in_net_order(data + 1, 100), inet_fold_checksum_in_net_order(bufchain_sum(&chain, 1)));
+
+    // Gathered across the segments
+    uint8_t out[sizeof(data)] = { 0 };
+    TEST_ASSERT_EQUAL_UINT32(60, bufchain_copy_out(&chain, 2, out, 60));
+    TEST_ASSERT_EQUAL_MEMORY(data + 2, out, 60);
+    TEST_ASSERT_EQUAL_UINT32(1, bufchain_copy_out(&chain, 100, out, 60));
+
+    // The spans follow the segments, the empty one is skipped
+    BufChainIter iter = bufchain_iter(&chain, 0);
+    const uint8_t* span = NULL;
+    TEST_ASSERT_EQUAL_UINT32(3,  bufchain_next(&iter, &span, UINT32_MAX));
+    TEST_ASSERT_EQUAL_UINT32(40, bufchain_next(&iter, &span, 40));
+    TEST_ASSERT_EQUAL_PTR(data + 3, span);
+    TEST_ASSERT_EQUAL_UINT32(10, bufchain_next(&iter, &span, UINT32_MAX));
+    TEST_ASSERT_EQUAL_UINT32(48, bufchain_next(&iter, &span, UINT32_MAX));
+    TEST_ASSERT_EQUAL_PTR(data + 53, span);
+    TEST_ASSERT_EQUAL_UINT32(0,  bufchain_next(&iter, &span, UINT32_MAX));
+
+    // A header is pulled from the first segment
+    bufchain_pull(&chain, 3);
+    TEST_ASSERT_EQUAL_UINT32(98, chain.len);
+    TEST_ASSERT_EQUAL_UINT32(1, bufchain_copy_out(&chain, 0, out, 1));
+    TEST_ASSERT_EQUAL_UINT8(data[3], out[0]);
+}
+
 void all_buffer_tests(void) {
     test_buffer_create();
     test_buffer_add();
     test_buffer_sub();
     test_buffer_reclaim();
     test_free_buffer();
+    test_buffer_desc();
+    test_bufchain();
 }
\ No newline at end of file
@@ -0,0 +1,63 @@
+#include "unity.h"
+#include <event/busypoll.h>
+#include <unistd.h>
+
+static bool found_at_third(void* arg) {
+    int* calls = arg;
+    return ++(*calls) == 3;
+}
+
+static bool never(void* arg) {
+    (void) arg;
+    return false;
+}
+
+void test_busypoll_spin(void) {
+    BusyPoll busy;
+    int calls = 0;
+
+    // Disabled: doesn't even look
+    busypoll_init(&busy, (BusyPollConfig){ .budget_ns = 0, .adaptive = false });
+    TEST_ASSERT_FALSE(busypoll_spin(&busy, found_at_third, &calls));
+    TEST_ASSERT_EQUAL(0, calls);
+    TEST_ASSERT_EQUAL(0, busypoll_park_start(&busy));
+
+    busypoll_init(&busy, (BusyPollConfig){ .budget_ns = 1000000, .adaptive = false });
+    TEST_ASSERT_TRUE(busypoll_spin(&busy, found_at_third, &calls));
+    TEST_ASSERT_EQUAL(3, calls);
+    TEST_ASSERT_FALSE(busypoll_spin(&busy, never, NULL));
+    TEST_ASSERT_EQUAL(2, busy.spins);
+    TEST_ASSERT_EQUAL(1, busy.spin_hits);
+    TEST_ASSERT_TRUE(busy.spin_ns >= 1000000);
+}
+
+void test_busypoll_adaptive(void) {
+    BusyPoll busy;
+    busypoll_init(&busy, (BusyPollConfig){ .budget_ns = 1000000, .adaptive = true });
+
+    // Back to back arrivals: keep spinning
+    busypoll_arrival(&busy);
+    busypoll_arrival(&busy);
+    TEST_ASSERT_FALSE(busypoll_spin(&busy, never, NULL));
+    TEST_ASSERT_EQUAL(1, busy.spins);
+
+    // Idle for longer than the budget: park right away
+    usleep(2000);
+    TEST_ASSERT_FALSE(busypoll_spin(&busy, never, NULL));
+    TEST_ASSERT_EQUAL(1, busy.spins);
+    TEST_ASSERT_EQUAL(1, busy.spin_skips);
+
+    // Sparse arrivals: the average gap goes above the budget
+    for (int i = 0; i < 16; i++) {
+        usleep(2000);
+        busypoll_arrival(&busy);
+    }
+    TEST_ASSERT_TRUE(busy.gap_avg > 1000000);
+    TEST_ASSERT_FALSE(busypoll_spin(&busy, never, NULL));
+    TEST_ASSERT_EQUAL(2, busy.spin_skips);
+}
+
+void all_busypoll_tests(void) {
+    test_busypoll_spin();
+    test_busypoll_adaptive();
+}
@@ -100,6 +100,25 @@ void test_inet_checksum(void) {
     TEST_ASSERT_EQUAL_UINT16(expected_checksum, checksum);
 }
 
+void test_pseudo_checksum_in_net_order(void) {
+    uint8_t data[64] = { 0 };
+    memcpy(data + 20, "Hello World", 11);
+
+    // The device finishes a partial checksum by summing from the TCP header, with the pseudo header sum in the field
+    struct pseudo_ip_header_in_net_order pheader = PSEUDO_HEADER_IPv4(0x12345678, 0x87654321, IP_PROTO_TCP, sizeof(data));
+    uint16_t expected_checksum = tcp_checksum_in_net_order(data, pheader);
+    uint16_t partial = pseudo_checksum_in_net_order(pheader);
+    memcpy(data + 16, &partial, sizeof(uint16_t));
+    TEST_ASSERT_EQUAL_UINT16(expected_checksum, inet_checksum_in_net_order(data, sizeof(data)));
+
+    memset(data + 16, 0, sizeof(uint16_t));
+    pheader = PSEUDO_HEADER_IPv6(0x12345678, 0x87654321, IP_PROTO_TCP, sizeof(data));
+    expected_checksum = tcp_checksum_in_net_order(data, pheader);
+    partial = pseudo_checksum_in_net_order(pheader);
+    memcpy(data + 16, &partial, sizeof(uint16_t));
+    TEST_ASSERT_EQUAL_UINT16(expected_checksum, inet_checksum_in_net_order(data, sizeof(data)));
+}
+
 void all_checksum_tests(void) {
     test_tcp_checksum_in_net_order_ipv4();
     test_tcp_checksum_in_net_order_ipv6();
@@ -109,6 +128,8 @@ void all_checksum_tests(void) {
 
     test_inet_checksum();
 
+    test_pseudo_checksum_in_net_order();
+
     TEST_IGNORE_MESSAGE ("Should test the case that the checksum is 0xFFFF");
     TEST_IGNORE_MESSAGE ("Should test the case that the checksum is 0x0000");
 }
@@ -0,0 +1,94 @@
+#include "unity.h"
+#include <lock_free/deque.h>
+#include <pthread.h>
+
+void test_deque_order(void) {
+    WsDeque* deque = aligned_alloc(ATOMIC_ISOLATION, sizeof(WsDeque));
+    TEST_ASSERT_NOT_NULL(deque);
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, wsdeque_init(deque, 4));
+
+    uintptr_t values[] = { 1, 2, 3, 4 };
+    for (size_t i = 0; i < 4; i++) TEST_ASSERT_EQUAL(SYS_ERR_OK, wsdeque_push(deque, (void*)values[i]));
+    TEST_ASSERT_EQUAL(EVENT_ENQUEUE_FULL, wsdeque_push(deque, (void*)5));
+    TEST_ASSERT_EQUAL(4, wsdeque_size(deque));
+
+    // The owner takes the newest, the thieves the oldest
+    void* data = NULL;
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, wsdeque_pop(deque, &data));
+    TEST_ASSERT_EQUAL(4, (uintptr_t)data);
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, wsdeque_steal(deque, &data));
+    TEST_ASSERT_EQUAL(1, (uintptr_t)data);
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, wsdeque_steal(deque, &data));
+    TEST_ASSERT_EQUAL(2, (uintptr_t)data);
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, wsdeque_pop(deque, &data));
+    TEST_ASSERT_EQUAL(3, (uintptr_t)data);
+
+    TEST_ASSERT_EQUAL(EVENT_DEQUEUE_EMPTY, wsdeque_pop(deque, &data));
+    TEST_ASSERT_NULL(data);
+    TEST_ASSERT_EQUAL(EVENT_DEQUEUE_EMPTY, wsdeque_steal(deque, &data));
+    TEST_ASSERT_EQUAL(0, wsdeque_size(deque));
+
+    // Wraps around the slots
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, wsdeque_push(deque, (void*)values[0]));
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, wsdeque_steal(deque, &data));
+    TEST_ASSERT_EQUAL(1, (uintptr_t)data);
+
+    wsdeque_destroy(deque);
+    free(deque);
+}
+
+#define DEQUE_TEST_ITEMS    100000
+#define DEQUE_TEST_THIEVES  3
+
+typedef struct {
+    WsDeque      *deque;
+    atomic_uint  *seen;
+    atomic_bool  *done;
+} DequeTest;
+
+static void* thief(void* arg) {
+    DequeTest* test = arg;
+    void* data = NULL;
+    while (!atomic_load(test->done) || wsdeque_size(test->deque) > 0) {
+        if (wsdeque_steal(test->deque, &data) == SYS_ERR_OK) atomic_fetch_add(&test->seen[(uintptr_t)data - 1], 1);
+    }
+    return NULL;
+}
+
+void test_deque_steal(void) {
+    WsDeque* deque = aligned_alloc(ATOMIC_ISOLATION, sizeof(WsDeque));
+    TEST_ASSERT_NOT_NULL(deque);
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, wsdeque_init(deque, 256));
+    atomic_uint* seen = calloc(DEQUE_TEST_ITEMS, sizeof(atomic_uint));
+    TEST_ASSERT_NOT_NULL(seen);
+    atomic_bool done = false;
+    DequeTest test = { deque, seen, &done };
+
+    pthread_t thieves[DEQUE_TEST_THIEVES];
+    for (size_t i = 0; i < DEQUE_TEST_THIEVES; i++)
+        TEST_ASSERT_EQUAL(0, pthread_create(&thieves[i], NULL, thief, &test));
+
+    // The owner pushes every item once and pops some back, each is taken exactly once
+    void* data = NULL;
+    for (uintptr_t i = 1; i <= DEQUE_TEST_ITEMS; i++) {
+        while (wsdeque_push(deque, (void*)i) == EVENT_ENQUEUE_FULL) {
+            if (wsdeque_pop(deque, &data) == SYS_ERR_OK) atomic_fetch_add(&seen[(uintptr_t)data - 1], 1);
+        }
+        if (i % 3 == 0 && wsdeque_pop(deque, &data) == SYS_ERR_OK) atomic_fetch_add(&seen[(uintptr_t)data - 1], 1);
+    }
+    while (wsdeque_pop(deque, &data) == SYS_ERR_OK) atomic_fetch_add(&seen[(uintptr_t)data - 1], 1);
+    atomic_store(&done, true);
+    for (size_t i = 0; i < DEQUE_TEST_THIEVES; i++)
+        TEST_ASSERT_EQUAL(0, pthread_join(thieves[i], NULL));
+
+    for (size_t i = 0; i < DEQUE_TEST_ITEMS; i++) TEST_ASSERT_EQUAL(1, atomic_load(&seen[i]));
+
+    free(seen);
+    wsdeque_destroy(deque);
+    free(deque);
+}
+
+void all_deque_tests(void) {
+    test_deque_order();
+    test_deque_steal();
+}
@@ -76,8 +76,22 @@ void test_format_ipv6_addr(void) {
     TEST_ASSERT_EQUAL_STRING(expected, buffer);
 }
 
+void test_parse_mac_addr(void) {
+    mac_addr addr;
+    mac_addr expected = {.addr = {0x02, 0x00, 0x5E, 0xAB, 0xcd, 0x0A}};
+
+    TEST_ASSERT_TRUE(parse_mac_addr("02:00:5e:AB:cd:0a", &addr));
+    TEST_ASSERT_EQUAL_MEMORY(expected.addr, addr.addr, sizeof(addr.addr));
+
+    TEST_ASSERT_FALSE(parse_mac_addr("02:00:5e:ab:cd", &addr));
+    TEST_ASSERT_FALSE(parse_mac_addr("02:00:5e:ab:cd:0a:11", &addr));
+    TEST_ASSERT_FALSE(parse_mac_addr("02:00:5e:ab:cd:100", &addr));
+    TEST_ASSERT_FALSE(parse_mac_addr("not a mac", &addr));
+}
+
 void all_format_ip_addr_tests(void) {
     test_format_mac_address();
     test_format_ipv4_addr();
     test_format_ipv6_addr();
+    test_parse_mac_addr();
 }
\ No newline at end of file
@@ -0,0 +1,105 @@
+#include "unity.h"
+#include <lock_free/eventcount.h>
+#include <pthread.h>
+
+void test_eventcount_wait(void) {
+    EventCount event;
+    eventcount_init(&event);
+
+    // Nobody waits, no syscall
+    TEST_ASSERT_FALSE(eventcount_notify(&event));
+
+    // A notify between the prepare and the wait isn't lost
+    uint32_t key = eventcount_prepare(&event);
+    TEST_ASSERT_TRUE(eventcount_notify(&event));
+    eventcount_wait(&event, key);
+    TEST_ASSERT_EQUAL(0, atomic_load(&event.waiters));
+
+    // Found something after the prepare
+    eventcount_prepare(&event);
+    eventcount_cancel(&event);
+    TEST_ASSERT_FALSE(eventcount_notify(&event));
+}
+
+#define EVENTCOUNT_TEST_ITEMS       200000
+#define EVENTCOUNT_TEST_CONSUMERS   3
+
+typedef struct {
+    EventCount      event;
+    atomic_size_t   items;      ///< Produced and not consumed yet
+    atomic_size_t   consumed;
+} EventCountTest;
+
+static bool take_item(void* arg) {
+    EventCountTest* test = arg;
+    size_t items = atomic_load(&test->items);
+    while (items > 0) {
+        if (atomic_compare_exchange_weak(&test->items, &items, items - 1)) return true;
+    }
+    return false;
+}
+
+static void* consumer(void* arg) {
+    EventCountTest* test = arg;
+    while (true) {
+        eventcount_await(&test->event, take_item, test);
+        if (atomic_fetch_add(&test->consumed, 1) + 1 >= EVENTCOUNT_TEST_ITEMS) break;
+    }
+    return NULL;
+}
+
+void test_eventcount_lost_wakeup(void) {
+    EventCountTest test = { .items = 0, .consumed = 0 };
+    eventcount_init(&test.event);
+
+    pthread_t consumers[EVENTCOUNT_TEST_CONSUMERS];
+    for (size_t i = 0; i < EVENTCOUNT_TEST_CONSUMERS; i++)
+        TEST_ASSERT_EQUAL(0, pthread_create(&consumers[i], NULL, consumer, &test));
+
+    // Every item is consumed, none of the consumers sleeps on one forever
+    for (size_t i = 0; i < EVENTCOUNT_TEST_ITEMS; i++) {
+        atomic_fetch_add(&test.items, 1);
+        eventcount_notify(&test.event);
+    }
+    while (atomic_load(&test.consumed) < EVENTCOUNT_TEST_ITEMS) ;
+
+    // The others are still waiting for one more
+    for (size_t i = 1; i < EVENTCOUNT_TEST_CONSUMERS; i++) {
+        atomic_fetch_add(&test.items, 1);
+        eventcount_notify_all(&test.event);
+    }
+    for (size_t i = 0; i < EVENTCOUNT_TEST_CONSUMERS; i++)
+        TEST_ASSERT_EQUAL(0, pthread_join(consumers[i], NULL));
+    TEST_ASSERT_EQUAL(0, atomic_load(&test.items));
+}
+
+static bool never(void* arg) {
+    (void)arg;
+    return false;
+}
+
+static void* sleeper(void* arg) {
+    EventCount* event = arg;
+    eventcount_await(event, never, NULL);
+    return NULL;
+}
+
+void test_eventcount_cancel(void) {
+    EventCount event;
+    eventcount_init(&event);
+
+    // Asleep or about to sleep, the notify after the cancel gets it out
+    pthread_t thread;
+    TEST_ASSERT_EQUAL(0, pthread_create(&thread, NULL, sleeper, &event));
+    TEST_ASSERT_EQUAL(0, pthread_cancel(thread));
+    eventcount_notify_all(&event);
+    void* ret = NULL;
+    TEST_ASSERT_EQUAL(0, pthread_join(thread, &ret));
+    TEST_ASSERT_EQUAL_PTR(PTHREAD_CANCELED, ret);
+}
+
+void all_eventcount_tests(void) {
+    test_eventcount_wait();
+    test_eventcount_lost_wakeup();
+    test_eventcount_cancel();
+}
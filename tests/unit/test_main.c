@@ -17,6 +17,16 @@ extern void all_checksum_tests(void);
 extern void all_format_ip_addr_tests(void);
 
 extern void all_buffer_tests(void);
+extern void all_mempool_tests(void);
+extern void all_slab_tests(void);
+extern void all_deque_tests(void);
+extern void all_eventcount_tests(void);
+extern void all_ring_tests(void);
+
+extern void all_pcap_tests(void);
+
+extern void all_busypoll_tests(void);
+extern void all_rss_tests(void);
 
 
 int main(void) {
@@ -38,6 +48,16 @@ int main(void) {
     RUN_TEST(all_format_ip_addr_tests);
 
     RUN_TEST(all_buffer_tests);
+    RUN_TEST(all_mempool_tests);
+    RUN_TEST(all_slab_tests);
+    RUN_TEST(all_deque_tests);
+    RUN_TEST(all_eventcount_tests);
+    RUN_TEST(all_ring_tests);
+
+    RUN_TEST(all_pcap_tests);
+
+    RUN_TEST(all_busypoll_tests);
+    RUN_TEST(all_rss_tests);
 
     return UNITY_END();
 }
\ No newline at end of file
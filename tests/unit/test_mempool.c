@@ -0,0 +1,312 @@
+#include "unity.h"
+#include <event/memorypool.h>
+#include <event/buffer.h>
+
+/// @brief  A pool of the classes, the test fails if it can't be set up
+static MemPool* new_pool(const MemClassConfig* classes, size_t class_num, MemBacking backing, MemOverload overload) {
+    MemPool* pool = aligned_alloc(ATOMIC_ISOLATION, sizeof(MemPool));
+    TEST_ASSERT_NOT_NULL(pool);
+    memset(pool, 0x00, sizeof(MemPool));
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, mempool_init(pool, classes, class_num, backing, overload));
+    return pool;
+}
+
+/// @brief  Undo new_pool(), the pool is freed with its classes
+static void delete_pool(MemPool* pool) {
+    mempool_destroy(pool);
+}
+
+/// @brief  What mempool_init() says about a configuration, the pool is gone either way
+static errval_t init_pool(const MemClassConfig* classes, size_t class_num, MemBacking backing, MemOverload overload) {
+    MemPool* pool = aligned_alloc(ATOMIC_ISOLATION, sizeof(MemPool));
+    TEST_ASSERT_NOT_NULL(pool);
+    memset(pool, 0x00, sizeof(MemPool));
+    errval_t err = mempool_init(pool, classes, class_num, backing, overload);
+    if (err_is_ok(err)) mempool_destroy(pool);
+    else free(pool);
+    return err;
+}
+
+void test_mempool_classes(void) {
+    const MemClassConfig classes[] = { { 64, 2, 0 }, { 256, 2, 0 } };
+    MemPool* pool = new_pool(classes, 2, MEMPOOL_BACKING_DEFAULT, MEMPOOL_OVERLOAD_DEFAULT);
+    // Nothing handed out before the first allocation
+    TEST_ASSERT_EQUAL(0, atomic_load(&pool->classes[0].carved));
+
+    // The smallest class that fits
+    Buffer small, big;
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 42, &small));
+    TEST_ASSERT_TRUE(small.from_pool);
+    TEST_ASSERT_EQUAL_UINT32(64, small.whole_size);
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 65, &big));
+    TEST_ASSERT_TRUE(big.from_pool);
+    TEST_ASSERT_EQUAL_UINT32(256, big.whole_size);
+
+    // The class is empty: malloc, never given to the class
+    Buffer small2, fallback;
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 64, &small2));
+    TEST_ASSERT_TRUE(small2.from_pool);
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 64, &fallback));
+    TEST_ASSERT_FALSE(fallback.from_pool);
+    TEST_ASSERT_EQUAL_UINT32(64, fallback.whole_size);
+    TEST_ASSERT_EQUAL(1, pool->classes[0].fallback);
+
+    // Larger than any class
+    Buffer oversize;
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 1000, &oversize));
+    TEST_ASSERT_FALSE(oversize.from_pool);
+    TEST_ASSERT_EQUAL_UINT32(1000, oversize.whole_size);
+    TEST_ASSERT_EQUAL(1, pool->oversize);
+
+    // Every piece goes back to its own class
+    free_buffer(small);
+    free_buffer(fallback);
+    free_buffer(oversize);
+    free_buffer(big);
+    Buffer again;
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 10, &again));
+    TEST_ASSERT_TRUE(again.from_pool);
+    TEST_ASSERT_EQUAL_PTR(small.data, again.data);
+    TEST_ASSERT_EQUAL(2, atomic_load(&pool->classes[0].carved));
+    free_buffer(again);
+    free_buffer(small2);
+
+    delete_pool(pool);
+}
+
+void test_mempool_magazine(void) {
+    // Magazine of 4, moved by 2
+    const MemClassConfig classes[] = { { 64, 8, 4 } };
+    MemPool* pool = new_pool(classes, 1, MEMPOOL_BACKING_DEFAULT, MEMPOOL_OVERLOAD_DEFAULT);
+
+    Buffer bufs[8];
+    for (size_t i = 0; i < 8; i++) {
+        TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 64, &bufs[i]));
+        TEST_ASSERT_TRUE(bufs[i].from_pool);
+    }
+    MagCache* cache = atomic_load(&pool->caches[0]);
+    TEST_ASSERT_NOT_NULL(cache);
+    TEST_ASSERT_EQUAL(4, cache->misses);
+    TEST_ASSERT_EQUAL(4, cache->hits);
+    TEST_ASSERT_EQUAL(0, pool->classes[0].fallback);
+
+    // A full magazine gives half of it to the depot
+    for (size_t i = 0; i < 8; i++) free_buffer(bufs[i]);
+    TEST_ASSERT_EQUAL(2, cache->flushes);
+    TEST_ASSERT_EQUAL(4, cache->count);
+
+    // Taken back from the depot, last freed first
+    for (size_t i = 0; i < 8; i++) {
+        TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 64, &bufs[i]));
+        TEST_ASSERT_TRUE(bufs[i].from_pool);
+    }
+    TEST_ASSERT_EQUAL(6, cache->misses);
+    for (size_t i = 0; i < 8; i++) free_buffer(bufs[i]);
+
+    // Not a power of 2
+    const MemClassConfig wrong_classes[] = { { 64, 8, 6 } };
+    TEST_ASSERT_EQUAL(SYS_ERR_WRONG_CONFIG, init_pool(wrong_classes, 1, MEMPOOL_BACKING_DEFAULT, MEMPOOL_OVERLOAD_DEFAULT));
+
+    delete_pool(pool);
+}
+
+void test_mempool_two_pools(void) {
+    MemPool* pools[2];
+    const MemClassConfig classes[] = { { 64, 64, 4 } };
+    for (size_t p = 0; p < 2; p++) pools[p] = new_pool(classes, 1, MEMPOOL_BACKING_DEFAULT, MEMPOOL_OVERLOAD_DEFAULT);
+
+    // A worker freeing the frames of one node and allocating from another keeps one cache in each
+    for (size_t i = 0; i < 1000; i++) {
+        Buffer rx, tx;
+        TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pools[1], 64, &rx));
+        TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pools[0], 64, &tx));
+        TEST_ASSERT_TRUE(rx.from_pool && tx.from_pool);
+        free_buffer(rx);
+        free_buffer(tx);
+    }
+    for (size_t p = 0; p < 2; p++) {
+        TEST_ASSERT_EQUAL(1, atomic_load(&pools[p]->cache_num));
+        TEST_ASSERT_TRUE(atomic_load(&pools[p]->classes[0].avail) >= 64 - 4);
+        TEST_ASSERT_EQUAL(0, pools[p]->classes[0].fallback);
+        delete_pool(pools[p]);
+    }
+}
+
+void test_mempool_hugepage(void) {
+    // Transparent huge pages if none is reserved, mapped in whole huge pages either way
+    const MemClassConfig classes[] = { { 2048, 4, 0 } };
+    MemBacking backing = { .hugepage = true, .node = -1 };
+    MemPool* pool = new_pool(classes, 1, backing, MEMPOOL_OVERLOAD_DEFAULT);
+    TEST_ASSERT_EQUAL(0, pool->classes[0].map_len % MEMPOOL_HUGEPAGE_SIZE);
+
+    Buffer buf;
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 100, &buf));
+    TEST_ASSERT_TRUE(buf.from_pool);
+    free_buffer(buf);
+    delete_pool(pool);
+
+    // Normal pages faulted in at initialization
+    backing = (MemBacking) { .hugepage = false, .node = -1, .populate = true };
+    pool = new_pool(classes, 1, backing, MEMPOOL_OVERLOAD_DEFAULT);
+    TEST_ASSERT_TRUE(pool->classes[0].map_len > 0);
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 100, &buf));
+    TEST_ASSERT_TRUE(buf.from_pool);
+    free_buffer(buf);
+    delete_pool(pool);
+}
+
+void test_mempool_clone(void) {
+    const MemClassConfig classes[] = { { 64, 2, 0 } };
+    MemPool* pool = new_pool(classes, 1, MEMPOOL_BACKING_DEFAULT, MEMPOOL_OVERLOAD_DEFAULT);
+
+    Buffer buf, other;
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 64, &buf));
+    TEST_ASSERT_FALSE(buffer_shared(buf));
+
+    // Same bytes, separate views
+    Buffer clone = buffer_add(buffer_clone(buf), 10);
+    TEST_ASSERT_TRUE(buffer_shared(buf));
+    TEST_ASSERT_EQUAL_PTR(buf.data + 10, clone.data);
+    // Both would write their descriptor at the start of the piece
+    TEST_ASSERT_NULL(buffer_desc(clone, 8, 0));
+
+    // The piece stays with the clone
+    free_buffer(buf);
+    TEST_ASSERT_FALSE(buffer_shared(clone));
+    TEST_ASSERT_NOT_NULL(buffer_desc(clone, 8, 0));
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 64, &other));
+    TEST_ASSERT_TRUE(other.from_pool);
+    Buffer fallback;
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 64, &fallback));
+    TEST_ASSERT_FALSE(fallback.from_pool);
+    free_buffer(fallback);
+
+    // Copy on write
+    Buffer shared = buffer_clone(other);
+    other.data[0] = 0x42;
+    buffer_unshare(&shared);
+    TEST_ASSERT_FALSE(buffer_shared(other));
+    TEST_ASSERT_TRUE(shared.data != other.data);
+    TEST_ASSERT_EQUAL(0x42, shared.data[0]);
+    free_buffer(shared);
+    free_buffer(other);
+
+    // The last view gives it back
+    free_buffer(clone);
+    Buffer again;
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 64, &again));
+    TEST_ASSERT_TRUE(again.from_pool);
+    free_buffer(again);
+
+    delete_pool(pool);
+}
+
+void test_mempool_overload(void) {
+    // Pressure below 4 free pieces until 8 again, 4 kept for the control traffic
+    const MemClassConfig classes[] = { { 64, 16, 0 } };
+    MemOverload drop = { .policy = MEMPOOL_POLICY_DROP, .low = 25, .high = 50, .reserve = 25, .grow_max = 0 };
+    MemPool* pool = new_pool(classes, 1, MEMPOOL_BACKING_DEFAULT, drop);
+
+    Buffer rx[12], control[4], buf;
+    for (size_t i = 0; i < 12; i++) {
+        TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc_prio(pool, 64, MEMPOOL_PRIO_RX, &rx[i]));
+        TEST_ASSERT_TRUE(rx[i].from_pool);
+    }
+    // The reserve is left for the control traffic
+    TEST_ASSERT_EQUAL(EVENT_MEMPOOL_EMPTY, err_no(pool_alloc_prio(pool, 64, MEMPOOL_PRIO_RX, &buf)));
+    TEST_ASSERT_NULL(buf.data);
+    for (size_t i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 64, &control[i]));
+        TEST_ASSERT_TRUE(control[i].from_pool);
+    }
+    // Never refused
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 64, &buf));
+    TEST_ASSERT_FALSE(buf.from_pool);
+    free_buffer(buf);
+    for (size_t i = 0; i < 4; i++) free_buffer(control[i]);
+
+    // Above the reserve but still under pressure, until the high watermark
+    for (size_t i = 0; i < 3; i++) free_buffer(rx[i]);
+    TEST_ASSERT_EQUAL(EVENT_MEMPOOL_EMPTY, err_no(pool_alloc_prio(pool, 64, MEMPOOL_PRIO_RX, &buf)));
+    free_buffer(rx[3]);
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc_prio(pool, 64, MEMPOOL_PRIO_RX, &buf));
+    TEST_ASSERT_TRUE(buf.from_pool);
+    free_buffer(buf);
+    for (size_t i = 4; i < 12; i++) free_buffer(rx[i]);
+    TEST_ASSERT_EQUAL(2, atomic_load(&pool->classes[0].shed));
+    delete_pool(pool);
+
+    // Grows by one chunk of 2 pieces, then only the received frames are refused
+    const MemClassConfig small[] = { { 64, 8, 0 } };
+    MemOverload grow = { .policy = MEMPOOL_POLICY_GROW, .low = 50, .high = 75, .reserve = 0, .grow_max = 1 };
+    pool = new_pool(small, 1, MEMPOOL_BACKING_DEFAULT, grow);
+
+    Buffer bufs[10];
+    for (size_t i = 0; i < 10; i++) {
+        TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 64, &bufs[i]));
+        TEST_ASSERT_TRUE(bufs[i].from_pool);
+    }
+    TEST_ASSERT_EQUAL(1, atomic_load(&pool->classes[0].grown_num));
+    TEST_ASSERT_EQUAL(EVENT_MEMPOOL_EMPTY, err_no(pool_alloc_prio(pool, 64, MEMPOOL_PRIO_RX, &buf)));
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 64, &buf));
+    TEST_ASSERT_FALSE(buf.from_pool);
+    free_buffer(buf);
+    // The pieces of the chunk go back to the class
+    for (size_t i = 0; i < 10; i++) free_buffer(bufs[i]);
+    TEST_ASSERT_EQUAL(10, atomic_load(&pool->classes[0].avail));
+    delete_pool(pool);
+
+    // The reserve can't be above the low watermark
+    MemOverload wrong = { .policy = MEMPOOL_POLICY_DROP, .low = 10, .high = 25, .reserve = 20, .grow_max = 0 };
+    TEST_ASSERT_EQUAL(SYS_ERR_WRONG_CONFIG, init_pool(small, 1, MEMPOOL_BACKING_DEFAULT, wrong));
+}
+
+void test_mempool_track(void) {
+    const MemClassConfig classes[] = { { 64, 8, 4 } };
+    MemPool* pool = new_pool(classes, 1, MEMPOOL_BACKING_DEFAULT, MEMPOOL_OVERLOAD_DEFAULT);
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, mempool_track(pool));
+
+    // Unclaimed until a layer takes it, from the queue and from the magazine alike
+    Buffer a, b;
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 64, &a));
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 64, &b));
+    TEST_ASSERT_EQUAL(2, mempool_held(pool, MEMPOOL_OWNER_POOL));
+
+    buffer_set_owner(a, MEMPOOL_OWNER_DEVICE);
+    buffer_add_ptr(&b, 14);
+    buffer_set_owner(b, MEMPOOL_OWNER_ASSEMBLER);
+    TEST_ASSERT_EQUAL(0, mempool_held(pool, MEMPOOL_OWNER_POOL));
+    TEST_ASSERT_EQUAL(1, mempool_held(pool, MEMPOOL_OWNER_DEVICE));
+    TEST_ASSERT_EQUAL(1, mempool_held(pool, MEMPOOL_OWNER_ASSEMBLER));
+
+    // A shared piece is held until its last reference goes
+    Buffer c = buffer_clone(a);
+    free_buffer(a);
+    TEST_ASSERT_EQUAL(1, mempool_held(pool, MEMPOOL_OWNER_DEVICE));
+    free_buffer(c);
+    TEST_ASSERT_EQUAL(0, mempool_held(pool, MEMPOOL_OWNER_DEVICE));
+
+    // Everything is older than 0 ns, the leak is reported
+    mempool_report_held(pool, 0);
+    free_buffer(b);
+    TEST_ASSERT_EQUAL(0, mempool_held(pool, MEMPOOL_OWNER_ASSEMBLER));
+
+    // Too late once a piece is out
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 64, &a));
+    delete_pool(pool);
+    pool = new_pool(classes, 1, MEMPOOL_BACKING_DEFAULT, MEMPOOL_OVERLOAD_DEFAULT);
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pool_alloc(pool, 64, &a));
+    TEST_ASSERT_EQUAL(SYS_ERR_WRONG_CONFIG, mempool_track(pool));
+    free_buffer(a);
+    delete_pool(pool);
+}
+
+void all_mempool_tests(void) {
+    test_mempool_classes();
+    test_mempool_magazine();
+    test_mempool_two_pools();
+    test_mempool_hugepage();
+    test_mempool_clone();
+    test_mempool_overload();
+    test_mempool_track();
+}
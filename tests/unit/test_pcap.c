@@ -0,0 +1,127 @@
+#include "unity.h"
+#include <netutil/pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void test_pcap_write_read(void) {
+    char path[] = "/tmp/netcore_test_XXXXXX";
+    int fd = mkstemp(path);
+    TEST_ASSERT_TRUE(fd >= 0);
+    close(fd);
+
+    uint8_t frame1[60], frame2[100];
+    memset(frame1, 0xAA, sizeof(frame1));
+    memset(frame2, 0x55, sizeof(frame2));
+
+    PcapWriter writer;
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pcap_writer_open(&writer, path, 1536));
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pcap_writer_write(&writer, frame1, sizeof(frame1), 1000000001ULL));
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pcap_writer_write(&writer, frame2, sizeof(frame2), 2000000002ULL));
+    pcap_writer_close(&writer);
+
+    PcapReader reader;
+    uint8_t data[128];
+    size_t len, wire_len;
+    uint64_t ts;
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pcap_reader_open(&reader, path));
+    TEST_ASSERT_FALSE(reader.is_ng);
+
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pcap_reader_next(&reader, data, sizeof(data), &len, &wire_len, &ts));
+    TEST_ASSERT_EQUAL(sizeof(frame1), len);
+    TEST_ASSERT_EQUAL(sizeof(frame1), wire_len);
+    TEST_ASSERT_EQUAL_UINT64(1000000001ULL, ts);
+    TEST_ASSERT_EQUAL_MEMORY(frame1, data, sizeof(frame1));
+
+    // Doesn't fit: skipped, but the next one is still readable
+    TEST_ASSERT_EQUAL(NET_ERR_PCAP_TOO_LARGE, pcap_reader_next(&reader, data, 64, &len, &wire_len, &ts));
+    TEST_ASSERT_EQUAL(NET_ERR_PCAP_EOF, pcap_reader_next(&reader, data, sizeof(data), &len, &wire_len, &ts));
+
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pcap_reader_rewind(&reader));
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pcap_reader_next(&reader, data, sizeof(data), &len, &wire_len, &ts));
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pcap_reader_next(&reader, data, sizeof(data), &len, &wire_len, &ts));
+    TEST_ASSERT_EQUAL(sizeof(frame2), len);
+    TEST_ASSERT_EQUAL_UINT64(2000000002ULL, ts);
+    TEST_ASSERT_EQUAL_MEMORY(frame2, data, sizeof(frame2));
+
+    pcap_reader_close(&reader);
+    remove(path);
+}
+
+void test_pcapng_read(void) {
+    // SHB, IDB (Ethernet, if_tsresol = 9), EPB with a 4 bytes frame, all little endian
+    static const uint8_t file[] = {
+        0x0A, 0x0D, 0x0D, 0x0A,  28, 0, 0, 0,  0x4D, 0x3C, 0x2B, 0x1A,  1, 0, 0, 0,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,  28, 0, 0, 0,
+        1, 0, 0, 0,  32, 0, 0, 0,  1, 0, 0, 0,  0, 0, 4, 0,
+        9, 0, 1, 0,  9, 0, 0, 0,  0, 0, 0, 0,  32, 0, 0, 0,
+        6, 0, 0, 0,  36, 0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 0,  42, 0, 0, 0,
+        4, 0, 0, 0,  4, 0, 0, 0,  0xDE, 0xAD, 0xBE, 0xEF,  36, 0, 0, 0,
+    };
+    char path[] = "/tmp/netcore_test_XXXXXX";
+    int fd = mkstemp(path);
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_EQUAL(sizeof(file), write(fd, file, sizeof(file)));
+    close(fd);
+
+    PcapReader reader;
+    uint8_t data[64];
+    size_t len, wire_len;
+    uint64_t ts;
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pcap_reader_open(&reader, path));
+    TEST_ASSERT_TRUE(reader.is_ng);
+
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pcap_reader_next(&reader, data, sizeof(data), &len, &wire_len, &ts));
+    TEST_ASSERT_EQUAL(4, len);
+    TEST_ASSERT_EQUAL_UINT64(42, ts);
+    TEST_ASSERT_EQUAL_MEMORY("\xDE\xAD\xBE\xEF", data, 4);
+    TEST_ASSERT_EQUAL(NET_ERR_PCAP_EOF, pcap_reader_next(&reader, data, sizeof(data), &len, &wire_len, &ts));
+
+    pcap_reader_close(&reader);
+    remove(path);
+}
+
+void test_pcapng_write_read(void) {
+    char path[] = "/tmp/netcore_test_XXXXXX";
+    int fd = mkstemp(path);
+    TEST_ASSERT_TRUE(fd >= 0);
+    close(fd);
+
+    uint8_t frame[61];
+    memset(frame, 0x42, sizeof(frame));
+
+    // Truncated to 33 bytes, the padding and the options must be skipped by the reader
+    PcapWriter writer;
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pcapng_writer_open(&writer, path, 33));
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pcapng_writer_write(&writer, frame, 33, sizeof(frame), 1234567890123ULL, PCAPNG_EPB_INBOUND));
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pcapng_writer_write(&writer, frame, sizeof(frame), sizeof(frame), 1234567890124ULL, 0));
+    pcap_writer_close(&writer);
+
+    PcapReader reader;
+    uint8_t data[128];
+    size_t len, wire_len;
+    uint64_t ts;
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pcap_reader_open(&reader, path));
+    TEST_ASSERT_TRUE(reader.is_ng);
+
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pcap_reader_next(&reader, data, sizeof(data), &len, &wire_len, &ts));
+    TEST_ASSERT_EQUAL(33, len);
+    TEST_ASSERT_EQUAL(sizeof(frame), wire_len);
+    TEST_ASSERT_EQUAL_UINT64(1234567890123ULL, ts);
+
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, pcap_reader_next(&reader, data, sizeof(data), &len, &wire_len, &ts));
+    TEST_ASSERT_EQUAL(sizeof(frame), len);
+    TEST_ASSERT_EQUAL_UINT64(1234567890124ULL, ts);
+    TEST_ASSERT_EQUAL_MEMORY(frame, data, sizeof(frame));
+    TEST_ASSERT_EQUAL(NET_ERR_PCAP_EOF, pcap_reader_next(&reader, data, sizeof(data), &len, &wire_len, &ts));
+
+    pcap_reader_close(&reader);
+    remove(path);
+}
+
+void all_pcap_tests(void) {
+    test_pcap_write_read();
+    test_pcapng_read();
+    test_pcapng_write_read();
+}
@@ -0,0 +1,99 @@
+#include "unity.h"
+#include <lock_free/ring.h>
+#include <pthread.h>
+#include <sched.h>
+
+typedef struct {
+    uint64_t id;
+    uint64_t check;     ///< ~id, a torn copy doesn't match
+    uint8_t  pad[48];   ///< Two cells per value
+} RingValue;
+
+void test_ring_order(void) {
+    MpmcRing* ring = aligned_alloc(ATOMIC_ISOLATION, sizeof(MpmcRing));
+    TEST_ASSERT_NOT_NULL(ring);
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, mpmcring_init(ring, 4, sizeof(RingValue)));
+    TEST_ASSERT_EQUAL(2 * RING_CELL_SIZE, ring->cell_size);
+
+    RingValue values[5];
+    for (size_t i = 0; i < 5; i++) values[i] = (RingValue){ .id = i, .check = ~i };
+    TEST_ASSERT_EQUAL(4, mpmcring_push_batch(ring, values, 5));
+    TEST_ASSERT_EQUAL(EVENT_ENQUEUE_FULL, mpmcring_push(ring, &values[4]));
+    TEST_ASSERT_EQUAL(4, mpmcring_size(ring));
+
+    // First in, first out, copied
+    RingValue value = { 0 };
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, mpmcring_pop(ring, &value));
+    TEST_ASSERT_EQUAL(0, value.id);
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, mpmcring_push(ring, &values[4]));
+    RingValue out[8];
+    TEST_ASSERT_EQUAL(4, mpmcring_pop_batch(ring, out, 8));
+    for (size_t i = 0; i < 4; i++) TEST_ASSERT_EQUAL(i + 1, out[i].id);
+
+    TEST_ASSERT_EQUAL(EVENT_DEQUEUE_EMPTY, mpmcring_pop(ring, &value));
+    TEST_ASSERT_EQUAL(0, mpmcring_size(ring));
+
+    mpmcring_destroy(ring);
+    free(ring);
+}
+
+#define RING_TEST_ITEMS     100000
+#define RING_TEST_THREADS   3
+
+typedef struct {
+    MpmcRing     *ring;
+    atomic_uint  *seen;
+    atomic_size_t produced;
+    atomic_size_t consumed;
+} RingTest;
+
+static void* producer(void* arg) {
+    RingTest* test = arg;
+    while (true) {
+        size_t id = atomic_fetch_add(&test->produced, 1);
+        if (id >= RING_TEST_ITEMS) return NULL;
+        RingValue value = { .id = id, .check = ~(uint64_t)id };
+        while (mpmcring_push(test->ring, &value) == EVENT_ENQUEUE_FULL) sched_yield();
+    }
+}
+
+static void* consumer(void* arg) {
+    RingTest* test = arg;
+    RingValue value;
+    while (atomic_load(&test->consumed) < RING_TEST_ITEMS) {
+        if (mpmcring_pop(test->ring, &value) != SYS_ERR_OK) {
+            sched_yield();
+            continue;
+        }
+        if (value.check == ~value.id && value.id < RING_TEST_ITEMS) atomic_fetch_add(&test->seen[value.id], 1);
+        atomic_fetch_add(&test->consumed, 1);
+    }
+    return NULL;
+}
+
+void test_ring_mpmc(void) {
+    MpmcRing* ring = aligned_alloc(ATOMIC_ISOLATION, sizeof(MpmcRing));
+    TEST_ASSERT_NOT_NULL(ring);
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, mpmcring_init(ring, 64, sizeof(RingValue)));
+    RingTest test = { .ring = ring, .seen = calloc(RING_TEST_ITEMS, sizeof(atomic_uint)), .produced = 0, .consumed = 0 };
+    TEST_ASSERT_NOT_NULL(test.seen);
+
+    // Each value comes out once and whole
+    pthread_t threads[2 * RING_TEST_THREADS];
+    for (size_t i = 0; i < RING_TEST_THREADS; i++) {
+        TEST_ASSERT_EQUAL(0, pthread_create(&threads[2 * i], NULL, producer, &test));
+        TEST_ASSERT_EQUAL(0, pthread_create(&threads[2 * i + 1], NULL, consumer, &test));
+    }
+    for (size_t i = 0; i < 2 * RING_TEST_THREADS; i++) TEST_ASSERT_EQUAL(0, pthread_join(threads[i], NULL));
+
+    for (size_t i = 0; i < RING_TEST_ITEMS; i++) TEST_ASSERT_EQUAL(1, atomic_load(&test.seen[i]));
+
+    free(test.seen);
+    mpmcring_destroy(ring);
+    free(ring);
+}
+
+void all_ring_tests(void) {
+    test_ring_order();
+    test_ring_mpmc();
+}
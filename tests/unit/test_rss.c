@@ -0,0 +1,93 @@
+#include "unity.h"
+#include <device/rss.h>
+#include <netutil/etharp.h>
+#include <netutil/htons.h>
+#include <netutil/ip.h>
+#include <netutil/udp.h>
+#include <string.h>
+
+#define RSS_TEST_FRAME  (sizeof(struct eth_hdr) + sizeof(struct ipv6_hdr) + sizeof(struct udp_hdr))
+
+static size_t ipv4_udp(uint8_t* frame, uint32_t src, uint16_t sport, uint16_t dport, uint16_t offset) {
+    memset(frame, 0x00, RSS_TEST_FRAME);
+    ((struct eth_hdr*)frame)->type = htons(ETH_TYPE_IPv4);
+    struct ip_hdr* ip = (struct ip_hdr*)(frame + sizeof(struct eth_hdr));
+    ip->version = 4;
+    ip->ihl     = sizeof(struct ip_hdr) / 4;
+    ip->proto   = IP_PROTO_UDP;
+    ip->offset  = htons(offset);
+    ip->src     = htonl(src);
+    ip->dest    = htonl(0x0A000001);
+    struct udp_hdr* udp = (struct udp_hdr*)((uint8_t*)ip + sizeof(struct ip_hdr));
+    udp->src  = htons(sport);
+    udp->dest = htons(dport);
+    return sizeof(struct eth_hdr) + sizeof(struct ip_hdr) + sizeof(struct udp_hdr);
+}
+
+void test_rss_hash(void) {
+    uint8_t frame[RSS_TEST_FRAME];
+
+    // The same flow, the same hash, another port, another one
+    size_t len = ipv4_udp(frame, 0x0A000002, 1000, 53, 0);
+    uint32_t flow = rss_hash(frame, len);
+    TEST_ASSERT_EQUAL_UINT32(flow, rss_hash(frame, len));
+    ipv4_udp(frame, 0x0A000002, 1001, 53, 0);
+    TEST_ASSERT_NOT_EQUAL(flow, rss_hash(frame, len));
+
+    // Every fragment of a datagram goes to the same place, whatever the ports look like
+    ipv4_udp(frame, 0x0A000002, 1000, 53, IP_MF);
+    uint32_t first = rss_hash(frame, len);
+    ipv4_udp(frame, 0x0A000002, 0xBEEF, 0xCAFE, 185);
+    TEST_ASSERT_EQUAL_UINT32(first, rss_hash(frame, len));
+
+    // The flow label of IPv6 replaces the ports
+    memset(frame, 0x00, sizeof(frame));
+    ((struct eth_hdr*)frame)->type = htons(ETH_TYPE_IPv6);
+    struct ipv6_hdr* ip6 = (struct ipv6_hdr*)(frame + sizeof(struct eth_hdr));
+    ip6->vtc_flow    = htonl(IP6H_VTCFLOW(6, 0, 0x12345));
+    ip6->next_header = IP_PROTO_UDP;
+    uint32_t labeled = rss_hash(frame, sizeof(frame));
+    ((struct udp_hdr*)(ip6 + 1))->src = htons(4242);
+    TEST_ASSERT_EQUAL_UINT32(labeled, rss_hash(frame, sizeof(frame)));
+    ip6->vtc_flow = htonl(IP6H_VTCFLOW(6, 0, 0x54321));
+    TEST_ASSERT_NOT_EQUAL(labeled, rss_hash(frame, sizeof(frame)));
+
+    // Not IP, or too short
+    ((struct eth_hdr*)frame)->type = htons(ETH_TYPE_ARP);
+    TEST_ASSERT_EQUAL_UINT32(0, rss_hash(frame, sizeof(frame)));
+    TEST_ASSERT_EQUAL_UINT32(0, rss_hash(frame, 4));
+}
+
+void test_rss_steer(void) {
+    DeviceRss rss;
+    TEST_ASSERT_EQUAL(SYS_ERR_WRONG_CONFIG, rss_init(&rss, 0));
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, rss_init(&rss, 4));
+
+    // Many flows spread over every worker
+    uint8_t frame[RSS_TEST_FRAME];
+    size_t per_worker[4] = { 0 };
+    for (uint16_t port = 0; port < 4000; port++) {
+        size_t len = ipv4_udp(frame, 0x0A000002, 1024 + port, 80, 0);
+        per_worker[rss_steer(&rss, rss_hash(frame, len))] += 1;
+    }
+    for (size_t w = 0; w < 4; w++) TEST_ASSERT_GREATER_THAN(500, per_worker[w]);
+    TEST_ASSERT_EQUAL(0, rss_rebalance(&rss));
+
+    // Worker 0 gets hot: some of its buckets go to the others, not the hottest one
+    TEST_ASSERT_EQUAL(SYS_ERR_OK, rss_init(&rss, 4));
+    for (size_t bucket = 0; bucket < RSS_TABLE_SIZE; bucket++) {
+        atomic_store(&rss.hits[bucket], (bucket % 4 == 0) ? 100 + bucket : 10);
+    }
+    atomic_store(&rss.hits[0], 100000);
+    TEST_ASSERT_GREATER_THAN(0, rss_rebalance(&rss));
+    TEST_ASSERT_EQUAL(0, atomic_load(&rss.table[0]));
+    TEST_ASSERT_EQUAL(50000, atomic_load(&rss.hits[0]));
+
+    rss_move(&rss, 0, 3);
+    TEST_ASSERT_EQUAL(3, atomic_load(&rss.table[0]));
+}
+
+void all_rss_tests(void) {
+    test_rss_hash();
+    test_rss_steer();
+}
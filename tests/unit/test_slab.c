@@ -0,0 +1,90 @@
+#include "unity.h"
+#include <event/slab.h>
+#include <pthread.h>
+
+typedef struct {
+    uint64_t    id;
+    char        name[40];
+} Widget;
+
+typedef struct {
+    alignas(64) uint8_t line[8];
+} Isolated;
+
+void test_slab_alloc(void) {
+    Slab slab = SLAB_INITIALIZER(Widget);
+    Widget* objs[3 * SLAB_MAGAZINE];
+
+    // Distinct objects, through several refills
+    for (size_t i = 0; i < 3 * SLAB_MAGAZINE; i++) {
+        objs[i] = SLAB_NEW(&slab, Widget);
+        TEST_ASSERT_NOT_NULL(objs[i]);
+        TEST_ASSERT_EQUAL(0, (uintptr_t)objs[i] % alignof(Widget));
+        objs[i]->id = i;
+    }
+    for (size_t i = 0; i < 3 * SLAB_MAGAZINE; i++) TEST_ASSERT_EQUAL(i, objs[i]->id);
+    TEST_ASSERT_EQUAL(3 * SLAB_MAGAZINE, slab_in_use(&slab));
+    TEST_ASSERT_EQUAL(1, slab.chunk_num);
+
+    // Freed ones are reused before any new chunk
+    size_t obj_num = slab.obj_num;
+    for (size_t i = 0; i < 3 * SLAB_MAGAZINE; i++) slab_free(&slab, objs[i]);
+    TEST_ASSERT_EQUAL(0, slab_in_use(&slab));
+    for (size_t i = 0; i < 3 * SLAB_MAGAZINE; i++) objs[i] = slab_alloc(&slab);
+    TEST_ASSERT_EQUAL(obj_num, slab.obj_num);
+    for (size_t i = 0; i < 3 * SLAB_MAGAZINE; i++) slab_free(&slab, objs[i]);
+
+    Widget* zero = slab_zalloc(&slab);
+    TEST_ASSERT_EQUAL(0, zero->id);
+    TEST_ASSERT_EQUAL(0, zero->name[sizeof(zero->name) - 1]);
+    slab_free(&slab, zero);
+    slab_destroy(&slab);
+
+    // Over-aligned objects each have their own cache line
+    Slab lines = SLAB_INITIALIZER_ALIGNED(Isolated, 64);
+    Isolated* a = slab_alloc(&lines);
+    Isolated* b = slab_alloc(&lines);
+    TEST_ASSERT_EQUAL(0, (uintptr_t)a % 64);
+    TEST_ASSERT_EQUAL(0, (uintptr_t)b % 64);
+    TEST_ASSERT_TRUE(a != b);
+    slab_free(&lines, a);
+    slab_free(&lines, b);
+    slab_destroy(&lines);
+}
+
+#define SLAB_TEST_ROUNDS   10000
+
+static void* free_all(void* arg) {
+    void** args = arg;
+    Slab* slab = args[0];
+    Widget** objs = args[1];
+    for (size_t i = 0; i < SLAB_TEST_ROUNDS; i++) slab_free(slab, objs[i]);
+    return NULL;
+}
+
+void test_slab_threads(void) {
+    Slab slab = SLAB_INITIALIZER(Widget);
+    Widget** objs = calloc(SLAB_TEST_ROUNDS, sizeof(Widget*));
+    TEST_ASSERT_NOT_NULL(objs);
+
+    // Allocated here, freed by another thread: they go through the depot
+    for (size_t i = 0; i < SLAB_TEST_ROUNDS; i++) objs[i] = slab_alloc(&slab);
+    pthread_t thread;
+    void* args[] = { &slab, objs };
+    TEST_ASSERT_EQUAL(0, pthread_create(&thread, NULL, free_all, args));
+    TEST_ASSERT_EQUAL(0, pthread_join(thread, NULL));
+    TEST_ASSERT_EQUAL(0, slab_in_use(&slab));
+
+    size_t obj_num = slab.obj_num;
+    for (size_t i = 0; i < SLAB_TEST_ROUNDS; i++) objs[i] = slab_alloc(&slab);
+    TEST_ASSERT_EQUAL(obj_num, slab.obj_num);
+    for (size_t i = 0; i < SLAB_TEST_ROUNDS; i++) slab_free(&slab, objs[i]);
+
+    free(objs);
+    slab_destroy(&slab);
+}
+
+void all_slab_tests(void) {
+    test_slab_alloc();
+    test_slab_threads();
+}